@@ -0,0 +1,420 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "command_line.h"
+
+#include <external_sorter/include/utils.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+
+namespace es::app {
+
+namespace {
+
+const std::string_view kAutoValue{"auto"};
+
+/**
+ * Parses an unsigned number
+ * @param name name of the option (for error messages)
+ * @param value string value
+ * @return number
+ * @throws if the value is not a number
+ */
+std::size_t ParseNumber(std::string_view name, std::string_view value) {
+  if (value.empty()) {
+    throw MakeException("Invalid value of ", name, std::string_view{": "}, value);
+  }
+
+  std::size_t number = 0;
+
+  for (const char c : value) {
+    if (!std::isdigit(static_cast<unsigned char>(c)) ||
+        number > (std::numeric_limits<std::size_t>::max() - 9) / 10) {
+      throw MakeException("Invalid value of ", name, std::string_view{": "}, value);
+    }
+
+    number = number * 10 + static_cast<std::size_t>(c - '0');
+  }
+
+  return number;
+}
+
+/**
+ * Splits a comma-separated list
+ * @param name name of the option (for error messages)
+ * @param value string value
+ * @return items
+ * @throws if the list or an item is empty
+ */
+std::vector<std::string_view> SplitList(std::string_view name, std::string_view value) {
+  std::vector<std::string_view> items;
+
+  while (true) {
+    const auto separator_position = value.find(',');
+    const auto item = value.substr(0, separator_position);
+
+    if (item.empty()) {
+      throw MakeException("Invalid value of ", name, std::string_view{": "}, value);
+    }
+
+    items.push_back(item);
+
+    if (separator_position == std::string_view::npos) {
+      return items;
+    }
+
+    value.remove_prefix(separator_position + 1);
+  }
+}
+
+/**
+ * Parses a comma-separated list of quantiles
+ * @param name name of the option (for error messages)
+ * @param value string value
+ * @return quantiles
+ * @throws if an item is not a number from 0 to 1
+ */
+std::vector<double> ParseQuantiles(std::string_view name, std::string_view value) {
+  std::vector<double> quantiles;
+
+  for (const auto item : SplitList(name, value)) {
+    const std::string item_string{item};
+    char* end = nullptr;
+    const auto quantile = std::strtod(item_string.c_str(), &end);
+
+    if (end != item_string.c_str() + item_string.size() || !(quantile >= 0 && quantile <= 1)) {
+      throw MakeException("Invalid value of ", name, std::string_view{": "}, item);
+    }
+
+    quantiles.push_back(quantile);
+  }
+
+  return quantiles;
+}
+
+SpillPlacement ParseSpillPlacement(std::string_view value) {
+  if (value == "round-robin") {
+    return SpillPlacement::kRoundRobin;
+  }
+
+  if (value == "free-space") {
+    return SpillPlacement::kMostFreeSpace;
+  }
+
+  throw MakeException("Invalid value of --spill-placement: ", value);
+}
+
+SortStrategy ParseSortStrategy(std::string_view value) {
+  if (value == "merge") {
+    return SortStrategy::kMerge;
+  }
+
+  if (value == "distribution") {
+    return SortStrategy::kDistribution;
+  }
+
+  if (value == "counting") {
+    return SortStrategy::kCounting;
+  }
+
+  throw MakeException("Invalid value of --strategy: ", value);
+}
+
+SortEngine ParseSortEngine(std::string_view value) {
+  if (value == "intro") {
+    return SortEngine::kIntroSort;
+  }
+
+  if (value == "radix") {
+    return SortEngine::kRadixSort;
+  }
+
+  if (value == "counting") {
+    return SortEngine::kCountingSort;
+  }
+
+  throw MakeException("Invalid value of --engine: ", value);
+}
+
+/**
+ * Parses a pinning policy or an explicit list of CPUs
+ * @param value string value
+ * @param options options of a thread pool to fill in
+ */
+void ParsePinning(std::string_view value, ThreadPoolOptions& options) {
+  if (value == "none") {
+    options.pinning_ = ThreadPinning::kNone;
+  } else if (value == "compact") {
+    options.pinning_ = ThreadPinning::kCompact;
+  } else if (value == "scatter") {
+    options.pinning_ = ThreadPinning::kScatter;
+  } else {
+    options.pinning_ = ThreadPinning::kExplicit;
+    options.cpus_ = ParseCpuList(value);
+
+    if (options.cpus_.empty()) {
+      throw MakeException("Invalid value of --pinning: ", value);
+    }
+  }
+}
+
+/**
+ * Matches a file name with a pattern
+ * @param name file name
+ * @param pattern pattern with wildcards '*' (any characters) and '?' (any character)
+ * @return true if the name matches
+ */
+bool MatchPattern(std::string_view name, std::string_view pattern) noexcept {
+  std::size_t name_index = 0;
+  std::size_t pattern_index = 0;
+  // position of the last '*' in the pattern and of the name where it started matching
+  auto star_pattern_index = std::string_view::npos;
+  std::size_t star_name_index = 0;
+
+  while (name_index < name.size()) {
+    const auto pattern_char = pattern_index < pattern.size() ? pattern[pattern_index] : '\0';
+
+    if (pattern_index < pattern.size() && (pattern_char == '?' || pattern_char == name[name_index])) {
+      ++name_index;
+      ++pattern_index;
+    } else if (pattern_char == '*') {
+      star_pattern_index = pattern_index++;
+      star_name_index = name_index;
+    } else if (star_pattern_index != std::string_view::npos) {
+      pattern_index = star_pattern_index + 1;
+      name_index = ++star_name_index;
+    } else {
+      return false;
+    }
+  }
+
+  while (pattern_index < pattern.size() && pattern[pattern_index] == '*') {
+    ++pattern_index;
+  }
+
+  return pattern_index == pattern.size();
+}
+
+ReportFormat ParseReportFormat(std::string_view value) {
+  if (value == "text") {
+    return ReportFormat::kText;
+  }
+
+  if (value == "json") {
+    return ReportFormat::kJson;
+  }
+
+  throw MakeException("Invalid value of --report: ", value);
+}
+
+}  // namespace
+
+const std::string_view kUsage =
+    "Usage: app [options]\n"
+    "Sorts a binary file of unsigned 32-bit numbers.\n"
+    "\n"
+    "Options:\n"
+    "  --input=PATH                  input file, '-' for standard input (default: input); may be repeated, '*' and\n"
+    "                                '?' in the file name select all matching files\n"
+    "  --sorted-input=PATH           already sorted input file, which is merged without sorting; may be repeated and\n"
+    "                                contain wildcards like --input\n"
+    "  --input-readers=N             count of threads reading input files (default: one per device)\n"
+    "  --output=PATH                 output file, '-' for standard output (default: ./output)\n"
+    "  --base=PATH                   sorted file to merge the sorted input with (incremental mode), it may be the\n"
+    "                                output file, which is replaced then\n"
+    "  --memory=SIZE                 memory budget, K/M/G suffixes are allowed, or auto: derived from the memory\n"
+    "                                limit of the cgroup or available memory, merge buffers are shrunk near the\n"
+    "                                cgroup limit (default: 128M)\n"
+    "  --threads=N                   count of threads (default: available CPUs limited by the cgroup CPU quota)\n"
+    "  --pinning=POLICY              pin threads to CPUs: none, compact (fill NUMA nodes one by one), scatter\n"
+    "                                (spread between NUMA nodes) or a list of CPUs, e.g. 0-3,8 (default: none)\n"
+    "  --numa-local-buffers          read and sort every chunk in the thread which allocated its buffer\n"
+    "  --parallel-reads              read slices of regular input files by positional reads in chunk tasks\n"
+    "  --temp-dir=DIR                directory for intermediate files, may be repeated\n"
+    "                                (default: the output directory, or the current one for standard output)\n"
+    "  --spill-placement=POLICY      round-robin or free-space (default: round-robin)\n"
+    "  --strategy=STRATEGY           merge (sort chunks, then merge them), distribution (partition to buckets by\n"
+    "                                sampled splitters, then sort buckets; needs a regular input file) or counting\n"
+    "                                (count values in a single pass if sampling shows few distinct values, merge\n"
+    "                                otherwise; needs regular input files) (default: merge)\n"
+    "  --engine=ENGINE               algorithm of sorting chunks: intro, radix or counting (few distinct values)\n"
+    "                                (default: intro)\n"
+    "  --merge-fan-in=N              maximal count of files merged at once (default: limited by memory)\n"
+    "  --compaction                  merge runs in background while the input is still being read\n"
+    "  --compressed-runs             keep sorted chunks compressed in memory, spill only runs which do not fit\n"
+    "  --sparse-index=SIZE           write index of the output file with an entry per block of SIZE bytes to\n"
+    "                                <output>.index (K/M/G suffixes are allowed)\n"
+    "  --summary                     write count, min, max and distinct count of output numbers to\n"
+    "                                <output>.summary (JSON), computed while the output is written\n"
+    "  --quantiles=LIST              with --summary, exact quantiles from 0 to 1, e.g. 0.5,0.99 (needs regular\n"
+    "                                input files)\n"
+    "  --histogram=LIST              with --summary, ascending bounds between buckets of a histogram, e.g. 10,100\n"
+    "  --verify                      check that the output is sorted and has the same checksum as the input while\n"
+    "                                sorting (no additional pass over the output)\n"
+    "  --argsort                     write 64-bit positions of input numbers in stable sorted order instead of numbers\n"
+    "                                (up to 2^32 numbers; no sorted inputs, base file, sparse index and summary)\n"
+    "  --argsort-values              with --argsort, write sorted numbers to <output>.values too\n"
+    "  --output-buffers=N            count of merged buffers which may be written at once (default: 4)\n"
+    "  --preallocate                 preallocate the output file and intermediate files of known sizes (Linux)\n"
+    "  --write-behind=SIZE           start writeback of written data and wait for data SIZE bytes behind it, so\n"
+    "                                dirty pages do not pile up (Linux, K/M/G suffixes are allowed)\n"
+    "  --report=FORMAT               print statistics to standard error: text or json\n"
+    "  --trace=PATH                  write Chrome trace (requires the ENABLE_TRACING build option)\n"
+    "  --help                        print this message\n";
+
+std::size_t ParseSize(std::string_view name, std::string_view value) {
+  std::size_t multiplier = 1;
+
+  if (!value.empty()) {
+    switch (std::toupper(static_cast<unsigned char>(value.back()))) {
+      case 'K':
+        multiplier = 1024;
+        break;
+      case 'M':
+        multiplier = 1024 * 1024;
+        break;
+      case 'G':
+        multiplier = 1024 * 1024 * 1024;
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (multiplier != 1) {
+    value.remove_suffix(1);
+  }
+
+  const auto size = ParseNumber(name, value);
+
+  if (size > std::numeric_limits<std::size_t>::max() / multiplier) {
+    throw MakeException("Invalid value of ", name, std::string_view{": "}, value);
+  }
+
+  return size * multiplier;
+}
+
+std::vector<std::string> ExpandPathPattern(std::string_view pattern) {
+  const std::filesystem::path path{pattern};
+  const auto file_name_pattern = path.filename().string();
+
+  if (file_name_pattern.find_first_of("*?") == std::string::npos) {
+    return {std::string{pattern}};
+  }
+
+  const auto directory_path = path.has_parent_path() ? path.parent_path() : std::filesystem::path{"."};
+  std::vector<std::string> paths;
+
+  for (const auto& entry : std::filesystem::directory_iterator{directory_path}) {
+    if (entry.is_regular_file() && MatchPattern(entry.path().filename().string(), file_name_pattern)) {
+      paths.push_back(path.has_parent_path() ? entry.path().string() : entry.path().filename().string());
+    }
+  }
+
+  if (paths.empty()) {
+    throw MakeException("No files match the pattern ", pattern);
+  }
+
+  std::sort(paths.begin(), paths.end());
+
+  return paths;
+}
+
+CommandLine ParseCommandLine(int argc, const char* const* argv) {
+  CommandLine command_line{};
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg{argv[i]};
+    const auto separator_position = arg.find('=');
+    const auto name = arg.substr(0, separator_position);
+    const auto value = separator_position == std::string_view::npos ? std::string_view{}
+                                                                     : arg.substr(separator_position + 1);
+
+    if (name == "--help" || name == "-h") {
+      command_line.help_ = true;
+    } else if (name == "--input" || name == "--sorted-input") {
+      if (value.empty()) {
+        throw MakeException("Empty path: ", arg);
+      }
+
+      command_line.input_files_.push_back(InputFile{std::string{value}, name == "--sorted-input"});
+    } else if (name == "--input-readers") {
+      command_line.sorter_options_.input_readers_count_ = ParseNumber(name, value);
+    } else if (name == "--base") {
+      command_line.sorter_options_.base_file_path_ = value;
+    } else if (name == "--output") {
+      command_line.output_file_path_ = value;
+    } else if (name == "--memory") {
+      command_line.memory_size_ = value == kAutoValue ? kAutoAvailableMemory : ParseSize(name, value);
+    } else if (name == "--threads") {
+      command_line.thread_pool_options_.threads_count_ = ParseNumber(name, value);
+    } else if (name == "--pinning") {
+      ParsePinning(value, command_line.thread_pool_options_);
+    } else if (name == "--numa-local-buffers") {
+      command_line.sorter_options_.numa_local_buffers_ = true;
+    } else if (name == "--parallel-reads") {
+      command_line.sorter_options_.parallel_input_reads_ = true;
+    } else if (name == "--temp-dir") {
+      command_line.sorter_options_.spill_directories_.emplace_back(value);
+    } else if (name == "--spill-placement") {
+      command_line.sorter_options_.spill_placement_ = ParseSpillPlacement(value);
+    } else if (name == "--strategy") {
+      command_line.sorter_options_.sort_strategy_ = ParseSortStrategy(value);
+    } else if (name == "--engine") {
+      command_line.sorter_options_.sort_engine_ = ParseSortEngine(value);
+    } else if (name == "--merge-fan-in") {
+      command_line.sorter_options_.merge_fan_in_ = ParseNumber(name, value);
+    } else if (name == "--sparse-index") {
+      command_line.sorter_options_.sparse_index_block_size_ = ParseSize(name, value);
+    } else if (name == "--summary") {
+      command_line.sorter_options_.output_summary_ = true;
+    } else if (name == "--quantiles") {
+      command_line.sorter_options_.summary_quantiles_ = ParseQuantiles(name, value);
+    } else if (name == "--histogram") {
+      command_line.sorter_options_.summary_histogram_bounds_.clear();
+
+      for (const auto item : SplitList(name, value)) {
+        command_line.sorter_options_.summary_histogram_bounds_.push_back(ParseNumber(name, item));
+      }
+    } else if (name == "--compaction") {
+      command_line.sorter_options_.background_compaction_ = true;
+    } else if (name == "--compressed-runs") {
+      command_line.sorter_options_.compressed_runs_ = true;
+    } else if (name == "--verify") {
+      command_line.sorter_options_.verify_ = true;
+    } else if (name == "--argsort") {
+      command_line.sorter_options_.argsort_ = true;
+    } else if (name == "--argsort-values") {
+      command_line.sorter_options_.argsort_values_ = true;
+    } else if (name == "--output-buffers") {
+      command_line.sorter_options_.output_buffers_count_ = ParseNumber(name, value);
+    } else if (name == "--preallocate") {
+      command_line.sorter_options_.preallocate_files_ = true;
+    } else if (name == "--write-behind") {
+      command_line.sorter_options_.write_behind_size_ = ParseSize(name, value);
+    } else if (name == "--report") {
+      command_line.report_format_ = ParseReportFormat(value);
+    } else if (name == "--trace") {
+      command_line.trace_file_path_ = value;
+    } else {
+      throw MakeException("Unknown option: ", arg);
+    }
+
+    if (command_line.output_file_path_.empty()) {
+      throw MakeException("Empty path: ", arg);
+    }
+  }
+
+  if (command_line.input_files_.empty()) {
+    command_line.input_files_.push_back(InputFile{"input"});
+  }
+
+  return command_line;
+}
+
+}  // namespace es::app
\ No newline at end of file
@@ -0,0 +1,72 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <external_sorter/include/external_sorter.h>
+#include <external_sorter/include/sorter_options.h>
+#include <external_sorter/include/thread_pool.h>
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace es::app {
+
+/**
+ * Format of the statistics report
+ */
+enum class ReportFormat {
+  kNone,  ///< No report
+  kText,  ///< Human-readable report
+  kJson,  ///< JSON object
+};
+
+/**
+ * Parsed command line of the application
+ */
+struct CommandLine {
+  std::size_t memory_size_ = 128 * 1024 * 1024;       ///< Memory budget of sorting (kAutoAvailableMemory - auto)
+  ThreadPoolOptions thread_pool_options_;             ///< Options of the thread pool
+  std::vector<InputFile> input_files_;                ///< Input files or patterns of their names (default: "input")
+  std::string output_file_path_ = "./output";         ///< Path to output file ("-" - standard output)
+  SorterOptions sorter_options_;                      ///< Options of the sorter
+  ReportFormat report_format_ = ReportFormat::kNone;  ///< Format of the statistics report
+  std::string trace_file_path_;                       ///< Path to Chrome trace file (empty - no tracing)
+  bool help_ = false;                                 ///< Flag for printing usage
+};
+
+/**
+ * Usage of the application
+ */
+extern const std::string_view kUsage;
+
+/**
+ * Parses size with an optional suffix: K, M or G (powers of 1024)
+ * @param name name of the option (for error messages)
+ * @param value string value
+ * @return size in bytes
+ * @throws if the value is not a valid size
+ */
+std::size_t ParseSize(std::string_view name, std::string_view value);
+
+/**
+ * Expands a path pattern with wildcards '*' and '?' in the file name to paths of matching regular files
+ * @param pattern path or pattern
+ * @return sorted paths (the path itself if there are no wildcards)
+ * @throws if no files match the pattern
+ */
+std::vector<std::string> ExpandPathPattern(std::string_view pattern);
+
+/**
+ * Parses command line arguments
+ * @param argc count of arguments
+ * @param argv arguments
+ * @return command line
+ * @throws if an argument is unknown or has an invalid value
+ */
+CommandLine ParseCommandLine(int argc, const char* const* argv);
+
+}  // namespace es::app
\ No newline at end of file
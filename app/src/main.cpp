@@ -2,33 +2,181 @@
  * external_sorter: 2021 Sergey Gorelyshev
  */
 
+#include "command_line.h"
+
 #include <external_sorter/include/defines.h>
 #include <external_sorter/include/external_sorter.h>
+#include <external_sorter/include/output_summary.h>
+#include <external_sorter/include/resource_limits.h>
+#include <external_sorter/include/sort_stats.h>
+#include <external_sorter/include/sparse_index.h>
 #include <external_sorter/include/thread_pool.h>
+#include <external_sorter/include/tracing.h>
+#include <external_sorter/include/utils.h>
 
 #include <exception>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 namespace {
 
 enum : int { kOk = 0, kError = -1 };
 
-const std::size_t kMemorySize = 128 * 1024 * 1024;  // 128mb
-const std::string kDefaultInputPath = "input";
-const std::string kDefaultOutputDirectory = "./";
+const std::string_view kStandardStream = "-";
+const std::string kStandardInputPath = "/dev/stdin";
+const std::string kStandardOutputDirectory = "/dev/";
+const std::string kStandardOutputFileName = "stdout";
+const std::string kStandardOutputSpillDirectory = ".";
+const std::string_view kTemporaryFileExtension = ".tmp";
+
+/**
+ * Sorts input files by a sorter of numbers of a type
+ * @tparam NumberType type of numbers of the sorter
+ * @param command_line command line
+ * @param input_files input files
+ * @param output_directory_path path to output directory
+ * @param options options of the sorter
+ * @return statistics of sorting
+ */
+template <typename NumberType>
+es::SortStats SortFiles(const es::app::CommandLine& command_line, std::vector<es::InputFile> input_files,
+                        const std::string& output_directory_path, es::SorterOptions options) {
+  auto thread_pool = std::make_shared<es::ThreadPool>(command_line.thread_pool_options_);
+
+  es::ExternalSorter<NumberType> sorter{command_line.memory_size_, std::move(input_files), output_directory_path,
+                                        std::move(thread_pool), std::move(options)};
+
+  if (!command_line.trace_file_path_.empty()) {
+    es::Tracer::instance().start();
+  }
+
+  sorter.sort();
+
+  return sorter.stats();
+}
+
+/**
+ * Sorts the input file according to the command line
+ * @param command_line command line
+ */
+void Sort(es::app::CommandLine command_line) {
+  auto& options = command_line.sorter_options_;
+  std::string output_directory_path;
+  std::filesystem::path replaced_base_file_path;
+  std::string temporary_output_file_path;
+
+  if (command_line.output_file_path_ == kStandardStream) {
+    output_directory_path = kStandardOutputDirectory;
+    options.output_file_name_ = kStandardOutputFileName;
+
+    if (options.sparse_index_block_size_ != 0) {
+      throw es::MakeException("The sparse index requires an output file");
+    }
+
+    if (options.output_summary_) {
+      throw es::MakeException("The output summary requires an output file");
+    }
+
+    if (options.spill_directories_.empty()) {
+      options.spill_directories_.push_back(kStandardOutputSpillDirectory);
+    }
+  } else {
+    const std::filesystem::path output_file_path{command_line.output_file_path_};
+
+    output_directory_path = output_file_path.has_parent_path() ? output_file_path.parent_path().string() : ".";
+    std::filesystem::create_directories(output_directory_path);
+    output_directory_path.push_back(std::filesystem::path::preferred_separator);
+    options.output_file_name_ = output_file_path.filename().string();
+
+    // The base file is read while the output file is written, so it is replaced by the output file after sorting.
+    std::error_code ec{};
+    if (!options.base_file_path_.empty() &&
+        std::filesystem::equivalent(options.base_file_path_, output_file_path, ec)) {
+      replaced_base_file_path = options.base_file_path_;
+      options.output_file_name_.append(kTemporaryFileExtension);
+      temporary_output_file_path = output_directory_path + options.output_file_name_;
+    }
+  }
+
+  // The automatic budget is taken from the cgroup limit, so merges also watch the cgroup in case it grows.
+  if (command_line.memory_size_ == es::kAutoAvailableMemory) {
+    options.memory_monitor_ = es::CreateMemoryPressureMonitor();
+  }
+
+  std::vector<es::InputFile> input_files;
+
+  for (const auto& input_file : command_line.input_files_) {
+    if (input_file.path_ == kStandardStream) {
+      input_files.push_back(es::InputFile{kStandardInputPath, input_file.is_sorted_});
+
+      continue;
+    }
+
+    for (auto& input_file_path : es::app::ExpandPathPattern(input_file.path_)) {
+      input_files.push_back(es::InputFile{std::move(input_file_path), input_file.is_sorted_});
+    }
+  }
+
+  // Keys of the argsort mode are sorted packed with their indices.
+  const auto stats = options.argsort_
+                         ? SortFiles<es::argsort_number_t>(command_line, std::move(input_files), output_directory_path,
+                                                           std::move(options))
+                         : SortFiles<es::number_t>(command_line, std::move(input_files), output_directory_path,
+                                                   std::move(options));
+
+  if (!replaced_base_file_path.empty()) {
+    const auto index_file_path = es::CreateSparseIndexFilePath(temporary_output_file_path);
+    const auto summary_file_path = es::CreateOutputSummaryFilePath(temporary_output_file_path);
+
+    std::filesystem::rename(temporary_output_file_path, replaced_base_file_path);
+
+    if (std::filesystem::exists(index_file_path)) {
+      std::filesystem::rename(index_file_path, es::CreateSparseIndexFilePath(replaced_base_file_path.string()));
+    }
+
+    if (std::filesystem::exists(summary_file_path)) {
+      std::filesystem::rename(summary_file_path, es::CreateOutputSummaryFilePath(replaced_base_file_path.string()));
+    }
+  }
+
+  if (!command_line.trace_file_path_.empty()) {
+    es::Tracer::instance().stop();
+
+    std::ofstream trace_stream{command_line.trace_file_path_};
+    es::Tracer::instance().writeChromeTrace(trace_stream);
+  }
+
+  switch (command_line.report_format_) {
+    case es::app::ReportFormat::kText:
+      std::cerr << es::ToText(stats);
+      break;
+    case es::app::ReportFormat::kJson:
+      std::cerr << es::ToJson(stats) << '\n';
+      break;
+    case es::app::ReportFormat::kNone:
+      break;
+  }
+}
 
 }  // namespace
 
-int main() {
+int main(int argc, char** argv) {
   try {
-    es::ExternalSorter<es::number_t> sorter{kMemorySize, kDefaultInputPath,
-                                            kDefaultOutputDirectory,
-                                            std::make_shared<es::ThreadPool>()};
+    const auto command_line = es::app::ParseCommandLine(argc, argv);
+
+    if (command_line.help_) {
+      std::cout << es::app::kUsage;
+
+      return kOk;
+    }
 
-    sorter.sort();
+    Sort(command_line);
   } catch (const std::exception& ex) {
-    std::cout << "Exception occurred: " << ex.what() << ".\n";
+    std::cerr << "Exception occurred: " << ex.what() << ".\n";
+    std::cerr << "Run with --help for usage.\n";
 
     return kError;
   }
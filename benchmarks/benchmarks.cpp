@@ -0,0 +1,30 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "benchmarks.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace es::benchmarks {
+
+double CalcThroughput(std::uint64_t bytes_count, std::uint64_t time_ns) noexcept {
+  constexpr double ns_per_second = 1e9;
+
+  return time_ns == 0 ? 0.0
+                      : static_cast<double>(bytes_count) / static_cast<double>(kMegabyte) /
+                            (static_cast<double>(time_ns) / ns_per_second);
+}
+
+std::vector<std::size_t> CreateThreadsCounts() {
+  const std::size_t hardware_threads_count = std::max(std::thread::hardware_concurrency(), 2U) - 1;
+
+  if (hardware_threads_count == 1) {
+    return {1};
+  }
+
+  return {1, hardware_threads_count};
+}
+
+}  // namespace es::benchmarks
\ No newline at end of file
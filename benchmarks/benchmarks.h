@@ -0,0 +1,56 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace es::benchmarks {
+
+const std::size_t kMegabyte = 1024 * 1024;
+
+/**
+ * Configuration of a benchmarks run
+ */
+struct BenchmarkConfig {
+  bool quick_ = false;                         ///< Run a reduced sweep (e.g. for CI)
+  std::uint64_t seed_ = 42;                    ///< Seed of data generators
+  std::filesystem::path directory_ = "bench";  ///< Working directory for generated files
+};
+
+/**
+ * Runs external sorting for all combinations of data distributions, input sizes, memory budgets, thread counts, sort
+ * strategies and sort engines. Writes one JSON object per line for each combination.
+ * @param config configuration
+ * @param output stream for results
+ */
+void RunSortBenchmarks(const BenchmarkConfig& config, std::ostream& output);
+
+/**
+ * Runs micro-benchmarks of the merge heap, BinaryFileBuffer::get() and ThreadPool::add(). Writes one JSON object per
+ * line for each benchmark.
+ * @param config configuration
+ * @param output stream for results
+ */
+void RunMicroBenchmarks(const BenchmarkConfig& config, std::ostream& output);
+
+/**
+ * Calculates throughput
+ * @param bytes_count amount of processed bytes
+ * @param time_ns processing time in nanoseconds
+ * @return throughput in MB/s
+ */
+double CalcThroughput(std::uint64_t bytes_count, std::uint64_t time_ns) noexcept;
+
+/**
+ * Returns thread counts for sweeps: one thread and all hardware threads except the current one
+ * @return thread counts
+ */
+std::vector<std::size_t> CreateThreadsCounts();
+
+}  // namespace es::benchmarks
\ No newline at end of file
@@ -0,0 +1,144 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "data_generators.h"
+
+#include <external_sorter/include/utils.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+
+namespace es::benchmarks {
+
+namespace {
+
+const std::size_t kGeneratorBufferNumbersCount = 1024 * 1024;
+const std::size_t kFewUniqueValuesCount = 16;
+const std::size_t kZipfValuesCount = 65536;
+const std::size_t kSawtoothPeriod = 65536;
+const std::size_t kNearlySortedSwapsPercent = 1;
+
+using generator_t = std::function<number_t(std::size_t)>;
+
+/**
+ * Creates a function which returns a number by its index in the file
+ * @param distribution distribution of numbers
+ * @param numbers_count count of numbers in the file
+ * @param random_engine random engine
+ * @return generator
+ */
+generator_t CreateGenerator(Distribution distribution, std::size_t numbers_count, std::mt19937_64& random_engine) {
+  switch (distribution) {
+    case Distribution::kUniform:
+    case Distribution::kNearlySorted:
+      break;
+    case Distribution::kSorted:
+      return [](std::size_t index) { return static_cast<number_t>(index); };
+    case Distribution::kReverseSorted:
+      return [numbers_count](std::size_t index) { return static_cast<number_t>(numbers_count - 1 - index); };
+    case Distribution::kFewUnique: {
+      std::uniform_int_distribution<number_t> values_distribution{};
+      std::vector<number_t> values(kFewUniqueValuesCount);
+      std::generate(values.begin(), values.end(), [&]() { return values_distribution(random_engine); });
+
+      std::uniform_int_distribution<std::size_t> index_distribution{0, kFewUniqueValuesCount - 1};
+
+      return [values = std::move(values), index_distribution, &random_engine](std::size_t) mutable {
+        return values[index_distribution(random_engine)];
+      };
+    }
+    case Distribution::kZipf: {
+      // cumulative distribution function for the inverse transform sampling
+      std::vector<double> cdf(kZipfValuesCount);
+      double sum = 0.0;
+      for (std::size_t rank = 0; rank < kZipfValuesCount; ++rank) {
+        sum += 1.0 / static_cast<double>(rank + 1);
+        cdf[rank] = sum;
+      }
+
+      std::uniform_real_distribution<double> distrib{0.0, sum};
+
+      return [cdf = std::move(cdf), distrib, &random_engine](std::size_t) mutable {
+        return static_cast<number_t>(std::lower_bound(cdf.begin(), cdf.end(), distrib(random_engine)) - cdf.begin());
+      };
+    }
+    case Distribution::kSawtooth:
+      return [](std::size_t index) { return static_cast<number_t>(index % kSawtoothPeriod); };
+  }
+
+  std::uniform_int_distribution<number_t> distrib{};
+
+  return [distrib, &random_engine](std::size_t) mutable { return distrib(random_engine); };
+}
+
+}  // namespace
+
+const std::vector<Distribution>& AllDistributions() {
+  static const std::vector<Distribution> distributions{
+      Distribution::kUniform,   Distribution::kSorted, Distribution::kReverseSorted, Distribution::kNearlySorted,
+      Distribution::kFewUnique, Distribution::kZipf,   Distribution::kSawtooth};
+
+  return distributions;
+}
+
+std::string_view ToString(Distribution distribution) noexcept {
+  switch (distribution) {
+    case Distribution::kUniform:
+      return "uniform";
+    case Distribution::kSorted:
+      return "sorted";
+    case Distribution::kReverseSorted:
+      return "reverse_sorted";
+    case Distribution::kNearlySorted:
+      return "nearly_sorted";
+    case Distribution::kFewUnique:
+      return "few_unique";
+    case Distribution::kZipf:
+      return "zipf";
+    case Distribution::kSawtooth:
+      return "sawtooth";
+  }
+
+  return "unknown";
+}
+
+void GenerateInputFile(std::string_view file_path, Distribution distribution, std::size_t size, std::uint64_t seed) {
+  const auto numbers_count = size / sizeof(number_t);
+
+  std::mt19937_64 random_engine{seed};
+  auto generator = distribution == Distribution::kNearlySorted
+                       ? CreateGenerator(Distribution::kSorted, numbers_count, random_engine)
+                       : CreateGenerator(distribution, numbers_count, random_engine);
+
+  auto stream = OpenOutputBinaryFileStream(file_path);
+  auto buffer = std::make_unique<number_t[]>(kGeneratorBufferNumbersCount);
+
+  for (std::size_t offset = 0; offset < numbers_count; offset += kGeneratorBufferNumbersCount) {
+    const auto count = std::min(kGeneratorBufferNumbersCount, numbers_count - offset);
+
+    for (std::size_t i = 0; i < count; ++i) {
+      buffer[i] = generator(offset + i);
+    }
+
+    // nearly sorted data: swaps random pairs inside of each block
+    if (distribution == Distribution::kNearlySorted) {
+      std::uniform_int_distribution<std::size_t> index_distribution{0, count - 1};
+
+      for (std::size_t i = 0; i < count * kNearlySortedSwapsPercent / 100; ++i) {
+        std::swap(buffer[index_distribution(random_engine)], buffer[index_distribution(random_engine)]);
+      }
+    }
+
+    stream.write(reinterpret_cast<const char*>(buffer.get()), static_cast<std::streamsize>(count * sizeof(number_t)));
+    if (!stream) {
+      throw MakeException("Failed to write the file ", file_path, std::string_view{": "}, errno);
+    }
+  }
+}
+
+}  // namespace es::benchmarks
\ No newline at end of file
@@ -0,0 +1,51 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <external_sorter/include/defines.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace es::benchmarks {
+
+/**
+ * Distribution of numbers in a generated input file
+ */
+enum class Distribution {
+  kUniform,        ///< Uniformly distributed numbers
+  kSorted,         ///< Ascending numbers
+  kReverseSorted,  ///< Descending numbers
+  kNearlySorted,   ///< Ascending numbers with 1% of randomly swapped pairs
+  kFewUnique,      ///< Uniformly distributed numbers of 16 distinct values
+  kZipf,           ///< Zipf-distributed numbers (s = 1) of 65536 distinct values
+  kSawtooth,       ///< Repeated ascending ramps of 65536 numbers
+};
+
+/**
+ * Returns all distributions
+ * @return distributions
+ */
+const std::vector<Distribution>& AllDistributions();
+
+/**
+ * Returns name of a distribution
+ * @param distribution distribution
+ * @return name
+ */
+std::string_view ToString(Distribution distribution) noexcept;
+
+/**
+ * Generates a binary file of numbers. The same seed always produces the same file.
+ * @param file_path path to file
+ * @param distribution distribution of numbers
+ * @param size size of the file (in bytes)
+ * @param seed seed of the random generator
+ */
+void GenerateInputFile(std::string_view file_path, Distribution distribution, std::size_t size, std::uint64_t seed);
+
+}  // namespace es::benchmarks
\ No newline at end of file
@@ -0,0 +1,93 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "benchmarks.h"
+
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <system_error>
+
+namespace {
+
+enum : int { kOk = 0, kError = -1 };
+
+const std::string_view kUsage =
+    "Usage: benchmarks [--quick] [--sort-only|--micro-only] [--seed=<number>] [--directory=<path>]\n"
+    "Writes results as JSON objects (one per line) to the standard output.\n"
+    "Generated files are written to a new directory (\"bench\" by default), which is removed afterwards.\n";
+
+/**
+ * Removes files generated by benchmarks and their directory (if it has nothing else)
+ * @param directory working directory of benchmarks
+ */
+void RemoveGeneratedFiles(const std::filesystem::path& directory) {
+  std::error_code ec{};
+
+  for (const auto* name : {"input", "output", "micro_input"}) {
+    std::filesystem::remove_all(directory / name, ec);
+  }
+
+  std::filesystem::remove(directory, ec);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  es::benchmarks::BenchmarkConfig config{};
+  bool run_sort_benchmarks = true;
+  bool run_micro_benchmarks = true;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg{argv[i]};
+
+    if (arg == "--quick") {
+      config.quick_ = true;
+    } else if (arg == "--sort-only") {
+      run_micro_benchmarks = false;
+    } else if (arg == "--micro-only") {
+      run_sort_benchmarks = false;
+    } else if (arg.rfind("--seed=", 0) == 0) {
+      config.seed_ = std::stoull(std::string{arg.substr(arg.find('=') + 1)});
+    } else if (arg.rfind("--directory=", 0) == 0) {
+      config.directory_ = arg.substr(arg.find('=') + 1);
+    } else {
+      std::cerr << kUsage;
+
+      return kError;
+    }
+  }
+
+  // An existing directory is refused, so generated files are never mixed with files of the user.
+  std::error_code ec{};
+
+  if (std::filesystem::exists(config.directory_, ec) || ec) {
+    std::cerr << "The directory " << config.directory_ << " already exists, choose a new one by --directory.\n";
+
+    return kError;
+  }
+
+  int result = kOk;
+
+  try {
+    std::filesystem::create_directories(config.directory_);
+
+    if (run_micro_benchmarks) {
+      es::benchmarks::RunMicroBenchmarks(config, std::cout);
+    }
+
+    if (run_sort_benchmarks) {
+      es::benchmarks::RunSortBenchmarks(config, std::cout);
+    }
+  } catch (const std::exception& ex) {
+    std::cerr << "Exception occurred: " << ex.what() << ".\n";
+
+    result = kError;
+  }
+
+  RemoveGeneratedFiles(config.directory_);
+
+  return result;
+}
\ No newline at end of file
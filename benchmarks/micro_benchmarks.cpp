@@ -0,0 +1,169 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "benchmarks.h"
+#include "data_generators.h"
+
+#include <external_sorter/include/binary_file_buffer.h>
+#include <external_sorter/include/memory_budget.h>
+#include <external_sorter/include/merge_queue.h>
+#include <external_sorter/include/thread_pool.h>
+#include <external_sorter/include/utils.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace es::benchmarks {
+
+namespace {
+
+/**
+ * Merges sorted runs with the merge heap by pushing and popping every number
+ * @param runs_count count of runs
+ * @param numbers_count total count of numbers
+ * @param seed seed of the random generator
+ * @param output stream for results
+ */
+void RunMergeHeapBenchmark(std::size_t runs_count, std::size_t numbers_count, std::uint64_t seed,
+                           std::ostream& output) {
+  std::mt19937_64 random_engine{seed};
+  std::uniform_int_distribution<number_t> distrib{};
+
+  const auto run_numbers_count = numbers_count / runs_count;
+  std::vector<std::vector<number_t>> runs(runs_count);
+
+  for (auto& run : runs) {
+    run.resize(run_numbers_count);
+    std::generate(run.begin(), run.end(), [&]() { return distrib(random_engine); });
+    std::sort(run.begin(), run.end());
+  }
+
+  std::vector<std::size_t> positions(runs_count, 0);
+  std::vector<number_t> result;
+  result.reserve(runs_count * run_numbers_count);
+
+  const auto start_time = SteadyClockNs();
+
+  merge_queue_t<number_t> merge_queue;
+
+  for (std::size_t i = 0; i < runs_count; ++i) {
+    merge_queue.push(MergeData<number_t>{i, runs[i][positions[i]++]});
+  }
+
+  while (!merge_queue.empty()) {
+    const auto min_data = merge_queue.top();
+    merge_queue.pop();
+
+    result.push_back(min_data.value_);
+
+    auto& position = positions[min_data.file_buffer_index_];
+    if (position != run_numbers_count) {
+      merge_queue.push(MergeData<number_t>{min_data.file_buffer_index_, runs[min_data.file_buffer_index_][position++]});
+    }
+  }
+
+  const auto time_ns = SteadyClockNs() - start_time;
+
+  output << "{\"benchmark\":\"merge_heap\",\"runs\":" << runs_count << ",\"numbers\":" << result.size()
+         << ",\"time_ns\":" << time_ns
+         << ",\"ns_per_number\":" << static_cast<double>(time_ns) / static_cast<double>(result.size()) << "}"
+         << std::endl;
+}
+
+/**
+ * Reads a file with BinaryFileBuffer::get()
+ * @param file_path path to file
+ * @param file_size size of the file
+ * @param buffer_size size of the buffer
+ * @param output stream for results
+ */
+void RunBinaryFileBufferBenchmark(const std::string& file_path, std::size_t file_size, std::size_t buffer_size,
+                                  std::ostream& output) {
+  MemoryBudget memory_budget{buffer_size};
+  std::uint64_t checksum = 0;
+  std::size_t numbers_count = 0;
+
+  const auto start_time = SteadyClockNs();
+
+  {
+    BinaryFileBuffer<number_t> file_buffer{std::make_shared<ThreadPool>(1), file_path, buffer_size, memory_budget};
+    file_buffer.waitForReady();
+
+    number_t number;
+    while (file_buffer.get(number)) {
+      checksum += number;
+      ++numbers_count;
+    }
+  }
+
+  const auto time_ns = SteadyClockNs() - start_time;
+
+  output << "{\"benchmark\":\"binary_file_buffer_get\",\"file_size\":" << file_size
+         << ",\"buffer_size\":" << buffer_size << ",\"numbers\":" << numbers_count << ",\"time_ns\":" << time_ns
+         << ",\"throughput_mb_s\":" << CalcThroughput(file_size, time_ns) << ",\"checksum\":" << checksum << "}"
+         << std::endl;
+}
+
+/**
+ * Adds empty tasks to a thread pool and waits for their completion
+ * @param threads_count count of threads in the thread pool
+ * @param tasks_count count of tasks
+ * @param output stream for results
+ */
+void RunThreadPoolAddBenchmark(std::size_t threads_count, std::size_t tasks_count, std::ostream& output) {
+  ThreadPool thread_pool{threads_count};
+  std::atomic_size_t executed_tasks_count = 0;
+
+  const auto start_time = SteadyClockNs();
+
+  for (std::size_t i = 0; i < tasks_count; ++i) {
+    thread_pool.add([&executed_tasks_count]() { executed_tasks_count.fetch_add(1, std::memory_order_relaxed); });
+  }
+
+  while (thread_pool.hasPendingTasks()) {
+    std::this_thread::yield();
+  }
+
+  const auto time_ns = SteadyClockNs() - start_time;
+
+  output << "{\"benchmark\":\"thread_pool_add\",\"threads\":" << threads_count << ",\"tasks\":" << tasks_count
+         << ",\"time_ns\":" << time_ns
+         << ",\"ns_per_task\":" << static_cast<double>(time_ns) / static_cast<double>(tasks_count) << "}"
+         << std::endl;
+}
+
+}  // namespace
+
+void RunMicroBenchmarks(const BenchmarkConfig& config, std::ostream& output) {
+  const std::size_t numbers_count = config.quick_ ? 4 * kMegabyte : 32 * kMegabyte;
+
+  for (const std::size_t runs_count : {2U, 16U, 128U, 1024U}) {
+    RunMergeHeapBenchmark(runs_count, numbers_count, config.seed_, output);
+  }
+
+  std::filesystem::create_directories(config.directory_);
+
+  const auto file_path = (config.directory_ / "micro_input").string();
+  const auto file_size = numbers_count * sizeof(number_t);
+
+  GenerateInputFile(file_path, Distribution::kUniform, file_size, config.seed_);
+
+  for (const std::size_t buffer_size : {kMegabyte / 16, kMegabyte, 16 * kMegabyte}) {
+    RunBinaryFileBufferBenchmark(file_path, file_size, buffer_size, output);
+  }
+
+  std::filesystem::remove(file_path);
+
+  const std::size_t tasks_count = config.quick_ ? 100000 : 1000000;
+
+  for (const auto threads_count : CreateThreadsCounts()) {
+    RunThreadPoolAddBenchmark(threads_count, tasks_count, output);
+  }
+}
+
+}  // namespace es::benchmarks
\ No newline at end of file
@@ -0,0 +1,126 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "benchmarks.h"
+#include "data_generators.h"
+
+#include <external_sorter/include/external_sorter.h>
+#include <external_sorter/include/thread_pool.h>
+#include <external_sorter/include/utils.h>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace es::benchmarks {
+
+namespace {
+
+/**
+ * Parameters of sorting
+ */
+struct SortParameters {
+  Distribution distribution_;     ///< Distribution of input numbers
+  std::size_t input_size_;        ///< Size of input file
+  std::size_t available_memory_;  ///< Memory budget
+  std::size_t threads_count_;     ///< Count of threads in the thread pool
+  SortStrategy sort_strategy_;    ///< Strategy of external sorting
+  SortEngine sort_engine_;        ///< Algorithm of sorting chunks
+};
+
+std::string_view ToString(SortStrategy sort_strategy) noexcept {
+  switch (sort_strategy) {
+    case SortStrategy::kMerge:
+      return "merge";
+    case SortStrategy::kDistribution:
+      return "distribution";
+    case SortStrategy::kCounting:
+      return "counting";
+  }
+
+  return "unknown";
+}
+
+std::string_view ToString(SortEngine sort_engine) noexcept {
+  switch (sort_engine) {
+    case SortEngine::kIntroSort:
+      return "intro";
+    case SortEngine::kRadixSort:
+      return "radix";
+    case SortEngine::kCountingSort:
+      return "counting";
+  }
+
+  return "unknown";
+}
+
+/**
+ * Sorts an input file and writes results
+ * @param parameters parameters of sorting
+ * @param input_path path to input file
+ * @param output_directory path to output directory (with trailing separator)
+ * @param output stream for results
+ */
+void RunSortBenchmark(const SortParameters& parameters, const std::string& input_path,
+                      const std::string& output_directory, std::ostream& output) {
+  SorterOptions options{};
+  options.sort_strategy_ = parameters.sort_strategy_;
+  options.sort_engine_ = parameters.sort_engine_;
+
+  ExternalSorter<number_t> sorter{parameters.available_memory_, input_path, output_directory,
+                                  std::make_shared<ThreadPool>(parameters.threads_count_), options};
+
+  sorter.sort();
+
+  const auto& stats = sorter.stats();
+
+  output << "{\"benchmark\":\"sort\""
+         << ",\"distribution\":\"" << ToString(parameters.distribution_) << '"'
+         << ",\"input_size\":" << parameters.input_size_ << ",\"available_memory\":" << parameters.available_memory_
+         << ",\"threads\":" << parameters.threads_count_ << ",\"sort_strategy\":\""
+         << ToString(parameters.sort_strategy_) << '"' << ",\"sort_engine\":\"" << ToString(parameters.sort_engine_)
+         << '"' << ",\"throughput_mb_s\":" << CalcThroughput(parameters.input_size_, stats.total_.wall_time_ns_)
+         << ",\"stats\":" << ToJson(stats) << "}" << std::endl;
+}
+
+}  // namespace
+
+void RunSortBenchmarks(const BenchmarkConfig& config, std::ostream& output) {
+  using sizes_t = std::vector<std::size_t>;
+
+  const auto input_sizes = config.quick_ ? sizes_t{16 * kMegabyte} : sizes_t{64 * kMegabyte, 256 * kMegabyte};
+  const auto memory_sizes = config.quick_ ? sizes_t{8 * kMegabyte} : sizes_t{16 * kMegabyte, 64 * kMegabyte};
+  const auto threads_counts = CreateThreadsCounts();
+  const std::vector<SortStrategy> sort_strategies{SortStrategy::kMerge, SortStrategy::kDistribution,
+                                                  SortStrategy::kCounting};
+  const std::vector<SortEngine> sort_engines{SortEngine::kIntroSort, SortEngine::kRadixSort, SortEngine::kCountingSort};
+
+  const auto input_path = (config.directory_ / "input").string();
+  const auto output_directory = (config.directory_ / "output").string() + '/';
+
+  std::filesystem::create_directories(output_directory);
+
+  for (const auto distribution : AllDistributions()) {
+    for (const auto input_size : input_sizes) {
+      GenerateInputFile(input_path, distribution, input_size, config.seed_);
+
+      for (const auto memory_size : memory_sizes) {
+        for (const auto threads_count : threads_counts) {
+          for (const auto sort_strategy : sort_strategies) {
+            for (const auto sort_engine : sort_engines) {
+              RunSortBenchmark(
+                  SortParameters{distribution, input_size, memory_size, threads_count, sort_strategy, sort_engine},
+                  input_path, output_directory, output);
+
+              std::filesystem::remove_all(output_directory);
+              std::filesystem::create_directories(output_directory);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace es::benchmarks
\ No newline at end of file
@@ -0,0 +1,67 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include "defines.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace es {
+
+/**
+ * Count of low bits of a packed number which keep the input index of its key in the argsort mode
+ */
+const unsigned kArgsortIndexBits = 32;
+
+/**
+ * Maximal count of numbers which can be sorted in the argsort mode
+ */
+const std::uint64_t kMaxArgsortNumbersCount = std::uint64_t{1} << kArgsortIndexBits;
+
+/**
+ * Packs a key with its input index in the argsort mode: the key takes the high bits and the index the low ones, so
+ * packed numbers are ordered by keys and equal keys keep the order of input (the sort is stable), and any sort engine
+ * (e.g. radix sort) applies to packed numbers as is
+ * @param key key
+ * @param index index of the key in input files (less than kMaxArgsortNumbersCount)
+ * @return packed number
+ */
+constexpr argsort_number_t PackArgsortNumber(number_t key, std::uint64_t index) noexcept {
+  return (argsort_number_t{key} << kArgsortIndexBits) | index;
+}
+
+/**
+ * Returns the key of a packed number
+ * @param number packed number
+ * @return key
+ */
+constexpr number_t ArgsortKey(argsort_number_t number) noexcept {
+  return static_cast<number_t>(number >> kArgsortIndexBits);
+}
+
+/**
+ * Returns the input index of a packed number
+ * @param number packed number
+ * @return index
+ */
+constexpr std::uint64_t ArgsortIndex(argsort_number_t number) noexcept {
+  return number & (kMaxArgsortNumbersCount - 1);
+}
+
+/**
+ * Creates path to the file of sorted keys which is written in the argsort mode alongside the output file of indices
+ * @param file_path path to the output file
+ * @return path to the values file
+ */
+inline std::string CreateArgsortValuesFilePath(std::string_view file_path) {
+  std::string values_file_path{file_path};
+  values_file_path.append(".values");
+
+  return values_file_path;
+}
+
+}  // namespace es
\ No newline at end of file
@@ -4,9 +4,14 @@
 
 #pragma once
 
+#include "compressed_run.h"
 #include "defines.h"
+#include "memory_budget.h"
+#include "multiset_checksum.h"
+#include "run_file.h"
 
 #include <atomic>
+#include <cstdint>
 #include <fstream>
 #include <memory>
 #include <queue>
@@ -14,10 +19,14 @@
 
 namespace es {
 
+class CancellationToken;
 class ThreadPool;
 
 /**
  * This class represents a file buffer that reads buffer chunk of numbers in a separate thread using a thread pool.
+ * Memory of both parts of the buffer is reserved from a memory budget. A run file (see RunFileWriter) is read by
+ * RunFileReader, so its blocks are verified while loading and the index takes a part of the memory of the buffer. A
+ * compressed run is decoded from memory by loading tasks in the same way.
  */
 template <typename NumberType>
 class BinaryFileBuffer {
@@ -29,24 +38,66 @@ class BinaryFileBuffer {
   struct buffer_internal {
     buffer_internal() = default;
 
-    buffer_internal(std::unique_ptr<NumberType[]> buffer) noexcept : buffer_{std::move(buffer)} {}
+    buffer_internal(std::unique_ptr<NumberType[]> buffer, std::size_t capacity) noexcept
+        : buffer_{std::move(buffer)}, capacity_{capacity} {}
 
     buffer_internal(buffer_internal&& other) noexcept
-        : is_ready_{other.is_ready_.load()}, numbers_read_{other.numbers_read_}, buffer_{std::move(other.buffer_)} {}
+        : is_ready_{other.is_ready_.load()},
+          numbers_read_{other.numbers_read_},
+          buffer_{std::move(other.buffer_)},
+          capacity_{other.capacity_} {}
 
     friend void swap(buffer_internal& own, buffer_internal& other) noexcept {
       own.is_ready_.store(other.is_ready_.load());  // note just copy
       std::swap(own.numbers_read_, other.numbers_read_);
       std::swap(own.buffer_, other.buffer_);
+      std::swap(own.capacity_, other.capacity_);
     }
 
     std::atomic_bool is_ready_{false};      ///< Flag for indicating if buffer is ready
     std::size_t numbers_read_{0};           ///< Count of read numbers
     std::unique_ptr<NumberType[]> buffer_;  ///< Buffer
+    std::size_t capacity_{0};               ///< Count of numbers the buffer is allocated for
   };
 
  public:
-  BinaryFileBuffer(std::shared_ptr<ThreadPool> pool, std::string_view file_path, std::size_t buffer_size);
+  /**
+   * Constructor
+   * @param pool thread pool for loading the buffer
+   * @param file_path path to file
+   * @param buffer_size total size of both parts of the buffer (in bytes)
+   * @param memory_budget memory budget to reserve the buffer from
+   * @param compute_checksum flag for computing checksum of loaded numbers by loading tasks
+   * @param cancellation_token token which is checked by loading tasks before every load (may be null)
+   * @param is_run_file flag of a run file, otherwise the file contains only numbers
+   * @throws if a run file has a wrong format
+   */
+  BinaryFileBuffer(std::shared_ptr<ThreadPool> pool, std::string_view file_path, std::size_t buffer_size,
+                   MemoryBudget& memory_budget, bool compute_checksum = false,
+                   const CancellationToken* cancellation_token = nullptr, bool is_run_file = false);
+
+  /**
+   * Constructor of a buffer of a resident run: numbers are already in memory, so nothing is read
+   * @param pool thread pool
+   * @param numbers numbers
+   * @param numbers_count count of numbers
+   * @param reservation memory reserved for numbers
+   */
+  BinaryFileBuffer(std::shared_ptr<ThreadPool> pool, std::unique_ptr<NumberType[]> numbers, std::size_t numbers_count,
+                   MemoryReservation reservation);
+
+  /**
+   * Constructor of a buffer of a compressed run
+   * @param pool thread pool for loading the buffer
+   * @param run compressed run
+   * @param run_reservation memory reserved for the run, which is released when the run is decoded
+   * @param buffer_size total size of both parts of the buffer (in bytes)
+   * @param memory_budget memory budget to reserve the buffer from
+   * @param cancellation_token token which is checked by loading tasks before every load (may be null)
+   */
+  BinaryFileBuffer(std::shared_ptr<ThreadPool> pool, CompressedRun<NumberType> run, MemoryReservation run_reservation,
+                   std::size_t buffer_size, MemoryBudget& memory_budget,
+                   const CancellationToken* cancellation_token = nullptr);
 
   /**
    * The destructor cannot be called while executing related tasks in a thread pool.
@@ -61,7 +112,7 @@ class BinaryFileBuffer {
   /**
    * Should be called before first use of get(). We need to be sure that buffer_0 has been loaded.
    */
-  void waitForReady() const;
+  void waitForReady();
 
   /**
    * Gets number from buffer
@@ -70,6 +121,38 @@ class BinaryFileBuffer {
    */
   bool get(NumberType& number);
 
+  /**
+   * Waits for loading of both parts of the buffer which may still be in progress after the last get(). Should be called
+   * before destruction.
+   */
+  void waitForLoads() const;
+
+  /**
+   * Halves both parts of the buffer (down to a minimal size) to release memory under memory pressure. A part is
+   * reallocated when it has been consumed, before its next load, so the memory is released while the merge goes on.
+   * Buffers of resident runs are not shrunk.
+   * @return true if the buffer is shrunk
+   */
+  bool shrink();
+
+  /**
+   * Returns amount of bytes which have been read from the file and handed out by get()
+   * @return amount of bytes
+   */
+  std::uint64_t bytesRead() const noexcept { return bytes_read_; }
+
+  /**
+   * Returns time which the current thread spent waiting for buffers to be loaded
+   * @return time in nanoseconds
+   */
+  std::uint64_t waitTime() const noexcept { return wait_time_ns_; }
+
+  /**
+   * Returns checksum of all loaded numbers (if it is computed), should be called after waitForLoads()
+   * @return checksum
+   */
+  const MultisetChecksum& checksum() const noexcept { return checksum_; }
+
  private:
   /**
    * Waits for readiness of a buffer in the current thread
@@ -77,20 +160,43 @@ class BinaryFileBuffer {
    */
   void waitForBuffer(const buffer_internal& buffer) const;
 
+  /**
+   * Adds a task which loads both parts of the buffer
+   */
+  void startLoading();
+
   /**
    * Function for loading buffer_internal in parallel
    * @param stream file stream
+   * @param run_reader reader of a run file (nullptr - numbers are read from the stream)
+   * @param compressed_reader reader of a compressed run (nullptr - numbers are read from a file)
    * @param buffer internal buffer for loading to
    * @param buffer_size size of the internal buffer
+   * @param checksum checksum of loaded numbers to update (nullptr - no checksum)
+   * @param cancellation_token cancellation token (nullptr - loading cannot be cancelled)
+   * @throws SortCancelledException if loading is cancelled
    */
-  static void loadBuffer(std::ifstream& stream, buffer_internal& buffer, std::size_t buffer_size);
+  static void loadBuffer(std::ifstream& stream, RunFileReader<NumberType>* run_reader,
+                         CompressedRunReader<NumberType>* compressed_reader, buffer_internal& buffer,
+                         std::size_t buffer_size, MultisetChecksum* checksum,
+                         const CancellationToken* cancellation_token);
 
  private:
-  std::shared_ptr<ThreadPool> thread_pool_;  ///< Thread pool for executing tasks
-  std::size_t buffer_size_;                  ///< Size of the internal buffer
-  std::size_t numbers_count_;                ///< Count of number corresponding to buffer_size_
-  std::size_t current_index_ = 0;            ///< Current index
-  std::ifstream stream_;                     ///< Input file stream
+  std::shared_ptr<ThreadPool> thread_pool_;                ///< Thread pool for executing tasks
+  std::unique_ptr<RunFileReader<NumberType>> run_reader_;  ///< Reader of a run file (null for other files)
+  std::size_t buffer_size_;                                ///< Size of the internal buffer (of the next loads)
+  std::size_t numbers_count_;                              ///< Count of number corresponding to buffer_size_
+  std::size_t current_index_ = 0;                          ///< Current index
+  std::ifstream stream_;                                   ///< Input file stream (not opened for a run file)
+  MemoryReservation reservation_;                          ///< Memory reserved for both parts of buffer
+  std::uint64_t bytes_read_ = 0;                           ///< Amount of bytes read from the file
+  mutable std::uint64_t wait_time_ns_ = 0;                 ///< Time of waiting for buffers
+  bool compute_checksum_ = false;                          ///< Flag for computing checksum of loaded numbers
+  bool is_resident_ = false;                               ///< Flag of a resident run (there is no file)
+  const CancellationToken* cancellation_token_ = nullptr;  ///< Token checked by loading tasks
+  MultisetChecksum checksum_;                              ///< Checksum of loaded numbers (loads are never concurrent)
+
+  std::unique_ptr<CompressedRunReader<NumberType>> compressed_reader_;  ///< Reader of a compressed run (null for files)
 
   buffer_internal buffer_0;  ///< First part of buffer
   buffer_internal buffer_1;  ///< Second part of buffer
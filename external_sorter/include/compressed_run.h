@@ -0,0 +1,177 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include "memory_budget.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace es {
+
+/**
+ * Count of numbers of a complete block of a compressed run
+ */
+const std::size_t kCompressedRunBlockNumbersCount = 256;
+
+/**
+ * Sorted run which is kept in memory in compressed form. Numbers are split into blocks: a block starts with its first
+ * number (native byte order) and the bit width of its deltas (uint8), followed by deltas between neighbouring numbers
+ * packed with that width (the block is padded to a byte). Deltas of a sorted chunk are small, so e.g. a chunk of a
+ * million uniformly distributed 32-bit numbers takes less than half of its size.
+ * @tparam NumberType type of numbers (unsigned)
+ */
+template <typename NumberType>
+class CompressedRun {
+ public:
+  /**
+   * Calculates the size of compressed numbers without compressing them
+   * @param numbers sorted numbers
+   * @param count count of numbers
+   * @return size in bytes
+   */
+  static std::size_t calcSize(const NumberType* numbers, std::size_t count) noexcept;
+
+  CompressedRun() = default;
+
+  /**
+   * Constructor, compresses numbers
+   * @param numbers sorted numbers
+   * @param count count of numbers
+   */
+  CompressedRun(const NumberType* numbers, std::size_t count);
+
+ public:
+  /**
+   * Returns count of numbers in the run
+   * @return count
+   */
+  std::uint64_t numbersCount() const noexcept { return numbers_count_; }
+
+  /**
+   * Returns size of compressed numbers
+   * @return size in bytes
+   */
+  std::size_t size() const noexcept { return size_; }
+
+ private:
+  template <typename T>
+  friend class CompressedRunReader;
+
+  std::unique_ptr<std::uint8_t[]> data_;  ///< Compressed blocks
+  std::size_t size_ = 0;                  ///< Size of compressed blocks
+  std::uint64_t numbers_count_ = 0;       ///< Count of numbers
+};
+
+/**
+ * Decodes numbers of a compressed run sequentially. The run is released when its last block is decoded.
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class CompressedRunReader {
+ public:
+  /**
+   * Constructor
+   * @param run compressed run, which is taken away
+   * @param reservation memory reserved for the run (released with it)
+   */
+  explicit CompressedRunReader(CompressedRun<NumberType> run, MemoryReservation reservation = {});
+
+ public:
+  /**
+   * Decodes the next numbers
+   * @param numbers buffer for numbers
+   * @param count maximal count of numbers to decode
+   * @return count of decoded numbers (0 at the end of the run)
+   */
+  std::size_t read(NumberType* numbers, std::size_t count);
+
+ private:
+  /**
+   * Decodes the next block
+   * @param numbers buffer for numbers of the block (kCompressedRunBlockNumbersCount numbers)
+   * @return count of numbers in the block
+   */
+  std::size_t decodeBlock(NumberType* numbers);
+
+ private:
+  CompressedRun<NumberType> run_;   ///< Run
+  MemoryReservation reservation_;   ///< Memory of the run
+  std::size_t offset_ = 0;          ///< Offset of the next block
+  std::uint64_t position_ = 0;      ///< Count of decoded numbers
+  std::vector<NumberType> block_;   ///< Decoded numbers of a partially read block
+  std::size_t block_position_ = 0;  ///< Count of read numbers of block_
+};
+
+/**
+ * Keeps compressed runs of run generation within the memory of the store (thread-safe). Room of a run is reserved
+ * before compressing it; if the store is full, the largest stored run which is not smaller than the new one is evicted
+ * and spilled by the caller, so the store keeps as many runs as possible. Spills of evicted runs are decoded by parts
+ * of a buffer of the store, one at a time.
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class CompressedRunStore {
+ public:
+  /**
+   * Constructor
+   * @param reservation memory of the store (compressed runs and the spill buffer)
+   */
+  explicit CompressedRunStore(MemoryReservation reservation);
+
+  CompressedRunStore(const CompressedRunStore&) = delete;
+  CompressedRunStore& operator=(const CompressedRunStore&) = delete;
+
+ public:
+  /**
+   * Reserves room for a new run. If there is no room, the largest stored run not smaller than the new one is evicted
+   * (its room is still reserved until it is spilled), then the caller spills it and tries again.
+   * @param size compressed size of the new run
+   * @param evicted_run evicted run (empty if nothing is evicted)
+   * @return true if room is reserved, false if the new run has to be spilled itself (when nothing is evicted)
+   */
+  bool reserve(std::size_t size, std::optional<CompressedRun<NumberType>>& evicted_run);
+
+  /**
+   * Adds a run which room is reserved for
+   * @param run run
+   */
+  void add(CompressedRun<NumberType> run);
+
+  /**
+   * Decodes an evicted run by parts and releases its room
+   * @param run evicted run
+   * @param write function which is called for every decoded part (numbers, count)
+   */
+  void spill(CompressedRun<NumberType> run, const std::function<void(const NumberType*, std::size_t)>& write);
+
+  /**
+   * Takes stored runs away and releases the memory of the store
+   * @return runs
+   */
+  std::vector<CompressedRun<NumberType>> takeRuns();
+
+  /**
+   * Returns count of runs evicted by reserve()
+   * @return count
+   */
+  std::size_t evictedRunsCount() const;
+
+ private:
+  MemoryReservation reservation_;                ///< Memory of the store
+  std::size_t capacity_;                         ///< Memory for runs
+  std::size_t reserved_size_ = 0;                ///< Room of stored and evicted runs which are not spilled yet
+  std::size_t evicted_runs_count_ = 0;           ///< Count of evicted runs
+  std::vector<CompressedRun<NumberType>> runs_;  ///< Stored runs
+  mutable std::mutex mutex_;                     ///< Mutex of runs and sizes
+  std::unique_ptr<NumberType[]> spill_buffer_;   ///< Buffer for decoding evicted runs
+  std::mutex spill_mutex_;                       ///< Mutex of the spill buffer
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,206 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace es {
+
+/**
+ * Value with count of its occurrences
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+struct CountedValue {
+  NumberType value_ = {};     ///< Value
+  std::uint64_t count_ = {};  ///< Count of occurrences
+};
+
+/**
+ * Counts occurrences of values by an open addressing hash table (linear probing, at most half full) of a fixed
+ * capacity, so counting fails as soon as there are too many distinct values. Runs of equal numbers are counted without
+ * lookups. Numbers of up to 16 bits are counted by a dense array of all values instead, which never fails.
+ * @tparam NumberType type of numbers (unsigned)
+ */
+template <typename NumberType>
+class CountingTable {
+  static_assert(std::is_unsigned_v<NumberType>, "Counting sort supports only unsigned numbers");
+
+  static constexpr bool kIsDense = sizeof(NumberType) <= 2;
+
+ public:
+  /**
+   * Calculates memory of a table
+   * @param max_values_count maximal count of distinct values
+   * @return size in bytes
+   */
+  static std::size_t calcMemorySize(std::size_t max_values_count) noexcept {
+    return calcCapacity(max_values_count) * ((kIsDense ? 0 : sizeof(NumberType)) + sizeof(std::uint64_t));
+  }
+
+  /**
+   * Constructor
+   * @param max_values_count maximal count of distinct values (ignored for numbers of up to 16 bits)
+   */
+  explicit CountingTable(std::size_t max_values_count)
+      : max_values_count_{kIsDense ? calcCapacity(max_values_count) : std::max<std::size_t>(max_values_count, 1)},
+        counts_(calcCapacity(max_values_count)),
+        keys_(kIsDense ? 0 : counts_.size()) {
+    while ((std::size_t{1} << (64 - hash_shift_)) < counts_.size()) {
+      --hash_shift_;
+    }
+  }
+
+ public:
+  /**
+   * Counts numbers
+   * @param numbers numbers
+   * @param count count of numbers
+   * @return false if there are too many distinct values (the table is not usable then)
+   */
+  bool add(const NumberType* numbers, std::size_t count) {
+    if constexpr (kIsDense) {
+      for (std::size_t i = 0; i < count; ++i) {
+        ++counts_[numbers[i]];
+      }
+
+      return true;
+    } else {
+      const auto mask = counts_.size() - 1;
+
+      for (std::size_t i = 0; i < count; ++i) {
+        const auto number = numbers[i];
+
+        if (number == last_value_ && values_count_ != 0) {
+          ++counts_[last_slot_];
+
+          continue;
+        }
+
+        auto slot = static_cast<std::size_t>((static_cast<std::uint64_t>(number) * kHashMultiplier) >> hash_shift_);
+
+        while (counts_[slot] != 0 && keys_[slot] != number) {
+          slot = (slot + 1) & mask;
+        }
+
+        if (counts_[slot] == 0) {
+          if (values_count_ == max_values_count_) {
+            return false;
+          }
+
+          keys_[slot] = number;
+          ++values_count_;
+        }
+
+        ++counts_[slot];
+        last_value_ = number;
+        last_slot_ = slot;
+      }
+
+      return true;
+    }
+  }
+
+  /**
+   * Appends counted values to a vector (in no particular order)
+   * @param values vector of values
+   */
+  void appendValues(std::vector<CountedValue<NumberType>>& values) const {
+    for (std::size_t slot = 0; slot < counts_.size(); ++slot) {
+      if (counts_[slot] != 0) {
+        const auto value = kIsDense ? static_cast<NumberType>(slot) : keys_[slot];
+
+        values.push_back(CountedValue<NumberType>{value, counts_[slot]});
+      }
+    }
+  }
+
+ private:
+  /**
+   * Calculates count of slots of a table
+   * @param max_values_count maximal count of distinct values
+   * @return power of two
+   */
+  static std::size_t calcCapacity(std::size_t max_values_count) noexcept {
+    if constexpr (kIsDense) {
+      return std::size_t{1} << (8 * sizeof(NumberType));
+    } else {
+      std::size_t capacity = 2;
+
+      while (capacity < 2 * max_values_count) {
+        capacity *= 2;
+      }
+
+      return capacity;
+    }
+  }
+
+ private:
+  static constexpr std::uint64_t kHashMultiplier = 0x9E3779B97F4A7C15ULL;  ///< Multiplier of Fibonacci hashing
+
+  std::size_t max_values_count_;       ///< Maximal count of distinct values
+  std::vector<std::uint64_t> counts_;  ///< Counts of slots (0 - the slot is free)
+  std::vector<NumberType> keys_;       ///< Values of slots (empty for dense tables)
+  unsigned hash_shift_ = 63;           ///< Shift of a hash to the index of a slot
+  std::size_t values_count_ = 0;       ///< Count of distinct values
+  NumberType last_value_ = {};         ///< The last counted value
+  std::size_t last_slot_ = 0;          ///< Slot of the last counted value
+};
+
+/**
+ * Sorts counted values by values and merges counts of equal ones (e.g. of tables of several threads)
+ * @tparam NumberType type of numbers
+ * @param values values
+ */
+template <typename NumberType>
+void ReduceCountedValues(std::vector<CountedValue<NumberType>>& values) {
+  std::sort(values.begin(), values.end(),
+            [](const auto& value, const auto& other) { return value.value_ < other.value_; });
+
+  std::size_t reduced_count = 0;
+
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    if (reduced_count != 0 && values[reduced_count - 1].value_ == values[i].value_) {
+      values[reduced_count - 1].count_ += values[i].count_;
+    } else {
+      values[reduced_count++] = values[i];
+    }
+  }
+
+  values.resize(reduced_count);
+}
+
+/**
+ * Sorts numbers in place by counting their values, so a range with few distinct values is sorted in linear time
+ * @tparam NumberType type of numbers
+ * @param begin beginning of the range
+ * @param end end of the range
+ * @param max_values_count maximal count of distinct values
+ * @return false if there are more distinct values (numbers are not changed then)
+ */
+template <typename NumberType>
+bool CountingSort(NumberType* begin, NumberType* end, std::size_t max_values_count) {
+  CountingTable<NumberType> table{max_values_count};
+
+  if (!table.add(begin, static_cast<std::size_t>(end - begin))) {
+    return false;
+  }
+
+  std::vector<CountedValue<NumberType>> values;
+  table.appendValues(values);
+  ReduceCountedValues(values);
+
+  for (const auto& value : values) {
+    begin = std::fill_n(begin, static_cast<std::size_t>(value.count_), value.value_);
+  }
+
+  return true;
+}
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,62 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace es {
+
+/**
+ * Policy of pinning threads of a thread pool to CPUs
+ */
+enum class ThreadPinning {
+  kNone,      ///< Threads are not pinned and migrate freely
+  kCompact,   ///< Threads fill CPUs of the first NUMA node, then of the next one and so on
+  kScatter,   ///< Threads are distributed between NUMA nodes one by one
+  kExplicit,  ///< Threads are pinned to the given CPUs one by one
+};
+
+/**
+ * CPUs available to the process grouped by NUMA nodes
+ */
+struct CpuTopology {
+  std::vector<std::vector<unsigned int>> nodes_cpus_;  ///< CPUs of every NUMA node (nodes without CPUs are skipped)
+};
+
+/**
+ * Detects NUMA nodes and CPUs the process is allowed to run on. If NUMA information is not available, all CPUs are
+ * reported as a single node.
+ * @return topology
+ */
+CpuTopology DetectCpuTopology();
+
+/**
+ * Parses a list of CPUs in the Linux format, e.g. "0-3,8,10-11"
+ * @param cpu_list list of CPUs
+ * @return CPUs in the listed order
+ * @throws if the list is malformed
+ */
+std::vector<unsigned int> ParseCpuList(std::string_view cpu_list);
+
+/**
+ * Creates CPUs for threads of a thread pool
+ * @param topology topology
+ * @param pinning pinning policy (kExplicit is not supported, explicit CPUs are used as is)
+ * @param threads_count count of threads
+ * @return CPU of every thread or empty vector if threads are not pinned
+ */
+std::vector<unsigned int> CreatePinningCpus(const CpuTopology& topology, ThreadPinning pinning,
+                                            std::size_t threads_count);
+
+/**
+ * Pins the current thread to a CPU
+ * @param cpu CPU
+ * @return true if the thread has been pinned (false on failure or if pinning is not supported by the platform)
+ */
+bool PinCurrentThread(unsigned int cpu) noexcept;
+
+}  // namespace es
\ No newline at end of file
@@ -9,4 +9,5 @@
 namespace es {
 
 using number_t = std::uint32_t;
+using argsort_number_t = std::uint64_t;  ///< Key (number_t) packed with its input index by the argsort mode
 }  // namespace es
\ No newline at end of file
@@ -4,21 +4,60 @@
 
 #pragma once
 
+#include "compressed_run.h"
+#include "counting_sort.h"
 #include "defines.h"
+#include "memory_budget.h"
+#include "multiset_checksum.h"
+#include "output_summary.h"
+#include "sort_control.h"
+#include "sort_stats.h"
+#include "sorter_options.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace es {
 
+class OutputFile;
+template <typename Item>
+class Pipeline;
 class ThreadPool;
+template <typename NumberType>
+class SparseIndexWriter;
+template <typename NumberType>
+class OutputSummaryCollector;
+struct FileReadResult;
+struct ThreadPoolStats;
+
+/**
+ * Available memory of a sorter which is derived from resource limits of the process: the memory limit of its cgroup or
+ * available memory of the system (see CalcAutoMemorySize()). Zero memory is still rejected as not enough.
+ */
+const std::size_t kAutoAvailableMemory = std::numeric_limits<std::size_t>::max();
+
+/**
+ * Input file of a sorter
+ */
+struct InputFile {
+  std::string path_;        ///< Path to the file
+  bool is_sorted_ = false;  ///< Flag of an already sorted file, which is merged as a run without sorting
+};
 
 /**
  * Sorts numbers stored in binary file using limited amount of memory (available_memory) and writes results to output file.
  * It sorts chunks of data and then merge them
- * NOTE: intermediate files will be created in output directory
+ * NOTE: intermediate files will be created in output directory unless spill directories are specified in options
  *
  * @tparam NumberType type of numbers in a binary file
  */
@@ -27,24 +66,282 @@ class ExternalSorter {
  public:
   /**
    * Constructor
-   * @param available_memory available memory for solving the tasks (in bytes)
+   * @param available_memory available memory for solving the tasks (in bytes, kAutoAvailableMemory - by limits)
    * @param input_file_path path to input file
    * @param output_directory_path path to output file
    * @param thread_pool thread pool
+   * @param options additional options
    */
   ExternalSorter(std::size_t available_memory, std::string input_file_path, std::string output_directory_path,
-                 std::shared_ptr<ThreadPool> thread_pool);
+                 std::shared_ptr<ThreadPool> thread_pool, SorterOptions options = {});
+
+  /**
+   * Constructor of a sorter of several input files, which are sorted to a single output file
+   * @param available_memory available memory for solving the tasks (in bytes, kAutoAvailableMemory - by limits)
+   * @param input_files input files
+   * @param output_directory_path path to output file
+   * @param thread_pool thread pool
+   * @param options additional options
+   */
+  ExternalSorter(std::size_t available_memory, std::vector<InputFile> input_files, std::string output_directory_path,
+                 std::shared_ptr<ThreadPool> thread_pool, SorterOptions options = {});
   ~ExternalSorter();
   ExternalSorter(ExternalSorter&&) = default;
   ExternalSorter& operator=(ExternalSorter&&) = default;
 
  public:
   /**
-   * Performs sorting and storing results to the output file
+   * Performs sorting and storing results to the output file. If sorting fails or is cancelled, tasks of the sorter are
+   * waited for and intermediate files are removed, so the thread pool can be reused.
+   * @throws SortCancelledException if sorting is cancelled by the cancellation token of options
+   * @throws if verification of options finds that the output is not sorted or its checksum differs from the input one
    */
   void sort();
 
+  /**
+   * Returns progress of the current sort() call, may be called by any thread while sorting
+   * @return progress
+   */
+  SortProgress progress() const;
+
+  /**
+   * Returns the memory budget of the sorter, e.g. for inspecting current and peak amount of reserved memory
+   * @return memory budget
+   */
+  const MemoryBudget& memoryBudget() const noexcept;
+
+  /**
+   * Returns statistics of the last sort() call
+   * @return statistics
+   */
+  const SortStats& stats() const noexcept;
+
+  /**
+   * Returns the summary of the output file of the last sort() call (if the output summary is enabled by options)
+   * @return summary
+   */
+  const OutputSummary& outputSummary() const noexcept;
+
  private:
+  /**
+   * Creates sorted chunks and merges them to the output file. Input which fits in memory is sorted without spilling.
+   */
+  void mergeSortImpl();
+
+  /**
+   * Checks whether unsorted input files can be sorted in memory: they are regular files and their numbers (with scratch
+   * space of the sort engine) leave enough memory for merging sorted parts with presorted runs
+   * @return true if input fits in memory
+   */
+  bool isInputFitInMemory() const;
+
+  /**
+   * Reads all unsorted input files to resident runs (a run per thread of the thread pool) and sorts them in parallel
+   */
+  void createResidentRuns();
+
+  /**
+   * Keeps the last chunk of run generation in memory as a resident run (may be called by several threads)
+   * @param reservation memory of the chunk buffer, which is taken away
+   * @param buffer chunk buffer, which is taken away
+   * @param numbers_count count of sorted numbers in the chunk
+   */
+  void addResidentRun(MemoryReservation& reservation, std::unique_ptr<NumberType[]>& buffer,
+                      std::size_t numbers_count);
+
+  /**
+   * Shrinks resident runs kept by run generation to their sizes when it is over (a chunk buffer may be much larger than
+   * its run) or spills them if there is no memory for copies, and reserves memory for compressed runs
+   */
+  void reserveResidentRuns();
+
+  /**
+   * Partitions the input file to bucket files by splitters sampled from it, then sorts buckets in memory and appends
+   * them to the output file
+   */
+  void distributionSortImpl();
+
+  /**
+   * Counts values of input files and writes them to the output file by counts if sampling shows few distinct values,
+   * otherwise (or if there are more distinct values than the sample has shown) sorts input files by mergeSortImpl()
+   */
+  void countingSortImpl();
+
+  /**
+   * Calculates how many distinct values tables of the counting strategy may hold: tables of all threads take at most a
+   * half of available memory
+   * @param tables_count count of tables
+   * @return count of values (0 if memory is not enough for the counting strategy)
+   */
+  std::size_t calcMaxCountedValuesCount(std::size_t tables_count) const;
+
+  /**
+   * Counts values of input files by chunk tasks, every thread of the pool counts to its own table. Reading stops as
+   * soon as a table overflows.
+   * @param max_values_count maximal count of distinct values of a table
+   * @param values sorted values with their total counts
+   * @return false if there are too many distinct values (input files are partially read then)
+   */
+  bool countInputNumbers(std::size_t max_values_count, std::vector<CountedValue<NumberType>>& values);
+
+  /**
+   * Writes counted values to the output file, every value repeated by its count
+   * @param values sorted values with their counts
+   */
+  void writeCountedValues(const std::vector<CountedValue<NumberType>>& values);
+
+  /**
+   * Rewinds input files, so they are read from the beginning again (after the counting strategy gives up)
+   */
+  void rewindInputFiles();
+
+  /**
+   * Sorted run which is kept in memory and merged without spilling
+   */
+  struct ResidentRun {
+    MemoryReservation reservation_;          ///< Memory of numbers
+    std::unique_ptr<NumberType[]> numbers_;  ///< Sorted numbers (null for a compressed run)
+    std::size_t numbers_count_ = 0;          ///< Count of numbers
+    CompressedRun<NumberType> compressed_;   ///< Compressed numbers (if numbers_ is null)
+  };
+
+  /**
+   * File which chunks are read by a reader of processChunks()
+   */
+  struct ChunkSource {
+    std::string path_;                                        ///< Path to the file (for error messages)
+    std::function<FileReadResult(char*, std::size_t)> read_;  ///< Function for reading the next part of the file
+    std::size_t reader_index_ = 0;                            ///< Index of the reader of the file
+  };
+
+  /**
+   * Chunk of numbers which passes stages of run generation or partitioning
+   */
+  struct Chunk {
+    MemoryReservation reservation_;          ///< Memory of the buffer (taken away with it)
+    std::unique_ptr<NumberType[]> numbers_;  ///< Buffer (a stage may take it away, then it is not reused)
+    std::size_t numbers_count_ = 0;          ///< Count of numbers in the chunk
+    bool is_last_ = false;                   ///< Flag of the last (incomplete) chunk of input
+    std::uint64_t begin_ = 0;                ///< Index of the first number in input files (for positional reads)
+  };
+
+  /**
+   * Reads chunks of files and pushes them to a pipeline which processes them in threads of the thread pool. Every
+   * reader reads its files one by one: the first reader is the current thread, others are started for the call. Chunk
+   * buffers are recycled by the pipeline, so reading stalls until a buffer is processed if all of them are busy.
+   * @param sources files to read
+   * @param bytes_read_counter counter of read bytes
+   * @param chunks_count count of chunk buffers
+   * @param chunk_numbers_count capacity of a chunk
+   * @param chunk_allocation_factor count of chunk capacities allocated per buffer (for scratch space)
+   * @param pipeline pipeline with stages of processing chunks, is_last_ is set for the last (incomplete) chunk of a
+   * reader
+   */
+  void processChunks(const std::vector<ChunkSource>& sources, StatsCounter bytes_read_counter,
+                     std::size_t chunks_count, std::size_t chunk_numbers_count, std::size_t chunk_allocation_factor,
+                     Pipeline<Chunk>& pipeline);
+
+  /**
+   * Reserves and allocates chunk buffers of a pipeline, every chunk carries the reservation of its buffer
+   * @param pipeline pipeline of run generation or partitioning
+   * @param chunks_count count of chunk buffers
+   * @param chunk_numbers_count capacity of a chunk
+   * @param chunk_allocation_factor count of chunk capacities allocated per buffer (for scratch space)
+   * @throws if memory is exceeded
+   */
+  void addChunks(Pipeline<Chunk>& pipeline, std::size_t chunks_count, std::size_t chunk_numbers_count,
+                 std::size_t chunk_allocation_factor);
+
+  /**
+   * Adds a stage of adding numbers of chunks to the input checksum in the verification mode
+   * @param pipeline pipeline of run generation or partitioning
+   */
+  void addInputChecksumStage(Pipeline<Chunk>& pipeline);
+
+  /**
+   * Adds stages of run generation after chunks are read: the input checksum, sorting and writing chunks to
+   * intermediate files (the last chunk of input is kept as a resident run)
+   * @param pipeline pipeline of run generation
+   * @param chunk_numbers_count capacity of a chunk
+   */
+  void addSortChunkStages(Pipeline<Chunk>& pipeline, std::size_t chunk_numbers_count);
+
+  /**
+   * Adds statistics of stages of a pipeline to statistics of sorting (may be called by several threads)
+   * @param stages_stats statistics of stages
+   */
+  void addStagesStats(const std::vector<StageStats>& stages_stats);
+
+  /**
+   * Partitions files to bucket files in parallel
+   * @param sources files to read
+   * @param bytes_read_counter counter of read bytes
+   * @param splitters sorted unique splitters
+   * @return paths to bucket files in the order of their numbers
+   */
+  std::vector<std::filesystem::path> partitionToBuckets(const std::vector<ChunkSource>& sources,
+                                                        StatsCounter bytes_read_counter,
+                                                        const std::vector<NumberType>& splitters);
+
+  /**
+   * Sorts buckets in parallel and appends them to the output file in order. Oversized buckets are partitioned again.
+   * Bucket files are removed.
+   * @param buckets_paths paths to bucket files in the order of their numbers
+   * @param depth depth of partitioning
+   */
+  void sortBuckets(const std::vector<std::filesystem::path>& buckets_paths, std::size_t depth);
+
+  /**
+   * Appends a bucket of equal numbers to the output file and removes it
+   * @param bucket_path path to the bucket file
+   * @param numbers_count count of numbers in the bucket
+   */
+  void writeEqualityBucket(const std::filesystem::path& bucket_path, std::uint64_t numbers_count);
+
+  /**
+   * Appends sorted numbers to the output file, see addOutput()
+   * NOTE: calls must not be concurrent
+   * @param buffer numbers
+   * @param size size in bytes
+   */
+  void writeOutputFile(const char* buffer, std::size_t size);
+
+  /**
+   * Accounts sorted numbers which are written to the output file: adds them to the sparse index (if it is enabled) and
+   * to statistics. In the verification mode checks that numbers continue the output in order and adds them to the
+   * output checksum.
+   * NOTE: calls must not be concurrent and must follow the order of the output file
+   * @param buffer numbers
+   * @param size size in bytes
+   */
+  void addOutput(const char* buffer, std::size_t size);
+
+  /**
+   * Adds input numbers to the input checksum in the verification mode (may be called by several threads)
+   * @param numbers numbers
+   * @param count count of numbers
+   */
+  void addInputChecksum(const NumberType* numbers, std::size_t count);
+
+  /**
+   * Compares checksums of input and output numbers in the verification mode
+   * @throws if they differ
+   */
+  void verifyChecksums() const;
+
+  /**
+   * Calculates count of numbers of a bucket which can be sorted in memory (while other threads sort their buckets)
+   * @return count of numbers
+   */
+  std::size_t calcBucketCapacity() const;
+
+  /**
+   * Calculates count of range buckets which numbers are partitioned to
+   * @param numbers_count count of numbers
+   * @return count of buckets
+   */
+  std::size_t calcRangeBucketsCount(std::uint64_t numbers_count) const;
+
   /**
    * Reads chunk of input file, then sorts this chunk and writes it to intermediate directory in single thread
    */
@@ -56,29 +353,260 @@ class ExternalSorter {
   void createSortedChunksImplMultiThreaded();
 
   /**
-   * Merges sorted chunks from intermediate directory and writes results to output file
+   * Creates sorted chunks in threads of the thread pool: every thread owns a chunk buffer which it allocates, fills by
+   * reading the input file (reads are serialized), sorts and writes to intermediate directory. So a buffer never leaves
+   * the NUMA node of its thread when the threads are pinned.
+   */
+  void createSortedChunksImplNumaLocal();
+
+  /**
+   * Creates sorted chunks in threads of the thread pool: every task reads its own slice of input files (as if they were
+   * concatenated) by positional reads, sorts and writes it to intermediate directory, so several reads are in flight
+   * while the current thread only schedules tasks. Input files must be regular files.
+   */
+  void createSortedChunksImplParallelReads();
+
+  /**
+   * Starts the thread of background compaction if it is enabled: while run generation is in progress, every time there
+   * are enough runs it merges them to a larger run. Memory of compaction is taken from run generation.
+   */
+  void startCompaction();
+
+  /**
+   * Stops background compaction when run generation is over: waits for the current merge and adds larger runs to runs
+   * for the final merge
+   * @throws if compaction failed
+   */
+  void stopCompaction();
+
+  /**
+   * Creates the store of compressed runs for run generation if they are enabled by options, it takes a half of memory
+   * of run generation
+   */
+  void createCompressedRunStore();
+
+  /**
+   * Merges groups of runs until run generation is over (the body of the compaction thread)
+   */
+  void compactRuns();
+
+  /**
+   * Merges sorted chunks from intermediate directory and writes results to output file. If there are more chunks than
+   * the merge fan-in, groups of chunks are merged to new intermediate files first.
    */
   void mergeSortedChunksImpl();
 
+  /**
+   * Merges sorted files and appends results to a file. Merged numbers are written from a ring of buffers by threads of
+   * the thread pool, so several writes are in flight at once.
+   * @tparam MergedFunction void(char* buffer, std::size_t size), called by the current thread for every buffer of
+   * merged numbers (in their order) before it is written, it may transform numbers in place
+   * @param intermediate_files_paths paths to sorted files
+   * @param file file for merged numbers
+   * @param merged function for accounting merged numbers
+   * @param resident_runs sorted runs in memory which are merged with files
+   * @param memory_size memory of the merge (limited by available memory)
+   */
+  template <typename MergedFunction>
+  void mergeFiles(const std::vector<std::filesystem::path>& intermediate_files_paths, OutputFile& file,
+                  MergedFunction merged, std::vector<ResidentRun> resident_runs = {},
+                  std::size_t memory_size = std::numeric_limits<std::size_t>::max());
+
+  /**
+   * Merges sorted intermediate files to a new intermediate file and removes them
+   * @param files_paths paths to intermediate files
+   * @param memory_size memory of the merge (limited by available memory)
+   * @return path to the new intermediate file
+   */
+  std::filesystem::path mergeToIntermediateFile(const std::vector<std::filesystem::path>& files_paths,
+                                                std::size_t memory_size = std::numeric_limits<std::size_t>::max());
+
+  /**
+   * Checks whether a file is a presorted run, i.e. it is merged as is (e.g. the base file of the incremental mode)
+   * @param file_path path to file
+   * @return true for presorted runs
+   */
+  bool isPresortedRun(const std::filesystem::path& file_path) const;
+
+  /**
+   * Calculates count of files which are merged at once: the merge fan-in option limited by memory
+   * @param memory_size memory of the merge
+   * @return count of files
+   */
+  std::size_t calcMergeFanIn(std::size_t memory_size) const;
+
+  /**
+   * Returns memory which can be used by run generation: available memory except memory of background compaction
+   * @return size in bytes
+   */
+  std::size_t calcRunGenerationMemorySize() const;
+
  private:
   /**
-   * Creates the intermediate directory
+   * Creates the intermediate directories
+   */
+  void createIntermediateDirectories() const;
+
+  /**
+   * Selects an intermediate directory for the next intermediate file according to the spill placement policy
+   * @return index of the intermediate directory
+   */
+  std::size_t selectIntermediateDirectory();
+
+  /**
+   * Reads the next part of an unsorted input file
+   * @param index index of the file among unsorted input files
+   * @param buffer buffer
+   * @param size size of the buffer
+   * @return reading results
    */
-  void createIntermediateDirectory() const;
+  FileReadResult readInputFile(std::size_t index, char* buffer, std::size_t size);
+
+  /**
+   * Reads the next keys of an unsorted input file in the argsort mode and packs them with their input indices
+   * @param index index of the file among unsorted input files
+   * @param buffer buffer for packed numbers
+   * @param size size of the buffer
+   * @return reading results (the size of packed numbers)
+   * @throws if there are too many keys to pack their indices
+   */
+  FileReadResult readArgsortKeys(std::size_t index, char* buffer, std::size_t size);
+
+  /**
+   * Counts numbers of unsorted input files (keys in the argsort mode), which must be regular files
+   * @return count of numbers
+   */
+  std::uint64_t countUnsortedInputNumbers() const;
+
+  /**
+   * Reads the next part of unsorted input files as if they were concatenated
+   * @param buffer buffer
+   * @param size size of the buffer
+   * @return count of read bytes
+   * @throws if reading fails
+   */
+  std::size_t readInputFiles(char* buffer, std::size_t size);
+
+  /**
+   * Creates sources of chunks of unsorted input files assigned to readers: one reader per device of files unless the
+   * count of readers is specified in options
+   * @return sources
+   */
+  std::vector<ChunkSource> createInputChunkSources();
+
+  /**
+   * Creates path to a new intermediate file in an intermediate directory selected by the spill placement policy
+   * @return path
+   */
+  std::filesystem::path createIntermediateFilePath();
+
+  /**
+   * Writes a sorted chunk to a new intermediate file and registers it for merging
+   * @param buffer sorted chunk
+   * @param size size of the chunk in bytes
+   */
+  void writeIntermediateFile(const char* buffer, std::size_t size);
+
+  /**
+   * Keeps a sorted chunk in the store of compressed runs, evicting larger runs to intermediate files if there is no
+   * room for it, or writes the chunk to an intermediate file if it does not fit anyway (may be called by several
+   * threads)
+   * @param numbers sorted chunk
+   * @param numbers_count count of numbers in the chunk
+   */
+  void writeSortedChunk(const NumberType* numbers, std::size_t numbers_count);
+
+  /**
+   * Writes a compressed run evicted from the store to a new intermediate file and registers it for merging
+   * @param run run
+   */
+  void writeCompressedRun(CompressedRun<NumberType> run);
+
+  /**
+   * Registers a written intermediate file for merging
+   * @param path path to file
+   * @param size size of numbers in the file
+   */
+  void addIntermediateFile(std::filesystem::path path, std::size_t size);
+
+  /**
+   * Throws if sorting is cancelled by the cancellation token of options (may be called by several threads)
+   * @throws SortCancelledException
+   */
+  void checkCancellation() const;
+
+  /**
+   * Waits for all tasks of the thread pool, e.g. when sorting has failed and its tasks are still running
+   */
+  void waitForPendingTasks() const;
+
+  /**
+   * Removes all intermediate files created by the sorter which still exist
+   */
+  void removeIntermediateFiles() const;
+
+  /**
+   * Fills in statistics when sorting is over
+   * @param initial_pool_stats statistics of the thread pool before sorting
+   */
+  void collectStats(const ThreadPoolStats& initial_pool_stats);
 
  private:
-  std::size_t available_memory_;                       ///< Amount of available memory
-  std::string input_file_path_;                        ///< Input file path
-  std::string output_directory_path_;                  ///< Path to output directory
-  std::string output_file_path_;                       ///< Output file path
-  std::filesystem::path intermediate_directory_path_;  ///< Path to intermediate directory
+  std::vector<InputFile> input_files_;  ///< Input files
+  std::string output_directory_path_;   ///< Path to output directory
+  SorterOptions options_;               ///< Additional options
+  std::string output_file_path_;        ///< Output file path
+
+  std::vector<std::filesystem::path> intermediate_directories_paths_;  ///< Paths to intermediate directories
+
+  std::vector<std::string> unsorted_input_files_paths_;      ///< Paths to input files which have to be sorted
+  std::vector<std::ifstream> unsorted_input_files_streams_;  ///< Streams of input files which have to be sorted
+  std::size_t current_input_file_index_ = 0;                 ///< Index of the stream read by readInputFiles()
+  std::vector<std::uint64_t> argsort_positions_;             ///< Index of the next key of every file (argsort)
+  std::unique_ptr<OutputFile> output_file_;                  ///< Output file
 
-  std::ifstream input_file_stream_;   ///< input file stream
-  std::ofstream output_file_stream_;  ///< output file stream
+  std::unique_ptr<SparseIndexWriter<NumberType>> sparse_index_writer_;  ///< Writer of the sparse index of output file
+
+  std::unique_ptr<OutputSummaryCollector<NumberType>> summary_collector_;  ///< Collector of the output summary
+  OutputSummary output_summary_;                                           ///< Summary of the output file
 
   std::shared_ptr<ThreadPool> thread_pool_;  ///< thread pool
 
+  StatsCounters counters_;  ///< Counters which are updated while sorting
+  SortStats stats_;         ///< Statistics of sorting
+
+  std::unique_ptr<MemoryBudget> memory_budget_;  ///< Budget of available memory
+  MemoryReservation overhead_reservation_;       ///< Memory reserved for the thread pool and objects of the sorter
+
   std::atomic_uint32_t intermediate_files_count_ = {};  ///< Amount of intermediate files
+  std::atomic_size_t next_directory_index_ = {};        ///< Index of the next intermediate directory (round-robin)
+
+  std::mutex stages_stats_mutex_;  ///< Mutex for statistics of stages of pipelines
+
+  std::atomic<SortPhase> phase_ = SortPhase::kNotStarted;  ///< Current phase of sorting
+  std::atomic_uint64_t start_time_ns_ = {};                ///< Time of the start of sorting
+  std::atomic_uint64_t finish_time_ns_ = {};               ///< Time of the end of sorting (0 - it is not over)
+  std::uint64_t input_files_size_ = 0;                     ///< Total size of input files (0 - unknown)
+
+  MultisetChecksum input_checksum_;   ///< Checksum of input numbers (in the verification mode)
+  MultisetChecksum output_checksum_;  ///< Checksum of output numbers (in the verification mode)
+  NumberType last_output_number_{};   ///< The last number written to the output file (in the verification mode)
+  std::mutex input_checksum_mutex_;   ///< Mutex for input_checksum_
+
+  std::vector<std::filesystem::path> intermediate_files_paths_;  ///< Paths to written intermediate files
+  std::vector<std::filesystem::path> presorted_runs_paths_;      ///< Paths to sorted files merged as runs
+  std::vector<std::filesystem::path> compacted_runs_paths_;      ///< Paths to runs merged by background compaction
+  std::vector<ResidentRun> resident_runs_;                       ///< Runs kept in memory for the final merge
+  std::uint64_t compacted_runs_count_ = 0;                       ///< Count of runs merged by background compaction
+  bool is_run_generation_over_ = false;                          ///< Flag for stopping background compaction
+  std::mutex intermediate_files_mutex_;                          ///< Mutex for intermediate files and compaction
+  std::condition_variable intermediate_files_cv_;                ///< Notifies about new runs and end of run generation
+
+  std::unique_ptr<CompressedRunStore<NumberType>> compressed_run_store_;  ///< Compressed runs of run generation
+
+  std::size_t compaction_memory_size_ = 0;   ///< Memory of background compaction (0 - it is not running)
+  std::thread compaction_thread_;            ///< Thread of background compaction
+  std::exception_ptr compaction_exception_;  ///< Exception thrown by background compaction
 };
 
 }  // namespace es
\ No newline at end of file
@@ -0,0 +1,62 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#ifndef __linux__
+#include <fstream>
+#include <mutex>
+#endif
+
+namespace es {
+
+struct FileReadResult;
+
+/**
+ * Input binary file which is read by positional reads, so reads of several threads can be in flight at once.
+ * NOTE: other platforms than Linux read files through std::ifstream, so reads are serialized there.
+ */
+class InputFileReader {
+ public:
+  /**
+   * Opens the file
+   * @param file_path path to file
+   */
+  explicit InputFileReader(std::string file_path);
+
+  ~InputFileReader();
+
+  InputFileReader(const InputFileReader&) = delete;
+  InputFileReader& operator=(const InputFileReader&) = delete;
+
+ public:
+  /**
+   * Reads data at an offset (thread-safe), less data is read only at the end of the file
+   * @param buffer buffer
+   * @param size size of data
+   * @param offset offset of data in the file
+   * @return reading results
+   */
+  FileReadResult read(char* buffer, std::size_t size, std::uint64_t offset);
+
+  /**
+   * Returns path to the file
+   * @return path
+   */
+  const std::string& path() const noexcept { return path_; }
+
+ private:
+  std::string path_;  ///< Path to the file
+#ifdef __linux__
+  int fd_ = -1;  ///< File descriptor
+#else
+  std::ifstream stream_;     ///< Stream of the file
+  std::mutex stream_mutex_;  ///< Mutex of reads
+#endif
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace es {
+
+class MemoryBudget;
+
+/**
+ * RAII handle of memory reserved from a memory budget. The memory is returned to the budget on destruction.
+ * NOTE: the budget must outlive all its reservations
+ */
+class MemoryReservation {
+ public:
+  MemoryReservation() = default;
+  ~MemoryReservation();
+
+  MemoryReservation(MemoryReservation&& other) noexcept;
+  MemoryReservation& operator=(MemoryReservation&& other) noexcept;
+
+  MemoryReservation(const MemoryReservation&) = delete;
+  MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+ public:
+  /**
+   * Returns the reserved memory to the budget
+   */
+  void reset() noexcept;
+
+  /**
+   * Returns a part of the reserved memory to the budget
+   * @param size new size of the reservation (not greater than the current one)
+   */
+  void shrink(std::size_t size) noexcept;
+
+  /**
+   * Returns size of the reservation
+   * @return size in bytes
+   */
+  std::size_t size() const noexcept { return size_; }
+
+ private:
+  friend class MemoryBudget;
+
+  MemoryReservation(MemoryBudget* budget, std::size_t size) noexcept : budget_{budget}, size_{size} {}
+
+ private:
+  MemoryBudget* budget_ = nullptr;  ///< Budget the memory is reserved from
+  std::size_t size_ = 0;            ///< Size of the reservation
+};
+
+/**
+ * Accounts memory of all buffers used for sorting. Every buffer allocation is preceded by a reservation, so the amount
+ * of reserved memory never exceeds the budget and each phase can plan its buffers to use all of the available memory.
+ */
+class MemoryBudget {
+ public:
+  /**
+   * Constructor
+   * @param total_size size of the budget (in bytes)
+   */
+  explicit MemoryBudget(std::size_t total_size) noexcept;
+
+  MemoryBudget(const MemoryBudget&) = delete;
+  MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+ public:
+  /**
+   * Reserves memory from the budget
+   * @param size size in bytes
+   * @return reservation
+   * @throws if the budget is exceeded
+   */
+  MemoryReservation reserve(std::size_t size);
+
+  /**
+   * Returns size of the budget
+   * @return size in bytes
+   */
+  std::size_t total() const noexcept { return total_size_; }
+
+  /**
+   * Returns amount of memory which is not reserved yet
+   * @return size in bytes
+   */
+  std::size_t available() const noexcept;
+
+  /**
+   * Returns amount of currently reserved memory
+   * @return size in bytes
+   */
+  std::size_t reserved() const noexcept;
+
+  /**
+   * Returns the maximal amount of simultaneously reserved memory
+   * @return size in bytes
+   */
+  std::size_t peakReserved() const noexcept;
+
+ private:
+  friend class MemoryReservation;
+
+  /**
+   * Returns memory to the budget
+   * @param size size in bytes
+   */
+  void release(std::size_t size) noexcept;
+
+ private:
+  std::size_t total_size_;                ///< Size of the budget
+  std::atomic_size_t reserved_size_ = 0;  ///< Currently reserved memory
+  std::atomic_size_t peak_size_ = 0;      ///< Peak of reserved memory
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,42 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <queue>
+#include <vector>
+
+namespace es {
+
+/**
+ * Class for keeping information about an intermediate chunk
+ * @tparam NumberType
+ */
+template <typename NumberType>
+struct MergeData {
+  std::size_t file_buffer_index_;  ///< index of an intermediate file buffer
+  NumberType value_;               ///< The last number from the intermediate file buffer
+};
+
+/**
+ * Greater functor
+ * @tparam NumberType
+ */
+template <typename NumberType>
+struct MergeDataComparator {
+  bool operator()(const MergeData<NumberType>& lv, const MergeData<NumberType>& rv) noexcept {
+    return lv.value_ > rv.value_;
+  }
+};
+
+/**
+ * Min heap of the last numbers of intermediate chunks which is used for merging
+ * @tparam NumberType
+ */
+template <typename NumberType>
+using merge_queue_t =
+    std::priority_queue<MergeData<NumberType>, std::vector<MergeData<NumberType>>, MergeDataComparator<NumberType>>;
+
+}  // namespace es
\ No newline at end of file
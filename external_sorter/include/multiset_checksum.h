@@ -0,0 +1,83 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace es {
+
+/**
+ * Order-independent checksum of a multiset of numbers: count of numbers and the sum of their hashes (modulo 2^64).
+ * Checksums of parts are combined by adding, so parts can be hashed by several threads in any order, and a sorted
+ * permutation of numbers has the same checksum as the numbers themselves.
+ */
+class MultisetChecksum {
+ public:
+  /**
+   * Adds numbers to the checksum
+   * @tparam NumberType type of numbers
+   * @param numbers numbers
+   * @param count count of numbers
+   */
+  template <typename NumberType>
+  void add(const NumberType* numbers, std::size_t count) noexcept {
+    auto hashes_sum = hashes_sum_;
+
+    for (std::size_t i = 0; i < count; ++i) {
+      hashes_sum += Hash(static_cast<std::uint64_t>(numbers[i]));
+    }
+
+    hashes_sum_ = hashes_sum;
+    count_ += count;
+  }
+
+  /**
+   * Adds numbers of another checksum
+   * @param other checksum
+   */
+  void add(const MultisetChecksum& other) noexcept {
+    hashes_sum_ += other.hashes_sum_;
+    count_ += other.count_;
+  }
+
+  /**
+   * Returns count of numbers
+   * @return count
+   */
+  std::uint64_t count() const noexcept { return count_; }
+
+  /**
+   * Returns the sum of hashes of numbers
+   * @return sum modulo 2^64
+   */
+  std::uint64_t hashesSum() const noexcept { return hashes_sum_; }
+
+  bool operator==(const MultisetChecksum& other) const noexcept {
+    return hashes_sum_ == other.hashes_sum_ && count_ == other.count_;
+  }
+
+  bool operator!=(const MultisetChecksum& other) const noexcept { return !(*this == other); }
+
+ private:
+  /**
+   * Mixes bits of a number (the finalizer of SplitMix64), so that sums of hashes of different multisets rarely collide
+   * @param value number
+   * @return hash
+   */
+  static std::uint64_t Hash(std::uint64_t value) noexcept {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+
+    return value ^ (value >> 31);
+  }
+
+ private:
+  std::uint64_t hashes_sum_ = 0;  ///< Sum of hashes of numbers
+  std::uint64_t count_ = 0;       ///< Count of numbers
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,190 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include "pipeline.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef __linux__
+#include <fstream>
+#include <mutex>
+#endif
+
+namespace es {
+
+/**
+ * Options of writing an output file
+ */
+struct OutputFileOptions {
+  std::uint64_t preallocation_size_ = 0;  ///< Expected size of the file which is allocated in advance (0 - none)
+  std::size_t write_behind_size_ = 0;     ///< Distance behind a write which is waited to be on disk (0 - none)
+};
+
+/**
+ * Output binary file which is written by positional writes, so writes of several threads can be in flight at once.
+ * Space for data is reserved by reserve() which returns its offset, then the data may be written at any time. Files
+ * which do not support positional writes (e.g. pipes) are written sequentially, so data has to be written in the order
+ * of reservation then.
+ * NOTE: on Linux a regular file may be preallocated (fallocate) and written back right behind writes (sync_file_range),
+ * so dirty pages do not pile up and stall writes later; other platforms write files sequentially through std::ofstream.
+ */
+class OutputFile {
+ public:
+  /**
+   * Creates (or truncates) the file
+   * @param file_path path to file
+   * @param options options of writing
+   */
+  explicit OutputFile(std::string file_path, OutputFileOptions options = {});
+
+  ~OutputFile();
+
+  OutputFile(const OutputFile&) = delete;
+  OutputFile& operator=(const OutputFile&) = delete;
+
+ public:
+  /**
+   * Reserves space at the end of the file (thread-safe)
+   * @param size size of data
+   * @return offset of data
+   */
+  std::uint64_t reserve(std::size_t size) noexcept;
+
+  /**
+   * Writes data to reserved space (thread-safe)
+   * @param buffer data
+   * @param size size of data
+   * @param offset offset returned by reserve()
+   */
+  void write(const char* buffer, std::size_t size, std::uint64_t offset);
+
+  /**
+   * Writes data at the end of the file (thread-safe)
+   * @param buffer data
+   * @param size size of data
+   */
+  void append(const char* buffer, std::size_t size) { write(buffer, size, reserve(size)); }
+
+  /**
+   * Releases preallocated space beyond the written data and closes the file. Should be called when all writes are
+   * finished.
+   */
+  void finish();
+
+  /**
+   * Checks whether writes at different offsets can be in flight at once
+   * @return true for positional writes
+   */
+  bool isPositional() const noexcept { return is_positional_; }
+
+  /**
+   * Returns path to the file
+   * @return path
+   */
+  const std::string& path() const noexcept { return path_; }
+
+ private:
+  /**
+   * Starts writeback of written data and waits for data which is write_behind_size_ behind it
+   * @param offset offset of written data
+   * @param size size of written data
+   */
+  void writeBehind(std::uint64_t offset, std::size_t size) noexcept;
+
+ private:
+  std::string path_;               ///< Path to the file
+  OutputFileOptions options_;      ///< Options of writing
+  bool is_positional_ = false;     ///< Flag of positional writes
+  std::atomic_uint64_t size_ = 0;  ///< Size of reserved space
+#ifdef __linux__
+  int fd_ = -1;  ///< File descriptor
+#else
+  std::ofstream stream_;     ///< Stream of the file
+  std::mutex stream_mutex_;  ///< Mutex of sequential writes
+#endif
+};
+
+/**
+ * Writer of numbers to an output file through a pipeline of buffers: a filled buffer is written by a thread of the
+ * thread pool while the next ones are filled, so several writes are in flight at once, and a single stalled write does
+ * not stall the writer until all buffers are busy. Files without positional writes have a single write in flight, so
+ * buffers are written in order.
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class OutputFileWriter {
+  /**
+   * Buffer of numbers which is written at its offset
+   */
+  struct Buffer {
+    std::unique_ptr<NumberType[]> numbers_;  ///< Numbers
+    std::size_t numbers_count_ = 0;          ///< Count of numbers to write
+    std::uint64_t offset_ = 0;               ///< Offset in the file
+  };
+
+ public:
+  /**
+   * Constructor
+   * @param pool thread pool
+   * @param file output file
+   * @param buffers_count count of buffers (at least one)
+   * @param buffer_numbers_count capacity of a buffer
+   */
+  OutputFileWriter(std::shared_ptr<ThreadPool> pool, OutputFile& file, std::size_t buffers_count,
+                   std::size_t buffer_numbers_count);
+
+  OutputFileWriter(const OutputFileWriter&) = delete;
+  OutputFileWriter& operator=(const OutputFileWriter&) = delete;
+
+ public:
+  /**
+   * Returns the current buffer, waits for a written one if all buffers are in flight
+   * @return buffer of bufferNumbersCount() numbers
+   */
+  NumberType* buffer();
+
+  /**
+   * Returns capacity of a buffer
+   * @return count of numbers
+   */
+  std::size_t bufferNumbersCount() const noexcept { return buffer_numbers_count_; }
+
+  /**
+   * Writes numbers of the current buffer at the end of the file in a thread of the thread pool, the next buffer becomes
+   * current
+   * @param numbers_count count of numbers at the beginning of the buffer
+   */
+  void submit(std::size_t numbers_count);
+
+  /**
+   * Waits for all writes in flight
+   */
+  void waitForWrites();
+
+  /**
+   * Returns time which the current thread spent waiting for buffers to be written
+   * @return time in nanoseconds
+   */
+  std::uint64_t waitTime() const { return pipeline_.waitTime(); }
+
+  /**
+   * Returns statistics of the stage of writing
+   * @return statistics of stages
+   */
+  std::vector<StageStats> stats() const { return pipeline_.stats(); }
+
+ private:
+  OutputFile& file_;                  ///< Output file
+  std::size_t buffer_numbers_count_;  ///< Capacity of a buffer
+  Buffer current_buffer_;             ///< The current buffer (numbers are null until it is acquired)
+  Pipeline<Buffer> pipeline_;         ///< Pipeline of writing buffers, waits for writes in flight when destroyed
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,101 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace es {
+
+/**
+ * Quantile of a sorted file
+ */
+struct OutputQuantile {
+  double quantile_ = {};      ///< Requested quantile (from 0 to 1)
+  std::uint64_t rank_ = {};   ///< Index of the number in the file (nearest rank)
+  std::uint64_t value_ = {};  ///< Number at the rank
+};
+
+/**
+ * Summary of a sorted file
+ */
+struct OutputSummary {
+  std::uint64_t numbers_count_ = {};             ///< Count of numbers
+  std::uint64_t min_ = {};                       ///< The first (minimal) number
+  std::uint64_t max_ = {};                       ///< The last (maximal) number
+  std::uint64_t distinct_count_ = {};            ///< Count of distinct numbers
+  std::vector<OutputQuantile> quantiles_;        ///< Quantiles in ascending order (if the count is known in advance)
+  std::vector<std::uint64_t> histogram_bounds_;  ///< Lower bounds of buckets of the histogram except the first one
+  std::vector<std::uint64_t> histogram_counts_;  ///< Counts of numbers of buckets (one more than bounds, if any)
+};
+
+/**
+ * Creates path to the summary of a file
+ * @param file_path path to the sorted file
+ * @return path to the summary file
+ */
+std::string CreateOutputSummaryFilePath(std::string_view file_path);
+
+/**
+ * Converts a summary to JSON, e.g. {"numbers_count":4,"min":1,"max":7,"distinct_count":3,
+ * "quantiles":[{"quantile":0.5,"rank":1,"value":2}],"histogram":{"bounds":[5],"counts":[3,1]}}
+ * @param summary summary
+ * @return JSON string
+ */
+std::string ToJson(const OutputSummary& summary);
+
+/**
+ * Writes a summary to a file as JSON
+ * @param summary summary
+ * @param file_path path to the summary file
+ * @throws if the file cannot be written
+ */
+void WriteOutputSummary(const OutputSummary& summary, std::string_view file_path);
+
+/**
+ * Computes a summary of a sorted file from its numbers in the order of the file, so it costs a comparison per number
+ * (for the distinct count) and a few binary searches per added part. Quantiles are exact: their ranks are computed in
+ * advance from the count of numbers of the file, and the numbers at the ranks are taken as they pass by. Bucket i of
+ * the histogram counts numbers in [bounds[i - 1], bounds[i]), the first one starts at 0 and the last one is unbounded.
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class OutputSummaryCollector {
+ public:
+  /**
+   * Constructor
+   * @param numbers_count count of numbers of the file (0 - unknown, quantiles are not computed then)
+   * @param quantiles requested quantiles (from 0 to 1)
+   * @param histogram_bounds bounds between buckets of the histogram (ascending, no histogram if empty)
+   * @throws if a quantile is out of range or bounds are not ascending
+   */
+  OutputSummaryCollector(std::uint64_t numbers_count, std::vector<double> quantiles,
+                         std::vector<std::uint64_t> histogram_bounds);
+
+ public:
+  /**
+   * Adds numbers which have been written to the sorted file
+   * @param numbers numbers in the order of the file
+   * @param count count of numbers
+   */
+  void add(const NumberType* numbers, std::size_t count);
+
+  /**
+   * Completes the summary when all numbers are added. Quantiles are dropped if the count of added numbers differs from
+   * the expected one, as their ranks are not exact then.
+   * @return summary
+   */
+  const OutputSummary& finish();
+
+ private:
+  std::uint64_t expected_numbers_count_;  ///< Count of numbers the ranks of quantiles are computed for
+  OutputSummary summary_;                 ///< Summary which is being computed
+  std::size_t next_quantile_index_ = 0;   ///< Index of the first quantile whose number has not passed by yet
+  std::size_t bucket_index_ = 0;          ///< Index of the bucket of the last added number
+};
+
+}  // namespace es
\ No newline at end of file
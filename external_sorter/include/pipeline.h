@@ -0,0 +1,317 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include "sort_stats.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace es {
+
+/**
+ * Pipeline of stages which process items (usually buffers) in threads of a thread pool. Every stage has a channel of
+ * items waiting for it, which may be bounded, and declared parallelism (maximal count of items processed at once). A
+ * stage does not start items while the channel of the next stage is full, so a slow stage stalls previous ones and
+ * finally the producer (backpressure). Processed items are recycled: the producer takes them back by acquire(), so the
+ * count of items bounds memory of the pipeline.
+ * If a stage throws, the exception is rethrown to the producer and other items skip the rest of stages. Tasks never
+ * throw to the thread pool, so a failed pipeline does not affect other users of the pool.
+ * @tparam Item type of items, must be movable
+ */
+template <typename Item>
+class Pipeline {
+ public:
+  /**
+   * Function of a stage, it processes an item in place
+   */
+  using stage_function_t = std::function<void(Item& item)>;
+
+  /**
+   * Constructor
+   * @param pool thread pool for executing stages
+   */
+  explicit Pipeline(std::shared_ptr<ThreadPool> pool)
+      : thread_pool_{std::move(pool)}, start_time_ns_{SteadyClockNs()} {}
+
+  /**
+   * Waits for items in flight, as their tasks refer to the pipeline
+   */
+  ~Pipeline() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cv_.wait(lock, [this]() { return items_in_flight_ == 0; });
+  }
+
+  Pipeline(const Pipeline&) = delete;
+  Pipeline& operator=(const Pipeline&) = delete;
+
+ public:
+  /**
+   * Adds a stage at the end of the pipeline, should be called before the first item is pushed
+   * @param name name of the stage (for statistics)
+   * @param parallelism maximal count of items processed at once (at least one)
+   * @param function function of the stage
+   * @param capacity maximal count of items waiting for the stage (0 - unbounded)
+   * @return the pipeline
+   */
+  Pipeline& addStage(std::string name, std::size_t parallelism, stage_function_t function, std::size_t capacity = 0) {
+    auto stage = std::make_unique<Stage>();
+    stage->name_ = std::move(name);
+    stage->parallelism_ = std::max<std::size_t>(parallelism, 1);
+    stage->capacity_ = capacity;
+    stage->function_ = std::move(function);
+
+    stages_.push_back(std::move(stage));
+
+    return *this;
+  }
+
+  /**
+   * Adds an item which is handed out by acquire()
+   * @param item item
+   */
+  void addItem(Item item) {
+    {
+      std::scoped_lock<std::mutex> lock(mutex_);
+
+      free_items_.push_back(std::move(item));
+    }
+
+    cv_.notify_all();
+  }
+
+  /**
+   * Takes a free item, waits for a processed one if all items are in flight (thread-safe)
+   * @return item
+   * @throws if a stage has failed
+   */
+  Item acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    waitFor(lock, [this]() { return !free_items_.empty(); });
+
+    auto item = std::move(free_items_.front());
+    free_items_.pop_front();
+
+    return item;
+  }
+
+  /**
+   * Pushes an item to the first stage, waits while its channel is full (thread-safe)
+   * @param item item
+   * @throws if a stage has failed
+   */
+  void push(Item item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    waitFor(lock, [this]() { return stages_.empty() || !isChannelFull(0); });
+
+    ++items_in_flight_;
+
+    forward(0, std::move(item));
+    schedule();
+  }
+
+  /**
+   * Waits until all pushed items are processed
+   * @throws if a stage has failed
+   */
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cv_.wait(lock, [this]() { return items_in_flight_ == 0; });
+
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+
+  /**
+   * Returns time which producers spent waiting for free items and room in the first channel
+   * @return time in nanoseconds
+   */
+  std::uint64_t waitTime() const {
+    std::scoped_lock<std::mutex> lock(mutex_);
+
+    return wait_time_ns_;
+  }
+
+  /**
+   * Returns statistics of stages since the pipeline was created
+   * @return statistics of every stage
+   */
+  std::vector<StageStats> stats() const {
+    std::scoped_lock<std::mutex> lock(mutex_);
+
+    std::vector<StageStats> stats;
+    stats.reserve(stages_.size());
+
+    const auto elapsed_time = SteadyClockNs() - start_time_ns_;
+
+    for (const auto& stage : stages_) {
+      stats.push_back(stage->stats_);
+      stats.back().name_ = stage->name_;
+      stats.back().parallelism_ = stage->parallelism_;
+      stats.back().elapsed_time_ns_ = elapsed_time;
+    }
+
+    return stats;
+  }
+
+ private:
+  /**
+   * Stage of the pipeline
+   */
+  struct Stage {
+    std::string name_;              ///< Name
+    std::size_t parallelism_ = 1;   ///< Maximal count of items processed at once
+    std::size_t capacity_ = 0;      ///< Maximal count of items in the channel (0 - unbounded)
+    stage_function_t function_;     ///< Function
+    std::queue<Item> channel_;      ///< Items waiting for the stage
+    std::size_t active_count_ = 0;  ///< Count of items being processed
+    StageStats stats_;              ///< Statistics (items, busy time, peak depth of the channel)
+  };
+
+  /**
+   * Waits for a condition or a failure of a stage, accounts time of waiting
+   * @tparam Predicate bool()
+   * @param lock lock of mutex_
+   * @param predicate condition
+   * @throws if a stage has failed
+   */
+  template <typename Predicate>
+  void waitFor(std::unique_lock<std::mutex>& lock, Predicate predicate) {
+    if (!exception_ && !predicate()) {
+      const auto start_time = SteadyClockNs();
+
+      cv_.wait(lock, [this, &predicate]() { return exception_ || predicate(); });
+
+      wait_time_ns_ += SteadyClockNs() - start_time;
+    }
+
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+
+  /**
+   * Checks whether the channel of a stage is full, counting items which are being processed by the previous stage
+   * @param index index of the stage
+   * @return true if no more items may be sent to the stage
+   */
+  bool isChannelFull(std::size_t index) const {
+    const auto& stage = *stages_[index];
+    const auto incoming_count = index == 0 ? 0 : stages_[index - 1]->active_count_;
+
+    return stage.capacity_ != 0 && stage.channel_.size() + incoming_count >= stage.capacity_;
+  }
+
+  /**
+   * Sends an item to the channel of a stage, or recycles it after the last stage or a failure (under lock)
+   * @param index index of the stage
+   * @param item item
+   */
+  void forward(std::size_t index, Item item) {
+    if (index == stages_.size() || exception_) {
+      free_items_.push_back(std::move(item));
+      --items_in_flight_;
+
+      return;
+    }
+
+    auto& stage = *stages_[index];
+
+    stage.channel_.push(std::move(item));
+    stage.stats_.peak_queue_depth_ = std::max<std::uint64_t>(stage.stats_.peak_queue_depth_, stage.channel_.size());
+  }
+
+  /**
+   * Starts items of all stages which have free parallelism and room in the next channel (under lock). Later stages are
+   * started first, as they make room for earlier ones.
+   */
+  void schedule() {
+    for (auto index = stages_.size(); index-- != 0;) {
+      auto& stage = *stages_[index];
+
+      while (!stage.channel_.empty() && stage.active_count_ < stage.parallelism_ &&
+             (index + 1 == stages_.size() || !isChannelFull(index + 1))) {
+        auto item = std::make_shared<Item>(std::move(stage.channel_.front()));
+        stage.channel_.pop();
+
+        ++stage.active_count_;
+
+        thread_pool_->add([this, index, item]() { process(index, *item); });
+      }
+    }
+
+    cv_.notify_all();
+  }
+
+  /**
+   * Processes an item by a stage and forwards it to the next one (in a thread of the thread pool)
+   * @param index index of the stage
+   * @param item item
+   */
+  void process(std::size_t index, Item& item) {
+    auto& stage = *stages_[index];
+    std::exception_ptr exception;
+    std::uint64_t busy_time = 0;
+
+    if (!is_failed_.load(std::memory_order_acquire)) {
+      const auto start_time = SteadyClockNs();
+
+      try {
+        stage.function_(item);
+      } catch (...) {
+        exception = std::current_exception();
+      }
+
+      busy_time = SteadyClockNs() - start_time;
+    }
+
+    // Nothing refers to the pipeline after the lock is released, as it may be destroyed right away.
+    std::scoped_lock<std::mutex> lock(mutex_);
+
+    --stage.active_count_;
+    ++stage.stats_.items_count_;
+    stage.stats_.busy_time_ns_ += busy_time;
+
+    if (exception && !exception_) {
+      exception_ = exception;
+      is_failed_.store(true, std::memory_order_release);
+    }
+
+    forward(index + 1, std::move(item));
+    schedule();
+  }
+
+ private:
+  std::shared_ptr<ThreadPool> thread_pool_;     ///< Thread pool for executing stages
+  std::vector<std::unique_ptr<Stage>> stages_;  ///< Stages
+  std::deque<Item> free_items_;                 ///< Items which may be acquired
+  std::size_t items_in_flight_ = 0;             ///< Count of pushed items which are not recycled yet
+  std::exception_ptr exception_;                ///< The first exception thrown by a stage
+  std::atomic_bool is_failed_ = false;          ///< Flag of a failed stage (for skipping stages without lock)
+  std::uint64_t start_time_ns_;                 ///< Time of creation
+  std::uint64_t wait_time_ns_ = 0;              ///< Time of waiting of producers
+  mutable std::mutex mutex_;                    ///< Mutex of channels, items and statistics
+  std::condition_variable cv_;                  ///< Notifies about recycled items, room in channels and failures
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,74 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace es {
+
+/**
+ * Sorts unsigned numbers with LSD radix sort (one byte per pass). Passes in which all numbers have the same byte are
+ * skipped, so narrow ranges of values are sorted with fewer passes.
+ * @tparam NumberType type of numbers
+ * @param begin beginning of the range
+ * @param end end of the range
+ * @param scratch buffer for at least (end - begin) numbers
+ */
+template <typename NumberType>
+void RadixSort(NumberType* begin, NumberType* end, NumberType* scratch) {
+  static_assert(std::is_unsigned_v<NumberType>, "Radix sort supports only unsigned numbers");
+
+  constexpr std::size_t kDigitBits = 8;
+  constexpr std::size_t kBucketsCount = std::size_t{1} << kDigitBits;
+  constexpr std::size_t kPassesCount = sizeof(NumberType);
+
+  const auto count = static_cast<std::size_t>(end - begin);
+
+  if (count < 2) {
+    return;
+  }
+
+  // histograms of all passes are built with a single read of the range
+  std::array<std::array<std::size_t, kBucketsCount>, kPassesCount> histograms{};
+
+  for (auto* number = begin; number != end; ++number) {
+    for (std::size_t pass = 0; pass < kPassesCount; ++pass) {
+      ++histograms[pass][(*number >> (pass * kDigitBits)) & (kBucketsCount - 1)];
+    }
+  }
+
+  NumberType* source = begin;
+  NumberType* destination = scratch;
+
+  for (std::size_t pass = 0; pass < kPassesCount; ++pass) {
+    auto& histogram = histograms[pass];
+    const auto shift = pass * kDigitBits;
+
+    if (histogram[(*source >> shift) & (kBucketsCount - 1)] == count) {
+      continue;
+    }
+
+    std::size_t offset = 0;
+    for (auto& bucket : histogram) {
+      offset += std::exchange(bucket, offset);
+    }
+
+    for (auto* number = source; number != source + count; ++number) {
+      destination[histogram[(*number >> shift) & (kBucketsCount - 1)]++] = *number;
+    }
+
+    std::swap(source, destination);
+  }
+
+  if (source != begin) {
+    std::copy(source, source + count, begin);
+  }
+}
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,110 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace es {
+
+/**
+ * Share of the memory limit which is used by the memory pressure monitor as the threshold
+ */
+const double kMemoryPressureThreshold = 0.9;
+
+/**
+ * Minimal interval between checks of memory usage by the memory pressure monitor (in nanoseconds)
+ */
+const std::uint64_t kMemoryPressureCheckInterval = 100 * 1000 * 1000;
+
+/**
+ * Resources available to the process. In a container the limits of its cgroup (v2) are taken, as the hardware of the
+ * host is usually much larger: the strictest memory.max and cpu.max of the cgroup and its ancestors.
+ */
+struct ResourceLimits {
+  std::size_t memory_limit_ = 0;    ///< memory.max of the cgroup or MemAvailable of the system (0 - unknown)
+  std::size_t memory_usage_ = 0;    ///< Working set of the cgroup with the memory limit (0 - there is no limit)
+  std::size_t cpus_count_ = 1;      ///< CPUs the process may run on limited by the CPU quota (at least one)
+  std::string memory_cgroup_path_;  ///< Directory of the cgroup with the memory limit (empty - there is no limit)
+};
+
+/**
+ * Detects resources available to the process: limits of its cgroup (v2) if there are any, otherwise MemAvailable of
+ * /proc/meminfo and the CPU affinity of the process (the hardware concurrency on other platforms)
+ * @return limits
+ */
+ResourceLimits DetectResourceLimits();
+
+/**
+ * Reads limits of a cgroup (v2) and its ancestors up to the root of the hierarchy
+ * @param cgroup_root_path root of the hierarchy, e.g. "/sys/fs/cgroup"
+ * @param cgroup_path path to the cgroup relative to the root as in /proc/self/cgroup, e.g. "/user.slice/job"
+ * @param cpus_count count of CPUs the process may run on, it is limited by quotas of cgroups
+ * @param available_memory memory which is reported if no cgroup limits memory (0 - unknown)
+ * @return limits
+ */
+ResourceLimits ReadCgroupLimits(std::string_view cgroup_root_path, std::string_view cgroup_path,
+                                std::size_t cpus_count, std::size_t available_memory);
+
+/**
+ * Reads the working set of a cgroup: memory.current without inactive file pages of memory.stat, which the kernel
+ * reclaims before hitting the limit (e.g. pages of written intermediate files)
+ * @param cgroup_directory_path directory of the cgroup
+ * @return size in bytes (0 if it cannot be read)
+ */
+std::size_t ReadCgroupMemoryUsage(std::string_view cgroup_directory_path);
+
+/**
+ * Calculates a memory budget of sorting for limits: three quarters of memory which is not used yet, the rest is left
+ * for the page cache, stacks of threads and allocations outside of the budget
+ * @param limits limits
+ * @return size in bytes (0 if available memory is unknown)
+ */
+std::size_t CalcAutoMemorySize(const ResourceLimits& limits) noexcept;
+
+/**
+ * Watches the working set of a cgroup, so that long merges can shrink their buffers before the cgroup hits its memory
+ * limit (e.g. when other processes of a container grow). The usage is read at most once per interval, so the monitor
+ * may be checked for every merged buffer.
+ */
+class MemoryPressureMonitor {
+ public:
+  /**
+   * Constructor
+   * @param cgroup_directory_path directory of the cgroup with the memory limit
+   * @param memory_limit memory limit of the cgroup
+   * @param threshold share of the limit which is considered as pressure
+   * @param check_interval_ns minimal interval between reads of the usage
+   */
+  MemoryPressureMonitor(std::string cgroup_directory_path, std::size_t memory_limit,
+                        double threshold = kMemoryPressureThreshold,
+                        std::uint64_t check_interval_ns = kMemoryPressureCheckInterval);
+
+ public:
+  /**
+   * Checks whether the working set of the cgroup exceeds the threshold (thread-safe)
+   * @return true if the usage has been read and exceeds the threshold, false if it is lower or the interval is not over
+   */
+  bool check();
+
+ private:
+  std::string cgroup_directory_path_;   ///< Directory of the cgroup
+  std::size_t threshold_size_;          ///< Working set which is considered as pressure
+  std::uint64_t check_interval_ns_;     ///< Minimal interval between reads of the usage
+  std::uint64_t last_check_time_ns_{};  ///< Time of the last read of the usage (0 - never)
+  std::mutex mutex_;                    ///< Mutex of the time of the last read
+};
+
+/**
+ * Creates a memory pressure monitor of the cgroup which limits memory of the process
+ * @return monitor or null if no cgroup (v2) limits memory of the process
+ */
+std::shared_ptr<MemoryPressureMonitor> CreateMemoryPressureMonitor();
+
+}  // namespace es
\ No newline at end of file
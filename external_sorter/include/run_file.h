@@ -0,0 +1,165 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include "multiset_checksum.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace es {
+
+class OutputFile;
+
+/**
+ * Default size of a block of a run file (in bytes)
+ */
+const std::size_t kRunFileBlockSize = 256 * 1024;
+
+/**
+ * Entry of the index of a run file which describes a block
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+struct RunFileBlock {
+  NumberType min_ = {};          ///< The first (minimal) number of the block
+  NumberType max_ = {};          ///< The last (maximal) number of the block
+  std::uint64_t checksum_ = {};  ///< Sum of hashes of numbers of the block (MultisetChecksum::hashesSum())
+};
+
+/**
+ * Writes a sorted run file: a header, numbers split into fixed-size blocks and a footer index with the first and the
+ * last numbers and the checksum of every block. Numbers are written by the caller right after the header (at offsets
+ * reserved from the file after the writer is created, e.g. by OutputFileWriter) and are passed to add() in the order
+ * of the file, so the writer needs memory only for the index.
+ *
+ * Run file format (native byte order): magic "ESRUN001", size of a number (uint32), kind of numbers (uint32: 0 -
+ * unsigned, 1 - signed, 2 - floating point), version (uint32), sort order (uint32: 0 - ascending), block size in bytes
+ * (uint64), count of numbers (uint64), count of blocks (uint64), offset of the index (uint64), then numbers, then
+ * blocks of the index: min and max numbers, checksum (uint64). The header is written last, so an incomplete file is
+ * never taken for a valid one.
+ *
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class RunFileWriter {
+ public:
+  /**
+   * Constructor, reserves the header at the beginning of the file
+   * @param file empty output file
+   * @param block_size size of a block in bytes (rounded down to count of numbers, at least one number)
+   */
+  explicit RunFileWriter(OutputFile& file, std::size_t block_size = kRunFileBlockSize);
+
+ public:
+  /**
+   * Adds numbers which have been (or are being) written to the file
+   * @param numbers numbers in the order of the file
+   * @param count count of numbers
+   */
+  void add(const NumberType* numbers, std::size_t count);
+
+  /**
+   * Appends the index and writes the header, should be called when all numbers are written
+   */
+  void finish();
+
+ private:
+  OutputFile& file_;                              ///< Run file
+  std::uint64_t block_numbers_count_;             ///< Count of numbers of a complete block
+  std::uint64_t numbers_count_ = 0;               ///< Count of added numbers
+  std::vector<RunFileBlock<NumberType>> blocks_;  ///< Index of complete blocks
+  RunFileBlock<NumberType> current_block_;        ///< Block which is being filled
+  MultisetChecksum current_block_checksum_;       ///< Checksum of the block which is being filled
+};
+
+/**
+ * Reads numbers of a run file sequentially and verifies every block against the index when the block is over, so a
+ * corrupted block (e.g. bit rot on a spill disk) is reported before the numbers after it are read. The index is kept
+ * in memory: it allows to find the block which may contain a number (splitters of a merge, skipping blocks of range and
+ * top-K queries) and to start reading from it.
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class RunFileReader {
+ public:
+  /**
+   * Opens a run file and loads its header and index, the next read starts at the first block
+   * @param file_path path to file
+   * @throws if the file cannot be read or has a wrong format
+   */
+  explicit RunFileReader(std::string_view file_path);
+
+ public:
+  /**
+   * Returns blocks of the file
+   * @return blocks
+   */
+  const std::vector<RunFileBlock<NumberType>>& blocks() const noexcept { return blocks_; }
+
+  /**
+   * Returns count of numbers in the file
+   * @return count
+   */
+  std::uint64_t numbersCount() const noexcept { return numbers_count_; }
+
+  /**
+   * Returns count of numbers of a complete block
+   * @return count
+   */
+  std::uint64_t blockNumbersCount() const noexcept { return block_numbers_count_; }
+
+  /**
+   * Returns memory of the index
+   * @return size in bytes
+   */
+  std::size_t indexMemorySize() const noexcept { return blocks_.size() * sizeof(RunFileBlock<NumberType>); }
+
+  /**
+   * Finds the first block which may contain numbers not less than a number (binary search in memory)
+   * @param number number
+   * @return index of the block (count of blocks if all numbers are less)
+   */
+  std::size_t findBlock(NumberType number) const noexcept;
+
+  /**
+   * Makes the next read start at a block
+   * @param block_index index of the block (count of blocks - the end of the file)
+   */
+  void seekBlock(std::size_t block_index);
+
+  /**
+   * Reads the next numbers and verifies blocks which are over
+   * @param numbers buffer for numbers
+   * @param count maximal count of numbers to read
+   * @return count of read numbers (0 at the end of the file)
+   * @throws if the file cannot be read or a block is corrupted
+   */
+  std::size_t read(NumberType* numbers, std::size_t count);
+
+ private:
+  /**
+   * Verifies read numbers against the index
+   * @param numbers numbers in the order of the file
+   * @param count count of numbers
+   * @throws if a block is corrupted
+   */
+  void verify(const NumberType* numbers, std::size_t count);
+
+ private:
+  std::string file_path_;                         ///< Path to file
+  std::ifstream stream_;                          ///< Stream of file
+  std::uint64_t block_numbers_count_ = 0;         ///< Count of numbers of a complete block
+  std::uint64_t numbers_count_ = 0;               ///< Count of numbers in the file
+  std::vector<RunFileBlock<NumberType>> blocks_;  ///< Index of blocks
+  std::uint64_t position_ = 0;                    ///< Index of the next number to read
+  std::uint64_t block_position_ = 0;              ///< Count of read numbers of the current block
+  MultisetChecksum block_checksum_;               ///< Checksum of read numbers of the current block
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+namespace es {
+
+/**
+ * Phase of sorting
+ */
+enum class SortPhase {
+  kNotStarted,     ///< sort() has not been called yet
+  kRunGeneration,  ///< Creating sorted chunks (partitioning to buckets for the distribution sort)
+  kMerge,          ///< Merging sorted chunks (sorting buckets for the distribution sort)
+  kFinished,       ///< Sorting is over (successfully or not)
+};
+
+/**
+ * Progress of sorting which is returned by ExternalSorter::progress(). Processed bytes are bytes of input read and
+ * bytes of output written, so the total is twice the size of input files and the remaining time is estimated by the
+ * average rate since the start.
+ */
+struct SortProgress {
+  SortPhase phase_ = SortPhase::kNotStarted;  ///< Current phase
+  std::uint64_t bytes_processed_ = {};        ///< Bytes of input read and output written
+  std::uint64_t bytes_total_ = {};            ///< Bytes to process (0 - unknown, as some input is not a regular file)
+  std::uint64_t elapsed_time_ns_ = {};        ///< Time since the start of sorting
+  std::uint64_t remaining_time_ns_ = {};      ///< Estimated remaining time (0 - unknown or sorting is over)
+};
+
+/**
+ * Exception which is thrown by ExternalSorter::sort() when sorting is cancelled
+ */
+class SortCancelledException : public std::runtime_error {
+ public:
+  SortCancelledException() : std::runtime_error{"Sorting is cancelled"} {}
+};
+
+/**
+ * Token for cooperative cancellation of sorting: any thread may cancel it, a sorter checks it at boundaries of chunks,
+ * merged buffers and loads of file buffers and throws SortCancelledException then.
+ */
+class CancellationToken {
+ public:
+  /**
+   * Requests cancellation (thread-safe)
+   */
+  void cancel() noexcept { is_cancelled_.store(true, std::memory_order_relaxed); }
+
+  /**
+   * Checks whether cancellation is requested (thread-safe)
+   * @return true if it is requested
+   */
+  bool isCancelled() const noexcept { return is_cancelled_.load(std::memory_order_relaxed); }
+
+  /**
+   * Throws if cancellation is requested
+   * @throws SortCancelledException
+   */
+  void throwIfCancelled() const {
+    if (isCancelled()) {
+      throw SortCancelledException{};
+    }
+  }
+
+ private:
+  std::atomic_bool is_cancelled_ = false;  ///< Flag of requested cancellation
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,159 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include "external_sorter.h"
+#include "memory_budget.h"
+#include "sort_stats.h"
+#include "sorter_options.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace es {
+
+class ThreadPool;
+
+/**
+ * Sorting job of a sort service
+ */
+struct SortJob {
+  std::vector<InputFile> input_files_;  ///< Input files
+  std::string output_directory_path_;   ///< Path to output directory
+  SorterOptions options_;               ///< Options of the sorter (the intermediate directory is set by the service)
+};
+
+/**
+ * Options of a sort service
+ */
+struct SortServiceOptions {
+  std::size_t memory_size_ = 0;                         ///< Memory shared by all jobs (in bytes)
+  std::size_t max_active_jobs_count_ = 0;               ///< Jobs sorted at once (0 - per thread of the pool)
+  std::size_t min_job_memory_size_ = 16 * 1024 * 1024;  ///< Memory a job waits for in the queue (unless it is alone)
+};
+
+/**
+ * Sorts many jobs concurrently by one thread pool and one memory budget. Submitted jobs wait in a queue (in the order
+ * of submission) for a free job slot and enough memory. A started job reserves a share of the global memory budget:
+ * the available memory divided between the started job and the jobs which may start next (the queued jobs limited by
+ * free slots), so a lone job gets all memory and a burst of jobs gets equal shares. The reservation is returned when
+ * the job is over, so memory of short jobs goes to the queued ones.
+ * Every job is sorted by its own ExternalSorter in a slot thread: tasks of the job belong to its task group of the
+ * pool, which serves groups in turn, so a big job does not starve small ones, and a failure of a job does not affect
+ * others. Intermediate files of every job are written to its own directory ("intermediate_<service>_<job>"), which is
+ * removed when the job is over, so jobs may share the output and spill directories.
+ * NOTE: statistics of the thread pool in statistics of a job include tasks of other jobs
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class SortService {
+ public:
+  /**
+   * Constructor, starts slot threads
+   * @param pool thread pool shared by jobs
+   * @param options options
+   */
+  SortService(std::shared_ptr<ThreadPool> pool, SortServiceOptions options);
+
+  /**
+   * Sorts all submitted jobs and stops slot threads
+   */
+  ~SortService();
+
+  SortService(const SortService&) = delete;
+  SortService& operator=(const SortService&) = delete;
+
+ public:
+  /**
+   * Adds a job to the queue (thread-safe)
+   * @param job job
+   * @return statistics of the job when it is sorted, or its exception (e.g. if there is not enough memory)
+   */
+  std::future<SortStats> submit(SortJob job);
+
+  /**
+   * Adds jobs to the queue at once (thread-safe), so they share memory as a burst
+   * @param jobs jobs
+   * @return results of jobs in the order of jobs
+   */
+  std::vector<std::future<SortStats>> submit(std::vector<SortJob> jobs);
+
+  /**
+   * Returns count of jobs which wait in the queue
+   * @return count
+   */
+  std::size_t queuedJobsCount() const;
+
+  /**
+   * Returns count of jobs which are being sorted
+   * @return count
+   */
+  std::size_t activeJobsCount() const;
+
+  /**
+   * Returns the maximal count of simultaneously sorted jobs
+   * @return count
+   */
+  std::size_t peakActiveJobsCount() const;
+
+  /**
+   * Returns the global memory budget, e.g. for inspecting memory reserved by active jobs
+   * @return memory budget
+   */
+  const MemoryBudget& memoryBudget() const noexcept { return memory_budget_; }
+
+ private:
+  /**
+   * Queued job
+   */
+  struct QueuedJob {
+    SortJob job_;                     ///< Job
+    std::uint64_t id_ = 0;            ///< Identifier of the job in the service
+    std::promise<SortStats> result_;  ///< Statistics or exception of the job
+  };
+
+  /**
+   * Takes queued jobs while the service is not stopped (in a slot thread)
+   */
+  void runSlot();
+
+  /**
+   * Calculates memory of the next job (under lock)
+   * @return size in bytes or 0 if the job has to wait for memory
+   */
+  std::size_t calcJobMemorySize() const;
+
+  /**
+   * Sorts a job in the current thread
+   * @param queued_job job
+   * @param memory_size memory of the job
+   */
+  void sortJob(QueuedJob& queued_job, std::size_t memory_size);
+
+ private:
+  std::shared_ptr<ThreadPool> thread_pool_;  ///< Thread pool shared by jobs
+  SortServiceOptions options_;               ///< Options
+  MemoryBudget memory_budget_;               ///< Memory shared by jobs
+  std::string name_;                         ///< Unique name of the service in names of intermediate directories
+  std::size_t slots_count_;                  ///< Count of slot threads (maximal count of active jobs)
+
+  std::deque<QueuedJob> queue_;             ///< Queued jobs
+  std::uint64_t next_job_id_ = 0;           ///< Identifier of the next submitted job
+  std::size_t active_jobs_count_ = 0;       ///< Count of jobs which are being sorted
+  std::size_t peak_active_jobs_count_ = 0;  ///< Maximal count of simultaneously sorted jobs
+  bool is_stopped_ = false;                 ///< Flag for stopping slot threads when the queue is empty
+  mutable std::mutex mutex_;                ///< Mutex of the queue and the counters
+  std::condition_variable cv_;              ///< Notifies about queued jobs, finished jobs and stopping
+  std::vector<std::thread> slots_;          ///< Slot threads sorting jobs
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,157 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace es {
+
+/**
+ * Statistics of a sorting phase
+ */
+struct PhaseStats {
+  std::uint64_t wall_time_ns_ = {};  ///< Elapsed time
+  std::uint64_t cpu_time_ns_ = {};   ///< CPU time of all threads of the process
+};
+
+/**
+ * Statistics of I/O operations with a class of files
+ */
+struct IoStats {
+  std::uint64_t bytes_read_ = {};     ///< Amount of read bytes
+  std::uint64_t bytes_written_ = {};  ///< Amount of written bytes
+};
+
+/**
+ * Statistics of a stage of pipelines with the same name. Utilization of the stage is busy time divided by elapsed time
+ * multiplied by parallelism.
+ */
+struct StageStats {
+  std::string name_;                     ///< Name of the stage
+  std::size_t parallelism_ = {};         ///< Maximal count of items processed at once
+  std::uint64_t items_count_ = {};       ///< Count of processed items
+  std::uint64_t busy_time_ns_ = {};      ///< Time of processing items by all threads
+  std::uint64_t elapsed_time_ns_ = {};   ///< Lifetime of pipelines with the stage
+  std::uint64_t peak_queue_depth_ = {};  ///< Maximal count of items waiting for the stage
+};
+
+/**
+ * Statistics of sorting which is filled in by ExternalSorter::sort()
+ */
+struct SortStats {
+  PhaseStats total_;           ///< Whole sorting
+  PhaseStats run_generation_;  ///< Creating sorted chunks (partitioning to buckets for the distribution sort)
+  PhaseStats merge_;           ///< Merging sorted chunks (sorting buckets for the distribution sort)
+
+  IoStats input_;         ///< Input file
+  IoStats intermediate_;  ///< Intermediate files
+  IoStats output_;        ///< Output file
+
+  std::uint64_t runs_count_ = {};             ///< Count of sorted chunks (or top-level buckets)
+  std::uint64_t merge_passes_count_ = {};     ///< Count of merge passes
+  std::uint64_t compactions_count_ = {};      ///< Count of merges of runs by background compaction
+  std::uint64_t resident_runs_count_ = {};    ///< Count of runs which are merged from memory without spilling
+  std::uint64_t compressed_runs_count_ = {};  ///< Count of resident runs which are kept compressed
+  std::uint64_t compressed_runs_size_ = {};   ///< Total size of compressed runs
+  std::uint64_t evicted_runs_count_ = {};     ///< Count of compressed runs spilled to make room for others
+  std::uint64_t counted_values_count_ = {};   ///< Count of distinct values of the counting strategy (0 - not counted)
+
+  std::uint64_t chunk_buffer_wait_time_ns_ = {};      ///< Time of waiting for a free chunk buffer while reading input
+  std::uint64_t file_buffer_wait_time_ns_ = {};       ///< Time blocked in BinaryFileBuffer::waitForBuffer()
+  std::uint64_t merge_buffer_wait_time_ns_ = {};      ///< Time of waiting for a merge buffer to be written
+  std::uint64_t memory_pressure_shrinks_count_ = {};  ///< Count of shrinks of merge file buffers under memory pressure
+
+  std::uint64_t pool_tasks_count_ = {};       ///< Count of tasks added to the thread pool
+  std::uint64_t pool_busy_time_ns_ = {};      ///< Time of executing tasks by all threads of the thread pool
+  std::uint64_t pool_wait_time_ns_ = {};      ///< Time blocked in ThreadPool::waitForTask()
+  double pool_average_queue_depth_ = {};      ///< Average depth of the thread pool queue when adding a task
+  std::uint64_t pool_peak_queue_depth_ = {};  ///< Maximal depth of the thread pool queue (since its creation)
+  std::uint64_t peak_reserved_memory_ = {};   ///< Maximal amount of reserved memory
+
+  std::vector<StageStats> stages_;  ///< Stages of pipelines of run generation and merging
+};
+
+/**
+ * Serializes statistics to JSON
+ * @param stats statistics
+ * @return JSON object
+ */
+std::string ToJson(const SortStats& stats);
+
+/**
+ * Formats statistics as a human-readable report (one value per line)
+ * @param stats statistics
+ * @return report
+ */
+std::string ToText(const SortStats& stats);
+
+/**
+ * Counters which are updated while sorting
+ */
+enum class StatsCounter : std::size_t {
+  kInputBytesRead,
+  kIntermediateBytesWritten,
+  kIntermediateBytesRead,
+  kOutputBytesWritten,
+  kChunkBufferWaitTime,
+  kFileBufferWaitTime,
+  kMergeBufferWaitTime,
+  kMemoryPressureShrinks,
+  kCount
+};
+
+/**
+ * Set of counters which are updated by many threads. Every thread of a thread pool updates its own cache line (other
+ * threads share the last one), so updates are cheap; values are summed up when requested.
+ */
+class StatsCounters {
+  enum : std::size_t { kCountersCount = static_cast<std::size_t>(StatsCounter::kCount) };
+
+  /**
+   * Counters of a thread
+   */
+  struct alignas(64) Slot {
+    std::array<std::atomic_uint64_t, kCountersCount> values_ = {};
+  };
+
+ public:
+  /**
+   * Constructor
+   * @param threads_count count of threads in the thread pool
+   */
+  explicit StatsCounters(std::size_t threads_count);
+
+ public:
+  /**
+   * Adds a value to a counter of the current thread
+   * @param counter counter
+   * @param value value
+   */
+  void add(StatsCounter counter, std::uint64_t value) noexcept;
+
+  /**
+   * Sums up a counter of all threads
+   * @param counter counter
+   * @return value
+   */
+  std::uint64_t sum(StatsCounter counter) const noexcept;
+
+  /**
+   * Resets a counter of all threads (while no thread updates it), e.g. when the counted work is discarded
+   * @param counter counter
+   */
+  void reset(StatsCounter counter) noexcept;
+
+ private:
+  std::size_t slots_count_;        ///< Count of slots (threads of the thread pool and one for other threads)
+  std::unique_ptr<Slot[]> slots_;  ///< Slots of counters
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace es {
+
+class CancellationToken;
+class MemoryPressureMonitor;
+
+/**
+ * Policy of placing intermediate files to spill directories
+ */
+enum class SpillPlacement {
+  kRoundRobin,     ///< Intermediate files are distributed between spill directories one by one
+  kMostFreeSpace,  ///< Intermediate file is written to the spill directory with the most free space
+};
+
+/**
+ * Algorithm of sorting chunks in memory
+ */
+enum class SortEngine {
+  kIntroSort,     ///< std::sort, works in place
+  kRadixSort,     ///< LSD radix sort, needs a scratch buffer of the chunk size
+  kCountingSort,  ///< Counts values of a chunk by a small hash table, introsort if there are too many distinct values
+};
+
+/**
+ * Strategy of external sorting
+ */
+enum class SortStrategy {
+  kMerge,         ///< Sorted chunks are merged with a k-way merge
+  kDistribution,  ///< Input is partitioned to buckets by sampled splitters, buckets are sorted in parallel
+  kCounting,      ///< Values are counted by tables (see CountingTable) if a sample shows few of them, otherwise merge
+};
+
+/**
+ * Additional options of ExternalSorter
+ */
+struct SorterOptions {
+  std::vector<std::string> spill_directories_ = {};               ///< Directories for intermediate files (or output)
+  SpillPlacement spill_placement_ = SpillPlacement::kRoundRobin;  ///< Policy of placing intermediate files
+  std::string intermediate_directory_name_ = "intermediate";      ///< Subdirectory of spill directories for chunks
+  std::string output_file_name_ = "output";                       ///< Name of the output file in the output directory
+
+  SortStrategy sort_strategy_ = SortStrategy::kMerge;  ///< Merge for irregular, sorted or base inputs and argsort
+  SortEngine sort_engine_ = SortEngine::kIntroSort;    ///< Algorithm of sorting chunks
+  std::size_t merge_fan_in_ = 0;                       ///< Maximal count of merged files (0 - by memory)
+  bool numa_local_buffers_ = false;                    ///< Sort chunks in threads owning their buffers
+  bool parallel_input_reads_ = false;                  ///< Chunk tasks read their slices of regular inputs
+  std::size_t input_readers_count_ = 0;                ///< Threads reading input files (0 - one per device)
+  bool background_compaction_ = false;                 ///< Merge runs while input is still being read
+  bool compressed_runs_ = false;                       ///< Keep chunks compressed in half of memory, spill the largest
+  std::string base_file_path_ = {};                    ///< Sorted file merged as a run with the input (incremental)
+
+  std::size_t sparse_index_block_size_ = 0;                   ///< Block of "<output>.index" (0 - no index)
+  bool output_summary_ = false;                               ///< Write "<output>.summary" (see OutputSummaryCollector)
+  std::vector<double> summary_quantiles_ = {};                ///< Exact quantiles of the summary (from 0 to 1)
+  std::vector<std::uint64_t> summary_histogram_bounds_ = {};  ///< Bounds between buckets of the summary histogram
+
+  bool verify_ = false;                   ///< sort() throws if output is not sorted or not the input multiset
+  std::size_t output_buffers_count_ = 4;  ///< Merged buffers in flight (ring of positional writes)
+  bool preallocate_files_ = false;        ///< Preallocate output, chunks and runs of known sizes (Linux)
+  std::size_t write_behind_size_ = 0;     ///< Writeback lag of written files (0 - by kernel, Linux)
+  bool argsort_ = false;                  ///< Output stable indices of sorted keys (argsort_number_t only)
+  bool argsort_values_ = false;           ///< Write sorted keys to "<output>.values" (argsort)
+
+  std::shared_ptr<const CancellationToken> cancellation_token_;  ///< Cancels sort() at a chunk or buffer (may be null)
+  std::shared_ptr<MemoryPressureMonitor> memory_monitor_;        ///< Merges halve buffers under pressure (may be null)
+};
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,146 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace es {
+
+/**
+ * Block of a sorted file described by a sparse index
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+struct SparseIndexBlock {
+  std::uint64_t offset_ = {};  ///< Offset of the block in the file (in bytes)
+  std::uint64_t count_ = {};   ///< Count of numbers in the block
+  NumberType min_ = {};        ///< The first (minimal) number of the block
+  NumberType max_ = {};        ///< The last (maximal) number of the block
+};
+
+/**
+ * Range of bytes of a file
+ */
+struct ByteRange {
+  std::uint64_t begin_ = {};  ///< Offset of the first byte
+  std::uint64_t end_ = {};    ///< Offset after the last byte
+};
+
+/**
+ * Creates path to the sparse index of a file
+ * @param file_path path to the sorted file
+ * @return path to the index file
+ */
+std::string CreateSparseIndexFilePath(std::string_view file_path);
+
+/**
+ * Writes a sparse index of a sorted file while the file is written: every block of the file gets an entry with its
+ * offset, count of numbers and the first and the last numbers. Entries are appended to the index file as soon as their
+ * blocks are complete, so the writer needs constant memory.
+ *
+ * Index file format (native byte order): magic "ESSPIDX1", size of a number (uint32), version (uint32), block size in
+ * bytes (uint64), count of numbers (uint64), count of blocks (uint64), then blocks: offset (uint64), count (uint64),
+ * min and max numbers.
+ *
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class SparseIndexWriter {
+ public:
+  /**
+   * Constructor
+   * @param index_file_path path to index file
+   * @param block_size size of a block in bytes (rounded down to count of numbers, at least one number)
+   */
+  SparseIndexWriter(std::string index_file_path, std::size_t block_size);
+
+ public:
+  /**
+   * Adds numbers which have been written to the sorted file
+   * @param numbers numbers in the order of the file
+   * @param count count of numbers
+   */
+  void add(const NumberType* numbers, std::size_t count);
+
+  /**
+   * Writes the last block and the header of the index
+   */
+  void finish();
+
+ private:
+  /**
+   * Writes an entry of a block
+   * @param block block
+   */
+  void writeBlock(const SparseIndexBlock<NumberType>& block);
+
+  /**
+   * Writes the header of the index
+   */
+  void writeHeader();
+
+ private:
+  std::string index_file_path_;                 ///< Path to index file
+  std::ofstream stream_;                        ///< Stream of index file
+  std::uint64_t block_numbers_count_;           ///< Count of numbers of a complete block
+  std::uint64_t numbers_count_ = 0;             ///< Count of added numbers
+  std::uint64_t blocks_count_ = 0;              ///< Count of written blocks
+  SparseIndexBlock<NumberType> current_block_;  ///< Block which is being filled
+};
+
+/**
+ * Sparse index of a sorted file which resolves ranges of numbers to ranges of bytes of the file
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class SparseIndex {
+ public:
+  /**
+   * Loads an index file
+   * @param index_file_path path to index file
+   * @throws if the file cannot be read or has a wrong format
+   */
+  explicit SparseIndex(std::string_view index_file_path);
+
+ public:
+  /**
+   * Returns blocks of the indexed file
+   * @return blocks
+   */
+  const std::vector<SparseIndexBlock<NumberType>>& blocks() const noexcept { return blocks_; }
+
+  /**
+   * Returns count of numbers in the indexed file
+   * @return count
+   */
+  std::uint64_t numbersCount() const noexcept { return numbers_count_; }
+
+  /**
+   * Finds bytes of the indexed file which contain all numbers from a range (binary search in memory)
+   * @param min minimal number of the range
+   * @param max maximal number of the range
+   * @return range of bytes (empty if there are no such numbers)
+   */
+  ByteRange find(NumberType min, NumberType max) const noexcept;
+
+  /**
+   * Reads numbers of a range from the indexed file with a single read
+   * @param file_path path to the indexed file
+   * @param min minimal number of the range
+   * @param max maximal number of the range
+   * @return sorted numbers
+   */
+  std::vector<NumberType> read(std::string_view file_path, NumberType min, NumberType max) const;
+
+ private:
+  std::uint64_t numbers_count_ = 0;                   ///< Count of numbers in the indexed file
+  std::vector<SparseIndexBlock<NumberType>> blocks_;  ///< Blocks of the indexed file
+};
+
+}  // namespace es
\ No newline at end of file
@@ -4,12 +4,17 @@
 
 #pragma once
 
+#include "cpu_topology.h"
 #include "defines.h"
 
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <exception>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
@@ -22,8 +27,37 @@ namespace es {
  */
 using task_t = std::function<void()>;
 
+/**
+ * Identifier of a group of tasks of a thread pool
+ */
+using task_group_t = std::size_t;
+
+/**
+ * Cumulative statistics of a thread pool since its creation
+ */
+struct ThreadPoolStats {
+  std::uint64_t tasks_count_ = {};       ///< Count of added tasks
+  std::uint64_t busy_time_ns_ = {};      ///< Total time of executing tasks by all threads
+  std::uint64_t wait_time_ns_ = {};      ///< Total time spent blocked in waitForTask()
+  std::uint64_t queue_depth_sum_ = {};   ///< Sum of queue depths observed when adding tasks
+  std::uint64_t peak_queue_depth_ = {};  ///< Maximal queue depth
+};
+
+/**
+ * Options of a thread pool
+ */
+struct ThreadPoolOptions {
+  std::size_t threads_count_ = 0;                 ///< Count of threads (0 - per available CPU except the current one)
+  ThreadPinning pinning_ = ThreadPinning::kNone;  ///< Policy of pinning threads to CPUs
+  std::vector<unsigned int> cpus_ = {};           ///< CPUs for ThreadPinning::kExplicit (assigned one by one)
+};
+
 /**
  * Thread pool
+ * Tasks belong to task groups (e.g. a group per job sharing the pool): a task is added to the group of the current
+ * thread, which is set by TaskGroupScope and is the group of the task for threads of the pool, so tasks added by tasks
+ * stay in their group. Threads take tasks from groups in turn, so a group with a long queue does not delay others. The
+ * exception and pending tasks are tracked per group, so a failed job does not affect other jobs.
  */
 class ThreadPool {
   /**
@@ -33,59 +67,184 @@ class ThreadPool {
   using cv_type = std::condition_variable;
 
  public:
+  /**
+   * Creates a pool with a thread per CPU available to the process except the current one, the CPU quota of the cgroup
+   * of the process is taken into account (see DetectResourceLimits())
+   */
   ThreadPool();
+
+  /**
+   * Creates a pool with the given count of threads
+   * @param threads_count count of threads (0 - a thread per available CPU except the current one)
+   */
+  explicit ThreadPool(std::size_t threads_count);
+
+  /**
+   * Creates a pool according to options. Threads are pinned to CPUs before executing any task, so memory first touched
+   * by a task is allocated on the NUMA node of its thread. Failures of pinning are ignored.
+   * @param options options
+   */
+  explicit ThreadPool(const ThreadPoolOptions& options);
+
   ~ThreadPool();
 
   ThreadPool(const ThreadPool&) = delete;
   ThreadPool& operator=(const ThreadPool&) = delete;
 
+  /**
+   * Sets the task group of the current thread while the scope exists
+   */
+  class TaskGroupScope {
+   public:
+    /**
+     * Constructor
+     * @param group task group
+     */
+    explicit TaskGroupScope(task_group_t group) noexcept;
+    ~TaskGroupScope();
+
+    TaskGroupScope(const TaskGroupScope&) = delete;
+    TaskGroupScope& operator=(const TaskGroupScope&) = delete;
+
+   private:
+    task_group_t previous_group_;  ///< Task group of the thread before the scope
+  };
+
  public:
   /**
-   * Adds a task to the thread pool
+   * Adds a task to the task group of the current thread
    * @param task task
    */
   void add(task_t task);
 
   /**
-   * Throws a stored exception (if any exists)
+   * Throws a stored exception of the task group of the current thread (if any exists)
    * @throws
    */
   void checkException() const;
 
   /**
-   * Checks whether pool has pending tasks
+   * Clears a stored exception of the task group of the current thread, so the pool can be reused after a failed job
+   * NOTE: should be called when tasks of the failed job are over
+   */
+  void clearException() noexcept;
+
+  /**
+   * Checks whether the task group of the current thread has pending (queued or executing) tasks
    * @return
    */
   bool hasPendingTasks() const;
 
   /**
-   * Waits a condition in this thread
-   * TODO: consider updating behavior after switching to C++20
+   * Creates a task group
+   * @return task group
+   */
+  task_group_t createTaskGroup();
+
+  /**
+   * Removes a task group, should be called when its tasks are over
+   * @param group task group (not the default one)
+   */
+  void removeTaskGroup(task_group_t group);
+
+  /**
+   * Returns count of working threads
+   * @return
+   */
+  std::size_t threadsCount() const noexcept;
+
+  /**
+   * Returns CPUs which threads are pinned to
+   * @return CPU of every thread or empty vector if threads are not pinned
+   */
+  const std::vector<unsigned int>& threadsCpus() const noexcept;
+
+  /**
+   * Returns cumulative statistics of the pool
+   * @return
+   */
+  ThreadPoolStats stats() const;
+
+  /**
+   * Returns index of the current thread in its thread pool
+   * @return index or kNotPoolThread if the current thread does not belong to a thread pool
+   */
+  static std::size_t currentThreadIndex() noexcept;
+
+  /**
+   * Index of threads which do not belong to a thread pool
+   */
+  static constexpr std::size_t kNotPoolThread = static_cast<std::size_t>(-1);
+
+  /**
+   * Returns the task group of the current thread
+   * @return task group (kDefaultTaskGroup if it is not set)
+   */
+  static task_group_t currentTaskGroup() noexcept;
+
+  /**
+   * Task group of threads which have not set another one
+   */
+  static constexpr task_group_t kDefaultTaskGroup = 0;
+
+  /**
+   * Blocks this thread until a task sets the flag. The flag must be set by a task of the pool before the task is over,
+   * as waiters are woken when tasks are over.
    * @param task_flag
+   * @throws a stored exception of the task group of the current thread
    */
   void waitForTask(const std::atomic_bool& task_flag) const;
 
  private:
   /**
-   * Pops a task from the queue
+   * Tasks of a task group
+   */
+  struct TaskGroup {
+    std::queue<task_t> tasks_;                    ///< Queued tasks
+    std::size_t active_tasks_count_ = 0;          ///< Count of executing tasks
+    std::exception_ptr exception_ptr_ = nullptr;  ///< The first exception thrown by a task
+  };
+
+  /**
+   * Pops a task of the next task group in turn (under lock, there must be queued tasks)
    * @param task
-   * @return true if the task has been extracted
+   * @return task group of the task
+   */
+  task_group_t popTask(task_t& task);
+
+  /**
+   * Accounts the end of a task and wakes threads blocked in waitForTask()
+   * @param group task group of the task
+   * @param exception exception thrown by the task (may be null)
    */
-  bool popTask(task_t& task);
+  void finishTask(task_group_t group, std::exception_ptr exception);
 
  private:
-  std::atomic_uint_fast32_t active_tasks_ = 0;  ///< Amount of active tasks
+  /**
+   * Statistics of a working thread. Each thread updates its own cache line.
+   */
+  struct alignas(64) ThreadStats {
+    std::atomic_uint64_t busy_time_ns_ = 0;  ///< Time of executing tasks
+  };
 
-  std::vector<std::thread> threads_;  ///< Working threads
+  std::vector<std::thread> threads_;        ///< Working threads
+  std::vector<unsigned int> threads_cpus_;  ///< CPUs which threads are pinned to
 
-  std::atomic_bool exception_flag_ = false;     ///< Exception flag
-  std::exception_ptr exception_ptr_ = nullptr;  ///< Exception pointer
+  std::atomic_size_t exceptions_count_ = 0;  ///< Count of groups with exceptions (checked without lock)
 
   mutable mutex_type mutex_;       ///< Tasks mutex
   std::atomic_bool stop_ = false;  ///< Stop flag
   cv_type cv_;                     ///< Tasks condition variable
+  mutable cv_type done_cv_;        ///< Condition variable of finished tasks (see waitForTask())
+
+  std::map<task_group_t, TaskGroup> groups_;         ///< Task groups
+  std::deque<task_group_t> ready_groups_;            ///< Groups with queued tasks in the order of turns
+  std::size_t queued_tasks_count_ = 0;               ///< Count of queued tasks of all groups
+  task_group_t next_group_ = kDefaultTaskGroup + 1;  ///< Identifier of the next created group
 
-  std::queue<task_t> tasks_;  ///< Tasks
+  std::unique_ptr<ThreadStats[]> threads_stats_;   ///< Statistics of working threads
+  mutable std::atomic_uint64_t wait_time_ns_ = 0;  ///< Time spent blocked in waitForTask()
+  ThreadPoolStats queue_stats_;                    ///< Statistics of the queue (guarded by mutex_)
 };
 
 }  // namespace es
\ No newline at end of file
@@ -0,0 +1,157 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/**
+ * Tracing macros. Tracing is compiled in only with ES_ENABLE_TRACING (CMake option ENABLE_TRACING), otherwise the
+ * macros expand to nothing and have no overhead.
+ */
+#ifdef ES_ENABLE_TRACING
+#define ES_TRACE_CONCAT_IMPL(lhs, rhs) lhs##rhs
+#define ES_TRACE_CONCAT(lhs, rhs) ES_TRACE_CONCAT_IMPL(lhs, rhs)
+#define ES_TRACE_SCOPE(category, name) const ::es::TraceScope ES_TRACE_CONCAT(trace_scope_, __LINE__){category, name}
+#else
+#define ES_TRACE_SCOPE(category, name) static_cast<void>(0)
+#endif
+
+namespace es {
+
+/**
+ * Event of a trace: an interval of time which a thread spent in a named scope
+ */
+struct TraceEvent {
+  const char* category_;         ///< Category (string literal)
+  const char* name_;             ///< Name (string literal)
+  std::uint64_t begin_time_ns_;  ///< Time of beginning
+  std::uint64_t end_time_ns_;    ///< Time of end
+};
+
+/**
+ * Collects trace events of all threads and writes them in Chrome/Perfetto trace-event format. Every thread records
+ * events to its own buffer without locks; buffers are registered once per thread. A buffer of an exited thread keeps
+ * its events until they are cleared, then it is freed (or reused by a new thread if it has no events).
+ * NOTE: a trace should be written or cleared only when no thread records events
+ */
+class Tracer {
+  /**
+   * Buffer of events of a thread. Only the owner thread appends events.
+   */
+  struct ThreadBuffer {
+    std::size_t thread_id_ = 0;                    ///< Sequential id of the thread in the trace
+    std::size_t pool_thread_index_ = 0;            ///< Index of the thread in its thread pool
+    std::size_t capacity_ = 0;                     ///< Maximal count of events
+    std::unique_ptr<TraceEvent[]> events_;         ///< Events
+    std::atomic_size_t size_ = 0;                  ///< Count of recorded events
+    std::atomic_size_t dropped_events_count_ = 0;  ///< Count of events which did not fit to the buffer
+    std::atomic_bool is_released_ = false;         ///< Flag of a buffer whose thread has exited
+  };
+
+  /**
+   * Owner of the buffer of a thread, releases the buffer when the thread exits
+   */
+  struct ThreadBufferOwner {
+    ThreadBuffer* buffer_ = nullptr;  ///< Buffer of the thread (null until the thread records an event)
+
+    ~ThreadBufferOwner();
+  };
+
+ public:
+  static constexpr std::size_t kDefaultEventsPerThread = 64 * 1024;
+
+  /**
+   * Returns the global tracer
+   * @return tracer
+   */
+  static Tracer& instance();
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+ public:
+  /**
+   * Starts recording of events
+   * @param events_per_thread capacity of buffers of threads which have not recorded events yet
+   */
+  void start(std::size_t events_per_thread = kDefaultEventsPerThread);
+
+  /**
+   * Stops recording of events
+   */
+  void stop() noexcept;
+
+  /**
+   * Checks whether events are recorded
+   * @return true if recording is started
+   */
+  bool isEnabled() const noexcept { return enabled_.load(std::memory_order_relaxed); }
+
+  /**
+   * Records an event of the current thread
+   * @param event event
+   */
+  void record(const TraceEvent& event) noexcept;
+
+  /**
+   * Removes all recorded events and frees buffers of exited threads
+   */
+  void clear() noexcept;
+
+  /**
+   * Writes recorded events as Chrome trace-event JSON
+   * @param stream output stream
+   */
+  void writeChromeTrace(std::ostream& stream) const;
+
+ private:
+  Tracer() = default;
+
+  /**
+   * Returns buffer of the current thread (registers it or reuses an empty buffer of an exited thread on the first call)
+   * @return buffer
+   */
+  ThreadBuffer* currentThreadBuffer();
+
+ private:
+  std::atomic_bool enabled_ = false;                         ///< Recording flag
+  std::uint64_t start_time_ns_ = 0;                          ///< Time of start of recording
+  std::size_t events_per_thread_ = kDefaultEventsPerThread;  ///< Capacity of new buffers
+
+  mutable std::mutex mutex_;                            ///< Mutex for registering buffers
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;  ///< Buffers of all threads
+  std::size_t next_thread_id_ = 1;                      ///< Id of the next registered thread
+
+  static thread_local ThreadBufferOwner current_thread_buffer_;  ///< Buffer of the current thread
+};
+
+/**
+ * Records an event for the lifetime of the object
+ */
+class TraceScope {
+ public:
+  /**
+   * Constructor
+   * @param category category of the event (string literal)
+   * @param name name of the event (string literal)
+   */
+  TraceScope(const char* category, const char* name) noexcept;
+  ~TraceScope();
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const char* category_;         ///< Category of the event
+  const char* name_;             ///< Name of the event
+  std::uint64_t begin_time_ns_;  ///< Time of beginning (0 if tracing is disabled)
+};
+
+}  // namespace es
\ No newline at end of file
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <cerrno>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <memory>
@@ -26,6 +27,18 @@ std::size_t RoundSize(std::size_t size) noexcept {
   return size / sizeof(NumberType) * sizeof(NumberType);
 }
 
+/**
+ * Returns current time of the steady clock
+ * @return time in nanoseconds
+ */
+std::uint64_t SteadyClockNs() noexcept;
+
+/**
+ * Returns CPU time consumed by the process (by all its threads)
+ * @return time in nanoseconds
+ */
+std::uint64_t ProcessCpuTimeNs() noexcept;
+
 /**
  * Results of reading a file
  */
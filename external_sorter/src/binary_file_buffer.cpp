@@ -4,37 +4,98 @@
 
 #include "binary_file_buffer.h"
 
+#include "sort_control.h"
 #include "thread_pool.h"
+#include "tracing.h"
 #include "utils.h"
 
-#include <thread>
+#include <algorithm>
 
 namespace es {
 
+namespace {
+
+/**
+ * Minimal size of a part of a file buffer which is shrunk under memory pressure
+ */
+const std::size_t kMinShrunkBufferSize = 64 * 1024;
+
+/**
+ * Returns size of both parts of a file buffer: memory of the buffer without the index of a run file, at least a number
+ * per part
+ * @tparam NumberType type of numbers
+ * @param buffer_size total size of the buffer
+ * @param run_reader reader of a run file (may be null)
+ * @return size in bytes
+ */
+template <typename NumberType>
+std::size_t CalcBuffersSize(std::size_t buffer_size, const RunFileReader<NumberType>* run_reader) noexcept {
+  const auto index_size = run_reader ? run_reader->indexMemorySize() : 0;
+
+  return std::max(buffer_size > index_size ? buffer_size - index_size : 0, 2 * sizeof(NumberType));
+}
+
+}  // namespace
+
 template <typename NumberType>
 BinaryFileBuffer<NumberType>::BinaryFileBuffer(std::shared_ptr<ThreadPool> pool, std::string_view file_path,
-                                               std::size_t buffer_size)
+                                               std::size_t buffer_size, MemoryBudget& memory_budget,
+                                               bool compute_checksum, const CancellationToken* cancellation_token,
+                                               bool is_run_file)
     : thread_pool_{std::move(pool)},
-      buffer_size_{RoundSize<NumberType>(buffer_size / kBuffersCount)},
+      run_reader_{is_run_file ? std::make_unique<RunFileReader<NumberType>>(file_path) : nullptr},
+      buffer_size_{RoundSize<NumberType>(CalcBuffersSize(buffer_size, run_reader_.get()) / kBuffersCount)},
       numbers_count_{buffer_size_ / sizeof(NumberType)},
-      stream_{OpenInputBinaryFileStream(file_path)},
-      buffer_0{std::make_unique<NumberType[]>(numbers_count_)},
-      buffer_1{std::make_unique<NumberType[]>(numbers_count_)} {
-  thread_pool_->add([this]() {
-    loadBuffer(stream_, buffer_0, buffer_size_);
+      stream_{is_run_file ? std::ifstream{} : OpenInputBinaryFileStream(file_path)},
+      reservation_{memory_budget.reserve(kBuffersCount * buffer_size_ +
+                                         (run_reader_ ? run_reader_->indexMemorySize() : 0))},
+      compute_checksum_{compute_checksum},
+      cancellation_token_{cancellation_token},
+      buffer_0{std::make_unique<NumberType[]>(numbers_count_), numbers_count_},
+      buffer_1{std::make_unique<NumberType[]>(numbers_count_), numbers_count_} {
+  startLoading();
+}
 
-    std::this_thread::yield();
+template <typename NumberType>
+BinaryFileBuffer<NumberType>::BinaryFileBuffer(std::shared_ptr<ThreadPool> pool, std::unique_ptr<NumberType[]> numbers,
+                                               std::size_t numbers_count, MemoryReservation reservation)
+    : thread_pool_{std::move(pool)},
+      buffer_size_{numbers_count * sizeof(NumberType)},
+      numbers_count_{numbers_count},
+      reservation_{std::move(reservation)},
+      is_resident_{true},
+      buffer_0{std::move(numbers), numbers_count},
+      buffer_1{} {
+  buffer_0.numbers_read_ = numbers_count;
+  buffer_0.is_ready_.store(true);
+  buffer_1.is_ready_.store(true);
+}
 
-    loadBuffer(stream_, buffer_1, buffer_size_);
-  });
+template <typename NumberType>
+BinaryFileBuffer<NumberType>::BinaryFileBuffer(std::shared_ptr<ThreadPool> pool, CompressedRun<NumberType> run,
+                                               MemoryReservation run_reservation, std::size_t buffer_size,
+                                               MemoryBudget& memory_budget, const CancellationToken* cancellation_token)
+    : thread_pool_{std::move(pool)},
+      buffer_size_{RoundSize<NumberType>(CalcBuffersSize<NumberType>(buffer_size, nullptr) / kBuffersCount)},
+      numbers_count_{buffer_size_ / sizeof(NumberType)},
+      reservation_{memory_budget.reserve(kBuffersCount * buffer_size_)},
+      cancellation_token_{cancellation_token},
+      compressed_reader_{std::make_unique<CompressedRunReader<NumberType>>(std::move(run), std::move(run_reservation))},
+      buffer_0{std::make_unique<NumberType[]>(numbers_count_), numbers_count_},
+      buffer_1{std::make_unique<NumberType[]>(numbers_count_), numbers_count_} {
+  startLoading();
 }
 
 template <typename NumberType>
 BinaryFileBuffer<NumberType>::~BinaryFileBuffer() = default;
 
 template <typename NumberType>
-void BinaryFileBuffer<NumberType>::waitForReady() const {
+void BinaryFileBuffer<NumberType>::waitForReady() {
   waitForBuffer(buffer_0);
+
+  if (!is_resident_) {
+    bytes_read_ += buffer_0.numbers_read_ * sizeof(NumberType);
+  }
 }
 
 template <typename NumberType>
@@ -43,9 +104,11 @@ bool BinaryFileBuffer<NumberType>::get(NumberType& number) {
     number = buffer_0.buffer_[current_index_++];
 
     return true;
-  } else if (buffer_0.numbers_read_ > 0) {
+  } else if (buffer_0.numbers_read_ > 0 && !is_resident_) {
     waitForBuffer(buffer_1);
 
+    bytes_read_ += buffer_1.numbers_read_ * sizeof(NumberType);
+
     swap(buffer_0, buffer_1);
 
     current_index_ = 0;
@@ -53,7 +116,19 @@ bool BinaryFileBuffer<NumberType>::get(NumberType& number) {
     buffer_1.is_ready_.store(false);
     buffer_1.numbers_read_ = 0;
 
-    thread_pool_->add([this]() { loadBuffer(stream_, buffer_1, buffer_size_); });
+    // The consumed part is not loaded now, so it takes the size set by shrink().
+    if (buffer_1.capacity_ > numbers_count_) {
+      reservation_.shrink(reservation_.size() - (buffer_1.capacity_ - numbers_count_) * sizeof(NumberType));
+
+      buffer_1.buffer_.reset();
+      buffer_1.buffer_ = std::make_unique<NumberType[]>(numbers_count_);
+      buffer_1.capacity_ = numbers_count_;
+    }
+
+    thread_pool_->add([this, buffer_size = buffer_size_]() {
+      loadBuffer(stream_, run_reader_.get(), compressed_reader_.get(), buffer_1, buffer_size,
+                 compute_checksum_ ? &checksum_ : nullptr, cancellation_token_);
+    });
 
     return get(number);
   }
@@ -61,26 +136,91 @@ bool BinaryFileBuffer<NumberType>::get(NumberType& number) {
   return false;
 }
 
+template <typename NumberType>
+bool BinaryFileBuffer<NumberType>::shrink() {
+  const auto buffer_size = RoundSize<NumberType>(std::max(buffer_size_ / 2, kMinShrunkBufferSize));
+
+  if (is_resident_ || buffer_size >= buffer_size_) {
+    return false;
+  }
+
+  buffer_size_ = buffer_size;
+  numbers_count_ = buffer_size_ / sizeof(NumberType);
+
+  return true;
+}
+
+template <typename NumberType>
+void BinaryFileBuffer<NumberType>::waitForLoads() const {
+  waitForBuffer(buffer_0);
+  waitForBuffer(buffer_1);
+}
+
 template <typename NumberType>
 void BinaryFileBuffer<NumberType>::waitForBuffer(const BinaryFileBuffer<NumberType>::buffer_internal& buffer) const {
+  if (buffer.is_ready_.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  ES_TRACE_SCOPE("wait", "wait for file buffer");
+
+  const auto start_time = SteadyClockNs();
+
   thread_pool_->waitForTask(buffer.is_ready_);
+
+  wait_time_ns_ += SteadyClockNs() - start_time;
+}
+
+template <typename NumberType>
+void BinaryFileBuffer<NumberType>::startLoading() {
+  // The size is captured, as shrink() may change it while the parts are being loaded. The second part is loaded by a
+  // task added by the first one, so the parts are read in order and a waiter of the first part is woken before the
+  // second one is loaded.
+  thread_pool_->add([this, buffer_size = buffer_size_]() {
+    loadBuffer(stream_, run_reader_.get(), compressed_reader_.get(), buffer_0, buffer_size,
+               compute_checksum_ ? &checksum_ : nullptr, cancellation_token_);
+
+    thread_pool_->add([this, buffer_size]() {
+      loadBuffer(stream_, run_reader_.get(), compressed_reader_.get(), buffer_1, buffer_size,
+                 compute_checksum_ ? &checksum_ : nullptr, cancellation_token_);
+    });
+  });
 }
 
 template <typename NumberType>
-void BinaryFileBuffer<NumberType>::loadBuffer(std::ifstream& stream,
+void BinaryFileBuffer<NumberType>::loadBuffer(std::ifstream& stream, RunFileReader<NumberType>* run_reader,
+                                              CompressedRunReader<NumberType>* compressed_reader,
                                               BinaryFileBuffer<NumberType>::buffer_internal& buffer,
-                                              std::size_t buffer_size) {
-  auto [ok, bytes_read] = ReadFileStream(stream, reinterpret_cast<char*>(buffer.buffer_.get()), buffer_size);
+                                              std::size_t buffer_size, MultisetChecksum* checksum,
+                                              const CancellationToken* cancellation_token) {
+  ES_TRACE_SCOPE("io", "read intermediate file");
 
-  if (!ok) {
-    throw MakeException("Failed to read file: ", errno);
+  if (cancellation_token) {
+    cancellation_token->throwIfCancelled();
   }
 
-  buffer.numbers_read_ = bytes_read / sizeof(NumberType);
+  if (run_reader) {
+    buffer.numbers_read_ = run_reader->read(buffer.buffer_.get(), buffer_size / sizeof(NumberType));
+  } else if (compressed_reader) {
+    buffer.numbers_read_ = compressed_reader->read(buffer.buffer_.get(), buffer_size / sizeof(NumberType));
+  } else {
+    auto [ok, bytes_read] = ReadFileStream(stream, reinterpret_cast<char*>(buffer.buffer_.get()), buffer_size);
+
+    if (!ok) {
+      throw MakeException("Failed to read file: ", errno);
+    }
+
+    buffer.numbers_read_ = bytes_read / sizeof(NumberType);
+  }
+
+  if (checksum) {
+    checksum->add(buffer.buffer_.get(), buffer.numbers_read_);
+  }
 
   buffer.is_ready_.store(true, std::memory_order_release);
 }
 
 template class BinaryFileBuffer<number_t>;
+template class BinaryFileBuffer<argsort_number_t>;
 
 }  // namespace es
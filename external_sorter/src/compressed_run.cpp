@@ -0,0 +1,366 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "compressed_run.h"
+
+#include "defines.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+namespace es {
+
+namespace {
+
+/**
+ * Size of the buffer of a compressed run store for decoding evicted runs
+ */
+const std::size_t kSpillBufferSize = 256 * 1024;
+
+/**
+ * Maximal count of bits which are written or read by a single call of BitWriter or BitReader
+ */
+const unsigned kMaxBitsPerCall = 32;
+
+/**
+ * Returns count of significant bits of a value
+ * @param value value
+ * @return count of bits (0 for 0)
+ */
+unsigned BitWidth(std::uint64_t value) noexcept {
+  unsigned width = 0;
+
+  for (; value != 0; value >>= 1) {
+    ++width;
+  }
+
+  return width;
+}
+
+/**
+ * Returns the bit width of deltas of a block
+ * @tparam NumberType type of numbers
+ * @param numbers sorted numbers of the block
+ * @param count count of numbers
+ * @return count of bits
+ */
+template <typename NumberType>
+unsigned CalcDeltaWidth(const NumberType* numbers, std::size_t count) noexcept {
+  // Bits of the union of deltas are enough for the largest one.
+  std::uint64_t deltas_bits = 0;
+
+  for (std::size_t i = 1; i < count; ++i) {
+    deltas_bits |= static_cast<std::uint64_t>(numbers[i] - numbers[i - 1]);
+  }
+
+  return BitWidth(deltas_bits);
+}
+
+/**
+ * Returns the compressed size of a block
+ * @tparam NumberType type of numbers
+ * @param count count of numbers
+ * @param width bit width of deltas
+ * @return size in bytes
+ */
+template <typename NumberType>
+std::size_t CalcBlockSize(std::size_t count, unsigned width) noexcept {
+  return sizeof(NumberType) + 1 + ((count - 1) * width + 7) / 8;
+}
+
+/**
+ * Writes bits to a byte buffer starting from the lowest ones
+ */
+class BitWriter {
+ public:
+  explicit BitWriter(std::uint8_t* data) noexcept : data_{data} {}
+
+  /**
+   * Writes bits of a value
+   * @param value value (only the lowest bits may be set)
+   * @param width count of bits
+   */
+  void write(std::uint64_t value, unsigned width) noexcept {
+    if (width > kMaxBitsPerCall) {
+      writeBits(value & 0xFFFFFFFFULL, kMaxBitsPerCall);
+      writeBits(value >> kMaxBitsPerCall, width - kMaxBitsPerCall);
+    } else {
+      writeBits(value, width);
+    }
+  }
+
+  /**
+   * Writes the incomplete byte
+   * @return pointer to the byte after written data
+   */
+  std::uint8_t* flush() noexcept {
+    if (bits_count_ != 0) {
+      *data_++ = static_cast<std::uint8_t>(bits_);
+    }
+
+    bits_ = 0;
+    bits_count_ = 0;
+
+    return data_;
+  }
+
+ private:
+  void writeBits(std::uint64_t value, unsigned width) noexcept {
+    bits_ |= value << bits_count_;
+    bits_count_ += width;
+
+    for (; bits_count_ >= 8; bits_count_ -= 8) {
+      *data_++ = static_cast<std::uint8_t>(bits_);
+      bits_ >>= 8;
+    }
+  }
+
+ private:
+  std::uint8_t* data_;       ///< The next byte
+  std::uint64_t bits_ = 0;   ///< Bits which are not written yet (less than a byte between calls)
+  unsigned bits_count_ = 0;  ///< Count of bits which are not written yet
+};
+
+/**
+ * Reads bits written by BitWriter
+ */
+class BitReader {
+ public:
+  explicit BitReader(const std::uint8_t* data) noexcept : data_{data} {}
+
+  /**
+   * Reads bits of a value
+   * @param width count of bits
+   * @return value
+   */
+  std::uint64_t read(unsigned width) noexcept {
+    if (width > kMaxBitsPerCall) {
+      const auto low = readBits(kMaxBitsPerCall);
+
+      return low | (readBits(width - kMaxBitsPerCall) << kMaxBitsPerCall);
+    }
+
+    return readBits(width);
+  }
+
+ private:
+  std::uint64_t readBits(unsigned width) noexcept {
+    for (; bits_count_ < width; bits_count_ += 8) {
+      bits_ |= static_cast<std::uint64_t>(*data_++) << bits_count_;
+    }
+
+    const auto value = bits_ & ((std::uint64_t{1} << width) - 1);
+
+    bits_ >>= width;
+    bits_count_ -= width;
+
+    return value;
+  }
+
+ private:
+  const std::uint8_t* data_;  ///< The next byte
+  std::uint64_t bits_ = 0;    ///< Bits which are not read yet
+  unsigned bits_count_ = 0;   ///< Count of bits which are not read yet
+};
+
+}  // namespace
+
+template <typename NumberType>
+std::size_t CompressedRun<NumberType>::calcSize(const NumberType* numbers, std::size_t count) noexcept {
+  std::size_t size = 0;
+
+  for (std::size_t begin = 0; begin < count; begin += kCompressedRunBlockNumbersCount) {
+    const auto block_count = std::min(count - begin, kCompressedRunBlockNumbersCount);
+
+    size += CalcBlockSize<NumberType>(block_count, CalcDeltaWidth(numbers + begin, block_count));
+  }
+
+  return size;
+}
+
+template <typename NumberType>
+CompressedRun<NumberType>::CompressedRun(const NumberType* numbers, std::size_t count)
+    : size_{calcSize(numbers, count)}, numbers_count_{count} {
+  static_assert(std::is_unsigned_v<NumberType>, "Deltas of compressed runs are computed for unsigned numbers");
+
+  data_ = std::make_unique<std::uint8_t[]>(size_);
+
+  auto* data = data_.get();
+
+  for (std::size_t begin = 0; begin < count; begin += kCompressedRunBlockNumbersCount) {
+    const auto* block = numbers + begin;
+    const auto block_count = std::min(count - begin, kCompressedRunBlockNumbersCount);
+    const auto width = CalcDeltaWidth(block, block_count);
+
+    std::memcpy(data, block, sizeof(NumberType));
+    data += sizeof(NumberType);
+    *data++ = static_cast<std::uint8_t>(width);
+
+    BitWriter writer{data};
+
+    for (std::size_t i = 1; i < block_count; ++i) {
+      writer.write(static_cast<std::uint64_t>(block[i] - block[i - 1]), width);
+    }
+
+    data = writer.flush();
+  }
+}
+
+template <typename NumberType>
+CompressedRunReader<NumberType>::CompressedRunReader(CompressedRun<NumberType> run, MemoryReservation reservation)
+    : run_{std::move(run)}, reservation_{std::move(reservation)}, block_(kCompressedRunBlockNumbersCount) {
+  block_position_ = block_.size();
+}
+
+template <typename NumberType>
+std::size_t CompressedRunReader<NumberType>::read(NumberType* numbers, std::size_t count) {
+  std::size_t read_count = 0;
+
+  while (read_count < count) {
+    // The rest of a partially read block is read first.
+    if (block_position_ < block_.size()) {
+      const auto part_count = std::min(block_.size() - block_position_, count - read_count);
+
+      std::copy_n(block_.begin() + static_cast<std::ptrdiff_t>(block_position_), part_count, numbers + read_count);
+
+      block_position_ += part_count;
+      read_count += part_count;
+
+      continue;
+    }
+
+    if (position_ == run_.numbers_count_) {
+      break;
+    }
+
+    // Complete blocks are decoded right to the buffer of the caller.
+    if (count - read_count >= kCompressedRunBlockNumbersCount) {
+      read_count += decodeBlock(numbers + read_count);
+    } else {
+      block_.resize(kCompressedRunBlockNumbersCount);
+      block_.resize(decodeBlock(block_.data()));
+      block_position_ = 0;
+    }
+  }
+
+  // The memory of the run is not needed any more.
+  if (position_ == run_.numbers_count_ && run_.data_) {
+    run_ = CompressedRun<NumberType>{};
+    position_ = 0;
+    reservation_.reset();
+  }
+
+  return read_count;
+}
+
+template <typename NumberType>
+std::size_t CompressedRunReader<NumberType>::decodeBlock(NumberType* numbers) {
+  const auto count = static_cast<std::size_t>(
+      std::min<std::uint64_t>(run_.numbers_count_ - position_, kCompressedRunBlockNumbersCount));
+  const auto* data = run_.data_.get() + offset_;
+
+  std::memcpy(numbers, data, sizeof(NumberType));
+  data += sizeof(NumberType);
+
+  const unsigned width = *data++;
+
+  BitReader reader{data};
+
+  for (std::size_t i = 1; i < count; ++i) {
+    numbers[i] = static_cast<NumberType>(numbers[i - 1] + reader.read(width));
+  }
+
+  offset_ += CalcBlockSize<NumberType>(count, width);
+  position_ += count;
+
+  return count;
+}
+
+template <typename NumberType>
+CompressedRunStore<NumberType>::CompressedRunStore(MemoryReservation reservation)
+    : reservation_{std::move(reservation)},
+      capacity_{reservation_.size() > kSpillBufferSize ? reservation_.size() - kSpillBufferSize : 0},
+      spill_buffer_{std::make_unique<NumberType[]>(kSpillBufferSize / sizeof(NumberType))} {}
+
+template <typename NumberType>
+bool CompressedRunStore<NumberType>::reserve(std::size_t size, std::optional<CompressedRun<NumberType>>& evicted_run) {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  evicted_run.reset();
+
+  if (reserved_size_ + size <= capacity_) {
+    reserved_size_ += size;
+
+    return true;
+  }
+
+  // Evicting a smaller run would not make room for the new one.
+  auto it = std::max_element(runs_.begin(), runs_.end(),
+                             [](const auto& run, const auto& other) { return run.size() < other.size(); });
+
+  if (it == runs_.end() || it->size() < size) {
+    return false;
+  }
+
+  evicted_run = std::move(*it);
+  runs_.erase(it);
+  ++evicted_runs_count_;
+
+  return false;
+}
+
+template <typename NumberType>
+void CompressedRunStore<NumberType>::add(CompressedRun<NumberType> run) {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  runs_.push_back(std::move(run));
+}
+
+template <typename NumberType>
+void CompressedRunStore<NumberType>::spill(CompressedRun<NumberType> run,
+                                           const std::function<void(const NumberType*, std::size_t)>& write) {
+  const auto size = run.size();
+
+  {
+    std::scoped_lock<std::mutex> lock(spill_mutex_);
+
+    CompressedRunReader<NumberType> reader{std::move(run)};
+
+    while (const auto count = reader.read(spill_buffer_.get(), kSpillBufferSize / sizeof(NumberType))) {
+      write(spill_buffer_.get(), count);
+    }
+  }
+
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  reserved_size_ -= size;
+}
+
+template <typename NumberType>
+std::vector<CompressedRun<NumberType>> CompressedRunStore<NumberType>::takeRuns() {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  reserved_size_ = 0;
+  reservation_.reset();
+  spill_buffer_.reset();
+
+  return std::move(runs_);
+}
+
+template <typename NumberType>
+std::size_t CompressedRunStore<NumberType>::evictedRunsCount() const {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  return evicted_runs_count_;
+}
+
+template class CompressedRun<number_t>;
+template class CompressedRun<argsort_number_t>;
+template class CompressedRunReader<number_t>;
+template class CompressedRunReader<argsort_number_t>;
+template class CompressedRunStore<number_t>;
+template class CompressedRunStore<argsort_number_t>;
+
+}  // namespace es
\ No newline at end of file
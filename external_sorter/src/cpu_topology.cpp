@@ -0,0 +1,242 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "cpu_topology.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace es {
+
+namespace {
+
+const std::string_view kNodesDirectoryPath{"/sys/devices/system/node"};
+const std::string_view kNodeDirectoryPrefix{"node"};
+const std::string_view kNodeCpuListFileName{"cpulist"};
+const std::size_t kMaxCpuNumberLength = 6;
+
+/**
+ * Checks whether a string consists of decimal digits only
+ * @param value string
+ * @return true if the string is a non-empty decimal number
+ */
+bool IsDecimalNumber(std::string_view value) noexcept {
+  return !value.empty() &&
+         std::all_of(value.begin(), value.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); });
+}
+
+/**
+ * Returns CPUs the process is allowed to run on
+ * @return CPUs or empty set if they are unknown
+ */
+std::set<unsigned int> GetAllowedCpus() {
+  std::set<unsigned int> cpus;
+
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+
+  if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+    for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &cpu_set)) {
+        cpus.insert(cpu);
+      }
+    }
+  }
+#endif
+
+  return cpus;
+}
+
+/**
+ * Reads CPUs of NUMA nodes from sysfs
+ * @return CPUs of every node ordered by node number or empty vector if NUMA information is not available
+ */
+std::vector<std::vector<unsigned int>> ReadNodesCpus() {
+  std::vector<std::pair<unsigned long, std::vector<unsigned int>>> nodes;
+
+  std::error_code ec{};
+  for (const auto& entry : std::filesystem::directory_iterator(kNodesDirectoryPath, ec)) {
+    const auto name = entry.path().filename().string();
+
+    if (name.rfind(kNodeDirectoryPrefix, 0) != 0 ||
+        !IsDecimalNumber(std::string_view{name}.substr(kNodeDirectoryPrefix.size()))) {
+      continue;
+    }
+
+    std::ifstream stream{entry.path() / kNodeCpuListFileName};
+    std::string cpu_list;
+
+    if (!std::getline(stream, cpu_list)) {
+      continue;
+    }
+
+    try {
+      nodes.emplace_back(std::stoul(name.substr(kNodeDirectoryPrefix.size())), ParseCpuList(cpu_list));
+    } catch (const std::exception&) {
+      continue;
+    }
+  }
+
+  std::sort(nodes.begin(), nodes.end());
+
+  std::vector<std::vector<unsigned int>> nodes_cpus;
+  nodes_cpus.reserve(nodes.size());
+
+  for (auto& node : nodes) {
+    nodes_cpus.push_back(std::move(node.second));
+  }
+
+  return nodes_cpus;
+}
+
+}  // namespace
+
+CpuTopology DetectCpuTopology() {
+  const auto allowed_cpus = GetAllowedCpus();
+
+  CpuTopology topology{};
+
+  for (auto& node_cpus : ReadNodesCpus()) {
+    if (!allowed_cpus.empty()) {
+      node_cpus.erase(std::remove_if(node_cpus.begin(), node_cpus.end(),
+                                     [&](unsigned int cpu) { return allowed_cpus.count(cpu) == 0; }),
+                      node_cpus.end());
+    }
+
+    if (!node_cpus.empty()) {
+      topology.nodes_cpus_.push_back(std::move(node_cpus));
+    }
+  }
+
+  if (topology.nodes_cpus_.empty()) {
+    if (!allowed_cpus.empty()) {
+      topology.nodes_cpus_.emplace_back(allowed_cpus.begin(), allowed_cpus.end());
+    } else {
+      std::vector<unsigned int> cpus(std::max(std::thread::hardware_concurrency(), 1U));
+
+      for (unsigned int cpu = 0; cpu < cpus.size(); ++cpu) {
+        cpus[cpu] = cpu;
+      }
+
+      topology.nodes_cpus_.push_back(std::move(cpus));
+    }
+  }
+
+  return topology;
+}
+
+std::vector<unsigned int> ParseCpuList(std::string_view cpu_list) {
+  std::vector<unsigned int> cpus;
+
+  while (!cpu_list.empty() && (cpu_list.back() == '\n' || cpu_list.back() == ' ')) {
+    cpu_list.remove_suffix(1);
+  }
+
+  const auto parseCpu = [&](std::string_view value) {
+    if (value.size() > kMaxCpuNumberLength || !IsDecimalNumber(value)) {
+      throw MakeException("Invalid list of CPUs: ", cpu_list);
+    }
+
+    return static_cast<unsigned int>(std::stoul(std::string{value}));
+  };
+
+  std::size_t begin = 0;
+
+  while (begin < cpu_list.size()) {
+    const auto end = std::min(cpu_list.find(',', begin), cpu_list.size());
+    const auto range = cpu_list.substr(begin, end - begin);
+    const auto separator_position = range.find('-');
+
+    if (separator_position == std::string_view::npos) {
+      cpus.push_back(parseCpu(range));
+    } else {
+      const auto first_cpu = parseCpu(range.substr(0, separator_position));
+      const auto last_cpu = parseCpu(range.substr(separator_position + 1));
+
+      if (first_cpu > last_cpu) {
+        throw MakeException("Invalid list of CPUs: ", cpu_list);
+      }
+
+      for (auto cpu = first_cpu; cpu <= last_cpu; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+
+    begin = end + 1;
+  }
+
+  return cpus;
+}
+
+std::vector<unsigned int> CreatePinningCpus(const CpuTopology& topology, ThreadPinning pinning,
+                                            std::size_t threads_count) {
+  std::vector<unsigned int> cpus;
+
+  if (topology.nodes_cpus_.empty() || (pinning != ThreadPinning::kCompact && pinning != ThreadPinning::kScatter)) {
+    return cpus;
+  }
+
+  std::vector<unsigned int> ordered_cpus;
+
+  if (pinning == ThreadPinning::kCompact) {
+    for (const auto& node_cpus : topology.nodes_cpus_) {
+      ordered_cpus.insert(ordered_cpus.end(), node_cpus.begin(), node_cpus.end());
+    }
+  } else {
+    std::size_t max_node_cpus_count = 0;
+
+    for (const auto& node_cpus : topology.nodes_cpus_) {
+      max_node_cpus_count = std::max(max_node_cpus_count, node_cpus.size());
+    }
+
+    for (std::size_t i = 0; i < max_node_cpus_count; ++i) {
+      for (const auto& node_cpus : topology.nodes_cpus_) {
+        if (i < node_cpus.size()) {
+          ordered_cpus.push_back(node_cpus[i]);
+        }
+      }
+    }
+  }
+
+  cpus.reserve(threads_count);
+
+  for (std::size_t i = 0; i < threads_count; ++i) {
+    cpus.push_back(ordered_cpus[i % ordered_cpus.size()]);
+  }
+
+  return cpus;
+}
+
+bool PinCurrentThread(unsigned int cpu) noexcept {
+#ifdef __linux__
+  if (cpu >= CPU_SETSIZE) {
+    return false;
+  }
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+  (void)cpu;
+
+  return false;
+#endif
+}
+
+}  // namespace es
\ No newline at end of file
@@ -4,297 +4,2621 @@
 
 #include "external_sorter.h"
 
+#include "argsort.h"
 #include "binary_file_buffer.h"
+#include "counting_sort.h"
+#include "memory_budget.h"
+#include "input_file_reader.h"
+#include "merge_queue.h"
+#include "output_file_writer.h"
+#include "output_summary.h"
+#include "pipeline.h"
+#include "radix_sort.h"
+#include "resource_limits.h"
+#include "run_file.h"
+#include "sort_control.h"
+#include "sparse_index.h"
 #include "thread_pool.h"
-#include "thread_safe_queue.h"
+#include "tracing.h"
 #include "utils.h"
 
 #include <algorithm>
+#include <cstring>
+#include <deque>
 #include <exception>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <queue>
 #include <string_view>
 #include <thread>
 #include <vector>
 
+#ifdef __linux__
+#include <sys/stat.h>
+#endif
+
 namespace es {
 
-namespace {
+namespace {
+
+const std::string_view kIntermediateFileName{"chunk_"};
+
+/**
+ * Memory which is accounted for each thread of the thread pool: touched pages of the stack, allocator caches and tasks.
+ */
+const std::size_t kThreadOverheadMemorySize = 256 * 1024;
+
+/**
+ * Memory which is accounted for the sorter itself: file streams with their buffers, queues and other objects.
+ */
+const std::size_t kSorterOverheadMemorySize = 256 * 1024;
+
+/**
+ * Upper bound of memory for merge buffers. Merge buffers only need to be large enough to amortize a write call, all
+ * other memory of the merge phase is given to intermediate files buffers, which determine sizes of reads.
+ */
+const std::size_t kMaxMergeBuffersMemorySize = 16 * 1024 * 1024;
+
+/**
+ * Calculates amount of memory which is used by the sorter regardless of buffers
+ * @param threads_count count of threads in the thread pool
+ * @return size
+ */
+std::size_t CalcOverheadMemorySize(std::size_t threads_count) noexcept {
+  return kSorterOverheadMemorySize + threads_count * kThreadOverheadMemorySize;
+}
+
+/**
+ * Returns the size of the memory budget of a sorter
+ * @param available_memory available memory of the sorter (kAutoAvailableMemory - derived from resource limits)
+ * @return size in bytes
+ * @throws if available memory cannot be detected
+ */
+std::size_t ResolveAvailableMemory(std::size_t available_memory) {
+  if (available_memory != kAutoAvailableMemory) {
+    return available_memory;
+  }
+
+  const auto memory_size = CalcAutoMemorySize(DetectResourceLimits());
+
+  if (memory_size == 0) {
+    throw MakeException("Failed to detect available memory");
+  }
+
+  return memory_size;
+}
+
+std::string CreateOutputFilePath(std::string output_directory_path, std::string_view output_file_name) {
+  output_directory_path.append(output_file_name);
+
+  return output_directory_path;
+}
+
+/**
+ * Checks whether two paths refer to the same file
+ * @param path first path
+ * @param other_path second path
+ * @return true for the same file
+ */
+bool IsSameFile(const std::string& path, const std::string& other_path) {
+  std::error_code ec{};
+
+  return path == other_path || std::filesystem::equivalent(path, other_path, ec);
+}
+
+/**
+ * Creates options of writing a file
+ * @param options options of the sorter
+ * @param file_size expected size of the file (0 - unknown)
+ * @return options
+ */
+OutputFileOptions CreateOutputFileOptions(const SorterOptions& options, std::uint64_t file_size) noexcept {
+  return OutputFileOptions{options.preallocate_files_ ? file_size : 0, options.write_behind_size_};
+}
+
+/**
+ * Returns total size of input files and the base file, which is the size of the output file
+ * @param options options of the sorter
+ * @param input_files input files
+ * @return size (0 if it is unknown, as some file is not a regular one)
+ */
+std::uint64_t CalcInputFilesSize(const SorterOptions& options, const std::vector<InputFile>& input_files) {
+  std::vector<std::string> files_paths;
+
+  if (!options.base_file_path_.empty()) {
+    files_paths.push_back(options.base_file_path_);
+  }
+
+  for (const auto& input_file : input_files) {
+    files_paths.push_back(input_file.path_);
+  }
+
+  std::uint64_t size = 0;
+
+  for (const auto& file_path : files_paths) {
+    std::error_code ec{};
+
+    if (!std::filesystem::is_regular_file(file_path, ec)) {
+      return 0;
+    }
+
+    size += std::filesystem::file_size(file_path, ec);
+  }
+
+  // Keys of the argsort mode are sorted as packed numbers, which are twice as large, and so are indices of the output.
+  return options.argsort_ ? size / sizeof(number_t) * sizeof(argsort_number_t) : size;
+}
+
+/**
+ * Opens the output file. It must be neither the base file of the incremental mode nor a sorted input file, which are
+ * read while the output is written.
+ * @param output_file_path path to output file
+ * @param options options of the sorter
+ * @param input_files input files
+ * @return file
+ */
+std::unique_ptr<OutputFile> OpenOutputFile(const std::string& output_file_path, const SorterOptions& options,
+                                           const std::vector<InputFile>& input_files) {
+  if (!options.base_file_path_.empty() && IsSameFile(options.base_file_path_, output_file_path)) {
+    throw MakeException("The output file must differ from the base file ", options.base_file_path_);
+  }
+
+  for (const auto& input_file : input_files) {
+    if (input_file.is_sorted_ && IsSameFile(input_file.path_, output_file_path)) {
+      throw MakeException("The output file must differ from the sorted input file ", input_file.path_);
+    }
+  }
+
+  const auto output_file_size = options.preallocate_files_ ? CalcInputFilesSize(options, input_files) : 0;
+
+  return std::make_unique<OutputFile>(output_file_path, CreateOutputFileOptions(options, output_file_size));
+}
+
+/**
+ * Selects paths to input files which have to be sorted
+ * @param input_files input files
+ * @return paths
+ */
+std::vector<std::string> SelectUnsortedInputFilesPaths(const std::vector<InputFile>& input_files) {
+  std::vector<std::string> paths;
+
+  for (const auto& input_file : input_files) {
+    if (!input_file.is_sorted_) {
+      paths.push_back(input_file.path_);
+    }
+  }
+
+  return paths;
+}
+
+/**
+ * Opens input files
+ * @param files_paths paths to files
+ * @return streams
+ */
+std::vector<std::ifstream> OpenInputFilesStreams(const std::vector<std::string>& files_paths) {
+  std::vector<std::ifstream> streams;
+  streams.reserve(files_paths.size());
+
+  for (const auto& file_path : files_paths) {
+    streams.push_back(OpenInputBinaryFileStream(file_path));
+  }
+
+  return streams;
+}
+
+/**
+ * Returns identifier of the device of a file, so files of different devices can be read in parallel
+ * @param file_path path to file
+ * @return identifier (0 if it is unknown)
+ */
+std::uint64_t GetFileDeviceId(const std::string& file_path) noexcept {
+#ifdef __linux__
+  struct stat file_stat {};
+
+  if (stat(file_path.c_str(), &file_stat) == 0) {
+    return static_cast<std::uint64_t>(file_stat.st_dev);
+  }
+#endif
+
+  return 0;
+}
+
+/**
+ * Returns count of readers of chunk sources
+ * @tparam ChunkSource type of a chunk source
+ * @param sources chunk sources
+ * @return count of readers (at least one)
+ */
+template <typename ChunkSource>
+std::size_t CountReaders(const std::vector<ChunkSource>& sources) noexcept {
+  std::size_t readers_count = 1;
+
+  for (const auto& source : sources) {
+    readers_count = std::max(readers_count, source.reader_index_ + 1);
+  }
+
+  return readers_count;
+}
+
+/**
+ * Checks whether all files are regular ones (so their sizes are known and they may be read at any offset)
+ * @param files_paths paths to files
+ * @return true if all files are regular
+ */
+bool AreRegularFiles(const std::vector<std::string>& files_paths) {
+  return std::all_of(files_paths.begin(), files_paths.end(),
+                     [](const auto& file_path) { return std::filesystem::is_regular_file(file_path); });
+}
+
+/**
+ * Returns indices of the first keys of files in the argsort mode (as if files were concatenated)
+ * @param files_paths paths to files
+ * @return indices
+ * @throws if a file except the last one is not a regular file (its size is unknown) or there are too many keys
+ */
+std::vector<std::uint64_t> CalcArgsortPositions(const std::vector<std::string>& files_paths) {
+  std::vector<std::uint64_t> positions;
+  std::uint64_t position = 0;
+
+  for (std::size_t i = 0; i < files_paths.size(); ++i) {
+    positions.push_back(position);
+
+    std::error_code ec{};
+
+    if (!std::filesystem::is_regular_file(files_paths[i], ec)) {
+      if (i + 1 != files_paths.size()) {
+        throw MakeException("Only the last input file may be not a regular file in the argsort mode: ", files_paths[i]);
+      }
+
+      break;
+    }
+
+    position += std::filesystem::file_size(files_paths[i]) / sizeof(number_t);
+  }
+
+  if (position > kMaxArgsortNumbersCount) {
+    throw MakeException("There are too many numbers for the argsort mode");
+  }
+
+  return positions;
+}
+
+/**
+ * Replaces packed numbers of the argsort mode by their input indices in place, keys are appended to the values file
+ * @param buffer packed numbers
+ * @param size size in bytes
+ * @param values_file file of sorted keys (may be null)
+ * @param values buffer for keys which are appended at once
+ */
+void UnpackArgsortNumbers(char* buffer, std::size_t size, OutputFile* values_file, std::vector<number_t>& values) {
+  const auto numbers_count = size / sizeof(argsort_number_t);
+
+  for (std::size_t begin = 0; values_file && begin < numbers_count; begin += values.size()) {
+    const auto count = std::min(values.size(), numbers_count - begin);
+
+    for (std::size_t i = 0; i < count; ++i) {
+      argsort_number_t number;
+      std::memcpy(&number, buffer + (begin + i) * sizeof(number), sizeof(number));
+
+      values[i] = ArgsortKey(number);
+    }
+
+    values_file->append(reinterpret_cast<const char*>(values.data()), count * sizeof(number_t));
+  }
+
+  // Packed numbers and indices have the same size, memcpy() keeps accesses of the buffer free of aliasing.
+  for (std::size_t i = 0; i < numbers_count; ++i) {
+    argsort_number_t number;
+    std::memcpy(&number, buffer + i * sizeof(number), sizeof(number));
+
+    const std::uint64_t index = ArgsortIndex(number);
+    std::memcpy(buffer + i * sizeof(index), &index, sizeof(index));
+  }
+}
+
+/**
+ * Returns count of numbers in files
+ * @tparam NumberType type of numbers
+ * @param files_paths paths to files
+ * @return count of numbers
+ */
+template <typename NumberType>
+std::uint64_t CountNumbers(const std::vector<std::string>& files_paths) {
+  std::uint64_t numbers_count = 0;
+
+  for (const auto& file_path : files_paths) {
+    numbers_count += std::filesystem::file_size(file_path) / sizeof(NumberType);
+  }
+
+  return numbers_count;
+}
+
+std::filesystem::path CreateIntermediateDirectoryPath(std::string_view output_directory_path,
+                                                      std::string_view intermediate_directory_name) {
+  std::filesystem::path intermediate_path{output_directory_path};
+  intermediate_path /= intermediate_directory_name;
+
+  return intermediate_path;
+}
+
+/**
+ * Creates paths of intermediate directories: one per spill directory, or the only one in the output directory
+ * @param output_directory_path path to output directory
+ * @param spill_directories spill directories
+ * @param intermediate_directory_name name of intermediate directories
+ * @return paths
+ */
+std::vector<std::filesystem::path> CreateIntermediateDirectoriesPaths(std::string_view output_directory_path,
+                                                                      const std::vector<std::string>& spill_directories,
+                                                                      std::string_view intermediate_directory_name) {
+  if (spill_directories.empty()) {
+    return {CreateIntermediateDirectoryPath(output_directory_path, intermediate_directory_name)};
+  }
+
+  std::vector<std::filesystem::path> paths;
+  paths.reserve(spill_directories.size());
+
+  for (const auto& spill_directory : spill_directories) {
+    paths.push_back(CreateIntermediateDirectoryPath(spill_directory, intermediate_directory_name));
+  }
+
+  return paths;
+}
+
+std::filesystem::path CreateIntermediateFilePath(std::filesystem::path intermediate_path, uint32_t id) {
+  intermediate_path /= kIntermediateFileName;
+  intermediate_path += std::to_string(id);
+
+  return intermediate_path;
+}
+
+/**
+ * Reorders intermediate files so that neighbouring files are located in different directories. Buffers of intermediate
+ * files are preloaded in this order, so reads of all spill devices are in flight at the same time.
+ * @param files_paths paths to intermediate files
+ * @return reordered paths
+ */
+std::vector<std::filesystem::path> InterleaveByDirectory(const std::vector<std::filesystem::path>& files_paths) {
+  std::map<std::filesystem::path, std::queue<std::filesystem::path>> directories;
+
+  for (const auto& file_path : files_paths) {
+    directories[file_path.parent_path()].push(file_path);
+  }
+
+  std::vector<std::filesystem::path> interleaved_paths;
+  interleaved_paths.reserve(files_paths.size());
+
+  while (interleaved_paths.size() != files_paths.size()) {
+    for (auto& [directory, directory_files] : directories) {
+      if (!directory_files.empty()) {
+        interleaved_paths.push_back(std::move(directory_files.front()));
+        directory_files.pop();
+      }
+    }
+  }
+
+  return interleaved_paths;
+}
+
+/**
+ * Input file which is read by positional reads as a part of concatenated input files
+ */
+struct ConcatenatedInputFile {
+  std::unique_ptr<InputFileReader> reader_;  ///< Reader of the file
+  std::uint64_t begin_ = 0;                  ///< Index of the first number of the file in the concatenated files
+  std::uint64_t numbers_count_ = 0;          ///< Count of numbers in the file
+};
+
+/**
+ * Reads numbers of concatenated files by positional reads (so it may be called by several threads)
+ * @tparam NumberType type of numbers
+ * @param files concatenated files
+ * @param buffer buffer for numbers
+ * @param begin index of the first number in the concatenated files
+ * @param numbers_count count of numbers to read (all of them must exist)
+ */
+template <typename NumberType>
+void ReadConcatenatedFiles(const std::vector<ConcatenatedInputFile>& files, NumberType* buffer, std::uint64_t begin,
+                           std::size_t numbers_count) {
+  for (const auto& file : files) {
+    const auto file_end = file.begin_ + file.numbers_count_;
+
+    if (numbers_count == 0) {
+      break;
+    }
+
+    if (begin >= file_end) {
+      continue;
+    }
+
+    const auto part_numbers_count = static_cast<std::size_t>(std::min<std::uint64_t>(numbers_count, file_end - begin));
+    const auto part_size = part_numbers_count * sizeof(NumberType);
+    auto [ok, bytes_read] =
+        file.reader_->read(reinterpret_cast<char*>(buffer), part_size, (begin - file.begin_) * sizeof(NumberType));
+
+    if (!ok || bytes_read != part_size) {
+      throw MakeException("Failed to read ", file.reader_->path(), std::string_view{": "}, errno);
+    }
+
+    buffer += part_numbers_count;
+    begin += part_numbers_count;
+    numbers_count -= part_numbers_count;
+  }
+}
+
+/**
+ * Calculates amount of memory which will be used for all merge buffers
+ * @param total_memory total amount of memory of the merge phase
+ * @return size
+ */
+std::size_t CalcMergeBuffersMemorySize(std::size_t total_memory) noexcept {
+  constexpr std::size_t denom = 8;
+
+  return std::min(total_memory / denom, kMaxMergeBuffersMemorySize);
+}
+
+/**
+ * Creates buffers for intermediate files, followed by buffers of resident runs
+ * @tparam NumberType
+ * @tparam ResidentRun type of a resident run
+ * @param thread_pool thread pool
+ * @param files_paths paths to intermediate files
+ * @param files_buffers_memory_sizes size of a buffer of every file, followed by sizes of buffers of resident runs
+ * @param compute_checksums flags for computing checksums of files
+ * @param are_run_files flags of run files (other files contain only numbers)
+ * @param resident_runs sorted runs in memory, their numbers are moved to buffers (compressed ones are decoded by them)
+ * @param memory_budget memory budget for buffers
+ * @param cancellation_token token checked by loading tasks (may be null)
+ * @return buffers
+ */
+template <typename NumberType, typename ResidentRun>
+std::vector<BinaryFileBuffer<NumberType>> CreateIntermediateFilesBuffers(
+    std::shared_ptr<ThreadPool> thread_pool, const std::vector<std::filesystem::path>& files_paths,
+    const std::vector<std::size_t>& files_buffers_memory_sizes, const std::vector<bool>& compute_checksums,
+    const std::vector<bool>& are_run_files, std::vector<ResidentRun>& resident_runs, MemoryBudget& memory_budget,
+    const CancellationToken* cancellation_token) {
+  // Buffers are never moved, as their loading tasks refer to them.
+  std::vector<BinaryFileBuffer<NumberType>> files_buffers;
+  files_buffers.reserve(files_paths.size() + resident_runs.size());
+
+  for (std::size_t i = 0; i < files_paths.size(); ++i) {
+    files_buffers.emplace_back(thread_pool, files_paths[i].string(), files_buffers_memory_sizes[i], memory_budget,
+                               compute_checksums[i], cancellation_token, are_run_files[i]);
+  }
+
+  for (std::size_t i = 0; i < resident_runs.size(); ++i) {
+    auto& resident_run = resident_runs[i];
+
+    if (resident_run.numbers_) {
+      files_buffers.emplace_back(thread_pool, std::move(resident_run.numbers_), resident_run.numbers_count_,
+                                 std::move(resident_run.reservation_));
+    } else {
+      files_buffers.emplace_back(thread_pool, std::move(resident_run.compressed_), std::move(resident_run.reservation_),
+                                 files_buffers_memory_sizes[files_paths.size() + i], memory_budget,
+                                 cancellation_token);
+    }
+  }
+
+  return files_buffers;
+}
+
+const std::size_t kMinAvailableMemory = 2 * 1024 * 1024;
+
+/**
+ * Memory which is accounted for each intermediate file while merging: the merge heap element, the file stream with its
+ * buffer and the file buffer object.
+ */
+template <typename NumberType>
+const std::size_t kFileOverheadMemorySize = sizeof(MergeData<NumberType>) + 16 * 1024;
+
+/**
+ * Minimal memory of an intermediate file buffer (both parts). Merging more files at once would make reads too small,
+ * so such files are merged in several passes.
+ */
+const std::size_t kMinFileBufferMemorySize = 256 * 1024;
+
+/**
+ * Memory which has to be left for merging resident runs when input is sorted in memory: merge buffers and overhead of
+ * runs.
+ */
+const std::size_t kMinInMemoryMergeMemorySize = 1024 * 1024;
+
+/**
+ * Minimal count of files which are merged at once
+ */
+const std::size_t kMinMergeFanIn = 2;
+
+/**
+ * Minimal count of runs merged by background compaction, it is not worth running otherwise
+ */
+const std::size_t kMinCompactionFanIn = 4;
+
+/**
+ * Memory of a bucket file of the distribution sort (stream and its mutex)
+ */
+const std::size_t kBucketOverheadMemorySize = 16 * 1024;
+
+/**
+ * Maximal count of range buckets which a file is partitioned to at once (the count of open files is twice as much)
+ */
+const std::size_t kMaxRangeBucketsCount = 256;
+
+/**
+ * Count of samples per range bucket for choosing splitters
+ */
+const std::size_t kSplitterOversampling = 16;
+
+/**
+ * Maximal depth of partitioning oversized buckets
+ */
+const std::size_t kMaxDistributionDepth = 8;
+
+/**
+ * Size of the buffer for writing an equality bucket of the distribution sort
+ */
+const std::size_t kEqualityBucketBufferSize = 64 * 1024;
+
+/**
+ * Size of the buffer for writing sorted keys to the values file of the argsort mode
+ */
+const std::size_t kArgsortValuesBufferSize = 64 * 1024;
+
+/**
+ * Maximal count of distinct values of a chunk sorted by the counting sort engine, so its table is a small part of the
+ * memory overhead of a thread
+ */
+const std::size_t kMaxChunkCountedValuesCount = 4096;
+
+/**
+ * Maximal count of distinct values of the counting strategy, so tables of threads stay in caches, input with more
+ * values is sorted faster by merging
+ */
+const std::size_t kMaxCountedValuesCount = 64 * 1024;
+
+/**
+ * Minimal count of distinct values which tables of the counting strategy must fit in memory
+ */
+const std::size_t kMinCountedValuesCount = 1024;
+
+/**
+ * Count of numbers sampled for detecting input with few distinct values
+ */
+const std::size_t kCardinalitySamplesCount = 64 * 1024;
+
+/**
+ * Minimal average count of occurrences of a distinct value in the sample: the counting strategy is used only if
+ * values repeat so often that the sample has likely seen most of them
+ */
+const std::size_t kMinSampledValueOccurrences = 4;
+
+/**
+ * Maximal size of a chunk of the counting strategy, chunks are only counted, so larger ones would not reduce work
+ */
+const std::size_t kMaxCountingChunkSize = 4 * 1024 * 1024;
+
+/**
+ * Returns how many numbers have to be allocated per number of a chunk: the chunk itself and a scratch buffer (if the
+ * sort engine needs it)
+ * @param sort_engine sort engine
+ * @return factor
+ */
+std::size_t CalcChunkAllocationFactor(SortEngine sort_engine) noexcept {
+  return sort_engine == SortEngine::kRadixSort ? 2 : 1;
+}
+
+/**
+ * Sorts a chunk of numbers
+ * @tparam NumberType
+ * @param sort_engine sort engine
+ * @param buffer chunk buffer allocated according to CalcChunkAllocationFactor()
+ * @param chunk_numbers_count capacity of the chunk
+ * @param numbers_count count of numbers to sort
+ */
+template <typename NumberType>
+void SortChunk(SortEngine sort_engine, NumberType* buffer, std::size_t chunk_numbers_count, std::size_t numbers_count) {
+  switch (sort_engine) {
+    case SortEngine::kIntroSort:
+      // std::sort works in place, so a chunk never needs more memory than its buffer (unlike std::stable_sort).
+      std::sort(buffer, buffer + numbers_count);
+      break;
+    case SortEngine::kRadixSort:
+      RadixSort(buffer, buffer + numbers_count, buffer + chunk_numbers_count);
+      break;
+    case SortEngine::kCountingSort:
+      if (!CountingSort(buffer, buffer + numbers_count, kMaxChunkCountedValuesCount)) {
+        std::sort(buffer, buffer + numbers_count);
+      }
+      break;
+  }
+}
+
+exception_t MakeFailedReadFileException(std::string_view file_path, int err) {
+  return MakeException("Failed to read ", file_path, std::string_view{": "}, err);
+}
+
+/**
+ * Classifies numbers to buckets of the distribution sort. Every splitter has its own equality bucket, so buckets are:
+ * (-inf, s0), [s0], (s0, s1), [s1], ..., (sN, +inf). Equality buckets never need sorting, so heavy duplicates do not
+ * produce oversized buckets.
+ * @tparam NumberType type of numbers
+ */
+template <typename NumberType>
+class BucketClassifier {
+ public:
+  /**
+   * Constructor
+   * @param splitters sorted unique splitters
+   */
+  explicit BucketClassifier(const std::vector<NumberType>& splitters) : splitters_{splitters} {}
+
+  /**
+   * Returns count of buckets
+   * @return count
+   */
+  std::size_t bucketsCount() const noexcept { return splitters_.size() * 2 + 1; }
+
+  /**
+   * Returns index of the bucket of a number
+   * @param number number
+   * @return index
+   */
+  std::size_t operator()(NumberType number) const noexcept {
+    const auto range_index =
+        static_cast<std::size_t>(std::upper_bound(splitters_.begin(), splitters_.end(), number) - splitters_.begin());
+
+    return range_index > 0 && splitters_[range_index - 1] == number ? range_index * 2 - 1 : range_index * 2;
+  }
+
+  /**
+   * Checks whether all numbers of a bucket are equal
+   * @param bucket_index index of the bucket
+   * @return true for equality buckets
+   */
+  static bool isEqualityBucket(std::size_t bucket_index) noexcept { return bucket_index % 2 == 1; }
+
+ private:
+  const std::vector<NumberType>& splitters_;  ///< Sorted unique splitters
+};
+
+/**
+ * Reads numbers at evenly spaced positions of files (as if they were concatenated)
+ * @tparam NumberType type of numbers
+ * @param files_paths paths to files
+ * @param numbers_count count of numbers in the files
+ * @param samples_count count of numbers to read (at most numbers_count)
+ * @return sorted numbers
+ */
+template <typename NumberType>
+std::vector<NumberType> ReadSamples(const std::vector<std::string>& files_paths, std::uint64_t numbers_count,
+                                    std::size_t samples_count) {
+  std::vector<NumberType> samples(samples_count);
+  std::ifstream stream;
+  std::size_t file_index = 0;
+  std::uint64_t file_begin = 0;  // position of the first number of the current file
+  std::uint64_t file_end = 0;    // position after the last number of the current file
+
+  for (std::size_t i = 0; i < samples_count; ++i) {
+    const auto position = (i * numbers_count + numbers_count / 2) / samples_count;
+
+    while (position >= file_end) {
+      file_begin = file_end;
+      file_end += std::filesystem::file_size(files_paths[file_index]) / sizeof(NumberType);
+      stream = OpenInputBinaryFileStream(files_paths[file_index++]);
+    }
+
+    stream.seekg(static_cast<std::streamoff>((position - file_begin) * sizeof(NumberType)));
+    stream.read(reinterpret_cast<char*>(&samples[i]), sizeof(NumberType));
+
+    if (!stream) {
+      throw MakeFailedReadFileException(files_paths[file_index - 1], errno);
+    }
+  }
+
+  std::sort(samples.begin(), samples.end());
+
+  return samples;
+}
+
+/**
+ * Chooses splitters of range buckets from sampled numbers of files
+ * @tparam NumberType type of numbers
+ * @param files_paths paths to files
+ * @param numbers_count count of numbers in the files
+ * @param range_buckets_count desired count of range buckets
+ * @return sorted unique splitters
+ */
+template <typename NumberType>
+std::vector<NumberType> SampleSplitters(const std::vector<std::string>& files_paths, std::uint64_t numbers_count,
+                                        std::size_t range_buckets_count) {
+  ES_TRACE_SCOPE("io", "sample splitters");
+
+  const auto samples_count =
+      static_cast<std::size_t>(std::min<std::uint64_t>(numbers_count, range_buckets_count * kSplitterOversampling));
+  const auto samples = ReadSamples<NumberType>(files_paths, numbers_count, samples_count);
+
+  std::vector<NumberType> splitters;
+
+  for (std::size_t i = 1; i < range_buckets_count && !samples.empty(); ++i) {
+    splitters.push_back(samples[i * samples_count / range_buckets_count]);
+  }
+
+  splitters.erase(std::unique(splitters.begin(), splitters.end()), splitters.end());
+
+  return splitters;
+}
+
+/**
+ * Checks by sampled numbers whether files have few distinct values, so they are sorted faster by counting values.
+ * Numbers of up to 16 bits are always counted, as their tables never overflow.
+ * @tparam NumberType type of numbers
+ * @param files_paths paths to files
+ * @param max_values_count maximal count of distinct values which can be counted
+ * @return true if the sample has at most a half of max_values_count distinct values, each of them repeated enough
+ */
+template <typename NumberType>
+bool IsLowCardinality(const std::vector<std::string>& files_paths, std::size_t max_values_count) {
+  if (sizeof(NumberType) <= 2) {
+    return true;
+  }
+
+  ES_TRACE_SCOPE("io", "sample cardinality");
+
+  const auto numbers_count = CountNumbers<NumberType>(files_paths);
+  const auto samples_count =
+      static_cast<std::size_t>(std::min<std::uint64_t>(numbers_count, kCardinalitySamplesCount));
+  auto samples = ReadSamples<NumberType>(files_paths, numbers_count, samples_count);
+
+  const auto values_count =
+      static_cast<std::size_t>(std::unique(samples.begin(), samples.end()) - samples.begin());
+
+  // All numbers of a small input are sampled, so their distinct values are known exactly.
+  if (samples_count == numbers_count) {
+    return values_count <= max_values_count;
+  }
+
+  return values_count * kMinSampledValueOccurrences <= samples_count && values_count <= max_values_count / 2;
+}
+
+/**
+ * Measures wall and CPU time of a phase
+ */
+class PhaseTimer {
+ public:
+  PhaseTimer() noexcept : wall_start_time_{SteadyClockNs()}, cpu_start_time_{ProcessCpuTimeNs()} {}
+
+  /**
+   * Returns time elapsed since construction
+   * @return statistics of the phase
+   */
+  PhaseStats elapsed() const noexcept {
+    return PhaseStats{SteadyClockNs() - wall_start_time_, ProcessCpuTimeNs() - cpu_start_time_};
+  }
+
+ private:
+  std::uint64_t wall_start_time_;  ///< Wall time of start
+  std::uint64_t cpu_start_time_;   ///< CPU time of start
+};
+
+/**
+ * Waits for all tasks of a thread pool if its scope is left by an exception, so tasks of a failed operation never refer
+ * to objects destroyed by unwinding
+ */
+class PendingTasksGuard {
+ public:
+  explicit PendingTasksGuard(const ThreadPool& thread_pool) noexcept
+      : thread_pool_{thread_pool}, uncaught_exceptions_count_{std::uncaught_exceptions()} {}
+
+  ~PendingTasksGuard() {
+    if (std::uncaught_exceptions() == uncaught_exceptions_count_) {
+      return;
+    }
+
+    while (thread_pool_.hasPendingTasks()) {
+      std::this_thread::yield();
+    }
+  }
+
+  PendingTasksGuard(const PendingTasksGuard&) = delete;
+  PendingTasksGuard& operator=(const PendingTasksGuard&) = delete;
+
+ private:
+  const ThreadPool& thread_pool_;  ///< Thread pool
+  int uncaught_exceptions_count_;  ///< Count of uncaught exceptions when the guard was created
+};
+
+}  // namespace
+
+template <typename NumberType>
+ExternalSorter<NumberType>::ExternalSorter(std::size_t available_memory, std::string input_file_path,
+                                           std::string output_directory_path, std::shared_ptr<ThreadPool> thread_pool,
+                                           SorterOptions options)
+    : ExternalSorter(available_memory, std::vector<InputFile>{InputFile{std::move(input_file_path)}},
+                     std::move(output_directory_path), std::move(thread_pool), std::move(options)) {}
+
+template <typename NumberType>
+ExternalSorter<NumberType>::ExternalSorter(std::size_t available_memory, std::vector<InputFile> input_files,
+                                           std::string output_directory_path, std::shared_ptr<ThreadPool> thread_pool,
+                                           SorterOptions options)
+    : input_files_{std::move(input_files)},
+      output_directory_path_{std::move(output_directory_path)},
+      options_{std::move(options)},
+      output_file_path_{CreateOutputFilePath(output_directory_path_, options_.output_file_name_)},
+      intermediate_directories_paths_{
+          CreateIntermediateDirectoriesPaths(output_directory_path_, options_.spill_directories_,
+                                             options_.intermediate_directory_name_)},
+      unsorted_input_files_paths_{SelectUnsortedInputFilesPaths(input_files_)},
+      unsorted_input_files_streams_{OpenInputFilesStreams(unsorted_input_files_paths_)},
+      output_file_{OpenOutputFile(output_file_path_, options_, input_files_)},
+      thread_pool_{std::move(thread_pool)},
+      counters_{thread_pool_->threadsCount()},
+      memory_budget_{std::make_unique<MemoryBudget>(ResolveAvailableMemory(available_memory))} {
+  if (input_files_.empty()) {
+    throw MakeException("There are no input files");
+  }
+
+  for (const auto& input_file : input_files_) {
+    if (input_file.is_sorted_) {
+      // Sorted input files are read only by the merge, so they are checked in advance.
+      OpenInputBinaryFileStream(input_file.path_);
+    }
+  }
+
+  const auto overhead_memory_size = CalcOverheadMemorySize(thread_pool_->threadsCount());
+
+  if (memory_budget_->total() < overhead_memory_size + kMinAvailableMemory) {
+    throw MakeException("There is not enough memory.");
+  }
+
+  overhead_reservation_ = memory_budget_->reserve(overhead_memory_size);
+  input_files_size_ = CalcInputFilesSize(options_, input_files_);
+
+  if (options_.argsort_) {
+    if (!std::is_same_v<NumberType, argsort_number_t>) {
+      throw MakeException("The argsort mode requires packed numbers (argsort_number_t)");
+    }
+
+    if (!options_.base_file_path_.empty() || unsorted_input_files_paths_.size() != input_files_.size() ||
+        options_.sparse_index_block_size_ != 0 || options_.output_summary_) {
+      throw MakeException(
+          "The argsort mode does not support sorted inputs, the base file, the sparse index and the output summary");
+    }
+
+    argsort_positions_ = CalcArgsortPositions(unsorted_input_files_paths_);
+  }
+}
+
+template <typename NumberType>
+ExternalSorter<NumberType>::~ExternalSorter() = default;
+
+template <typename NumberType>
+const MemoryBudget& ExternalSorter<NumberType>::memoryBudget() const noexcept {
+  return *memory_budget_;
+}
+
+template <typename NumberType>
+const SortStats& ExternalSorter<NumberType>::stats() const noexcept {
+  return stats_;
+}
+
+template <typename NumberType>
+const OutputSummary& ExternalSorter<NumberType>::outputSummary() const noexcept {
+  return output_summary_;
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::sort() {
+  const auto pool_stats = thread_pool_->stats();
+  const PhaseTimer total_timer{};
+
+  start_time_ns_.store(SteadyClockNs());
+  finish_time_ns_.store(0);
+  phase_.store(SortPhase::kRunGeneration);
+
+  try {
+    createIntermediateDirectories();
+
+    if (options_.sparse_index_block_size_ != 0) {
+      sparse_index_writer_ = std::make_unique<SparseIndexWriter<NumberType>>(
+          CreateSparseIndexFilePath(output_file_path_), options_.sparse_index_block_size_);
+    }
+
+    output_summary_ = {};
+
+    // Ranks of quantiles are computed for all input numbers, which is the count of output numbers.
+    if (options_.output_summary_) {
+      summary_collector_ = std::make_unique<OutputSummaryCollector<NumberType>>(
+          input_files_size_ / sizeof(NumberType), options_.summary_quantiles_, options_.summary_histogram_bounds_);
+    }
+
+    presorted_runs_paths_.clear();
+    input_checksum_ = {};
+    output_checksum_ = {};
+
+    if (!options_.base_file_path_.empty()) {
+      presorted_runs_paths_.emplace_back(options_.base_file_path_);
+    }
+
+    for (const auto& input_file : input_files_) {
+      if (input_file.is_sorted_) {
+        presorted_runs_paths_.emplace_back(input_file.path_);
+      }
+    }
+
+    const auto are_regular_files = AreRegularFiles(unsorted_input_files_paths_);
+
+    // Input which fits in memory is never spilled, so the distribution sort does not pay off then. Keys of the argsort
+    // mode are packed only by readInputFile(), which the distribution sort does not use for sampling.
+    if (options_.sort_strategy_ == SortStrategy::kDistribution && presorted_runs_paths_.empty() &&
+        are_regular_files && !options_.argsort_ && !isInputFitInMemory()) {
+      distributionSortImpl();
+    } else if (options_.sort_strategy_ == SortStrategy::kCounting && presorted_runs_paths_.empty() &&
+               are_regular_files && !options_.argsort_) {
+      countingSortImpl();
+    } else {
+      mergeSortImpl();
+    }
+
+    output_file_->finish();
+
+    if (sparse_index_writer_) {
+      sparse_index_writer_->finish();
+      sparse_index_writer_.reset();
+    }
+
+    if (summary_collector_) {
+      output_summary_ = summary_collector_->finish();
+      summary_collector_.reset();
+
+      WriteOutputSummary(output_summary_, CreateOutputSummaryFilePath(output_file_path_));
+    }
+
+    verifyChecksums();
+  } catch (...) {
+    // Tasks of the failed sorting may still refer to the sorter, and the pool keeps their exception.
+    waitForPendingTasks();
+    thread_pool_->clearException();
+
+    resident_runs_.clear();
+    compressed_run_store_.reset();
+    sparse_index_writer_.reset();
+    summary_collector_.reset();
+    removeIntermediateFiles();
+
+    finish_time_ns_.store(SteadyClockNs());
+    phase_.store(SortPhase::kFinished);
+
+    throw;
+  }
+
+  finish_time_ns_.store(SteadyClockNs());
+  phase_.store(SortPhase::kFinished);
+
+  stats_.total_ = total_timer.elapsed();
+
+  collectStats(pool_stats);
+}
+
+template <typename NumberType>
+SortProgress ExternalSorter<NumberType>::progress() const {
+  SortProgress progress{};
+
+  progress.phase_ = phase_.load();
+
+  if (progress.phase_ == SortPhase::kNotStarted) {
+    return progress;
+  }
+
+  const auto finish_time = finish_time_ns_.load();
+
+  progress.bytes_processed_ =
+      counters_.sum(StatsCounter::kInputBytesRead) + counters_.sum(StatsCounter::kOutputBytesWritten);
+  progress.bytes_total_ = 2 * input_files_size_;
+  progress.elapsed_time_ns_ = (finish_time != 0 ? finish_time : SteadyClockNs()) - start_time_ns_.load();
+
+  // The rest is assumed to be processed at the average rate since the start.
+  if (progress.phase_ != SortPhase::kFinished && progress.bytes_processed_ != 0 &&
+      progress.bytes_total_ > progress.bytes_processed_) {
+    progress.remaining_time_ns_ = static_cast<std::uint64_t>(
+        static_cast<double>(progress.elapsed_time_ns_) *
+        static_cast<double>(progress.bytes_total_ - progress.bytes_processed_) /
+        static_cast<double>(progress.bytes_processed_));
+  }
+
+  return progress;
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::mergeSortImpl() {
+  {
+    ES_TRACE_SCOPE("phase", "run generation");
+    const PhaseTimer run_generation_timer{};
+
+    resident_runs_.clear();
+
+    if (isInputFitInMemory()) {
+      createResidentRuns();
+    } else {
+      startCompaction();
+
+      try {
+        createCompressedRunStore();
+
+        if (options_.numa_local_buffers_) {
+          createSortedChunksImplNumaLocal();
+        } else if (options_.parallel_input_reads_ && !options_.argsort_ &&
+                   AreRegularFiles(unsorted_input_files_paths_)) {
+          createSortedChunksImplParallelReads();
+        } else {
+          createSortedChunksImplMultiThreaded();
+        }
+      } catch (...) {
+        stopCompaction();
+        throw;
+      }
+
+      stopCompaction();
+      reserveResidentRuns();
+    }
+
+    stats_.run_generation_ = run_generation_timer.elapsed();
+    stats_.runs_count_ = intermediate_files_paths_.size() - compacted_runs_paths_.size() + compacted_runs_count_ +
+                         resident_runs_.size();
+    stats_.resident_runs_count_ = resident_runs_.size();
+  }
+
+  phase_.store(SortPhase::kMerge);
+
+  {
+    ES_TRACE_SCOPE("phase", "merge");
+    const PhaseTimer merge_timer{};
+
+    mergeSortedChunksImpl();
+
+    stats_.merge_ = merge_timer.elapsed();
+  }
+}
+
+template <typename NumberType>
+bool ExternalSorter<NumberType>::isInputFitInMemory() const {
+  if (!AreRegularFiles(unsorted_input_files_paths_)) {
+    return false;
+  }
+
+  const auto allocation_factor = CalcChunkAllocationFactor(options_.sort_engine_);
+  const auto input_memory_size =
+      countUnsortedInputNumbers() * sizeof(NumberType) * allocation_factor;
+  const auto merge_memory_size = kMinInMemoryMergeMemorySize + presorted_runs_paths_.size() *
+                                                                   (kMinFileBufferMemorySize +
+                                                                    kFileOverheadMemorySize<NumberType>);
+
+  return input_memory_size + merge_memory_size <= memory_budget_->available();
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::createResidentRuns() {
+  const auto allocation_factor = CalcChunkAllocationFactor(options_.sort_engine_);
+  const auto numbers_count = countUnsortedInputNumbers();
+
+  // Every thread of the pool sorts its run while the current thread reads the next one.
+  const auto runs_count = static_cast<std::size_t>(
+      std::clamp<std::uint64_t>(numbers_count, 1, std::max<std::size_t>(thread_pool_->threadsCount(), 1)));
+
+  std::shared_ptr<std::atomic_bool[]> is_sorted{new std::atomic_bool[runs_count]{}};
+
+  resident_runs_.resize(runs_count);
+
+  for (std::size_t i = 0; i < runs_count; ++i) {
+    const auto run_numbers_count =
+        static_cast<std::size_t>(numbers_count * (i + 1) / runs_count - numbers_count * i / runs_count);
+    auto& run = resident_runs_[i];
+
+    checkCancellation();
+
+    run.reservation_ = memory_budget_->reserve(allocation_factor * run_numbers_count * sizeof(NumberType));
+    run.numbers_ = std::make_unique<NumberType[]>(allocation_factor * run_numbers_count);
+
+    const auto bytes_read =
+        readInputFiles(reinterpret_cast<char*>(run.numbers_.get()), run_numbers_count * sizeof(NumberType));
+
+    counters_.add(StatsCounter::kInputBytesRead, bytes_read);
+
+    run.numbers_count_ = bytes_read / sizeof(NumberType);
+
+    thread_pool_->add([this, is_sorted, run_index = i, numbers = run.numbers_.get(), run_numbers_count,
+                       sorted_numbers_count = run.numbers_count_]() {
+      checkCancellation();
+
+      addInputChecksum(numbers, sorted_numbers_count);
+
+      {
+        ES_TRACE_SCOPE("cpu", "sort chunk");
+
+        SortChunk(options_.sort_engine_, numbers, run_numbers_count, sorted_numbers_count);
+      }
+
+      is_sorted[run_index].store(true, std::memory_order_release);
+    });
+  }
+
+  for (std::size_t i = 0; i < runs_count; ++i) {
+    thread_pool_->waitForTask(is_sorted[i]);
+  }
+
+  thread_pool_->checkException();
+
+  resident_runs_.erase(std::remove_if(resident_runs_.begin(), resident_runs_.end(),
+                                      [](const auto& run) { return run.numbers_count_ == 0; }),
+                       resident_runs_.end());
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::addResidentRun(MemoryReservation& reservation, std::unique_ptr<NumberType[]>& buffer,
+                                                std::size_t numbers_count) {
+  std::scoped_lock<std::mutex> lock(intermediate_files_mutex_);
+
+  resident_runs_.push_back(ResidentRun{std::move(reservation), std::move(buffer), numbers_count});
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::reserveResidentRuns() {
+  for (auto& run : resident_runs_) {
+    const auto size = run.numbers_count_ * sizeof(NumberType);
+
+    // The chunk buffer may be much larger than the run (and has scratch space of the sort engine), so it is replaced by
+    // a copy. It stays reserved until then, so the run is spilled if there is no room for the copy.
+    if (size > memory_budget_->available()) {
+      writeIntermediateFile(reinterpret_cast<const char*>(run.numbers_.get()), size);
+
+      run.numbers_.reset();
+      run.reservation_.reset();
+
+      continue;
+    }
+
+    auto reservation = memory_budget_->reserve(size);
+    auto numbers = std::make_unique<NumberType[]>(run.numbers_count_);
+    std::copy_n(run.numbers_.get(), run.numbers_count_, numbers.get());
+
+    run.numbers_ = std::move(numbers);
+    run.reservation_ = std::move(reservation);
+  }
+
+  resident_runs_.erase(std::remove_if(resident_runs_.begin(), resident_runs_.end(),
+                                      [](const auto& run) { return !run.numbers_; }),
+                       resident_runs_.end());
+
+  if (!compressed_run_store_) {
+    return;
+  }
+
+  stats_.evicted_runs_count_ = compressed_run_store_->evictedRunsCount();
+
+  // The memory of the store is released, so every compressed run is reserved by its size.
+  for (auto& run : compressed_run_store_->takeRuns()) {
+    const auto numbers_count = static_cast<std::size_t>(run.numbersCount());
+
+    ++stats_.compressed_runs_count_;
+    stats_.compressed_runs_size_ += run.size();
+
+    auto reservation = memory_budget_->reserve(run.size());
+    resident_runs_.push_back(ResidentRun{std::move(reservation), nullptr, numbers_count, std::move(run)});
+  }
+
+  compressed_run_store_.reset();
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::distributionSortImpl() {
+  std::vector<std::filesystem::path> buckets_paths;
+
+  {
+    ES_TRACE_SCOPE("phase", "partition");
+    const PhaseTimer partition_timer{};
+
+    const auto numbers_count = CountNumbers<NumberType>(unsorted_input_files_paths_);
+    const auto splitters = SampleSplitters<NumberType>(unsorted_input_files_paths_, numbers_count,
+                                                       calcRangeBucketsCount(numbers_count));
+
+    buckets_paths = partitionToBuckets(createInputChunkSources(), StatsCounter::kInputBytesRead, splitters);
+
+    stats_.run_generation_ = partition_timer.elapsed();
+    stats_.runs_count_ = buckets_paths.size();
+  }
+
+  phase_.store(SortPhase::kMerge);
+
+  {
+    ES_TRACE_SCOPE("phase", "sort buckets");
+    const PhaseTimer sort_buckets_timer{};
+
+    sortBuckets(buckets_paths, 0);
+
+    stats_.merge_ = sort_buckets_timer.elapsed();
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::countingSortImpl() {
+  std::vector<CountedValue<NumberType>> values;
+  bool is_counted = false;
+
+  {
+    ES_TRACE_SCOPE("phase", "count");
+    const PhaseTimer count_timer{};
+
+    const auto max_values_count = calcMaxCountedValuesCount(thread_pool_->threadsCount() + 1);
+
+    is_counted = max_values_count != 0 &&
+                 IsLowCardinality<NumberType>(unsorted_input_files_paths_, max_values_count) &&
+                 countInputNumbers(max_values_count, values);
+
+    stats_.run_generation_ = count_timer.elapsed();
+    stats_.counted_values_count_ = is_counted ? values.size() : 0;
+  }
+
+  if (!is_counted) {
+    rewindInputFiles();
+    mergeSortImpl();
+
+    return;
+  }
+
+  phase_.store(SortPhase::kMerge);
+
+  {
+    ES_TRACE_SCOPE("phase", "write counted values");
+    const PhaseTimer write_timer{};
+
+    writeCountedValues(values);
+
+    stats_.merge_ = write_timer.elapsed();
+  }
+}
+
+template <typename NumberType>
+std::size_t ExternalSorter<NumberType>::calcMaxCountedValuesCount(std::size_t tables_count) const {
+  const auto table_memory_size = memory_budget_->available() / 2 / tables_count;
+  auto max_values_count = kMaxCountedValuesCount;
+
+  while (max_values_count >= kMinCountedValuesCount &&
+         CountingTable<NumberType>::calcMemorySize(max_values_count) > table_memory_size) {
+    max_values_count /= 2;
+  }
+
+  return max_values_count >= kMinCountedValuesCount ? max_values_count : 0;
+}
+
+template <typename NumberType>
+bool ExternalSorter<NumberType>::countInputNumbers(std::size_t max_values_count,
+                                                   std::vector<CountedValue<NumberType>>& values) {
+  // Stage tasks run only in threads of the pool, the last table is for other threads just in case.
+  const auto tables_count = thread_pool_->threadsCount() + 1;
+  const auto tables_reservation =
+      memory_budget_->reserve(tables_count * CountingTable<NumberType>::calcMemorySize(max_values_count));
+
+  std::vector<CountingTable<NumberType>> tables;
+  tables.reserve(tables_count);
+
+  for (std::size_t i = 0; i < tables_count; ++i) {
+    tables.emplace_back(max_values_count);
+  }
+
+  std::atomic_bool is_overflowed = false;
+  auto sources = createInputChunkSources();
+
+  for (auto& source : sources) {
+    source.read_ = [&is_overflowed, read = std::move(source.read_)](char* buffer, std::size_t size) {
+      return is_overflowed.load() ? FileReadResult{true, 0} : read(buffer, size);
+    };
+  }
+
+  // Chunks are only counted, so they are much smaller than chunks of run generation.
+  const std::size_t chunks_count = thread_pool_->threadsCount() + CountReaders(sources);
+  const auto chunk_numbers_count = std::max<std::size_t>(
+      std::min(memory_budget_->available() / 2 / chunks_count, kMaxCountingChunkSize) / sizeof(NumberType), 1);
+
+  Pipeline<Chunk> pipeline{thread_pool_};
+
+  addInputChecksumStage(pipeline);
+
+  pipeline.addStage("count chunk", thread_pool_->threadsCount(), [this, &tables, &is_overflowed](Chunk& chunk) {
+    checkCancellation();
+
+    ES_TRACE_SCOPE("cpu", "count chunk");
+
+    auto& table = tables[std::min(ThreadPool::currentThreadIndex(), tables.size() - 1)];
+
+    if (!is_overflowed.load() && !table.add(chunk.numbers_.get(), chunk.numbers_count_)) {
+      is_overflowed.store(true);
+    }
+  });
+
+  processChunks(sources, StatsCounter::kInputBytesRead, chunks_count, chunk_numbers_count, 1, pipeline);
+
+  if (is_overflowed.load()) {
+    return false;
+  }
+
+  for (const auto& table : tables) {
+    table.appendValues(values);
+  }
+
+  ReduceCountedValues(values);
+
+  return true;
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::writeCountedValues(const std::vector<CountedValue<NumberType>>& values) {
+  const auto buffers_count = std::max<std::size_t>(options_.output_buffers_count_, 2);
+  const auto buffer_size =
+      RoundSize<NumberType>(CalcMergeBuffersMemorySize(memory_budget_->available()) / buffers_count);
+  const auto buffer_numbers_count = buffer_size / sizeof(NumberType);
+  const auto buffers_reservation = memory_budget_->reserve(buffers_count * buffer_size);
+
+  // Filled buffers are written by threads of the pool while the next ones are filled in the current thread.
+  OutputFileWriter<NumberType> writer{thread_pool_, *output_file_, buffers_count, buffer_numbers_count};
+
+  auto* buffer = writer.buffer();
+  std::size_t buffer_index = 0;
+
+  auto submitBuffer = [&]() {
+    checkCancellation();
+
+    addOutput(reinterpret_cast<const char*>(buffer), buffer_index * sizeof(NumberType));
+
+    writer.submit(buffer_index);
+
+    buffer = writer.buffer();
+    buffer_index = 0;
+  };
+
+  for (const auto& value : values) {
+    for (auto count = value.count_; count != 0;) {
+      if (buffer_index == buffer_numbers_count) {
+        submitBuffer();
+      }
+
+      const auto filled_count =
+          static_cast<std::size_t>(std::min<std::uint64_t>(count, buffer_numbers_count - buffer_index));
+
+      std::fill_n(buffer + buffer_index, filled_count, value.value_);
+
+      buffer_index += filled_count;
+      count -= filled_count;
+    }
+  }
+
+  if (buffer_index != 0) {
+    submitBuffer();
+  }
+
+  writer.waitForWrites();
+
+  counters_.add(StatsCounter::kMergeBufferWaitTime, writer.waitTime());
+  addStagesStats(writer.stats());
+
+  thread_pool_->checkException();
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::rewindInputFiles() {
+  for (auto& stream : unsorted_input_files_streams_) {
+    stream.clear();
+    stream.seekg(0);
+  }
+
+  current_input_file_index_ = 0;
+
+  // Input is read again from the beginning, so bytes of the discarded pass are not counted twice.
+  counters_.reset(StatsCounter::kInputBytesRead);
+
+  std::scoped_lock<std::mutex> lock(input_checksum_mutex_);
+
+  input_checksum_ = {};
+}
+
+// Sorting with this method performs worse than with createSortedChunksImplMultiThreaded().
+template <typename NumberType>
+void ExternalSorter<NumberType>::createSortedChunksImplSingleThreaded() {
+  const auto allocation_factor = CalcChunkAllocationFactor(options_.sort_engine_);
+  const auto numbers_count = calcRunGenerationMemorySize() / sizeof(NumberType) / allocation_factor;
+  const auto buffer_size = numbers_count * sizeof(NumberType);
+  const auto buffer_reservation = memory_budget_->reserve(allocation_factor * buffer_size);
+  auto buffer = std::make_unique<NumberType[]>(allocation_factor * numbers_count);
+
+  while (true) {
+    checkCancellation();
+
+    const auto bytes_read = readInputFiles(reinterpret_cast<char*>(buffer.get()), buffer_size);
+
+    counters_.add(StatsCounter::kInputBytesRead, bytes_read);
+
+    if (bytes_read != 0) {
+      addInputChecksum(buffer.get(), bytes_read / sizeof(NumberType));
+
+      SortChunk(options_.sort_engine_, buffer.get(), numbers_count, bytes_read / sizeof(NumberType));
+
+      writeIntermediateFile(reinterpret_cast<char*>(buffer.get()), bytes_read);
+    }
+
+    if (buffer_size != bytes_read) {
+      break;
+    }
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::createIntermediateDirectories() const {
+  for (const auto& intermediate_directory_path : intermediate_directories_paths_) {
+    std::error_code ec{};
+    std::filesystem::create_directories(intermediate_directory_path, ec);
+    if (ec) {
+      throw MakeException("Failed to create the intermediate directory: ", ec);
+    }
+  }
+}
+
+template <typename NumberType>
+std::size_t ExternalSorter<NumberType>::selectIntermediateDirectory() {
+  const auto directories_count = intermediate_directories_paths_.size();
+
+  if (options_.spill_placement_ == SpillPlacement::kMostFreeSpace && directories_count > 1) {
+    std::size_t best_index = directories_count;
+    std::uintmax_t best_available = 0;
+
+    for (std::size_t i = 0; i < directories_count; ++i) {
+      std::error_code ec{};
+      const auto space_info = std::filesystem::space(intermediate_directories_paths_[i], ec);
+
+      if (!ec && space_info.available > best_available) {
+        best_index = i;
+        best_available = space_info.available;
+      }
+    }
+
+    if (best_index != directories_count) {
+      return best_index;
+    }
+  }
+
+  return next_directory_index_++ % directories_count;
+}
+
+template <typename NumberType>
+FileReadResult ExternalSorter<NumberType>::readInputFile(std::size_t index, char* buffer, std::size_t size) {
+  ES_TRACE_SCOPE("io", "read input file");
+
+  if (options_.argsort_) {
+    return readArgsortKeys(index, buffer, size);
+  }
+
+  return ReadFileStream(unsorted_input_files_streams_[index], buffer, size);
+}
+
+template <typename NumberType>
+FileReadResult ExternalSorter<NumberType>::readArgsortKeys(std::size_t index, char* buffer, std::size_t size) {
+  // Keys are read to the second half of the buffer and packed from its beginning, so a packed number overwrites only
+  // keys which are packed already.
+  const auto numbers_count = size / sizeof(argsort_number_t);
+  auto* keys = buffer + numbers_count * sizeof(number_t);
+
+  auto [ok, bytes_count] = ReadFileStream(unsorted_input_files_streams_[index], keys, numbers_count * sizeof(number_t));
+
+  if (!ok) {
+    return {false, 0};
+  }
+
+  const auto keys_count = bytes_count / sizeof(number_t);
+  auto& position = argsort_positions_[index];
+
+  if (position + keys_count > kMaxArgsortNumbersCount) {
+    throw MakeException("There are too many numbers for the argsort mode");
+  }
+
+  for (std::size_t i = 0; i < keys_count; ++i) {
+    number_t key;
+    std::memcpy(&key, keys + i * sizeof(key), sizeof(key));
+
+    const auto number = PackArgsortNumber(key, position + i);
+    std::memcpy(buffer + i * sizeof(number), &number, sizeof(number));
+  }
+
+  position += keys_count;
+
+  return {true, keys_count * sizeof(argsort_number_t)};
+}
+
+template <typename NumberType>
+std::uint64_t ExternalSorter<NumberType>::countUnsortedInputNumbers() const {
+  return options_.argsort_ ? CountNumbers<number_t>(unsorted_input_files_paths_)
+                           : CountNumbers<NumberType>(unsorted_input_files_paths_);
+}
+
+template <typename NumberType>
+std::size_t ExternalSorter<NumberType>::readInputFiles(char* buffer, std::size_t size) {
+  std::size_t bytes_read = 0;
+
+  while (bytes_read != size && current_input_file_index_ != unsorted_input_files_streams_.size()) {
+    auto [ok, bytes_count] = readInputFile(current_input_file_index_, buffer + bytes_read, size - bytes_read);
+
+    if (!ok) {
+      throw MakeFailedReadFileException(unsorted_input_files_paths_[current_input_file_index_], errno);
+    }
+
+    bytes_read += bytes_count;
+
+    if (bytes_read != size) {
+      ++current_input_file_index_;
+    }
+  }
+
+  return bytes_read;
+}
+
+template <typename NumberType>
+std::vector<typename ExternalSorter<NumberType>::ChunkSource> ExternalSorter<NumberType>::createInputChunkSources() {
+  std::vector<ChunkSource> sources;
+  std::vector<std::uint64_t> readers_devices_ids;
+
+  for (std::size_t i = 0; i < unsorted_input_files_paths_.size(); ++i) {
+    const auto& file_path = unsorted_input_files_paths_[i];
+    std::size_t reader_index = 0;
+
+    if (options_.input_readers_count_ != 0) {
+      reader_index = i % options_.input_readers_count_;
+    } else {
+      const auto device_id = GetFileDeviceId(file_path);
+      const auto it = std::find(readers_devices_ids.begin(), readers_devices_ids.end(), device_id);
+
+      reader_index = static_cast<std::size_t>(it - readers_devices_ids.begin());
+
+      if (it == readers_devices_ids.end()) {
+        readers_devices_ids.push_back(device_id);
+      }
+    }
+
+    sources.push_back(ChunkSource{
+        file_path, [this, i](char* buffer, std::size_t size) { return readInputFile(i, buffer, size); }, reader_index});
+  }
+
+  return sources;
+}
+
+template <typename NumberType>
+std::filesystem::path ExternalSorter<NumberType>::createIntermediateFilePath() {
+  return CreateIntermediateFilePath(intermediate_directories_paths_[selectIntermediateDirectory()],
+                                    intermediate_files_count_++);
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::writeIntermediateFile(const char* buffer, std::size_t size) {
+  auto path = createIntermediateFilePath();
+
+  {
+    OutputFile file{path.string(), CreateOutputFileOptions(options_, size)};
+    RunFileWriter<NumberType> run_writer{file};
+
+    file.append(buffer, size);
+    run_writer.add(reinterpret_cast<const NumberType*>(buffer), size / sizeof(NumberType));
+    run_writer.finish();
+    file.finish();
+  }
+
+  addIntermediateFile(std::move(path), size);
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::writeSortedChunk(const NumberType* numbers, std::size_t numbers_count) {
+  if (compressed_run_store_) {
+    const auto size = CompressedRun<NumberType>::calcSize(numbers, numbers_count);
+    std::optional<CompressedRun<NumberType>> evicted_run;
+
+    // Evicted runs are spilled until there is room for the chunk or nothing can be evicted.
+    while (true) {
+      if (compressed_run_store_->reserve(size, evicted_run)) {
+        ES_TRACE_SCOPE("cpu", "compress chunk");
+
+        compressed_run_store_->add(CompressedRun<NumberType>{numbers, numbers_count});
+
+        return;
+      }
+
+      if (!evicted_run) {
+        break;
+      }
+
+      writeCompressedRun(std::move(*evicted_run));
+    }
+  }
+
+  writeIntermediateFile(reinterpret_cast<const char*>(numbers), numbers_count * sizeof(NumberType));
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::writeCompressedRun(CompressedRun<NumberType> run) {
+  const auto size = static_cast<std::size_t>(run.numbersCount()) * sizeof(NumberType);
+  auto path = createIntermediateFilePath();
+
+  {
+    OutputFile file{path.string(), CreateOutputFileOptions(options_, size)};
+    RunFileWriter<NumberType> run_writer{file};
+
+    compressed_run_store_->spill(std::move(run), [&file, &run_writer](const NumberType* numbers, std::size_t count) {
+      file.append(reinterpret_cast<const char*>(numbers), count * sizeof(NumberType));
+      run_writer.add(numbers, count);
+    });
+
+    run_writer.finish();
+    file.finish();
+  }
+
+  addIntermediateFile(std::move(path), size);
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::addIntermediateFile(std::filesystem::path path, std::size_t size) {
+  counters_.add(StatsCounter::kIntermediateBytesWritten, size);
+
+  std::scoped_lock<std::mutex> lock(intermediate_files_mutex_);
+
+  intermediate_files_paths_.push_back(std::move(path));
+
+  intermediate_files_cv_.notify_one();
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::startCompaction() {
+  compacted_runs_paths_.clear();
+  compacted_runs_count_ = 0;
+  is_run_generation_over_ = false;
+  compaction_exception_ = nullptr;
+
+  if (!options_.background_compaction_) {
+    return;
+  }
+
+  // Compaction gets a quarter of memory, run generation has less memory for chunks then, so there are more runs.
+  compaction_memory_size_ = memory_budget_->available() / 4;
+
+  if (calcMergeFanIn(compaction_memory_size_) < kMinCompactionFanIn) {
+    compaction_memory_size_ = 0;
+
+    return;
+  }
+
+  // Tasks of compaction belong to the task group of the sorter (e.g. of its job in a shared pool).
+  compaction_thread_ = std::thread([this, task_group = ThreadPool::currentTaskGroup()]() {
+    const ThreadPool::TaskGroupScope task_group_scope{task_group};
+
+    try {
+      compactRuns();
+    } catch (...) {
+      compaction_exception_ = std::current_exception();
+    }
+  });
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::createCompressedRunStore() {
+  compressed_run_store_.reset();
+
+  if (!options_.compressed_runs_) {
+    return;
+  }
+
+  // Chunks are smaller then, but a sorted chunk usually takes a fraction of its size in the store, so more input is
+  // kept in memory than the memory taken from chunks.
+  compressed_run_store_ =
+      std::make_unique<CompressedRunStore<NumberType>>(memory_budget_->reserve(calcRunGenerationMemorySize() / 2));
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::stopCompaction() {
+  if (!compaction_thread_.joinable()) {
+    return;
+  }
+
+  {
+    std::scoped_lock<std::mutex> lock(intermediate_files_mutex_);
+
+    is_run_generation_over_ = true;
+
+    intermediate_files_cv_.notify_one();
+  }
+
+  compaction_thread_.join();
+  compaction_memory_size_ = 0;
+
+  intermediate_files_paths_.insert(intermediate_files_paths_.end(), compacted_runs_paths_.begin(),
+                                   compacted_runs_paths_.end());
+
+  if (compaction_exception_) {
+    std::rethrow_exception(compaction_exception_);
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::compactRuns() {
+  const auto fan_in = calcMergeFanIn(compaction_memory_size_);
+
+  std::unique_lock<std::mutex> lock(intermediate_files_mutex_);
+
+  while (true) {
+    intermediate_files_cv_.wait(
+        lock, [this, fan_in]() { return is_run_generation_over_ || intermediate_files_paths_.size() >= fan_in; });
+
+    // Remaining runs are merged by the final merge, which would have to wait for compaction otherwise.
+    if (is_run_generation_over_) {
+      return;
+    }
+
+    const std::vector<std::filesystem::path> files_paths(intermediate_files_paths_.begin(),
+                                                         intermediate_files_paths_.begin() + fan_in);
+    intermediate_files_paths_.erase(intermediate_files_paths_.begin(), intermediate_files_paths_.begin() + fan_in);
+
+    lock.unlock();
+
+    std::filesystem::path compacted_run_path;
+
+    {
+      ES_TRACE_SCOPE("phase", "compaction");
+
+      compacted_run_path = mergeToIntermediateFile(files_paths, compaction_memory_size_);
+    }
+
+    lock.lock();
+
+    compacted_runs_paths_.push_back(std::move(compacted_run_path));
+    compacted_runs_count_ += files_paths.size();
+    ++stats_.compactions_count_;
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::createSortedChunksImplMultiThreaded() {
+  const auto sources = createInputChunkSources();
+
+  // every thread of the pool sorts a chunk while every reader reads the next one
+  const std::size_t chunks_count = thread_pool_->threadsCount() + CountReaders(sources);
+  const auto chunk_allocation_factor = CalcChunkAllocationFactor(options_.sort_engine_);
+  const auto chunk_numbers_count =
+      (calcRunGenerationMemorySize() / sizeof(NumberType)) / (chunks_count * chunk_allocation_factor);
+
+  Pipeline<Chunk> pipeline{thread_pool_};
+
+  addSortChunkStages(pipeline, chunk_numbers_count);
+
+  processChunks(sources, StatsCounter::kInputBytesRead, chunks_count, chunk_numbers_count, chunk_allocation_factor,
+                pipeline);
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::processChunks(const std::vector<ChunkSource>& sources,
+                                               StatsCounter bytes_read_counter, std::size_t chunks_count,
+                                               std::size_t chunk_numbers_count, std::size_t chunk_allocation_factor,
+                                               Pipeline<Chunk>& pipeline) {
+  addChunks(pipeline, chunks_count, chunk_numbers_count, chunk_allocation_factor);
+
+  std::atomic_bool is_stopped = false;
+
+  // Reads files of a reader one by one.
+  auto readSources = [&](std::size_t reader_index) {
+    const ChunkSource* last_source = nullptr;
+
+    for (const auto& source : sources) {
+      if (source.reader_index_ == reader_index) {
+        last_source = &source;
+      }
+    }
+
+    for (const auto& source : sources) {
+      if (source.reader_index_ != reader_index) {
+        continue;
+      }
+
+      while (!is_stopped.load()) {
+        auto chunk = pipeline.acquire();
+
+        // The buffer has been taken away by a stage (e.g. as a resident run), so it is not reused.
+        if (!chunk.numbers_) {
+          continue;
+        }
+
+        checkCancellation();
+
+        const auto chunk_size = chunk_numbers_count * sizeof(NumberType);
+        auto [ok, bytes_read] = source.read_(reinterpret_cast<char*>(chunk.numbers_.get()), chunk_size);
+
+        if (!ok) {
+          throw MakeFailedReadFileException(source.path_, errno);
+        }
+
+        counters_.add(bytes_read_counter, bytes_read);
+
+        if (bytes_read == 0) {
+          pipeline.addItem(std::move(chunk));
+
+          break;
+        }
+
+        const bool is_end_of_source = bytes_read != chunk_size;
+
+        chunk.numbers_count_ = bytes_read / sizeof(NumberType);
+        chunk.is_last_ = is_end_of_source && &source == last_source;
+
+        pipeline.push(std::move(chunk));
+
+        if (is_end_of_source) {
+          break;
+        }
+      }
+    }
+  };
+
+  // The first reader is the current thread, others are started for reading files in parallel.
+  const auto readers_count = CountReaders(sources);
+  std::vector<std::exception_ptr> readers_exceptions(readers_count);
+  std::vector<std::thread> readers;
+
+  const auto task_group = ThreadPool::currentTaskGroup();
+
+  auto runReader = [&](std::size_t reader_index) {
+    const ThreadPool::TaskGroupScope task_group_scope{task_group};
+
+    try {
+      readSources(reader_index);
+    } catch (...) {
+      readers_exceptions[reader_index] = std::current_exception();
+      is_stopped.store(true);
+    }
+  };
+
+  for (std::size_t i = 1; i < readers_count; ++i) {
+    readers.emplace_back(runReader, i);
+  }
+
+  runReader(0);
+
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  for (const auto& reader_exception : readers_exceptions) {
+    if (reader_exception) {
+      std::rethrow_exception(reader_exception);
+    }
+  }
+
+  pipeline.wait();
+
+  counters_.add(StatsCounter::kChunkBufferWaitTime, pipeline.waitTime());
+  addStagesStats(pipeline.stats());
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::addChunks(Pipeline<Chunk>& pipeline, std::size_t chunks_count,
+                                           std::size_t chunk_numbers_count, std::size_t chunk_allocation_factor) {
+  const auto buffer_size = chunk_allocation_factor * chunk_numbers_count * sizeof(NumberType);
+
+  // All buffers are reserved before any of them is allocated, so there is no chunk if memory is exceeded.
+  std::vector<MemoryReservation> reservations;
+
+  for (std::size_t i = 0; i < chunks_count; ++i) {
+    reservations.push_back(memory_budget_->reserve(buffer_size));
+  }
+
+  for (auto& reservation : reservations) {
+    pipeline.addItem(
+        Chunk{std::move(reservation), std::make_unique<NumberType[]>(chunk_allocation_factor * chunk_numbers_count)});
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::addInputChecksumStage(Pipeline<Chunk>& pipeline) {
+  if (!options_.verify_) {
+    return;
+  }
+
+  pipeline.addStage("checksum chunk", thread_pool_->threadsCount(),
+                    [this](Chunk& chunk) { addInputChecksum(chunk.numbers_.get(), chunk.numbers_count_); });
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::addSortChunkStages(Pipeline<Chunk>& pipeline, std::size_t chunk_numbers_count) {
+  addInputChecksumStage(pipeline);
+
+  pipeline.addStage("sort chunk", thread_pool_->threadsCount(), [this, chunk_numbers_count](Chunk& chunk) {
+    checkCancellation();
+
+    ES_TRACE_SCOPE("cpu", "sort chunk");
+
+    SortChunk(options_.sort_engine_, chunk.numbers_.get(), chunk_numbers_count, chunk.numbers_count_);
+  });
+
+  pipeline.addStage("write chunk", thread_pool_->threadsCount(), [this](Chunk& chunk) {
+    // The tail of input is merged from memory, so it is never written and read back.
+    if (chunk.is_last_) {
+      addResidentRun(chunk.reservation_, chunk.numbers_, chunk.numbers_count_);
+    } else {
+      writeSortedChunk(chunk.numbers_.get(), chunk.numbers_count_);
+    }
+  });
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::addStagesStats(const std::vector<StageStats>& stages_stats) {
+  std::scoped_lock<std::mutex> lock(stages_stats_mutex_);
+
+  for (const auto& stage_stats : stages_stats) {
+    auto it = std::find_if(stats_.stages_.begin(), stats_.stages_.end(),
+                           [&stage_stats](const auto& stats) { return stats.name_ == stage_stats.name_; });
+
+    if (it == stats_.stages_.end()) {
+      stats_.stages_.push_back(stage_stats);
+
+      continue;
+    }
+
+    it->parallelism_ = std::max(it->parallelism_, stage_stats.parallelism_);
+    it->items_count_ += stage_stats.items_count_;
+    it->busy_time_ns_ += stage_stats.busy_time_ns_;
+    it->elapsed_time_ns_ += stage_stats.elapsed_time_ns_;
+    it->peak_queue_depth_ = std::max(it->peak_queue_depth_, stage_stats.peak_queue_depth_);
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::createSortedChunksImplNumaLocal() {
+  const std::size_t threads_count = thread_pool_->threadsCount();
+  const auto chunk_allocation_factor = CalcChunkAllocationFactor(options_.sort_engine_);
+  const auto chunk_numbers_count =
+      (calcRunGenerationMemorySize() / sizeof(NumberType)) / (threads_count * chunk_allocation_factor);
+  struct State {
+    std::mutex input_mutex_;                       ///< Mutex of reading the input file
+    std::unique_ptr<std::atomic_bool[]> is_done_;  ///< Flags of finished tasks
+    std::vector<MemoryReservation> reservations_;  ///< Memory of buffers of tasks
+  };
+
+  auto state = std::make_shared<State>();
+  state->is_done_ = std::make_unique<std::atomic_bool[]>(threads_count);
+
+  for (std::size_t i = 0; i < threads_count; ++i) {
+    state->reservations_.push_back(
+        memory_budget_->reserve(chunk_allocation_factor * chunk_numbers_count * sizeof(NumberType)));
+  }
+
+  for (std::size_t i = 0; i < threads_count; ++i) {
+    thread_pool_->add([this, state, task_index = i, chunk_allocation_factor, chunk_numbers_count]() {
+      // The buffer is allocated and zeroed by the thread which reads and sorts all its chunks, so its pages are placed
+      // on the NUMA node of the (pinned) thread.
+      auto buffer = std::make_unique<NumberType[]>(chunk_allocation_factor * chunk_numbers_count);
+
+      while (true) {
+        std::size_t bytes_read = 0;
+
+        checkCancellation();
+
+        {
+          std::scoped_lock<std::mutex> lock(state->input_mutex_);
+
+          bytes_read = readInputFiles(reinterpret_cast<char*>(buffer.get()), chunk_numbers_count * sizeof(NumberType));
+        }
+
+        counters_.add(StatsCounter::kInputBytesRead, bytes_read);
+
+        if (bytes_read == 0) {
+          break;
+        }
+
+        addInputChecksum(buffer.get(), bytes_read / sizeof(NumberType));
+
+        {
+          ES_TRACE_SCOPE("cpu", "sort chunk");
+
+          SortChunk(options_.sort_engine_, buffer.get(), chunk_numbers_count, bytes_read / sizeof(NumberType));
+        }
+
+        // The tail of input is merged from memory, so it is never written and read back.
+        if (bytes_read != chunk_numbers_count * sizeof(NumberType)) {
+          addResidentRun(state->reservations_[task_index], buffer, bytes_read / sizeof(NumberType));
+
+          break;
+        }
+
+        writeSortedChunk(buffer.get(), bytes_read / sizeof(NumberType));
+      }
+
+      state->is_done_[task_index].store(true, std::memory_order_release);
+    });
+  }
+
+  for (std::size_t i = 0; i < threads_count; ++i) {
+    thread_pool_->waitForTask(state->is_done_[i]);
+  }
+
+  // Tasks may outlive the call, but their buffers are freed, except resident runs which have taken their reservations.
+  state->reservations_.clear();
+
+  thread_pool_->checkException();
+}
 
-const std::string_view kOutputFileName{"output"};
-const std::string_view kIntermediateDirectoryName{"intermediate"};
-const std::string_view kIntermediateFileName{"chunk_"};
+template <typename NumberType>
+void ExternalSorter<NumberType>::createSortedChunksImplParallelReads() {
+  std::vector<ConcatenatedInputFile> files;
+  std::uint64_t numbers_count = 0;
 
-/**
- * Calculates amount of memory which can be used for buffers. It is not possible to use all available memory because we
- * need take into account size of thread pool, stacks, and objects.
- * @param total_size total memory size
- * @return size
- */
-std::size_t CalcUsefulMemorySize(std::size_t total_size) noexcept {
-  // magic numbers which were found with perf
-  constexpr std::size_t num = 9;
-  constexpr std::size_t denom = 16;
+  for (const auto& file_path : unsorted_input_files_paths_) {
+    const auto file_numbers_count = CountNumbers<NumberType>({file_path});
 
-  return total_size / denom * num;
-}
+    files.push_back(
+        ConcatenatedInputFile{std::make_unique<InputFileReader>(file_path), numbers_count, file_numbers_count});
+    numbers_count += file_numbers_count;
+  }
 
-std::string CreateOutputFilePath(std::string output_directory_path) {
-  output_directory_path.append(kOutputFileName);
+  // every thread of the pool reads and sorts a chunk, the current thread only schedules them
+  const std::size_t chunks_count = std::max<std::size_t>(thread_pool_->threadsCount(), 1);
+  const auto chunk_allocation_factor = CalcChunkAllocationFactor(options_.sort_engine_);
+  const auto chunk_numbers_count =
+      (calcRunGenerationMemorySize() / sizeof(NumberType)) / (chunks_count * chunk_allocation_factor);
 
-  return output_directory_path;
-}
+  if (chunk_numbers_count == 0) {
+    throw MakeException("There is not enough memory.");
+  }
 
-std::filesystem::path CreateIntermediateDirectoryPath(std::string_view output_directory_path) {
-  std::filesystem::path intermediate_path{output_directory_path};
-  intermediate_path /= kIntermediateDirectoryName;
+  Pipeline<Chunk> pipeline{thread_pool_};
 
-  return intermediate_path;
-}
+  pipeline.addStage("read slice", thread_pool_->threadsCount(), [this, &files](Chunk& chunk) {
+    checkCancellation();
 
-std::filesystem::path CreateIntermediateFilePath(std::filesystem::path intermediate_path, uint32_t id) {
-  intermediate_path /= kIntermediateFileName;
-  intermediate_path += std::to_string(id);
+    ReadConcatenatedFiles(files, chunk.numbers_.get(), chunk.begin_, chunk.numbers_count_);
 
-  return intermediate_path;
-}
+    counters_.add(StatsCounter::kInputBytesRead, chunk.numbers_count_ * sizeof(NumberType));
+  });
+
+  addSortChunkStages(pipeline, chunk_numbers_count);
+  addChunks(pipeline, chunks_count, chunk_numbers_count, chunk_allocation_factor);
+
+  const auto slices_count = (numbers_count + chunk_numbers_count - 1) / chunk_numbers_count;
 
-void WriteFile(std::ofstream& stream, const char* buffer, std::size_t size, std::string_view path) {
-  stream.write(buffer, size);
-  if (!stream) {
-    throw MakeException("Failed to write the file ", path, std::string_view{": "}, errno);
+  for (std::uint64_t slice_index = 0; slice_index < slices_count; ++slice_index) {
+    checkCancellation();
+
+    auto chunk = pipeline.acquire();
+
+    const auto begin = slice_index * chunk_numbers_count;
+
+    chunk.begin_ = begin;
+    chunk.numbers_count_ =
+        static_cast<std::size_t>(std::min<std::uint64_t>(chunk_numbers_count, numbers_count - begin));
+    chunk.is_last_ = slice_index + 1 == slices_count && chunk.numbers_count_ != chunk_numbers_count;
+
+    pipeline.push(std::move(chunk));
   }
-}
 
-void WriteIntermediateFile(std::filesystem::path intermediate_directory_path, uint32_t id, const char* buffer,
-                           std::size_t size) {
-  auto path = CreateIntermediateFilePath(intermediate_directory_path, id++).string();
-  auto stream = OpenOutputBinaryFileStream(path);
+  pipeline.wait();
 
-  WriteFile(stream, buffer, size, path);
+  counters_.add(StatsCounter::kChunkBufferWaitTime, pipeline.waitTime());
+  addStagesStats(pipeline.stats());
 }
 
-/**
- * Calculates amount of memory which will be used for intermediate files buffers
- * @param total_memory total amount of memory
- * @return size
- */
-std::size_t CalcFilesBuffersMemorySize(std::size_t total_memory) {
-  // magic numbers which were found with perf
-  constexpr std::size_t num = 3;
-  constexpr std::size_t denom = 4;
+template <typename NumberType>
+std::vector<std::filesystem::path> ExternalSorter<NumberType>::partitionToBuckets(
+    const std::vector<ChunkSource>& sources, StatsCounter bytes_read_counter,
+    const std::vector<NumberType>& splitters) {
+  struct Bucket {
+    std::filesystem::path path_;        ///< Path to the bucket file
+    std::unique_ptr<OutputFile> file_;  ///< Bucket file, chunks append to it concurrently
+  };
+
+  const BucketClassifier<NumberType> classifier{splitters};
+  const auto buckets_count = classifier.bucketsCount();
+  const auto buckets_reservation = memory_budget_->reserve(buckets_count * kBucketOverheadMemorySize);
+
+  std::shared_ptr<Bucket[]> buckets{new Bucket[buckets_count]};
+
+  for (std::size_t i = 0; i < buckets_count; ++i) {
+    buckets[i].path_ = createIntermediateFilePath();
+    buckets[i].file_ = std::make_unique<OutputFile>(buckets[i].path_.string(), CreateOutputFileOptions(options_, 0));
+  }
+
+  // Chunks are partitioned to a scratch part of their buffers, then every bucket gets a single write per chunk.
+  constexpr std::size_t chunk_allocation_factor = 2;
+  const std::size_t chunks_count = thread_pool_->threadsCount() + CountReaders(sources);
+  const auto chunk_numbers_count =
+      (memory_budget_->available() / sizeof(NumberType)) / (chunks_count * chunk_allocation_factor);
+
+  Pipeline<Chunk> pipeline{thread_pool_};
+
+  if (bytes_read_counter == StatsCounter::kInputBytesRead) {
+    addInputChecksumStage(pipeline);
+  }
+
+  pipeline.addStage("partition chunk", thread_pool_->threadsCount(),
+                    [this, buckets, &classifier, buckets_count, chunk_numbers_count](Chunk& chunk) {
+                      checkCancellation();
+
+                      ES_TRACE_SCOPE("cpu", "partition chunk");
+
+                      auto* buffer = chunk.numbers_.get();
+                      const auto numbers_count = chunk.numbers_count_;
+
+                      std::vector<std::size_t> offsets(buckets_count + 1);
+
+                      for (std::size_t i = 0; i < numbers_count; ++i) {
+                        ++offsets[classifier(buffer[i]) + 1];
+                      }
+
+                      for (std::size_t i = 1; i <= buckets_count; ++i) {
+                        offsets[i] += offsets[i - 1];
+                      }
 
-  return total_memory * num / denom;
+                      auto positions = offsets;
+                      auto* scratch = buffer + chunk_numbers_count;
+
+                      for (std::size_t i = 0; i < numbers_count; ++i) {
+                        scratch[positions[classifier(buffer[i])]++] = buffer[i];
+                      }
+
+                      for (std::size_t i = 0; i < buckets_count; ++i) {
+                        const auto size = (offsets[i + 1] - offsets[i]) * sizeof(NumberType);
+
+                        if (size == 0) {
+                          continue;
+                        }
+
+                        buckets[i].file_->append(reinterpret_cast<const char*>(scratch + offsets[i]), size);
+
+                        counters_.add(StatsCounter::kIntermediateBytesWritten, size);
+                      }
+                    });
+
+  processChunks(sources, bytes_read_counter, chunks_count, chunk_numbers_count, chunk_allocation_factor, pipeline);
+
+  std::vector<std::filesystem::path> buckets_paths;
+  buckets_paths.reserve(buckets_count);
+
+  for (std::size_t i = 0; i < buckets_count; ++i) {
+    buckets[i].file_->finish();
+
+    buckets_paths.push_back(std::move(buckets[i].path_));
+  }
+
+  return buckets_paths;
 }
 
-/**
- * Creates buffers for intermediate files
- * @tparam NumberType
- * @param thread_pool thread pool
- * @param files_count amount of intermediate files
- * @param file_buffer_memory_size size of a buffer
- * @param intermediate_directory_path path to intermediate directory
- * @return buffers
- */
 template <typename NumberType>
-std::vector<BinaryFileBuffer<NumberType>> CreateIntermediateFilesBuffers(
-    std::shared_ptr<ThreadPool> thread_pool, std::size_t files_count, std::size_t file_buffer_memory_size,
-    const std::filesystem::path& intermediate_directory_path) {
-  std::vector<BinaryFileBuffer<NumberType>> files_buffers;
-  files_buffers.reserve(files_count);
+void ExternalSorter<NumberType>::sortBuckets(const std::vector<std::filesystem::path>& buckets_paths,
+                                             std::size_t depth) {
+  struct SortedBucket {
+    std::atomic_bool is_ready_ = false;     ///< Flag of the sorted bucket
+    MemoryReservation reservation_;         ///< Memory of the buffer
+    std::unique_ptr<NumberType[]> buffer_;  ///< Buffer of the bucket
+    std::size_t numbers_count_ = 0;         ///< Count of numbers in the bucket
+  };
+
+  const auto allocation_factor = CalcChunkAllocationFactor(options_.sort_engine_);
+  const auto bucket_capacity = calcBucketCapacity();
+
+  // Buckets are sorted in the pool while the current thread writes already sorted ones to the output file in order.
+  const std::size_t max_sorted_buckets_count = thread_pool_->threadsCount() + 1;
+  std::deque<std::shared_ptr<SortedBucket>> sorted_buckets;
+
+  auto writeSortedBucket = [this, &sorted_buckets]() {
+    auto sorted_bucket = std::move(sorted_buckets.front());
+    sorted_buckets.pop_front();
+
+    thread_pool_->waitForTask(sorted_bucket->is_ready_);
+
+    const auto size = sorted_bucket->numbers_count_ * sizeof(NumberType);
+
+    writeOutputFile(reinterpret_cast<const char*>(sorted_bucket->buffer_.get()), size);
+  };
+
+  auto writeSortedBuckets = [&]() {
+    while (!sorted_buckets.empty()) {
+      writeSortedBucket();
+    }
+  };
+
+  for (std::size_t i = 0; i < buckets_paths.size(); ++i) {
+    const auto& bucket_path = buckets_paths[i];
+    const auto numbers_count = std::filesystem::file_size(bucket_path) / sizeof(NumberType);
+
+    checkCancellation();
+
+    if (numbers_count == 0) {
+      std::filesystem::remove(bucket_path);
+    } else if (BucketClassifier<NumberType>::isEqualityBucket(i)) {
+      writeSortedBuckets();
+      writeEqualityBucket(bucket_path, numbers_count);
+    } else if (numbers_count > bucket_capacity) {
+      writeSortedBuckets();
+
+      if (depth + 1 >= kMaxDistributionDepth) {
+        throw MakeException("Failed to partition an oversized bucket ", bucket_path.string());
+      }
+
+      // The oversized bucket is partitioned again with splitters sampled from its own numbers.
+      auto stream = OpenInputBinaryFileStream(bucket_path.string());
+      const auto splitters =
+          SampleSplitters<NumberType>({bucket_path.string()}, numbers_count, calcRangeBucketsCount(numbers_count));
+      const auto nested_buckets_paths = partitionToBuckets(
+          {ChunkSource{bucket_path.string(),
+                       [&stream](char* buffer, std::size_t size) { return ReadFileStream(stream, buffer, size); }}},
+          StatsCounter::kIntermediateBytesRead, splitters);
+
+      stream.close();
+      std::filesystem::remove(bucket_path);
+
+      sortBuckets(nested_buckets_paths, depth + 1);
+    } else {
+      if (sorted_buckets.size() == max_sorted_buckets_count) {
+        writeSortedBucket();
+      }
+
+      auto sorted_bucket = std::make_shared<SortedBucket>();
+      sorted_bucket->reservation_ = memory_budget_->reserve(allocation_factor * numbers_count * sizeof(NumberType));
+      sorted_bucket->numbers_count_ = numbers_count;
+
+      sorted_buckets.push_back(sorted_bucket);
+
+      thread_pool_->add([this, sorted_bucket, bucket_path, allocation_factor]() {
+        checkCancellation();
+
+        const auto numbers_count = sorted_bucket->numbers_count_;
+        const auto size = numbers_count * sizeof(NumberType);
+
+        sorted_bucket->buffer_ = std::make_unique<NumberType[]>(allocation_factor * numbers_count);
+
+        {
+          auto stream = OpenInputBinaryFileStream(bucket_path.string());
+
+          auto [ok, bytes_read] = ReadFileStream(stream, reinterpret_cast<char*>(sorted_bucket->buffer_.get()), size);
+
+          if (!ok || bytes_read != size) {
+            throw MakeFailedReadFileException(bucket_path.string(), errno);
+          }
+
+          counters_.add(StatsCounter::kIntermediateBytesRead, size);
+        }
+
+        std::filesystem::remove(bucket_path);
+
+        {
+          ES_TRACE_SCOPE("cpu", "sort bucket");
 
-  for (uint32_t i = 0; i < files_count; ++i) {
-    files_buffers.emplace_back(thread_pool, CreateIntermediateFilePath(intermediate_directory_path, i).string(),
-                               file_buffer_memory_size);
+          SortChunk(options_.sort_engine_, sorted_bucket->buffer_.get(), numbers_count, numbers_count);
+        }
+
+        sorted_bucket->is_ready_.store(true, std::memory_order_release);
+      });
+    }
   }
 
-  return files_buffers;
+  writeSortedBuckets();
 }
 
-/**
- * Class for keeping information about an intermediate chunk
- * @tparam NumberType
- */
 template <typename NumberType>
-struct MergeData {
-  std::size_t file_buffer_index_;  ///< index of an intermediate file buffer
-  NumberType value_;               ///< The last number from the intermediate file buffer
-};
+void ExternalSorter<NumberType>::writeEqualityBucket(const std::filesystem::path& bucket_path,
+                                                     std::uint64_t numbers_count) {
+  ES_TRACE_SCOPE("io", "write equality bucket");
 
-/**
- * Greater functor
- * @tparam NumberType
- */
-template <typename NumberType>
-struct MergeDataComparator {
-  bool operator()(const MergeData<NumberType>& lv, const MergeData<NumberType>& rv) noexcept {
-    return lv.value_ > rv.value_;
+  NumberType number{};
+
+  {
+    auto stream = OpenInputBinaryFileStream(bucket_path.string());
+
+    auto [ok, bytes_read] = ReadFileStream(stream, reinterpret_cast<char*>(&number), sizeof(number));
+
+    if (!ok || bytes_read != sizeof(number)) {
+      throw MakeFailedReadFileException(bucket_path.string(), errno);
+    }
+
+    counters_.add(StatsCounter::kIntermediateBytesRead, sizeof(number));
   }
-};
 
-const std::size_t kMinAvailableMemory = 2 * 1024 * 1024;
+  std::filesystem::remove(bucket_path);
+
+  // All numbers of the bucket are equal, so it is written from a buffer filled with the first one.
+  const auto buffer_numbers_count =
+      static_cast<std::size_t>(std::min<std::uint64_t>(numbers_count, kEqualityBucketBufferSize / sizeof(NumberType)));
+  const auto buffer_reservation = memory_budget_->reserve(buffer_numbers_count * sizeof(NumberType));
+  const std::vector<NumberType> buffer(buffer_numbers_count, number);
+
+  while (numbers_count != 0) {
+    const auto count = static_cast<std::size_t>(std::min<std::uint64_t>(numbers_count, buffer_numbers_count));
+
+    writeOutputFile(reinterpret_cast<const char*>(buffer.data()), count * sizeof(NumberType));
+
+    numbers_count -= count;
+  }
+}
 
 template <typename NumberType>
-struct MergeBuffer {
-  std::atomic_bool is_ready_to_fill_ = true;
-  std::unique_ptr<NumberType[]> buffer_;
-};
+void ExternalSorter<NumberType>::writeOutputFile(const char* buffer, std::size_t size) {
+  addOutput(buffer, size);
 
-exception_t MakeFailedReadFileException(std::string_view file_path, int err) {
-  return MakeException("Failed to read ", file_path, std::string_view{": "}, err);
+  output_file_->append(buffer, size);
 }
 
-}  // namespace
+template <typename NumberType>
+void ExternalSorter<NumberType>::addOutput(const char* buffer, std::size_t size) {
+  if (options_.verify_ && size != 0) {
+    const auto* numbers = reinterpret_cast<const NumberType*>(buffer);
+    const auto numbers_count = size / sizeof(NumberType);
+
+    if ((output_checksum_.count() != 0 && numbers[0] < last_output_number_) ||
+        !std::is_sorted(numbers, numbers + numbers_count)) {
+      throw MakeException("Verification failed: the output file ", output_file_path_,
+                          std::string_view{" is not sorted"});
+    }
+
+    output_checksum_.add(numbers, numbers_count);
+    last_output_number_ = numbers[numbers_count - 1];
+  }
+
+  counters_.add(StatsCounter::kOutputBytesWritten, size);
+
+  if (sparse_index_writer_) {
+    sparse_index_writer_->add(reinterpret_cast<const NumberType*>(buffer), size / sizeof(NumberType));
+  }
+
+  if (summary_collector_) {
+    summary_collector_->add(reinterpret_cast<const NumberType*>(buffer), size / sizeof(NumberType));
+  }
+}
 
 template <typename NumberType>
-ExternalSorter<NumberType>::ExternalSorter(std::size_t available_memory, std::string input_file_path,
-                                           std::string output_directory_path, std::shared_ptr<ThreadPool> thread_pool)
-    : available_memory_{RoundSize<NumberType>(CalcUsefulMemorySize(available_memory))},
-      input_file_path_{input_file_path},
-      output_directory_path_{std::move(output_directory_path)},
-      output_file_path_{CreateOutputFilePath(output_directory_path_)},
-      intermediate_directory_path_{CreateIntermediateDirectoryPath(output_directory_path_)},
-      input_file_stream_{OpenInputBinaryFileStream(input_file_path_)},
-      output_file_stream_{OpenOutputBinaryFileStream(output_file_path_)},
-      thread_pool_{std::move(thread_pool)} {
-  if (available_memory_ < kMinAvailableMemory) {
-    throw MakeException("There is not enough memory.");
+void ExternalSorter<NumberType>::addInputChecksum(const NumberType* numbers, std::size_t count) {
+  if (!options_.verify_) {
+    return;
   }
+
+  MultisetChecksum checksum{};
+  checksum.add(numbers, count);
+
+  std::scoped_lock<std::mutex> lock(input_checksum_mutex_);
+
+  input_checksum_.add(checksum);
 }
 
 template <typename NumberType>
-ExternalSorter<NumberType>::~ExternalSorter() = default;
+void ExternalSorter<NumberType>::verifyChecksums() const {
+  if (options_.verify_ && input_checksum_ != output_checksum_) {
+    throw MakeException("Verification failed: numbers of the output file ", output_file_path_,
+                        std::string_view{" differ from input numbers"});
+  }
+}
 
 template <typename NumberType>
-void ExternalSorter<NumberType>::sort() {
-  createIntermediateDirectory();
+std::size_t ExternalSorter<NumberType>::calcBucketCapacity() const {
+  const auto allocation_factor = CalcChunkAllocationFactor(options_.sort_engine_);
 
-  createSortedChunksImplMultiThreaded();
+  return memory_budget_->available() / sizeof(NumberType) / ((thread_pool_->threadsCount() + 1) * allocation_factor);
+}
 
-  mergeSortedChunksImpl();
+template <typename NumberType>
+std::size_t ExternalSorter<NumberType>::calcRangeBucketsCount(std::uint64_t numbers_count) const {
+  // Buckets are planned to be half of the capacity, so moderately skewed ones still fit in memory.
+  const auto bucket_numbers_count = std::max<std::size_t>(calcBucketCapacity() / 2, 1);
+  // Streams of buckets (two per range bucket) may take up to a quarter of memory.
+  const auto max_buckets_count =
+      std::clamp<std::size_t>(memory_budget_->available() / 4 / (2 * kBucketOverheadMemorySize), 2,
+                              kMaxRangeBucketsCount);
+  const auto buckets_count = (numbers_count + bucket_numbers_count - 1) / bucket_numbers_count;
+
+  return static_cast<std::size_t>(std::clamp<std::uint64_t>(buckets_count, 2, max_buckets_count));
 }
 
-// Sorting with this method performs worse than with createSortedChunksImplMultiThreaded().
 template <typename NumberType>
-void ExternalSorter<NumberType>::createSortedChunksImplSingleThreaded() {
-  auto numbers_count = available_memory_ / sizeof(NumberType);
-  auto buffer = std::make_unique<NumberType[]>(numbers_count);
+void ExternalSorter<NumberType>::mergeSortedChunksImpl() {
+  auto files_paths = intermediate_files_paths_;
+  const auto fan_in = calcMergeFanIn(memory_budget_->available());
+  const auto presorted_runs_count = presorted_runs_paths_.size();
+  const auto resident_runs_count = resident_runs_.size();
 
-  while (true) {
-    auto [ok, bytes_read] =
-        ReadFileStream(input_file_stream_, reinterpret_cast<char*>(buffer.get()), available_memory_);
+  // Groups of files are merged to new intermediate files until all files can be merged to the output file at once.
+  // Presorted and resident runs are merged only by the final pass, so they are read once and never spilled.
+  while (files_paths.size() + presorted_runs_count + resident_runs_count > fan_in && files_paths.size() > 1) {
+    std::vector<std::filesystem::path> merged_files_paths;
 
-    if (!ok) {
-      throw MakeFailedReadFileException(input_file_path_, errno);
-    }
+    for (std::size_t begin = 0; begin < files_paths.size(); begin += fan_in) {
+      const auto end = std::min(begin + fan_in, files_paths.size());
 
-    if (bytes_read != 0) {
-      std::stable_sort(buffer.get(), buffer.get() + bytes_read / sizeof(NumberType));
+      if (end - begin == 1) {
+        merged_files_paths.push_back(files_paths[begin]);
 
-      WriteIntermediateFile(intermediate_directory_path_, intermediate_files_count_++,
-                            reinterpret_cast<char*>(buffer.get()), bytes_read);
-    }
+        continue;
+      }
 
-    if (available_memory_ != bytes_read) {
-      break;
+      merged_files_paths.push_back(
+          mergeToIntermediateFile({files_paths.begin() + begin, files_paths.begin() + end}));
     }
+
+    files_paths = std::move(merged_files_paths);
+
+    ++stats_.merge_passes_count_;
   }
-}
 
-template <typename NumberType>
-void ExternalSorter<NumberType>::createIntermediateDirectory() const {
-  std::error_code ec{};
-  std::filesystem::create_directory(intermediate_directory_path_, ec);
-  if (ec) {
-    throw MakeException("Failed to create the intermediate directory: ", ec);
+  files_paths.insert(files_paths.end(), presorted_runs_paths_.begin(), presorted_runs_paths_.end());
+
+  if (!files_paths.empty() || resident_runs_count != 0) {
+    ++stats_.merge_passes_count_;
   }
-}
 
-template <typename NumberType>
-void ExternalSorter<NumberType>::createSortedChunksImplMultiThreaded() {
-  const std::size_t chunks_count = std::thread::hardware_concurrency();
-  const auto chunk_numbers_count = (available_memory_ / sizeof(NumberType)) / chunks_count;
+  // The output of the argsort mode gets indices of packed numbers, which are verified and counted before unpacking.
+  std::unique_ptr<OutputFile> values_file;
+  std::vector<number_t> values;
+  MemoryReservation values_reservation;
 
-  using number_buffer_t = std::unique_ptr<NumberType[]>;
-  auto chunks_queue = std::make_shared<ThreadSafeQueue<std::queue<number_buffer_t>>>();
+  if (options_.argsort_values_ && options_.argsort_) {
+    const auto values_file_size = input_files_size_ / sizeof(argsort_number_t) * sizeof(number_t);
 
-  for (std::size_t i = 0; i < chunks_count; ++i) {
-    chunks_queue->push(std::make_unique<NumberType[]>(chunk_numbers_count));
+    values_file = std::make_unique<OutputFile>(CreateArgsortValuesFilePath(output_file_path_),
+                                               CreateOutputFileOptions(options_, values_file_size));
+    values_reservation = memory_budget_->reserve(kArgsortValuesBufferSize);
+    values.resize(kArgsortValuesBufferSize / sizeof(number_t));
   }
 
-  while (true) {
-    number_buffer_t buffer;
-
-    if (!chunks_queue->pop(buffer)) {
-      std::this_thread::yield();
+  mergeFiles(
+      files_paths, *output_file_,
+      [this, &values_file, &values](char* buffer, std::size_t size) {
+        addOutput(buffer, size);
 
-      thread_pool_->checkException();
+        if (options_.argsort_) {
+          UnpackArgsortNumbers(buffer, size, values_file.get(), values);
+        }
+      },
+      std::move(resident_runs_));
 
-      continue;
-    }
+  resident_runs_.clear();
 
-    thread_pool_->checkException();
+  if (values_file) {
+    values_file->finish();
+  }
+}
 
-    auto [ok, bytes_read] = ReadFileStream(input_file_stream_, reinterpret_cast<char*>(buffer.get()),
-                                           chunk_numbers_count * sizeof(NumberType));
+template <typename NumberType>
+std::filesystem::path ExternalSorter<NumberType>::mergeToIntermediateFile(
+    const std::vector<std::filesystem::path>& files_paths, std::size_t memory_size) {
+  auto path = createIntermediateFilePath();
 
-    if (!ok) {
-      throw MakeFailedReadFileException(input_file_path_, errno);
-    }
+  {
+    std::uint64_t file_size = 0;
 
-    if (bytes_read == 0) {
-      break;
+    for (const auto& file_path : files_paths) {
+      file_size += std::filesystem::file_size(file_path);
     }
 
-    // Sorts chunk and writes it to a file in a separate thread.
-    thread_pool_->add([this, chunks_queue, buff = std::make_shared<number_buffer_t>(std::move(buffer)),
-                       bytes_read = bytes_read]() mutable {
-      NumberType* buffer{(*buff).get()};
+    OutputFile file{path.string(), CreateOutputFileOptions(options_, file_size)};
+    RunFileWriter<NumberType> run_writer{file};
 
-      std::stable_sort(buffer, buffer + bytes_read / sizeof(NumberType));
+    mergeFiles(
+        files_paths, file,
+        [this, &run_writer](const char* buffer, std::size_t size) {
+          counters_.add(StatsCounter::kIntermediateBytesWritten, size);
+          run_writer.add(reinterpret_cast<const NumberType*>(buffer), size / sizeof(NumberType));
+        },
+        {}, memory_size);
 
-      WriteIntermediateFile(intermediate_directory_path_, intermediate_files_count_++, reinterpret_cast<char*>(buffer),
-                            bytes_read);
+    run_writer.finish();
+    file.finish();
+  }
 
-      chunks_queue->push(std::move(*buff));
-    });
+  for (const auto& file_path : files_paths) {
+    std::error_code ec{};
+    std::filesystem::remove(file_path, ec);
   }
 
-  while (thread_pool_->hasPendingTasks()) {
-    std::this_thread::yield();
+  return path;
+}
+
+template <typename NumberType>
+bool ExternalSorter<NumberType>::isPresortedRun(const std::filesystem::path& file_path) const {
+  return std::find(presorted_runs_paths_.begin(), presorted_runs_paths_.end(), file_path) !=
+         presorted_runs_paths_.end();
+}
+
+template <typename NumberType>
+std::size_t ExternalSorter<NumberType>::calcMergeFanIn(std::size_t merge_memory_size) const {
+  const auto files_buffers_memory_size = merge_memory_size - CalcMergeBuffersMemorySize(merge_memory_size);
+  const auto max_fan_in = std::max<std::size_t>(
+      kMinMergeFanIn, files_buffers_memory_size / (kMinFileBufferMemorySize + kFileOverheadMemorySize<NumberType>));
+
+  if (options_.merge_fan_in_ == 0) {
+    return max_fan_in;
   }
 
-  thread_pool_->checkException();
+  return std::clamp(options_.merge_fan_in_, kMinMergeFanIn, max_fan_in);
 }
 
 template <typename NumberType>
-void ExternalSorter<NumberType>::mergeSortedChunksImpl() {
-  const std::size_t files_count = intermediate_files_count_.load();
+std::size_t ExternalSorter<NumberType>::calcRunGenerationMemorySize() const {
+  return memory_budget_->available() - compaction_memory_size_;
+}
+
+template <typename NumberType>
+template <typename MergedFunction>
+void ExternalSorter<NumberType>::mergeFiles(const std::vector<std::filesystem::path>& intermediate_files_paths,
+                                            OutputFile& file, MergedFunction merged,
+                                            std::vector<ResidentRun> resident_runs, std::size_t memory_size) {
+  const auto files_paths = InterleaveByDirectory(intermediate_files_paths);
+  const std::size_t files_count = files_paths.size() + resident_runs.size();
 
   if (files_count == 0) {
     return;
   }
 
-  const std::size_t file_buffer_memory_size =
-      RoundSize<NumberType>(CalcFilesBuffersMemorySize(available_memory_) / files_count);
+  const auto files_overhead_memory_size = files_count * kFileOverheadMemorySize<NumberType>;
+  const auto files_overhead_reservation = memory_budget_->reserve(files_overhead_memory_size);
 
-  auto files_buffers = CreateIntermediateFilesBuffers<NumberType>(thread_pool_, files_count, file_buffer_memory_size,
-                                                                  intermediate_directory_path_);
+  // The limit of memory includes the overhead of files which is reserved already.
+  const auto merge_memory_size =
+      std::min(memory_budget_->available(),
+               memory_size > files_overhead_memory_size ? memory_size - files_overhead_memory_size : 0);
 
-  constexpr std::size_t merge_buffers_count = 2;
+  const auto merge_buffers_count = std::max<std::size_t>(options_.output_buffers_count_, 2);
   const auto merge_buffer_size_in_bytes =
-      RoundSize<NumberType>((available_memory_ - file_buffer_memory_size) / merge_buffers_count);
+      RoundSize<NumberType>(CalcMergeBuffersMemorySize(merge_memory_size) / merge_buffers_count);
   const auto merge_numbers_count = merge_buffer_size_in_bytes / sizeof(NumberType);
+  const auto merge_buffers_reservation = memory_budget_->reserve(merge_buffers_count * merge_buffer_size_in_bytes);
 
-  std::size_t current_merge_buffer_index = 0;
+  // A presorted run is usually much longer than others, so it gets as much memory for streaming as all other files.
+  std::vector<bool> is_presorted_run(files_count);
+  std::size_t presorted_runs_count = 0;
+
+  for (std::size_t i = 0; i < files_paths.size(); ++i) {
+    is_presorted_run[i] = isPresortedRun(files_paths[i]);
+    presorted_runs_count += is_presorted_run[i] ? 1 : 0;
+  }
+
+  // Resident runs are already in memory, so only files and compressed runs get buffers.
+  const auto compressed_runs_count = static_cast<std::size_t>(std::count_if(
+      resident_runs.begin(), resident_runs.end(), [](const auto& run) { return run.numbers_ == nullptr; }));
+  const auto other_files_count = files_paths.size() - presorted_runs_count + compressed_runs_count;
+  const auto presorted_run_weight = std::max<std::size_t>(other_files_count, 1);
+  const auto total_weight = std::max<std::size_t>(other_files_count + presorted_runs_count * presorted_run_weight, 1);
+  const auto files_buffers_memory_size = merge_memory_size - merge_buffers_reservation.size();
+
+  std::vector<std::size_t> files_buffers_memory_sizes(files_count);
+
+  for (std::size_t i = 0; i < files_count; ++i) {
+    const auto weight = i < files_paths.size() && is_presorted_run[i] ? presorted_run_weight : 1;
+
+    files_buffers_memory_sizes[i] = RoundSize<NumberType>(files_buffers_memory_size / total_weight * weight);
+  }
+
+  // Presorted runs are not read by run generation, so their numbers are added to the input checksum while loading.
+  std::vector<bool> compute_checksums(files_count);
+
+  for (std::size_t i = 0; i < files_paths.size(); ++i) {
+    compute_checksums[i] = options_.verify_ && is_presorted_run[i];
+  }
+
+  // Intermediate files are run files, presorted runs are files of the user.
+  std::vector<bool> are_run_files(files_paths.size());
+
+  for (std::size_t i = 0; i < files_paths.size(); ++i) {
+    are_run_files[i] = !is_presorted_run[i];
+  }
 
-  // Write the first buffer to a file in a separate thread while filling the second buffer in the current thread.
-  MergeBuffer<NumberType> merge_buffer_0{true, std::make_unique<NumberType[]>(merge_numbers_count)};
-  MergeBuffer<NumberType> merge_buffer_1{true, std::make_unique<NumberType[]>(merge_numbers_count)};
+  auto files_buffers =
+      CreateIntermediateFilesBuffers<NumberType>(thread_pool_, files_paths, files_buffers_memory_sizes,
+                                                 compute_checksums, are_run_files, resident_runs, *memory_budget_,
+                                                 options_.cancellation_token_.get());
+
+  // Loading tasks refer to buffers, so they are finished before buffers are destroyed if the merge fails.
+  const PendingTasksGuard pending_tasks_guard{*thread_pool_};
+
+  // Filled buffers are written by threads of the pool while the next ones are filled in the current thread.
+  OutputFileWriter<NumberType> writer{thread_pool_, file, merge_buffers_count, merge_numbers_count};
 
   // min heap
-  std::priority_queue<MergeData<NumberType>, std::vector<MergeData<NumberType>>, MergeDataComparator<NumberType>>
-      merge_queue;
+  merge_queue_t<NumberType> merge_queue;
 
   // initialization of all buffers and merge queue
   for (std::size_t i = 0; i < std::size(files_buffers); ++i) {
@@ -308,26 +2632,55 @@ void ExternalSorter<NumberType>::mergeSortedChunksImpl() {
     merge_queue.push(MergeData<NumberType>{i, number});
   }
 
+  // Waits for pending loads of intermediate files buffers and adds their statistics to counters when the merge is over.
+  auto finishFilesBuffers = [this, &files_paths, &files_buffers, &is_presorted_run, &compute_checksums]() {
+    for (std::size_t i = 0; i < files_buffers.size(); ++i) {
+      const auto& file_buffer = files_buffers[i];
+
+      file_buffer.waitForLoads();
+
+      // Resident runs are not read from files.
+      if (i < files_paths.size()) {
+        counters_.add(is_presorted_run[i] ? StatsCounter::kInputBytesRead : StatsCounter::kIntermediateBytesRead,
+                      file_buffer.bytesRead());
+      }
+
+      counters_.add(StatsCounter::kFileBufferWaitTime, file_buffer.waitTime());
+
+      if (compute_checksums[i]) {
+        std::scoped_lock<std::mutex> lock(input_checksum_mutex_);
+
+        input_checksum_.add(file_buffer.checksum());
+      }
+    }
+  };
+
   if (merge_queue.empty()) {
+    finishFilesBuffers();
+
     return;
   }
 
-  // swap buffers and write buffer in a separate thread
-  auto swapMergeBufferAndCreateTask = [this](auto& merge_buffer_0, auto& merge_buffer_1,
-                                             auto& current_merge_buffer_index, const auto merge_buffer_size_in_bytes) {
-    thread_pool_->waitForTask(merge_buffer_1.is_ready_to_fill_);
+  auto* merge_buffer = writer.buffer();
+  std::size_t current_merge_buffer_index = 0;
+
+  // hands the merged buffer over to the writer and takes the next one
+  auto submitMergeBuffer = [&]() {
+    checkCancellation();
 
-    std::swap(merge_buffer_0.buffer_, merge_buffer_1.buffer_);
+    if (options_.memory_monitor_ && options_.memory_monitor_->check()) {
+      for (auto& file_buffer : files_buffers) {
+        file_buffer.shrink();
+      }
 
-    merge_buffer_1.is_ready_to_fill_ = false;
+      counters_.add(StatsCounter::kMemoryPressureShrinks, 1);
+    }
 
-    thread_pool_->add([&, size_in_bytes = merge_buffer_size_in_bytes]() {
-      WriteFile(output_file_stream_, reinterpret_cast<const char*>(merge_buffer_1.buffer_.get()), size_in_bytes,
-                output_file_path_);
+    merged(reinterpret_cast<char*>(merge_buffer), current_merge_buffer_index * sizeof(NumberType));
 
-      merge_buffer_1.is_ready_to_fill_ = true;
-    });
+    writer.submit(current_merge_buffer_index);
 
+    merge_buffer = writer.buffer();
     current_merge_buffer_index = 0;
   };
 
@@ -337,14 +2690,13 @@ void ExternalSorter<NumberType>::mergeSortedChunksImpl() {
 
   while (!merge_queue.empty()) {
     if (current_merge_buffer_index == merge_numbers_count) {
-      swapMergeBufferAndCreateTask(merge_buffer_0, merge_buffer_1, current_merge_buffer_index,
-                                   merge_buffer_size_in_bytes);
+      submitMergeBuffer();
     }
 
     min_data = merge_queue.top();
     merge_queue.pop();
 
-    merge_buffer_0.buffer_[current_merge_buffer_index++] = min_data.value_;
+    merge_buffer[current_merge_buffer_index++] = min_data.value_;
 
     top_value = merge_queue.empty() ? std::numeric_limits<NumberType>::max() : merge_queue.top().value_;
 
@@ -352,11 +2704,10 @@ void ExternalSorter<NumberType>::mergeSortedChunksImpl() {
     while (files_buffers[min_data.file_buffer_index_].get(number)) {
       if (number <= top_value) {
         if (current_merge_buffer_index == merge_numbers_count) {
-          swapMergeBufferAndCreateTask(merge_buffer_0, merge_buffer_1, current_merge_buffer_index,
-                                       merge_buffer_size_in_bytes);
+          submitMergeBuffer();
         }
 
-        merge_buffer_0.buffer_[current_merge_buffer_index++] = number;
+        merge_buffer[current_merge_buffer_index++] = number;
 
         continue;
       }
@@ -368,12 +2719,85 @@ void ExternalSorter<NumberType>::mergeSortedChunksImpl() {
   }
 
   if (current_merge_buffer_index != 0) {
-    WriteFile(output_file_stream_, reinterpret_cast<const char*>(merge_buffer_0.buffer_.get()),
-              current_merge_buffer_index * sizeof(NumberType), output_file_path_);
+    merged(reinterpret_cast<char*>(merge_buffer), current_merge_buffer_index * sizeof(NumberType));
+
+    writer.submit(current_merge_buffer_index);
   }
 
+  writer.waitForWrites();
+
+  counters_.add(StatsCounter::kMergeBufferWaitTime, writer.waitTime());
+  addStagesStats(writer.stats());
+
+  finishFilesBuffers();
+
   thread_pool_->checkException();
 }
 
+template <typename NumberType>
+void ExternalSorter<NumberType>::checkCancellation() const {
+  if (options_.cancellation_token_) {
+    options_.cancellation_token_->throwIfCancelled();
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::waitForPendingTasks() const {
+  while (thread_pool_->hasPendingTasks()) {
+    std::this_thread::yield();
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::removeIntermediateFiles() const {
+  // A file may be in any intermediate directory, so all of them are tried. Errors are ignored, as most of files are
+  // removed already.
+  for (std::uint32_t id = 0; id < intermediate_files_count_.load(); ++id) {
+    for (const auto& intermediate_directory_path : intermediate_directories_paths_) {
+      std::error_code ec{};
+      std::filesystem::remove(CreateIntermediateFilePath(intermediate_directory_path, id), ec);
+    }
+  }
+
+  // Directories are removed only if they are empty.
+  for (const auto& intermediate_directory_path : intermediate_directories_paths_) {
+    std::error_code ec{};
+    std::filesystem::remove(intermediate_directory_path, ec);
+  }
+}
+
+template <typename NumberType>
+void ExternalSorter<NumberType>::collectStats(const ThreadPoolStats& initial_pool_stats) {
+  stats_.input_.bytes_read_ = counters_.sum(StatsCounter::kInputBytesRead);
+
+  // Keys of the argsort mode are counted as packed numbers when they are read.
+  if (options_.argsort_) {
+    stats_.input_.bytes_read_ = stats_.input_.bytes_read_ / sizeof(argsort_number_t) * sizeof(number_t);
+  }
+  stats_.intermediate_.bytes_written_ = counters_.sum(StatsCounter::kIntermediateBytesWritten);
+  stats_.intermediate_.bytes_read_ = counters_.sum(StatsCounter::kIntermediateBytesRead);
+  stats_.output_.bytes_written_ = counters_.sum(StatsCounter::kOutputBytesWritten);
+
+  stats_.chunk_buffer_wait_time_ns_ = counters_.sum(StatsCounter::kChunkBufferWaitTime);
+  stats_.file_buffer_wait_time_ns_ = counters_.sum(StatsCounter::kFileBufferWaitTime);
+  stats_.merge_buffer_wait_time_ns_ = counters_.sum(StatsCounter::kMergeBufferWaitTime);
+  stats_.memory_pressure_shrinks_count_ = counters_.sum(StatsCounter::kMemoryPressureShrinks);
+
+  const auto pool_stats = thread_pool_->stats();
+
+  stats_.pool_tasks_count_ = pool_stats.tasks_count_ - initial_pool_stats.tasks_count_;
+  stats_.pool_busy_time_ns_ = pool_stats.busy_time_ns_ - initial_pool_stats.busy_time_ns_;
+  stats_.pool_wait_time_ns_ = pool_stats.wait_time_ns_ - initial_pool_stats.wait_time_ns_;
+  stats_.pool_average_queue_depth_ =
+      stats_.pool_tasks_count_ == 0
+          ? 0.0
+          : static_cast<double>(pool_stats.queue_depth_sum_ - initial_pool_stats.queue_depth_sum_) /
+                static_cast<double>(stats_.pool_tasks_count_);
+  stats_.pool_peak_queue_depth_ = pool_stats.peak_queue_depth_;
+
+  stats_.peak_reserved_memory_ = memory_budget_->peakReserved();
+}
+
 template class ExternalSorter<number_t>;
+template class ExternalSorter<argsort_number_t>;
 }  // namespace es
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "input_file_reader.h"
+
+#include "tracing.h"
+#include "utils.h"
+
+#include <string_view>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace es {
+
+InputFileReader::InputFileReader(std::string file_path) : path_{std::move(file_path)} {
+#ifdef __linux__
+  fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd_ == -1) {
+    throw MakeException("Failed to open the file ", path_, std::string_view{": "}, errno);
+  }
+#else
+  stream_ = OpenInputBinaryFileStream(path_);
+#endif
+}
+
+InputFileReader::~InputFileReader() {
+#ifdef __linux__
+  if (fd_ != -1) {
+    ::close(fd_);
+  }
+#endif
+}
+
+FileReadResult InputFileReader::read(char* buffer, std::size_t size, std::uint64_t offset) {
+  ES_TRACE_SCOPE("io", "read input file");
+
+#ifdef __linux__
+  std::size_t bytes_count = 0;
+
+  while (bytes_count != size) {
+    const auto bytes_read =
+        ::pread(fd_, buffer + bytes_count, size - bytes_count, static_cast<off_t>(offset + bytes_count));
+
+    if (bytes_read == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (bytes_read == -1) {
+      return {false, bytes_count};
+    }
+
+    if (bytes_read == 0) {
+      break;
+    }
+
+    bytes_count += static_cast<std::size_t>(bytes_read);
+  }
+
+  return {true, bytes_count};
+#else
+  std::scoped_lock<std::mutex> lock(stream_mutex_);
+
+  stream_.clear();
+  stream_.seekg(static_cast<std::streamoff>(offset));
+
+  return ReadFileStream(stream_, buffer, size);
+#endif
+}
+
+}  // namespace es
\ No newline at end of file
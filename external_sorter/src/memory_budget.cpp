@@ -0,0 +1,81 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "memory_budget.h"
+
+#include "utils.h"
+
+#include <utility>
+
+namespace es {
+
+MemoryReservation::~MemoryReservation() {
+  reset();
+}
+
+MemoryReservation::MemoryReservation(MemoryReservation&& other) noexcept
+    : budget_{std::exchange(other.budget_, nullptr)}, size_{std::exchange(other.size_, 0)} {}
+
+MemoryReservation& MemoryReservation::operator=(MemoryReservation&& other) noexcept {
+  if (this != &other) {
+    reset();
+
+    budget_ = std::exchange(other.budget_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+
+  return *this;
+}
+
+void MemoryReservation::reset() noexcept {
+  if (budget_) {
+    budget_->release(size_);
+  }
+
+  budget_ = nullptr;
+  size_ = 0;
+}
+
+void MemoryReservation::shrink(std::size_t size) noexcept {
+  if (budget_ && size < size_) {
+    budget_->release(size_ - size);
+    size_ = size;
+  }
+}
+
+MemoryBudget::MemoryBudget(std::size_t total_size) noexcept : total_size_{total_size} {}
+
+MemoryReservation MemoryBudget::reserve(std::size_t size) {
+  auto reserved_size = reserved_size_.load();
+
+  do {
+    if (size > total_size_ - reserved_size) {
+      throw MakeException("The memory budget is exceeded.");
+    }
+  } while (!reserved_size_.compare_exchange_weak(reserved_size, reserved_size + size));
+
+  auto peak_size = peak_size_.load();
+  while (peak_size < reserved_size + size && !peak_size_.compare_exchange_weak(peak_size, reserved_size + size)) {
+  }
+
+  return MemoryReservation{this, size};
+}
+
+std::size_t MemoryBudget::available() const noexcept {
+  return total_size_ - reserved_size_.load();
+}
+
+std::size_t MemoryBudget::reserved() const noexcept {
+  return reserved_size_.load();
+}
+
+std::size_t MemoryBudget::peakReserved() const noexcept {
+  return peak_size_.load();
+}
+
+void MemoryBudget::release(std::size_t size) noexcept {
+  reserved_size_.fetch_sub(size);
+}
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,196 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "output_file_writer.h"
+
+#include "defines.h"
+#include "thread_pool.h"
+#include "tracing.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <string_view>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace es {
+
+namespace {
+
+exception_t MakeFailedWriteFileException(std::string_view file_path, int err) {
+  return MakeException("Failed to write the file ", file_path, std::string_view{": "}, err);
+}
+
+}  // namespace
+
+OutputFile::OutputFile(std::string file_path, OutputFileOptions options)
+    : path_{std::move(file_path)}, options_{options} {
+#ifdef __linux__
+  fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+  if (fd_ == -1) {
+    throw MakeException("Failed to open the file ", path_, std::string_view{": "}, errno);
+  }
+
+  struct stat file_stat {};
+
+  is_positional_ = fstat(fd_, &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+
+  // Space is allocated beyond the end of the file, so its size grows with writes as usual. Failures are ignored, as
+  // preallocation is only a hint (e.g. some file systems do not support it).
+  if (is_positional_ && options_.preallocation_size_ != 0) {
+    fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(options_.preallocation_size_));
+  }
+#else
+  stream_ = OpenOutputBinaryFileStream(path_);
+#endif
+}
+
+OutputFile::~OutputFile() {
+#ifdef __linux__
+  if (fd_ != -1) {
+    ::close(fd_);
+  }
+#endif
+}
+
+std::uint64_t OutputFile::reserve(std::size_t size) noexcept {
+  return size_.fetch_add(size);
+}
+
+void OutputFile::write(const char* buffer, std::size_t size, std::uint64_t offset) {
+  ES_TRACE_SCOPE("io", "write file");
+
+#ifdef __linux__
+  const auto begin_offset = offset;
+  const auto total_size = size;
+
+  while (size != 0) {
+    const auto bytes_written = is_positional_ ? ::pwrite(fd_, buffer, size, static_cast<off_t>(offset))
+                                              : ::write(fd_, buffer, size);
+
+    if (bytes_written == -1 && errno == EINTR) {
+      continue;
+    }
+
+    if (bytes_written <= 0) {
+      throw MakeFailedWriteFileException(path_, errno);
+    }
+
+    buffer += bytes_written;
+    size -= static_cast<std::size_t>(bytes_written);
+    offset += static_cast<std::uint64_t>(bytes_written);
+  }
+
+  writeBehind(begin_offset, total_size);
+#else
+  static_cast<void>(offset);
+
+  std::scoped_lock<std::mutex> lock(stream_mutex_);
+
+  stream_.write(buffer, static_cast<std::streamsize>(size));
+
+  if (!stream_) {
+    throw MakeFailedWriteFileException(path_, errno);
+  }
+#endif
+}
+
+void OutputFile::finish() {
+#ifdef __linux__
+  if (fd_ == -1) {
+    return;
+  }
+
+  // Truncating to the same size releases preallocated space beyond the end of the file.
+  const bool is_truncated =
+      !is_positional_ || options_.preallocation_size_ == 0 || ftruncate(fd_, static_cast<off_t>(size_.load())) == 0;
+  const bool is_closed = ::close(fd_) == 0;
+
+  fd_ = -1;
+
+  if (!is_truncated || !is_closed) {
+    throw MakeFailedWriteFileException(path_, errno);
+  }
+#else
+  stream_.close();
+
+  if (!stream_) {
+    throw MakeFailedWriteFileException(path_, errno);
+  }
+#endif
+}
+
+void OutputFile::writeBehind(std::uint64_t offset, std::size_t size) noexcept {
+#ifdef __linux__
+  if (!is_positional_ || options_.write_behind_size_ == 0) {
+    return;
+  }
+
+  // Writeback is only a hint, so failures are ignored: write errors are reported by writes and closing.
+  sync_file_range(fd_, static_cast<off_t>(offset), static_cast<off_t>(size), SYNC_FILE_RANGE_WRITE);
+
+  if (offset >= options_.write_behind_size_) {
+    sync_file_range(fd_, static_cast<off_t>(offset - options_.write_behind_size_), static_cast<off_t>(size),
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  }
+#else
+  static_cast<void>(offset);
+  static_cast<void>(size);
+#endif
+}
+
+template <typename NumberType>
+OutputFileWriter<NumberType>::OutputFileWriter(std::shared_ptr<ThreadPool> pool, OutputFile& file,
+                                               std::size_t buffers_count, std::size_t buffer_numbers_count)
+    : file_{file}, buffer_numbers_count_{buffer_numbers_count}, pipeline_{std::move(pool)} {
+  // Sequential files are written in the order of reservation, so there is only one write in flight for them.
+  const auto writes_count = file_.isPositional() ? std::max<std::size_t>(buffers_count, 1) : 1;
+
+  pipeline_.addStage("write", writes_count, [this](Buffer& buffer) {
+    file_.write(reinterpret_cast<const char*>(buffer.numbers_.get()), buffer.numbers_count_ * sizeof(NumberType),
+                buffer.offset_);
+  });
+
+  for (std::size_t i = 0; i < std::max<std::size_t>(buffers_count, 1); ++i) {
+    pipeline_.addItem(Buffer{std::make_unique<NumberType[]>(buffer_numbers_count_)});
+  }
+}
+
+template <typename NumberType>
+NumberType* OutputFileWriter<NumberType>::buffer() {
+  if (!current_buffer_.numbers_) {
+    current_buffer_ = pipeline_.acquire();
+  }
+
+  return current_buffer_.numbers_.get();
+}
+
+template <typename NumberType>
+void OutputFileWriter<NumberType>::submit(std::size_t numbers_count) {
+  if (numbers_count == 0) {
+    return;
+  }
+
+  current_buffer_.numbers_count_ = numbers_count;
+  current_buffer_.offset_ = file_.reserve(numbers_count * sizeof(NumberType));
+
+  pipeline_.push(std::move(current_buffer_));
+
+  current_buffer_ = {};
+}
+
+template <typename NumberType>
+void OutputFileWriter<NumberType>::waitForWrites() {
+  pipeline_.wait();
+}
+
+template class OutputFileWriter<number_t>;
+template class OutputFileWriter<argsort_number_t>;
+
+}  // namespace es
\ No newline at end of file
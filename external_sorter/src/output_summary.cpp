@@ -0,0 +1,189 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "output_summary.h"
+
+#include "defines.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <sstream>
+
+namespace es {
+
+namespace {
+
+const std::string_view kSummaryFileExtension{".summary"};
+
+/**
+ * Calculates the nearest rank of a quantile: the index of the smallest number which is not less than the given share
+ * of numbers
+ * @param quantile quantile (from 0 to 1)
+ * @param numbers_count count of numbers (not 0)
+ * @return index of the number
+ */
+std::uint64_t CalcQuantileRank(double quantile, std::uint64_t numbers_count) {
+  const auto rank = static_cast<std::uint64_t>(std::ceil(quantile * static_cast<double>(numbers_count)));
+
+  return std::min(std::max<std::uint64_t>(rank, 1), numbers_count) - 1;
+}
+
+/**
+ * Writes numbers as a JSON array
+ * @param stream stream
+ * @param numbers numbers
+ */
+void WriteJsonArray(std::ostringstream& stream, const std::vector<std::uint64_t>& numbers) {
+  stream << '[';
+
+  for (std::size_t i = 0; i < numbers.size(); ++i) {
+    stream << (i == 0 ? "" : ",") << numbers[i];
+  }
+
+  stream << ']';
+}
+
+}  // namespace
+
+std::string CreateOutputSummaryFilePath(std::string_view file_path) {
+  std::string summary_file_path{file_path};
+  summary_file_path.append(kSummaryFileExtension);
+
+  return summary_file_path;
+}
+
+std::string ToJson(const OutputSummary& summary) {
+  std::ostringstream stream;
+
+  stream << "{\"numbers_count\":" << summary.numbers_count_ << ",\"min\":" << summary.min_
+         << ",\"max\":" << summary.max_ << ",\"distinct_count\":" << summary.distinct_count_ << ",\"quantiles\":[";
+
+  for (std::size_t i = 0; i < summary.quantiles_.size(); ++i) {
+    const auto& quantile = summary.quantiles_[i];
+
+    stream << (i == 0 ? "" : ",") << "{\"quantile\":" << quantile.quantile_ << ",\"rank\":" << quantile.rank_
+           << ",\"value\":" << quantile.value_ << '}';
+  }
+
+  stream << "],\"histogram\":{\"bounds\":";
+  WriteJsonArray(stream, summary.histogram_bounds_);
+  stream << ",\"counts\":";
+  WriteJsonArray(stream, summary.histogram_counts_);
+  stream << "}}";
+
+  return stream.str();
+}
+
+void WriteOutputSummary(const OutputSummary& summary, std::string_view file_path) {
+  auto stream = OpenOutputBinaryFileStream(file_path);
+
+  stream << ToJson(summary) << '\n';
+  stream.flush();
+
+  if (!stream) {
+    throw MakeException("Failed to write the file ", file_path, std::string_view{": "}, errno);
+  }
+}
+
+template <typename NumberType>
+OutputSummaryCollector<NumberType>::OutputSummaryCollector(std::uint64_t numbers_count, std::vector<double> quantiles,
+                                                           std::vector<std::uint64_t> histogram_bounds)
+    : expected_numbers_count_{numbers_count} {
+  for (const auto quantile : quantiles) {
+    if (!(quantile >= 0 && quantile <= 1)) {
+      throw MakeException("Invalid quantile: ", std::to_string(quantile));
+    }
+  }
+
+  if (std::adjacent_find(histogram_bounds.begin(), histogram_bounds.end(), std::greater_equal<>{}) !=
+      histogram_bounds.end()) {
+    throw MakeException("Bounds of the histogram are not ascending");
+  }
+
+  // Numbers at the ranks pass by in ascending order.
+  std::sort(quantiles.begin(), quantiles.end());
+
+  if (numbers_count != 0) {
+    for (const auto quantile : quantiles) {
+      summary_.quantiles_.push_back(OutputQuantile{quantile, CalcQuantileRank(quantile, numbers_count), 0});
+    }
+  }
+
+  if (!histogram_bounds.empty()) {
+    summary_.histogram_counts_.resize(histogram_bounds.size() + 1);
+    summary_.histogram_bounds_ = std::move(histogram_bounds);
+  }
+}
+
+template <typename NumberType>
+void OutputSummaryCollector<NumberType>::add(const NumberType* numbers, std::size_t count) {
+  if (count == 0) {
+    return;
+  }
+
+  const auto begin_position = summary_.numbers_count_;
+  const auto end_position = begin_position + count;
+
+  if (begin_position == 0) {
+    summary_.min_ = numbers[0];
+    summary_.distinct_count_ = 1;
+  } else if (numbers[0] != summary_.max_) {
+    ++summary_.distinct_count_;
+  }
+
+  std::uint64_t distinct_count = 0;
+
+  for (std::size_t i = 1; i < count; ++i) {
+    distinct_count += numbers[i] != numbers[i - 1];
+  }
+
+  summary_.distinct_count_ += distinct_count;
+
+  auto& quantiles = summary_.quantiles_;
+
+  for (; next_quantile_index_ < quantiles.size() && quantiles[next_quantile_index_].rank_ < end_position;
+       ++next_quantile_index_) {
+    auto& quantile = quantiles[next_quantile_index_];
+
+    quantile.value_ = numbers[quantile.rank_ - begin_position];
+  }
+
+  const auto& bounds = summary_.histogram_bounds_;
+
+  if (!bounds.empty()) {
+    const auto* bucket_begin = numbers;
+    const auto* end = numbers + count;
+
+    // Only buckets which end within the added numbers need a search.
+    for (; bucket_index_ < bounds.size() && bounds[bucket_index_] <= numbers[count - 1]; ++bucket_index_) {
+      const auto* bucket_end = std::lower_bound(
+          bucket_begin, end, bounds[bucket_index_],
+          [](NumberType number, std::uint64_t bound) { return static_cast<std::uint64_t>(number) < bound; });
+
+      summary_.histogram_counts_[bucket_index_] += static_cast<std::uint64_t>(bucket_end - bucket_begin);
+      bucket_begin = bucket_end;
+    }
+
+    summary_.histogram_counts_[bucket_index_] += static_cast<std::uint64_t>(end - bucket_begin);
+  }
+
+  summary_.max_ = numbers[count - 1];
+  summary_.numbers_count_ = end_position;
+}
+
+template <typename NumberType>
+const OutputSummary& OutputSummaryCollector<NumberType>::finish() {
+  if (summary_.numbers_count_ != expected_numbers_count_) {
+    summary_.quantiles_.clear();
+  }
+
+  return summary_;
+}
+
+template class OutputSummaryCollector<number_t>;
+template class OutputSummaryCollector<argsort_number_t>;
+
+}  // namespace es
\ No newline at end of file
@@ -0,0 +1,244 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "resource_limits.h"
+
+#include "cpu_topology.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <thread>
+#include <utility>
+
+namespace es {
+
+namespace {
+
+const std::string_view kCgroupRootPath{"/sys/fs/cgroup"};
+const std::string_view kProcessCgroupFilePath{"/proc/self/cgroup"};
+const std::string_view kMemoryInfoFilePath{"/proc/meminfo"};
+const std::string_view kCgroupV2Prefix{"0::"};
+const std::string_view kMemoryAvailablePrefix{"MemAvailable:"};
+const std::string_view kInactiveFilePrefix{"inactive_file "};
+const std::string_view kMemoryMaxFileName{"memory.max"};
+const std::string_view kMemoryCurrentFileName{"memory.current"};
+const std::string_view kMemoryStatFileName{"memory.stat"};
+const std::string_view kCpuMaxFileName{"cpu.max"};
+
+/**
+ * Parses a decimal number surrounded by spaces
+ * @param text text
+ * @param value parsed number
+ * @return true if the text is a number ("max" of cgroup files is not)
+ */
+bool ParseUnsigned(std::string_view text, std::uint64_t& value) noexcept {
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+    text.remove_prefix(1);
+  }
+
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\n')) {
+    text.remove_suffix(1);
+  }
+
+  const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+
+  return !text.empty() && ec == std::errc{} && end == text.data() + text.size();
+}
+
+/**
+ * Reads the first line of a file
+ * @param file_path path to file
+ * @param line the line
+ * @return true if the line has been read
+ */
+bool ReadFirstLine(const std::filesystem::path& file_path, std::string& line) {
+  std::ifstream stream{file_path};
+
+  return static_cast<bool>(std::getline(stream, line));
+}
+
+/**
+ * Reads the value of a line with a prefix, e.g. "MemAvailable: 1024 kB" of /proc/meminfo
+ * @param file_path path to file
+ * @param prefix prefix of the line
+ * @param value the number after the prefix (units are not parsed)
+ * @return true if the line has been found
+ */
+bool ReadPrefixedValue(const std::filesystem::path& file_path, std::string_view prefix, std::uint64_t& value) {
+  std::ifstream stream{file_path};
+  std::string line;
+
+  while (std::getline(stream, line)) {
+    if (line.rfind(prefix, 0) == 0) {
+      auto text = std::string_view{line}.substr(prefix.size());
+
+      return ParseUnsigned(text.substr(0, text.find(" kB")), value);
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Reads path to the cgroup (v2) of the process relative to the root of the hierarchy
+ * @return path or empty string if the process has no cgroup v2 (e.g. only cgroup v1 is mounted)
+ */
+std::string ReadProcessCgroupPath() {
+  std::ifstream stream{std::string{kProcessCgroupFilePath}};
+  std::string line;
+
+  while (std::getline(stream, line)) {
+    if (line.rfind(kCgroupV2Prefix, 0) == 0) {
+      return line.substr(kCgroupV2Prefix.size());
+    }
+  }
+
+  return {};
+}
+
+}  // namespace
+
+ResourceLimits DetectResourceLimits() {
+  ResourceLimits limits{};
+
+#ifdef __linux__
+  std::size_t cpus_count = 0;
+
+  for (const auto& node_cpus : DetectCpuTopology().nodes_cpus_) {
+    cpus_count += node_cpus.size();
+  }
+
+  std::uint64_t available_memory = 0;
+
+  if (ReadPrefixedValue(std::string{kMemoryInfoFilePath}, kMemoryAvailablePrefix, available_memory)) {
+    available_memory *= 1024;
+  }
+
+  const auto cgroup_path = ReadProcessCgroupPath();
+
+  if (!cgroup_path.empty()) {
+    return ReadCgroupLimits(kCgroupRootPath, cgroup_path, cpus_count, available_memory);
+  }
+
+  limits.memory_limit_ = available_memory;
+  limits.cpus_count_ = std::max<std::size_t>(cpus_count, 1);
+#else
+  limits.cpus_count_ = std::max(std::thread::hardware_concurrency(), 1U);
+#endif
+
+  return limits;
+}
+
+ResourceLimits ReadCgroupLimits(std::string_view cgroup_root_path, std::string_view cgroup_path,
+                                std::size_t cpus_count, std::size_t available_memory) {
+  ResourceLimits limits{};
+  limits.memory_limit_ = available_memory;
+  limits.cpus_count_ = std::max<std::size_t>(cpus_count, 1);
+
+  const std::filesystem::path root_path{cgroup_root_path};
+  auto relative_path = std::filesystem::path{cgroup_path}.relative_path();
+  auto memory_limit = std::numeric_limits<std::uint64_t>::max();
+
+  // Limits of ancestors apply to the cgroup too, so the strictest ones are taken up to the root of the hierarchy.
+  while (true) {
+    const auto directory_path = root_path / relative_path;
+    std::string line;
+    std::uint64_t value = 0;
+
+    if (ReadFirstLine(directory_path / kMemoryMaxFileName, line) && ParseUnsigned(line, value) &&
+        value < memory_limit) {
+      memory_limit = value;
+      limits.memory_cgroup_path_ = directory_path.string();
+    }
+
+    // cpu.max is "<quota> <period>" or "max <period>", a quota of 1.5 periods allows to use two threads.
+    if (ReadFirstLine(directory_path / kCpuMaxFileName, line)) {
+      const auto separator_position = std::min(line.find(' '), line.size());
+      std::uint64_t quota = 0;
+      std::uint64_t period = 0;
+
+      if (ParseUnsigned(std::string_view{line}.substr(0, separator_position), quota) &&
+          ParseUnsigned(std::string_view{line}.substr(separator_position), period) && period != 0) {
+        const auto quota_cpus_count = std::max<std::uint64_t>((quota + period - 1) / period, 1);
+
+        limits.cpus_count_ = static_cast<std::size_t>(std::min<std::uint64_t>(limits.cpus_count_, quota_cpus_count));
+      }
+    }
+
+    if (relative_path.empty()) {
+      break;
+    }
+
+    relative_path = relative_path.parent_path();
+  }
+
+  if (!limits.memory_cgroup_path_.empty()) {
+    limits.memory_limit_ = static_cast<std::size_t>(memory_limit);
+    limits.memory_usage_ = ReadCgroupMemoryUsage(limits.memory_cgroup_path_);
+  }
+
+  return limits;
+}
+
+std::size_t ReadCgroupMemoryUsage(std::string_view cgroup_directory_path) {
+  const std::filesystem::path directory_path{cgroup_directory_path};
+  std::string line;
+  std::uint64_t usage = 0;
+  std::uint64_t inactive_file_size = 0;
+
+  if (!ReadFirstLine(directory_path / kMemoryCurrentFileName, line) || !ParseUnsigned(line, usage)) {
+    return 0;
+  }
+
+  if (!ReadPrefixedValue(directory_path / kMemoryStatFileName, kInactiveFilePrefix, inactive_file_size)) {
+    inactive_file_size = 0;
+  }
+
+  return static_cast<std::size_t>(usage > inactive_file_size ? usage - inactive_file_size : 0);
+}
+
+std::size_t CalcAutoMemorySize(const ResourceLimits& limits) noexcept {
+  const auto free_memory =
+      limits.memory_limit_ > limits.memory_usage_ ? limits.memory_limit_ - limits.memory_usage_ : 0;
+
+  return free_memory / 4 * 3;
+}
+
+MemoryPressureMonitor::MemoryPressureMonitor(std::string cgroup_directory_path, std::size_t memory_limit,
+                                             double threshold, std::uint64_t check_interval_ns)
+    : cgroup_directory_path_{std::move(cgroup_directory_path)},
+      threshold_size_{static_cast<std::size_t>(static_cast<double>(memory_limit) * threshold)},
+      check_interval_ns_{check_interval_ns} {}
+
+bool MemoryPressureMonitor::check() {
+  {
+    std::scoped_lock<std::mutex> lock(mutex_);
+
+    const auto current_time = SteadyClockNs();
+
+    if (last_check_time_ns_ != 0 && current_time - last_check_time_ns_ < check_interval_ns_) {
+      return false;
+    }
+
+    last_check_time_ns_ = current_time;
+  }
+
+  return ReadCgroupMemoryUsage(cgroup_directory_path_) >= threshold_size_;
+}
+
+std::shared_ptr<MemoryPressureMonitor> CreateMemoryPressureMonitor() {
+  auto limits = DetectResourceLimits();
+
+  if (limits.memory_cgroup_path_.empty()) {
+    return nullptr;
+  }
+
+  return std::make_shared<MemoryPressureMonitor>(std::move(limits.memory_cgroup_path_), limits.memory_limit_);
+}
+
+}  // namespace es
\ No newline at end of file
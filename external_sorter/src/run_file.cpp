@@ -0,0 +1,263 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "run_file.h"
+
+#include "defines.h"
+#include "output_file_writer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <array>
+#include <type_traits>
+
+namespace es {
+
+namespace {
+
+const std::array<char, 8> kRunFileMagic{'E', 'S', 'R', 'U', 'N', '0', '0', '1'};
+const std::uint32_t kRunFileVersion = 1;
+const std::uint32_t kAscendingSortOrder = 0;
+
+/**
+ * Header of a run file (after the magic)
+ */
+struct RunFileHeader {
+  std::uint32_t number_size_ = {};    ///< Size of a number
+  std::uint32_t number_kind_ = {};    ///< Kind of numbers (unsigned, signed, floating point)
+  std::uint32_t version_ = {};        ///< Version of the format
+  std::uint32_t sort_order_ = {};     ///< Sort order of numbers
+  std::uint64_t block_size_ = {};     ///< Size of a block in bytes
+  std::uint64_t numbers_count_ = {};  ///< Count of numbers
+  std::uint64_t blocks_count_ = {};   ///< Count of blocks
+  std::uint64_t index_offset_ = {};   ///< Offset of the index
+};
+
+const std::size_t kRunFileHeaderSize = kRunFileMagic.size() + sizeof(RunFileHeader);
+
+/**
+ * Returns kind of numbers which is stored in the header
+ * @tparam NumberType type of numbers
+ * @return 0 - unsigned, 1 - signed, 2 - floating point
+ */
+template <typename NumberType>
+constexpr std::uint32_t NumberKind() noexcept {
+  if constexpr (std::is_floating_point_v<NumberType>) {
+    return 2;
+  } else {
+    return std::is_signed_v<NumberType> ? 1 : 0;
+  }
+}
+
+template <typename T>
+void ReadValue(std::ifstream& stream, T& value) {
+  stream.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+exception_t MakeInvalidRunFileException(std::string_view file_path) {
+  return MakeException("Invalid run file ", file_path);
+}
+
+exception_t MakeCorruptedBlockException(std::string_view file_path, std::uint64_t block_index) {
+  return MakeException("Corrupted block ", std::to_string(block_index), std::string_view{" of the run file "},
+                       file_path);
+}
+
+}  // namespace
+
+template <typename NumberType>
+RunFileWriter<NumberType>::RunFileWriter(OutputFile& file, std::size_t block_size)
+    : file_{file}, block_numbers_count_{std::max<std::size_t>(block_size / sizeof(NumberType), 1)} {
+  // the header is written with final counts by finish()
+  file_.reserve(kRunFileHeaderSize);
+}
+
+template <typename NumberType>
+void RunFileWriter<NumberType>::add(const NumberType* numbers, std::size_t count) {
+  while (count != 0) {
+    const auto block_count = numbers_count_ % block_numbers_count_;
+
+    if (block_count == 0) {
+      current_block_.min_ = numbers[0];
+    }
+
+    const auto added_count =
+        static_cast<std::size_t>(std::min<std::uint64_t>(count, block_numbers_count_ - block_count));
+
+    current_block_.max_ = numbers[added_count - 1];
+    current_block_checksum_.add(numbers, added_count);
+    numbers_count_ += added_count;
+
+    if (block_count + added_count == block_numbers_count_) {
+      current_block_.checksum_ = current_block_checksum_.hashesSum();
+      blocks_.push_back(current_block_);
+
+      current_block_ = {};
+      current_block_checksum_ = {};
+    }
+
+    numbers += added_count;
+    count -= added_count;
+  }
+}
+
+template <typename NumberType>
+void RunFileWriter<NumberType>::finish() {
+  if (numbers_count_ % block_numbers_count_ != 0) {
+    current_block_.checksum_ = current_block_checksum_.hashesSum();
+    blocks_.push_back(current_block_);
+
+    current_block_ = {};
+    current_block_checksum_ = {};
+  }
+
+  std::vector<char> index(blocks_.size() * (2 * sizeof(NumberType) + sizeof(std::uint64_t)));
+  auto* index_entry = index.data();
+
+  for (const auto& block : blocks_) {
+    std::copy_n(reinterpret_cast<const char*>(&block.min_), sizeof(NumberType), index_entry);
+    std::copy_n(reinterpret_cast<const char*>(&block.max_), sizeof(NumberType), index_entry + sizeof(NumberType));
+    std::copy_n(reinterpret_cast<const char*>(&block.checksum_), sizeof(std::uint64_t),
+                index_entry + 2 * sizeof(NumberType));
+
+    index_entry += 2 * sizeof(NumberType) + sizeof(std::uint64_t);
+  }
+
+  const auto index_offset = file_.reserve(index.size());
+
+  file_.write(index.data(), index.size(), index_offset);
+
+  const RunFileHeader header{static_cast<std::uint32_t>(sizeof(NumberType)),
+                             NumberKind<NumberType>(),
+                             kRunFileVersion,
+                             kAscendingSortOrder,
+                             block_numbers_count_ * sizeof(NumberType),
+                             numbers_count_,
+                             blocks_.size(),
+                             index_offset};
+
+  std::array<char, kRunFileHeaderSize> header_data{};
+  std::copy(kRunFileMagic.begin(), kRunFileMagic.end(), header_data.begin());
+  std::copy_n(reinterpret_cast<const char*>(&header), sizeof(header), header_data.begin() + kRunFileMagic.size());
+
+  file_.write(header_data.data(), header_data.size(), 0);
+}
+
+template <typename NumberType>
+RunFileReader<NumberType>::RunFileReader(std::string_view file_path)
+    : file_path_{file_path}, stream_{OpenInputBinaryFileStream(file_path)} {
+  std::array<char, kRunFileMagic.size()> magic{};
+  RunFileHeader header{};
+
+  stream_.read(magic.data(), magic.size());
+  ReadValue(stream_, header);
+
+  if (!stream_ || magic != kRunFileMagic || header.number_size_ != sizeof(NumberType) ||
+      header.number_kind_ != NumberKind<NumberType>() || header.version_ != kRunFileVersion ||
+      header.sort_order_ != kAscendingSortOrder || header.block_size_ < sizeof(NumberType) ||
+      header.block_size_ % sizeof(NumberType) != 0) {
+    throw MakeInvalidRunFileException(file_path_);
+  }
+
+  block_numbers_count_ = header.block_size_ / sizeof(NumberType);
+  numbers_count_ = header.numbers_count_;
+
+  if (header.blocks_count_ != (numbers_count_ + block_numbers_count_ - 1) / block_numbers_count_ ||
+      header.index_offset_ != kRunFileHeaderSize + numbers_count_ * sizeof(NumberType)) {
+    throw MakeInvalidRunFileException(file_path_);
+  }
+
+  blocks_.resize(header.blocks_count_);
+
+  stream_.seekg(static_cast<std::streamoff>(header.index_offset_));
+
+  for (auto& block : blocks_) {
+    ReadValue(stream_, block.min_);
+    ReadValue(stream_, block.max_);
+    ReadValue(stream_, block.checksum_);
+  }
+
+  if (!stream_) {
+    throw MakeInvalidRunFileException(file_path_);
+  }
+
+  seekBlock(0);
+}
+
+template <typename NumberType>
+std::size_t RunFileReader<NumberType>::findBlock(NumberType number) const noexcept {
+  const auto first = std::partition_point(blocks_.begin(), blocks_.end(),
+                                          [number](const auto& block) { return block.max_ < number; });
+
+  return static_cast<std::size_t>(first - blocks_.begin());
+}
+
+template <typename NumberType>
+void RunFileReader<NumberType>::seekBlock(std::size_t block_index) {
+  position_ = std::min<std::uint64_t>(block_index * block_numbers_count_, numbers_count_);
+  block_position_ = 0;
+  block_checksum_ = {};
+
+  stream_.clear();
+  stream_.seekg(static_cast<std::streamoff>(kRunFileHeaderSize + position_ * sizeof(NumberType)));
+}
+
+template <typename NumberType>
+std::size_t RunFileReader<NumberType>::read(NumberType* numbers, std::size_t count) {
+  count = static_cast<std::size_t>(std::min<std::uint64_t>(count, numbers_count_ - position_));
+
+  if (count == 0) {
+    return 0;
+  }
+
+  const auto size = count * sizeof(NumberType);
+  auto [ok, bytes_read] = ReadFileStream(stream_, reinterpret_cast<char*>(numbers), size);
+
+  if (!ok || bytes_read != size) {
+    throw MakeException("Failed to read the file ", file_path_, std::string_view{": "}, errno);
+  }
+
+  verify(numbers, count);
+
+  return count;
+}
+
+template <typename NumberType>
+void RunFileReader<NumberType>::verify(const NumberType* numbers, std::size_t count) {
+  while (count != 0) {
+    const auto block_index = position_ / block_numbers_count_;
+    const auto& block = blocks_[block_index];
+    const auto block_count = std::min(block_numbers_count_, numbers_count_ - block_index * block_numbers_count_);
+
+    if (block_position_ == 0 && numbers[0] != block.min_) {
+      throw MakeCorruptedBlockException(file_path_, block_index);
+    }
+
+    const auto verified_count =
+        static_cast<std::size_t>(std::min<std::uint64_t>(count, block_count - block_position_));
+
+    block_checksum_.add(numbers, verified_count);
+    block_position_ += verified_count;
+    position_ += verified_count;
+
+    if (block_position_ == block_count) {
+      if (numbers[verified_count - 1] != block.max_ || block_checksum_.hashesSum() != block.checksum_) {
+        throw MakeCorruptedBlockException(file_path_, block_index);
+      }
+
+      block_position_ = 0;
+      block_checksum_ = {};
+    }
+
+    numbers += verified_count;
+    count -= verified_count;
+  }
+}
+
+template class RunFileWriter<number_t>;
+template class RunFileWriter<argsort_number_t>;
+template class RunFileReader<number_t>;
+template class RunFileReader<argsort_number_t>;
+
+}  // namespace es
\ No newline at end of file
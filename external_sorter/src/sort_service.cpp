@@ -0,0 +1,228 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "sort_service.h"
+
+#include "defines.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <optional>
+#include <random>
+#include <sstream>
+
+namespace es {
+
+namespace {
+
+const std::string_view kIntermediateDirectoryPrefix{"intermediate_"};
+
+/**
+ * Creates a random name of a service, so services of different processes do not share intermediate directories
+ * @return name
+ */
+std::string CreateServiceName() {
+  std::random_device random_device{};
+  std::ostringstream stream;
+
+  stream << std::hex << random_device() << random_device();
+
+  return stream.str();
+}
+
+}  // namespace
+
+template <typename NumberType>
+SortService<NumberType>::SortService(std::shared_ptr<ThreadPool> pool, SortServiceOptions options)
+    : thread_pool_{std::move(pool)},
+      options_{options},
+      memory_budget_{options_.memory_size_},
+      name_{CreateServiceName()},
+      slots_count_{options_.max_active_jobs_count_ == 0 ? std::max<std::size_t>(thread_pool_->threadsCount(), 1)
+                                                         : options_.max_active_jobs_count_} {
+  if (options_.memory_size_ == 0) {
+    throw MakeException("There is not enough memory.");
+  }
+
+  for (std::size_t i = 0; i < slots_count_; ++i) {
+    slots_.emplace_back([this]() { runSlot(); });
+  }
+}
+
+template <typename NumberType>
+SortService<NumberType>::~SortService() {
+  {
+    std::scoped_lock<std::mutex> lock(mutex_);
+
+    is_stopped_ = true;
+  }
+
+  cv_.notify_all();
+
+  for (auto& slot : slots_) {
+    slot.join();
+  }
+}
+
+template <typename NumberType>
+std::future<SortStats> SortService<NumberType>::submit(SortJob job) {
+  std::future<SortStats> result;
+
+  {
+    std::scoped_lock<std::mutex> lock(mutex_);
+
+    queue_.push_back(QueuedJob{std::move(job), next_job_id_++, {}});
+    result = queue_.back().result_.get_future();
+  }
+
+  cv_.notify_all();
+
+  return result;
+}
+
+template <typename NumberType>
+std::vector<std::future<SortStats>> SortService<NumberType>::submit(std::vector<SortJob> jobs) {
+  std::vector<std::future<SortStats>> results;
+
+  {
+    std::scoped_lock<std::mutex> lock(mutex_);
+
+    for (auto& job : jobs) {
+      queue_.push_back(QueuedJob{std::move(job), next_job_id_++, {}});
+      results.push_back(queue_.back().result_.get_future());
+    }
+  }
+
+  cv_.notify_all();
+
+  return results;
+}
+
+template <typename NumberType>
+std::size_t SortService<NumberType>::queuedJobsCount() const {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  return queue_.size();
+}
+
+template <typename NumberType>
+std::size_t SortService<NumberType>::activeJobsCount() const {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  return active_jobs_count_;
+}
+
+template <typename NumberType>
+std::size_t SortService<NumberType>::peakActiveJobsCount() const {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  return peak_active_jobs_count_;
+}
+
+template <typename NumberType>
+void SortService<NumberType>::runSlot() {
+  while (true) {
+    QueuedJob queued_job;
+    std::size_t memory_size = 0;
+    MemoryReservation reservation;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      cv_.wait(lock, [this]() { return queue_.empty() ? is_stopped_ : calcJobMemorySize() != 0; });
+
+      if (queue_.empty()) {
+        return;
+      }
+
+      memory_size = calcJobMemorySize();
+      reservation = memory_budget_.reserve(memory_size);
+
+      queued_job = std::move(queue_.front());
+      queue_.pop_front();
+
+      ++active_jobs_count_;
+      peak_active_jobs_count_ = std::max(peak_active_jobs_count_, active_jobs_count_);
+    }
+
+    sortJob(queued_job, memory_size);
+
+    reservation.reset();
+
+    {
+      std::scoped_lock<std::mutex> lock(mutex_);
+
+      --active_jobs_count_;
+    }
+
+    cv_.notify_all();
+  }
+}
+
+template <typename NumberType>
+std::size_t SortService<NumberType>::calcJobMemorySize() const {
+  // A lone job (the only queued one while no job is active) shares memory with nobody, so it gets all memory.
+  const auto free_slots_count = slots_count_ - active_jobs_count_;
+  const auto sharing_jobs_count = std::max<std::size_t>(std::min(queue_.size(), free_slots_count), 1);
+  const auto memory_size = memory_budget_.available() / sharing_jobs_count;
+
+  if (memory_size >= options_.min_job_memory_size_) {
+    return memory_size;
+  }
+
+  // A job waits until its share is large enough, unless there is no active job to return memory.
+  return active_jobs_count_ == 0 ? memory_budget_.available() : 0;
+}
+
+template <typename NumberType>
+void SortService<NumberType>::sortJob(QueuedJob& queued_job, std::size_t memory_size) {
+  auto& job = queued_job.job_;
+
+  job.options_.intermediate_directory_name_ =
+      std::string{kIntermediateDirectoryPrefix} + name_ + '_' + std::to_string(queued_job.id_);
+
+  const auto intermediate_directory_name = job.options_.intermediate_directory_name_;
+  const auto intermediate_directories_paths = job.options_.spill_directories_.empty()
+                                                  ? std::vector<std::string>{job.output_directory_path_}
+                                                  : job.options_.spill_directories_;
+
+  const auto task_group = thread_pool_->createTaskGroup();
+  std::optional<SortStats> stats;
+  std::exception_ptr exception_ptr;
+
+  try {
+    const ThreadPool::TaskGroupScope task_group_scope{task_group};
+
+    ExternalSorter<NumberType> sorter{memory_size, std::move(job.input_files_), std::move(job.output_directory_path_),
+                                      thread_pool_, std::move(job.options_)};
+
+    sorter.sort();
+
+    stats = sorter.stats();
+  } catch (...) {
+    exception_ptr = std::current_exception();
+  }
+
+  thread_pool_->removeTaskGroup(task_group);
+
+  // The sorter keeps its intermediate directories (and chunks of the final merge), which would pile up, as every job
+  // has its own ones. Nothing else is written there, so they are removed entirely.
+  for (const auto& directory_path : intermediate_directories_paths) {
+    std::error_code ec{};
+    std::filesystem::remove_all(std::filesystem::path{directory_path} / intermediate_directory_name, ec);
+  }
+
+  if (exception_ptr) {
+    queued_job.result_.set_exception(exception_ptr);
+  } else {
+    queued_job.result_.set_value(std::move(*stats));
+  }
+}
+
+template class SortService<number_t>;
+template class SortService<argsort_number_t>;
+
+}  // namespace es
\ No newline at end of file
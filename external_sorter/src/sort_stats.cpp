@@ -0,0 +1,231 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "sort_stats.h"
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string_view>
+
+namespace es {
+
+namespace {
+
+/**
+ * Helper class for writing a flat JSON object
+ */
+class JsonObjectWriter {
+ public:
+  JsonObjectWriter() { stream_ << '{'; }
+
+  template <typename T>
+  JsonObjectWriter& add(std::string_view key, const T& value) {
+    stream_ << (empty_ ? "" : ",") << '"' << key << "\":" << value;
+    empty_ = false;
+
+    return *this;
+  }
+
+  JsonObjectWriter& add(std::string_view key, const PhaseStats& stats) {
+    return add(key, JsonObjectWriter{}
+                        .add("wall_time_ns", stats.wall_time_ns_)
+                        .add("cpu_time_ns", stats.cpu_time_ns_)
+                        .str());
+  }
+
+  JsonObjectWriter& add(std::string_view key, const IoStats& stats) {
+    return add(key, JsonObjectWriter{}
+                        .add("bytes_read", stats.bytes_read_)
+                        .add("bytes_written", stats.bytes_written_)
+                        .str());
+  }
+
+  JsonObjectWriter& add(std::string_view key, std::string_view value) {
+    stream_ << (empty_ ? "" : ",") << '"' << key << "\":\"" << value << '"';
+    empty_ = false;
+
+    return *this;
+  }
+
+  JsonObjectWriter& add(std::string_view key, const std::vector<StageStats>& stages) {
+    std::string array{"["};
+
+    for (const auto& stage : stages) {
+      array.append(array.size() == 1 ? "" : ",")
+          .append(JsonObjectWriter{}
+                      .add("name", std::string_view{stage.name_})
+                      .add("parallelism", stage.parallelism_)
+                      .add("items_count", stage.items_count_)
+                      .add("busy_time_ns", stage.busy_time_ns_)
+                      .add("elapsed_time_ns", stage.elapsed_time_ns_)
+                      .add("peak_queue_depth", stage.peak_queue_depth_)
+                      .str());
+    }
+
+    return add(key, array.append("]"));
+  }
+
+  std::string str() const { return stream_.str() + '}'; }
+
+ private:
+  std::ostringstream stream_;  ///< Stream for writing
+  bool empty_ = true;          ///< Flag for indicating if the object has no keys yet
+};
+
+/**
+ * Helper class for writing a human-readable report line by line
+ */
+class TextReportWriter {
+ public:
+  TextReportWriter() { stream_ << std::fixed << std::setprecision(3); }
+
+  TextReportWriter& add(std::string_view name, const PhaseStats& stats) {
+    stream_ << name << ": " << ToSeconds(stats.wall_time_ns_) << " s wall, " << ToSeconds(stats.cpu_time_ns_)
+            << " s cpu\n";
+
+    return *this;
+  }
+
+  TextReportWriter& add(std::string_view name, const IoStats& stats) {
+    stream_ << name << ": " << ToMegabytes(stats.bytes_read_) << " MiB read, " << ToMegabytes(stats.bytes_written_)
+            << " MiB written\n";
+
+    return *this;
+  }
+
+  TextReportWriter& add(const StageStats& stage) {
+    const auto capacity_time = static_cast<double>(stage.elapsed_time_ns_) * static_cast<double>(stage.parallelism_);
+    const auto utilization =
+        capacity_time == 0 ? 0.0 : 100.0 * static_cast<double>(stage.busy_time_ns_) / capacity_time;
+
+    stream_ << "stage " << stage.name_ << ": " << stage.items_count_ << " items, " << ToSeconds(stage.busy_time_ns_)
+            << " s busy, " << utilization << " % of " << stage.parallelism_ << " threads, peak queue "
+            << stage.peak_queue_depth_ << '\n';
+
+    return *this;
+  }
+
+  TextReportWriter& addSeconds(std::string_view name, std::uint64_t time_ns) {
+    return add(name, ToSeconds(time_ns), "s");
+  }
+
+  TextReportWriter& addMegabytes(std::string_view name, std::uint64_t size) {
+    return add(name, ToMegabytes(size), "MiB");
+  }
+
+  template <typename T>
+  TextReportWriter& add(std::string_view name, const T& value, std::string_view unit = {}) {
+    stream_ << name << ": " << value << (unit.empty() ? "" : " ") << unit << '\n';
+
+    return *this;
+  }
+
+  std::string str() const { return stream_.str(); }
+
+ private:
+  static double ToSeconds(std::uint64_t time_ns) noexcept { return static_cast<double>(time_ns) / 1e9; }
+
+  static double ToMegabytes(std::uint64_t size) noexcept { return static_cast<double>(size) / (1024.0 * 1024.0); }
+
+ private:
+  std::ostringstream stream_;  ///< Stream for writing
+};
+
+}  // namespace
+
+std::string ToJson(const SortStats& stats) {
+  return JsonObjectWriter{}
+      .add("total", stats.total_)
+      .add("run_generation", stats.run_generation_)
+      .add("merge", stats.merge_)
+      .add("input", stats.input_)
+      .add("intermediate", stats.intermediate_)
+      .add("output", stats.output_)
+      .add("runs_count", stats.runs_count_)
+      .add("merge_passes_count", stats.merge_passes_count_)
+      .add("compactions_count", stats.compactions_count_)
+      .add("resident_runs_count", stats.resident_runs_count_)
+      .add("compressed_runs_count", stats.compressed_runs_count_)
+      .add("compressed_runs_size", stats.compressed_runs_size_)
+      .add("evicted_runs_count", stats.evicted_runs_count_)
+      .add("counted_values_count", stats.counted_values_count_)
+      .add("chunk_buffer_wait_time_ns", stats.chunk_buffer_wait_time_ns_)
+      .add("file_buffer_wait_time_ns", stats.file_buffer_wait_time_ns_)
+      .add("merge_buffer_wait_time_ns", stats.merge_buffer_wait_time_ns_)
+      .add("memory_pressure_shrinks_count", stats.memory_pressure_shrinks_count_)
+      .add("pool_tasks_count", stats.pool_tasks_count_)
+      .add("pool_busy_time_ns", stats.pool_busy_time_ns_)
+      .add("pool_wait_time_ns", stats.pool_wait_time_ns_)
+      .add("pool_average_queue_depth", stats.pool_average_queue_depth_)
+      .add("pool_peak_queue_depth", stats.pool_peak_queue_depth_)
+      .add("peak_reserved_memory", stats.peak_reserved_memory_)
+      .add("stages", stats.stages_)
+      .str();
+}
+
+std::string ToText(const SortStats& stats) {
+  TextReportWriter writer{};
+
+  writer
+      .add("total", stats.total_)
+      .add("run generation", stats.run_generation_)
+      .add("merge", stats.merge_)
+      .add("input", stats.input_)
+      .add("intermediate", stats.intermediate_)
+      .add("output", stats.output_)
+      .add("runs", stats.runs_count_)
+      .add("merge passes", stats.merge_passes_count_)
+      .add("compactions", stats.compactions_count_)
+      .add("resident runs", stats.resident_runs_count_)
+      .add("compressed runs", stats.compressed_runs_count_)
+      .addMegabytes("compressed runs size", stats.compressed_runs_size_)
+      .add("evicted runs", stats.evicted_runs_count_)
+      .add("counted values", stats.counted_values_count_)
+      .addSeconds("chunk buffer wait", stats.chunk_buffer_wait_time_ns_)
+      .addSeconds("file buffer wait", stats.file_buffer_wait_time_ns_)
+      .addSeconds("merge buffer wait", stats.merge_buffer_wait_time_ns_)
+      .add("memory pressure shrinks", stats.memory_pressure_shrinks_count_)
+      .add("pool tasks", stats.pool_tasks_count_)
+      .addSeconds("pool busy", stats.pool_busy_time_ns_)
+      .addSeconds("pool wait", stats.pool_wait_time_ns_)
+      .add("pool average queue depth", stats.pool_average_queue_depth_)
+      .add("pool peak queue depth", stats.pool_peak_queue_depth_)
+      .addMegabytes("peak reserved memory", stats.peak_reserved_memory_);
+
+  for (const auto& stage : stats.stages_) {
+    writer.add(stage);
+  }
+
+  return writer.str();
+}
+
+StatsCounters::StatsCounters(std::size_t threads_count)
+    : slots_count_{threads_count + 1}, slots_{std::make_unique<Slot[]>(slots_count_)} {}
+
+void StatsCounters::add(StatsCounter counter, std::uint64_t value) noexcept {
+  const auto slot_index = std::min(ThreadPool::currentThreadIndex(), slots_count_ - 1);
+
+  slots_[slot_index].values_[static_cast<std::size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+std::uint64_t StatsCounters::sum(StatsCounter counter) const noexcept {
+  std::uint64_t value = 0;
+
+  for (std::size_t i = 0; i < slots_count_; ++i) {
+    value += slots_[i].values_[static_cast<std::size_t>(counter)].load(std::memory_order_relaxed);
+  }
+
+  return value;
+}
+
+void StatsCounters::reset(StatsCounter counter) noexcept {
+  for (std::size_t i = 0; i < slots_count_; ++i) {
+    slots_[i].values_[static_cast<std::size_t>(counter)].store(0, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace es
\ No newline at end of file
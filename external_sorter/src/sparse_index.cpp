@@ -0,0 +1,206 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "sparse_index.h"
+
+#include "defines.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <array>
+
+namespace es {
+
+namespace {
+
+const std::string_view kIndexFileExtension{".index"};
+const std::array<char, 8> kIndexMagic{'E', 'S', 'S', 'P', 'I', 'D', 'X', '1'};
+const std::uint32_t kIndexVersion = 1;
+
+/**
+ * Header of an index file
+ */
+struct IndexHeader {
+  std::uint32_t number_size_ = {};    ///< Size of a number
+  std::uint32_t version_ = {};        ///< Version of the format
+  std::uint64_t block_size_ = {};     ///< Size of a block in bytes
+  std::uint64_t numbers_count_ = {};  ///< Count of numbers
+  std::uint64_t blocks_count_ = {};   ///< Count of blocks
+};
+
+template <typename T>
+void WriteValue(std::ofstream& stream, const T& value) {
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+void ReadValue(std::ifstream& stream, T& value) {
+  stream.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+exception_t MakeInvalidIndexException(std::string_view index_file_path) {
+  return MakeException("Invalid sparse index file ", index_file_path);
+}
+
+}  // namespace
+
+std::string CreateSparseIndexFilePath(std::string_view file_path) {
+  std::string index_file_path{file_path};
+  index_file_path.append(kIndexFileExtension);
+
+  return index_file_path;
+}
+
+template <typename NumberType>
+SparseIndexWriter<NumberType>::SparseIndexWriter(std::string index_file_path, std::size_t block_size)
+    : index_file_path_{std::move(index_file_path)},
+      stream_{OpenOutputBinaryFileStream(index_file_path_)},
+      block_numbers_count_{std::max<std::size_t>(block_size / sizeof(NumberType), 1)} {
+  // the header is rewritten with final counts by finish()
+  writeHeader();
+}
+
+template <typename NumberType>
+void SparseIndexWriter<NumberType>::add(const NumberType* numbers, std::size_t count) {
+  while (count != 0) {
+    if (current_block_.count_ == 0) {
+      current_block_.offset_ = numbers_count_ * sizeof(NumberType);
+      current_block_.min_ = numbers[0];
+    }
+
+    const auto added_count = static_cast<std::size_t>(std::min<std::uint64_t>(
+        count, block_numbers_count_ - current_block_.count_));
+
+    current_block_.max_ = numbers[added_count - 1];
+    current_block_.count_ += added_count;
+    numbers_count_ += added_count;
+
+    if (current_block_.count_ == block_numbers_count_) {
+      writeBlock(current_block_);
+
+      current_block_ = {};
+    }
+
+    numbers += added_count;
+    count -= added_count;
+  }
+}
+
+template <typename NumberType>
+void SparseIndexWriter<NumberType>::finish() {
+  if (current_block_.count_ != 0) {
+    writeBlock(current_block_);
+
+    current_block_ = {};
+  }
+
+  stream_.seekp(0);
+  writeHeader();
+  stream_.flush();
+
+  if (!stream_) {
+    throw MakeException("Failed to write the file ", index_file_path_, std::string_view{": "}, errno);
+  }
+}
+
+template <typename NumberType>
+void SparseIndexWriter<NumberType>::writeBlock(const SparseIndexBlock<NumberType>& block) {
+  WriteValue(stream_, block.offset_);
+  WriteValue(stream_, block.count_);
+  WriteValue(stream_, block.min_);
+  WriteValue(stream_, block.max_);
+
+  ++blocks_count_;
+}
+
+template <typename NumberType>
+void SparseIndexWriter<NumberType>::writeHeader() {
+  stream_.write(kIndexMagic.data(), kIndexMagic.size());
+  WriteValue(stream_, IndexHeader{static_cast<std::uint32_t>(sizeof(NumberType)), kIndexVersion,
+                                  block_numbers_count_ * sizeof(NumberType), numbers_count_, blocks_count_});
+}
+
+template <typename NumberType>
+SparseIndex<NumberType>::SparseIndex(std::string_view index_file_path) {
+  auto stream = OpenInputBinaryFileStream(index_file_path);
+
+  std::array<char, kIndexMagic.size()> magic{};
+  IndexHeader header{};
+
+  stream.read(magic.data(), magic.size());
+  ReadValue(stream, header);
+
+  if (!stream || magic != kIndexMagic || header.number_size_ != sizeof(NumberType) ||
+      header.version_ != kIndexVersion) {
+    throw MakeInvalidIndexException(index_file_path);
+  }
+
+  numbers_count_ = header.numbers_count_;
+  blocks_.resize(header.blocks_count_);
+
+  for (auto& block : blocks_) {
+    ReadValue(stream, block.offset_);
+    ReadValue(stream, block.count_);
+    ReadValue(stream, block.min_);
+    ReadValue(stream, block.max_);
+  }
+
+  if (!stream) {
+    throw MakeInvalidIndexException(index_file_path);
+  }
+}
+
+template <typename NumberType>
+ByteRange SparseIndex<NumberType>::find(NumberType min, NumberType max) const noexcept {
+  if (min > max) {
+    return {};
+  }
+
+  // the first block which may contain min and the first block which starts after max
+  const auto first = std::partition_point(blocks_.begin(), blocks_.end(),
+                                          [min](const auto& block) { return block.max_ < min; });
+  const auto last =
+      std::partition_point(first, blocks_.end(), [max](const auto& block) { return block.min_ <= max; });
+
+  if (first == last) {
+    return {};
+  }
+
+  const auto& last_block = *std::prev(last);
+
+  return {first->offset_, last_block.offset_ + last_block.count_ * sizeof(NumberType)};
+}
+
+template <typename NumberType>
+std::vector<NumberType> SparseIndex<NumberType>::read(std::string_view file_path, NumberType min,
+                                                      NumberType max) const {
+  const auto range = find(min, max);
+
+  if (range.begin_ == range.end_) {
+    return {};
+  }
+
+  std::vector<NumberType> numbers((range.end_ - range.begin_) / sizeof(NumberType));
+
+  auto stream = OpenInputBinaryFileStream(file_path);
+  stream.seekg(static_cast<std::streamoff>(range.begin_));
+  stream.read(reinterpret_cast<char*>(numbers.data()), static_cast<std::streamsize>(range.end_ - range.begin_));
+
+  if (!stream) {
+    throw MakeException("Failed to read ", file_path, std::string_view{": "}, errno);
+  }
+
+  // only the boundary blocks may contain numbers out of the range
+  const auto begin = std::lower_bound(numbers.begin(), numbers.end(), min);
+  const auto end = std::upper_bound(begin, numbers.end(), max);
+
+  return {begin, end};
+}
+
+template class SparseIndexWriter<number_t>;
+template class SparseIndexWriter<argsort_number_t>;
+template class SparseIndex<number_t>;
+template class SparseIndex<argsort_number_t>;
+
+}  // namespace es
\ No newline at end of file
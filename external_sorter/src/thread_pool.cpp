@@ -4,66 +4,94 @@
 
 #include "thread_pool.h"
 
+#include "resource_limits.h"
+#include "tracing.h"
+#include "utils.h"
+
+#include <algorithm>
+
 namespace es {
 namespace {
 
-template <typename counter_type>
-class ThreadCounterWatchDog {
- public:
-  ThreadCounterWatchDog() = default;
-  ~ThreadCounterWatchDog() noexcept {
-    if (counter_ptr_) {
-      counter_ptr_->fetch_sub(1, std::memory_order_release);
-    }
-  }
+const std::size_t kMinThreadsCount = 2;
 
-  void init(counter_type* counter) noexcept {
-    counter_ptr_ = counter;
+thread_local std::size_t current_thread_index = ThreadPool::kNotPoolThread;
+thread_local task_group_t current_task_group = ThreadPool::kDefaultTaskGroup;
 
-    counter_ptr_->fetch_add(1, std::memory_order_release);
-  }
+}  // namespace
+
+ThreadPool::TaskGroupScope::TaskGroupScope(task_group_t group) noexcept : previous_group_{current_task_group} {
+  current_task_group = group;
+}
+
+ThreadPool::TaskGroupScope::~TaskGroupScope() {
+  current_task_group = previous_group_;
+}
 
- private:
-  counter_type* counter_ptr_ = nullptr;
-};
+ThreadPool::ThreadPool() : ThreadPool(ThreadPoolOptions{}) {}
 
-const unsigned int kMinThreadsCount = 2;
+ThreadPool::ThreadPool(std::size_t threads_count) : ThreadPool(ThreadPoolOptions{threads_count}) {}
 
-}  // namespace
+ThreadPool::ThreadPool(const ThreadPoolOptions& options) {
+  const auto threads_count =
+      options.threads_count_ == 0 ? std::max(DetectResourceLimits().cpus_count_, kMinThreadsCount) - 1
+                                  : options.threads_count_;
+
+  if (options.pinning_ == ThreadPinning::kExplicit) {
+    for (std::size_t i = 0; i < threads_count && !options.cpus_.empty(); ++i) {
+      threads_cpus_.push_back(options.cpus_[i % options.cpus_.size()]);
+    }
+  } else {
+    threads_cpus_ = CreatePinningCpus(DetectCpuTopology(), options.pinning_, threads_count);
+  }
 
-ThreadPool::ThreadPool() {
-  const auto threads_count = std::max(std::thread::hardware_concurrency(), kMinThreadsCount) - 1;
+  threads_stats_ = std::make_unique<ThreadStats[]>(threads_count);
+  groups_.emplace(kDefaultTaskGroup, TaskGroup{});
 
   for (std::size_t i = 0; i < threads_count; ++i) {
-    threads_.emplace_back([&]() {
+    threads_.emplace_back([&, thread_index = i]() {
+      current_thread_index = thread_index;
+
+      if (!threads_cpus_.empty()) {
+        PinCurrentThread(threads_cpus_[thread_index]);
+      }
+
+      auto& thread_stats = threads_stats_[thread_index];
+
       while (true) {
         task_t task;
-        ThreadCounterWatchDog<std::atomic_uint_fast32_t> counter{};
+        task_group_t group = kDefaultTaskGroup;
 
-        try {
-          {
-            std::unique_lock lock(mutex_);
-            cv_.wait(lock, [&]() { return stop_ || !tasks_.empty(); });
+        {
+          std::unique_lock lock(mutex_);
+          cv_.wait(lock, [&]() { return stop_ || queued_tasks_count_ != 0; });
+
+          if (stop_ && queued_tasks_count_ == 0) {
+            return;
+          }
 
-            if (stop_ && tasks_.empty()) {
-              return;
-            }
+          group = popTask(task);
+        }
 
-            std::swap(task, tasks_.front());
+        std::exception_ptr exception;
+        const auto start_time = SteadyClockNs();
 
-            tasks_.pop();
+        try {
+          const TaskGroupScope task_group_scope{group};
 
-            counter.init(&active_tasks_);
-          }
+          ES_TRACE_SCOPE("pool", "task");
 
           task();
         } catch (...) {
-          if (!exception_flag_.load()) {
-            exception_ptr_ = std::current_exception();
-
-            exception_flag_.store(true);
-          }
+          exception = std::current_exception();
         }
+
+        thread_stats.busy_time_ns_.fetch_add(SteadyClockNs() - start_time, std::memory_order_relaxed);
+
+        // The task is destroyed before it is over for waiters, as it may refer to their objects.
+        task = nullptr;
+
+        finishTask(group, std::move(exception));
       }
     });
   }
@@ -82,50 +110,202 @@ void ThreadPool::add(task_t task) {
   {
     std::scoped_lock<mutex_type> lock(mutex_);
 
-    tasks_.push(std::move(task));
+    auto group_it = groups_.find(current_task_group);
+
+    if (group_it == groups_.end()) {
+      group_it = groups_.find(kDefaultTaskGroup);
+    }
+
+    auto& group_tasks = group_it->second.tasks_;
+
+    group_tasks.push(std::move(task));
+
+    if (group_tasks.size() == 1) {
+      ready_groups_.push_back(group_it->first);
+    }
+
+    const auto queue_depth = ++queued_tasks_count_;
+
+    ++queue_stats_.tasks_count_;
+    queue_stats_.queue_depth_sum_ += queue_depth;
+    queue_stats_.peak_queue_depth_ = std::max<std::uint64_t>(queue_stats_.peak_queue_depth_, queue_depth);
   }
 
   cv_.notify_one();
 }
 
 void ThreadPool::checkException() const {
-  if (exception_flag_.load()) {
-    std::rethrow_exception(exception_ptr_);
+  if (exceptions_count_.load() == 0) {
+    return;
+  }
+
+  std::exception_ptr exception;
+
+  {
+    std::scoped_lock<mutex_type> lock(mutex_);
+
+    const auto group_it = groups_.find(current_task_group);
+
+    if (group_it != groups_.end()) {
+      exception = group_it->second.exception_ptr_;
+    }
+  }
+
+  if (exception) {
+    std::rethrow_exception(exception);
   }
 }
 
-bool ThreadPool::hasPendingTasks() const {
-  if (active_tasks_.load() != 0) {
-    return true;
+void ThreadPool::clearException() noexcept {
+  std::scoped_lock<mutex_type> lock(mutex_);
+
+  const auto group_it = groups_.find(current_task_group);
+
+  if (group_it != groups_.end() && group_it->second.exception_ptr_) {
+    group_it->second.exception_ptr_ = nullptr;
+    exceptions_count_.fetch_sub(1);
   }
+}
 
+bool ThreadPool::hasPendingTasks() const {
   std::scoped_lock<mutex_type> lock(mutex_);
 
-  return !(tasks_.empty() && active_tasks_.load(std::memory_order_relaxed) == 0);
+  const auto group_it = groups_.find(current_task_group);
+
+  return group_it != groups_.end() &&
+         (!group_it->second.tasks_.empty() || group_it->second.active_tasks_count_ != 0);
+}
+
+task_group_t ThreadPool::createTaskGroup() {
+  std::scoped_lock<mutex_type> lock(mutex_);
+
+  const auto group = next_group_++;
+
+  groups_.emplace(group, TaskGroup{});
+
+  return group;
+}
+
+void ThreadPool::removeTaskGroup(task_group_t group) {
+  std::scoped_lock<mutex_type> lock(mutex_);
+
+  const auto group_it = groups_.find(group);
+
+  if (group == kDefaultTaskGroup || group_it == groups_.end()) {
+    return;
+  }
+
+  // Tasks which are still queued are dropped.
+  if (!group_it->second.tasks_.empty()) {
+    queued_tasks_count_ -= group_it->second.tasks_.size();
+    ready_groups_.erase(std::find(ready_groups_.begin(), ready_groups_.end(), group));
+  }
+
+  if (group_it->second.exception_ptr_) {
+    exceptions_count_.fetch_sub(1);
+  }
+
+  groups_.erase(group_it);
+}
+
+std::size_t ThreadPool::threadsCount() const noexcept {
+  return threads_.size();
+}
+
+const std::vector<unsigned int>& ThreadPool::threadsCpus() const noexcept {
+  return threads_cpus_;
+}
+
+ThreadPoolStats ThreadPool::stats() const {
+  ThreadPoolStats stats{};
+
+  {
+    std::scoped_lock<mutex_type> lock(mutex_);
+
+    stats = queue_stats_;
+  }
+
+  for (std::size_t i = 0; i < threads_.size(); ++i) {
+    stats.busy_time_ns_ += threads_stats_[i].busy_time_ns_.load(std::memory_order_relaxed);
+  }
+
+  stats.wait_time_ns_ = wait_time_ns_.load(std::memory_order_relaxed);
+
+  return stats;
+}
+
+std::size_t ThreadPool::currentThreadIndex() noexcept {
+  return current_thread_index;
+}
+
+task_group_t ThreadPool::currentTaskGroup() noexcept {
+  return current_task_group;
 }
 
 void ThreadPool::waitForTask(const std::atomic_bool& task_flag) const {
-  while (!task_flag.load(std::memory_order_acquire)) {
-    std::this_thread::yield();
+  if (task_flag.load(std::memory_order_acquire)) {
+    return;
+  }
 
-    checkException();
+  const auto start_time = SteadyClockNs();
+
+  {
+    std::unique_lock lock(mutex_);
+
+    // The flag is set by a task before it is finished, and every finished task notifies waiters under the lock.
+    done_cv_.wait(lock, [&]() {
+      if (task_flag.load(std::memory_order_acquire)) {
+        return true;
+      }
+
+      const auto group_it = groups_.find(current_task_group);
+
+      return group_it != groups_.end() && group_it->second.exception_ptr_ != nullptr;
+    });
   }
+
+  wait_time_ns_.fetch_add(SteadyClockNs() - start_time, std::memory_order_relaxed);
+
+  checkException();
 }
 
-bool ThreadPool::popTask(task_t& task) {
-  std::unique_lock lock(mutex_);
+task_group_t ThreadPool::popTask(task_t& task) {
+  const auto group = ready_groups_.front();
+  auto& task_group = groups_.at(group);
+
+  ready_groups_.pop_front();
+
+  std::swap(task, task_group.tasks_.front());
 
-  cv_.wait(lock, [&]() { return stop_ || !tasks_.empty(); });
+  task_group.tasks_.pop();
+  ++task_group.active_tasks_count_;
+  --queued_tasks_count_;
 
-  if (stop_ && tasks_.empty()) {
-    return false;
+  // The group waits for its next turn behind other groups.
+  if (!task_group.tasks_.empty()) {
+    ready_groups_.push_back(group);
   }
 
-  std::swap(task, tasks_.front());
+  return group;
+}
 
-  tasks_.pop();
+void ThreadPool::finishTask(task_group_t group, std::exception_ptr exception) {
+  {
+    std::scoped_lock<mutex_type> lock(mutex_);
+
+    const auto group_it = groups_.find(group);
+
+    if (group_it != groups_.end()) {
+      --group_it->second.active_tasks_count_;
+
+      if (exception && !group_it->second.exception_ptr_) {
+        group_it->second.exception_ptr_ = std::move(exception);
+        exceptions_count_.fetch_add(1);
+      }
+    }
+  }
 
-  return true;
+  done_cv_.notify_all();
 }
 
 }  // namespace es
\ No newline at end of file
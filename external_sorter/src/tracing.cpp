@@ -0,0 +1,185 @@
+/*
+ * external_sorter: 2021 Sergey Gorelyshev
+ */
+
+#include "tracing.h"
+
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace es {
+
+namespace {
+
+/**
+ * Converts nanoseconds to microseconds which are used by the trace-event format
+ * @param time_ns time in nanoseconds
+ * @return time in microseconds
+ */
+double ToMicroseconds(std::uint64_t time_ns) noexcept {
+  constexpr double ns_per_us = 1000.0;
+
+  return static_cast<double>(time_ns) / ns_per_us;
+}
+
+}  // namespace
+
+thread_local Tracer::ThreadBufferOwner Tracer::current_thread_buffer_;
+
+Tracer::ThreadBufferOwner::~ThreadBufferOwner() {
+  if (buffer_) {
+    buffer_->is_released_.store(true, std::memory_order_release);
+  }
+}
+
+Tracer& Tracer::instance() {
+  static Tracer tracer;
+
+  return tracer;
+}
+
+void Tracer::start(std::size_t events_per_thread) {
+  clear();
+
+  {
+    std::scoped_lock<std::mutex> lock(mutex_);
+
+    events_per_thread_ = events_per_thread;
+  }
+
+  start_time_ns_ = SteadyClockNs();
+
+  enabled_.store(true, std::memory_order_release);
+}
+
+void Tracer::stop() noexcept {
+  enabled_.store(false, std::memory_order_release);
+}
+
+void Tracer::record(const TraceEvent& event) noexcept {
+  ThreadBuffer* buffer = nullptr;
+
+  try {
+    buffer = currentThreadBuffer();
+  } catch (...) {
+    return;
+  }
+
+  const auto size = buffer->size_.load(std::memory_order_relaxed);
+
+  if (size == buffer->capacity_) {
+    buffer->dropped_events_count_.fetch_add(1, std::memory_order_relaxed);
+
+    return;
+  }
+
+  buffer->events_[size] = event;
+  buffer->size_.store(size + 1, std::memory_order_release);
+}
+
+void Tracer::clear() noexcept {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  const auto is_released = [](const auto& buffer) {
+    return buffer->is_released_.load(std::memory_order_acquire);
+  };
+
+  buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(), is_released), buffers_.end());
+
+  for (auto& buffer : buffers_) {
+    buffer->size_.store(0, std::memory_order_relaxed);
+    buffer->dropped_events_count_.store(0, std::memory_order_relaxed);
+  }
+}
+
+void Tracer::writeChromeTrace(std::ostream& stream) const {
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  const char* separator = "";
+
+  stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+  for (const auto& buffer : buffers_) {
+    const auto size = buffer->size_.load(std::memory_order_acquire);
+    const auto dropped_events_count = buffer->dropped_events_count_.load(std::memory_order_relaxed);
+
+    // An exited thread without events is not a part of the trace.
+    if (size == 0 && dropped_events_count == 0 && buffer->is_released_.load(std::memory_order_acquire)) {
+      continue;
+    }
+
+    stream << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id_
+           << ",\"args\":{\"name\":\"";
+
+    if (buffer->pool_thread_index_ == ThreadPool::kNotPoolThread) {
+      stream << "thread " << buffer->thread_id_;
+    } else {
+      stream << "pool worker " << buffer->pool_thread_index_;
+    }
+
+    stream << "\",\"dropped_events\":" << dropped_events_count << "}}";
+    separator = ",";
+
+    for (std::size_t i = 0; i < size; ++i) {
+      const auto& event = buffer->events_[i];
+
+      if (event.begin_time_ns_ < start_time_ns_) {
+        continue;
+      }
+
+      stream << ",{\"name\":\"" << event.name_ << "\",\"cat\":\"" << event.category_
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id_
+             << ",\"ts\":" << ToMicroseconds(event.begin_time_ns_ - start_time_ns_)
+             << ",\"dur\":" << ToMicroseconds(event.end_time_ns_ - event.begin_time_ns_) << "}";
+    }
+  }
+
+  stream << "]}";
+}
+
+Tracer::ThreadBuffer* Tracer::currentThreadBuffer() {
+  if (current_thread_buffer_.buffer_) {
+    return current_thread_buffer_.buffer_;
+  }
+
+  std::scoped_lock<std::mutex> lock(mutex_);
+
+  // Threads of short runs (e.g. readers of input files) take over buffers of exited ones which have no events.
+  auto it = std::find_if(buffers_.begin(), buffers_.end(), [this](const auto& buffer) {
+    return buffer->is_released_.load(std::memory_order_acquire) && buffer->capacity_ == events_per_thread_ &&
+           buffer->size_.load(std::memory_order_relaxed) == 0 &&
+           buffer->dropped_events_count_.load(std::memory_order_relaxed) == 0;
+  });
+
+  if (it == buffers_.end()) {
+    auto buffer = std::make_unique<ThreadBuffer>();
+    buffer->capacity_ = events_per_thread_;
+    buffer->events_ = std::make_unique<TraceEvent[]>(buffer->capacity_);
+
+    buffers_.push_back(std::move(buffer));
+    it = std::prev(buffers_.end());
+  }
+
+  auto* buffer = it->get();
+  buffer->thread_id_ = next_thread_id_++;
+  buffer->pool_thread_index_ = ThreadPool::currentThreadIndex();
+  buffer->is_released_.store(false, std::memory_order_relaxed);
+
+  current_thread_buffer_.buffer_ = buffer;
+
+  return buffer;
+}
+
+TraceScope::TraceScope(const char* category, const char* name) noexcept
+    : category_{category}, name_{name}, begin_time_ns_{Tracer::instance().isEnabled() ? SteadyClockNs() : 0} {}
+
+TraceScope::~TraceScope() {
+  if (begin_time_ns_ != 0) {
+    Tracer::instance().record(TraceEvent{category_, name_, begin_time_ns_, SteadyClockNs()});
+  }
+}
+
+}  // namespace es
\ No newline at end of file
@@ -4,7 +4,9 @@
 
 #include "utils.h"
 
+#include <chrono>
 #include <cstring>
+#include <ctime>
 #include <exception>
 
 namespace es {
@@ -29,6 +31,18 @@ stream_type OpenBinaryFileStream(std::string_view file_path) {
 }
 }  // namespace
 
+std::uint64_t SteadyClockNs() noexcept {
+  const auto time = std::chrono::steady_clock::now().time_since_epoch();
+
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+}
+
+std::uint64_t ProcessCpuTimeNs() noexcept {
+  constexpr std::uint64_t ns_per_second = 1000 * 1000 * 1000;
+
+  return static_cast<std::uint64_t>(std::clock()) * ns_per_second / CLOCKS_PER_SEC;
+}
+
 FileReadResult ReadFileStream(std::ifstream& stream, char* buffer, std::size_t buffer_size) {
   stream.read(buffer, buffer_size);
 
@@ -2,18 +2,131 @@
  * external_sorter: 2021 Sergey Gorelyshev
  */
 
+#include <external_sorter/include/argsort.h>
+#include <external_sorter/include/compressed_run.h>
+#include <external_sorter/include/counting_sort.h>
+#include <external_sorter/include/cpu_topology.h>
 #include <external_sorter/include/external_sorter.h>
+#include <external_sorter/include/output_file_writer.h>
+#include <external_sorter/include/output_summary.h>
+#include <external_sorter/include/pipeline.h>
+#include <external_sorter/include/resource_limits.h>
+#include <external_sorter/include/run_file.h>
+#include <external_sorter/include/sort_service.h>
+#include <external_sorter/include/sparse_index.h>
 #include <external_sorter/include/thread_pool.h>
+#include <external_sorter/include/tracing.h>
 #include <external_sorter/include/utils.h>
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <new>
+#include <numeric>
+#include <optional>
 #include <random>
+#include <sstream>
+#include <thread>
 
 namespace {
 
+/**
+ * Tracks live large arrays (buffers of sorting) while a memory budget is watched, so a test can check that every buffer
+ * is reserved before it is allocated and released after it is freed
+ */
+struct LargeArraysTracker {
+  static inline const std::size_t kMinArraySize = 64 * 1024;
+  static inline const std::size_t kHeaderSize = alignof(std::max_align_t);
+
+  std::atomic_size_t live_size_ = 0;                              ///< Total size of live large arrays
+  std::atomic<const es::MemoryBudget*> memory_budget_ = nullptr;  ///< Watched budget (null - arrays are not checked)
+  std::atomic_size_t peak_excess_ = 0;                            ///< Maximal excess of live arrays over the budget
+};
+
+LargeArraysTracker& GetLargeArraysTracker() {
+  static LargeArraysTracker tracker;
+
+  return tracker;
+}
+
+}  // namespace
+
+// Every array starts with a header keeping its size.
+void* operator new[](std::size_t size) {
+  auto* allocation = static_cast<char*>(std::malloc(LargeArraysTracker::kHeaderSize + size));
+
+  if (!allocation) {
+    throw std::bad_alloc{};
+  }
+
+  *reinterpret_cast<std::size_t*>(allocation) = size;
+
+  if (size >= LargeArraysTracker::kMinArraySize) {
+    auto& tracker = GetLargeArraysTracker();
+    const auto live_size = tracker.live_size_.fetch_add(size) + size;
+
+    if (const auto* memory_budget = tracker.memory_budget_.load(); memory_budget) {
+      const auto reserved_size = memory_budget->reserved();
+      auto peak_excess = tracker.peak_excess_.load();
+
+      while (live_size > reserved_size && peak_excess < live_size - reserved_size &&
+             !tracker.peak_excess_.compare_exchange_weak(peak_excess, live_size - reserved_size)) {
+      }
+    }
+  }
+
+  return allocation + LargeArraysTracker::kHeaderSize;
+}
+
+void operator delete[](void* pointer) noexcept {
+  if (!pointer) {
+    return;
+  }
+
+  auto* allocation = static_cast<char*>(pointer) - LargeArraysTracker::kHeaderSize;
+  const auto size = *reinterpret_cast<std::size_t*>(allocation);
+
+  if (size >= LargeArraysTracker::kMinArraySize) {
+    GetLargeArraysTracker().live_size_.fetch_sub(size);
+  }
+
+  std::free(allocation);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+  operator delete[](pointer);
+}
+
+namespace {
+
+/**
+ * Counts threads of a Chrome trace
+ * @param trace trace
+ * @return count of thread names
+ */
+std::size_t CountTraceThreads(const std::string& trace) {
+  const std::string thread_name{"\"name\":\"thread_name\""};
+  std::size_t threads_count = 0;
+
+  for (auto pos = trace.find(thread_name); pos != std::string::npos; pos = trace.find(thread_name, pos + 1)) {
+    ++threads_count;
+  }
+
+  return threads_count;
+}
+
 /**
  * Test fixture
  */
@@ -138,4 +251,1505 @@ TEST_F(ExternalSorterTests, emptyFile) {
   EXPECT_TRUE(checkOutputFile());
 }
 
+/**
+ * Asserts that intermediate files are striped across all spill directories
+ */
+TEST_F(ExternalSorterTests, spillDirectories) {
+  generateInputFile(kMemorySize * 3);
+
+  es::SorterOptions options{};
+  options.spill_directories_ = {"test/spill_0", "test/spill_1"};
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+
+  for (const auto& spill_directory : options.spill_directories_) {
+    const std::filesystem::path intermediate_directory{spill_directory + "/intermediate"};
+
+    EXPECT_FALSE(std::filesystem::is_empty(intermediate_directory));
+  }
+
+  EXPECT_FALSE(std::filesystem::exists(kDefaultOutputDirectory + "intermediate"));
+}
+
+/**
+ * Asserts that buffers use (almost) all of the available memory but never exceed it
+ */
+TEST_F(ExternalSorterTests, memoryBudget) {
+  generateInputFile(kMemorySize * 3);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>());
+
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+
+  const auto& memory_budget = sorter_->memoryBudget();
+
+  EXPECT_EQ(memory_budget.total(), kMemorySize);
+  EXPECT_LE(memory_budget.peakReserved(), kMemorySize);
+  EXPECT_GE(memory_budget.peakReserved(), kMemorySize / 10 * 9);
+
+  EXPECT_THROW(es::ExternalSorter<es::number_t>(0, kDefaultInputPath, kDefaultOutputDirectory,
+                                                std::make_shared<es::ThreadPool>()),
+               std::runtime_error);
+}
+
+/**
+ * Asserts that buffers of sorting (including chunk buffers kept as resident runs) are alive only while they are
+ * reserved, so sorting never uses more memory than the budget
+ */
+TEST_F(ExternalSorterTests, reservedBuffers) {
+  // the incomplete tail chunk is kept as a resident run
+  generateInputFile(kMemorySize * 3 + 12345 * sizeof(es::number_t));
+
+  for (const auto numa_local_buffers : {false, true}) {
+    for (const auto sort_engine : {es::SortEngine::kIntroSort, es::SortEngine::kRadixSort}) {
+      es::SorterOptions options{};
+      options.numa_local_buffers_ = numa_local_buffers;
+      options.sort_engine_ = sort_engine;
+
+      sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(
+          kMemorySize, kDefaultInputPath, kDefaultOutputDirectory, std::make_shared<es::ThreadPool>(), options);
+
+      auto& tracker = GetLargeArraysTracker();
+      const auto& memory_budget = sorter_->memoryBudget();
+
+      // arrays which are alive before sorting (not of the sorter) are not checked
+      const auto excess_before = tracker.live_size_ - std::min(tracker.live_size_.load(), memory_budget.reserved());
+
+      tracker.peak_excess_ = excess_before;
+      tracker.memory_budget_ = &memory_budget;
+
+      sorter_->sort();
+
+      tracker.memory_budget_ = nullptr;
+
+      EXPECT_TRUE(checkOutputFile());
+      // buffers of the NUMA-local path may take all memory of run generation, then the tail run is spilled
+      EXPECT_LE(sorter_->stats().resident_runs_count_, 1);
+
+      if (!numa_local_buffers) {
+        EXPECT_EQ(sorter_->stats().resident_runs_count_, 1);
+      }
+      EXPECT_EQ(tracker.peak_excess_, excess_before);
+    }
+  }
+}
+
+/**
+ * Asserts that statistics account all bytes of every class of files
+ */
+TEST_F(ExternalSorterTests, stats) {
+  const std::size_t input_size = kMemorySize * 3;
+
+  generateInputFile(input_size);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>());
+
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+
+  const auto& stats = sorter_->stats();
+
+  EXPECT_EQ(stats.input_.bytes_read_, input_size);
+  // The last chunk is merged from memory, so it is not spilled.
+  EXPECT_LT(stats.intermediate_.bytes_written_, input_size);
+  EXPECT_EQ(stats.intermediate_.bytes_read_, stats.intermediate_.bytes_written_);
+  EXPECT_EQ(stats.output_.bytes_written_, input_size);
+  EXPECT_GT(stats.runs_count_, 1);
+  EXPECT_EQ(stats.resident_runs_count_, 1);
+  EXPECT_EQ(stats.merge_passes_count_, 1);
+  EXPECT_GE(stats.total_.wall_time_ns_, stats.run_generation_.wall_time_ns_ + stats.merge_.wall_time_ns_);
+  EXPECT_GT(stats.pool_tasks_count_, 0);
+
+  const auto json = es::ToJson(stats);
+
+  EXPECT_EQ(json.front(), '{');
+  EXPECT_EQ(json.back(), '}');
+  EXPECT_NE(json.find("\"run_generation\":{\"wall_time_ns\":"), std::string::npos);
+  EXPECT_NE(json.find("\"runs_count\":" + std::to_string(stats.runs_count_)), std::string::npos);
+}
+
+/**
+ * Asserts that input which fits in memory is sorted without intermediate files
+ */
+TEST_F(ExternalSorterTests, inMemorySort) {
+  const std::size_t input_size = kMemorySize / 2;
+
+  generateInputFile(input_size);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>());
+
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+
+  const auto& stats = sorter_->stats();
+
+  EXPECT_EQ(stats.input_.bytes_read_, input_size);
+  EXPECT_EQ(stats.intermediate_.bytes_written_, 0);
+  EXPECT_EQ(stats.intermediate_.bytes_read_, 0);
+  EXPECT_EQ(stats.output_.bytes_written_, input_size);
+  EXPECT_GT(stats.resident_runs_count_, 0);
+  EXPECT_EQ(stats.runs_count_, stats.resident_runs_count_);
+  EXPECT_EQ(stats.merge_passes_count_, 1);
+}
+
+/**
+ * Asserts that it is possible to sort a 'big' file with the radix sort engine
+ */
+TEST_F(ExternalSorterTests, radixSortEngine) {
+  generateInputFile(kMemorySize * 3);
+
+  es::SorterOptions options{};
+  options.sort_engine_ = es::SortEngine::kRadixSort;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_EQ(sorter_->stats().output_.bytes_written_, kMemorySize * 3);
+}
+
+/**
+ * Asserts that input with few distinct values is sorted by counting without spilling, and that the counting strategy
+ * falls back to merging if the sample has many distinct values or rare values overflow tables while counting (input is
+ * read again then). Chunks with few distinct values are sorted by the counting sort engine too.
+ */
+TEST_F(ExternalSorterTests, countingStrategy) {
+  const auto input_size = kMemorySize * 2;
+  std::mt19937 gen{std::random_device{}()};
+
+  auto writeInputFile = [&](const std::function<es::number_t(std::size_t)>& generate) {
+    auto stream{es::OpenOutputBinaryFileStream(kDefaultInputPath)};
+
+    for (std::size_t i = 0; i < input_size / sizeof(es::number_t); ++i) {
+      const auto number = generate(i);
+      stream.write(reinterpret_cast<const char*>(&number), sizeof(number));
+    }
+  };
+
+  const auto few_values = [&](std::size_t) { return static_cast<es::number_t>(gen() % 100 * 1000); };
+  const auto random_values = [&](std::size_t) { return static_cast<es::number_t>(gen()); };
+  const auto rare_values = [](std::size_t i) { return static_cast<es::number_t>(i % 32 == 31 ? i : i % 7); };
+
+  es::SorterOptions options{};
+  options.sort_strategy_ = es::SortStrategy::kCounting;
+  options.verify_ = true;
+
+  writeInputFile(few_values);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_EQ(sorter_->stats().counted_values_count_, 100);
+  EXPECT_EQ(sorter_->stats().intermediate_.bytes_written_, 0);
+  EXPECT_EQ(sorter_->stats().output_.bytes_written_, input_size);
+
+  // rare values pass the sample, so a part of input is counted before the fallback reads it again
+  for (const auto& generate : {std::function<es::number_t(std::size_t)>{random_values},
+                               std::function<es::number_t(std::size_t)>{rare_values}}) {
+    writeInputFile(generate);
+
+    sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(
+        kMemorySize, kDefaultInputPath, kDefaultOutputDirectory, std::make_shared<es::ThreadPool>(), options);
+    sorter_->sort();
+
+    EXPECT_TRUE(checkOutputFile());
+    EXPECT_EQ(sorter_->stats().counted_values_count_, 0);
+    EXPECT_EQ(sorter_->stats().output_.bytes_written_, input_size);
+    EXPECT_EQ(sorter_->stats().input_.bytes_read_, input_size);
+  }
+
+  options.sort_strategy_ = es::SortStrategy::kMerge;
+  options.sort_engine_ = es::SortEngine::kCountingSort;
+
+  writeInputFile(few_values);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_EQ(sorter_->stats().output_.bytes_written_, input_size);
+}
+
+/**
+ * Asserts that sorted chunks are merged in several passes when the merge fan-in is less than count of chunks
+ */
+TEST_F(ExternalSorterTests, mergeFanIn) {
+  generateInputFile(kMemorySize * 3);
+
+  es::SorterOptions options{};
+  options.merge_fan_in_ = 2;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  const auto& stats = sorter_->stats();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_GT(stats.runs_count_, 2);
+  EXPECT_GT(stats.merge_passes_count_, 1);
+  EXPECT_EQ(stats.output_.bytes_written_, kMemorySize * 3);
+  EXPECT_GT(stats.intermediate_.bytes_written_, kMemorySize * 3);
+}
+
+/**
+ * Asserts that runs are merged by background compaction while the input is read, so the final merge has fewer runs
+ */
+TEST_F(ExternalSorterTests, backgroundCompaction) {
+  generateInputFile(kMemorySize * 6);
+
+  es::SorterOptions options{};
+  options.background_compaction_ = true;
+  options.merge_fan_in_ = 4;
+  options.verify_ = true;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  const auto& stats = sorter_->stats();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_GT(stats.compactions_count_, 0);
+  EXPECT_GT(stats.runs_count_, 4);
+  EXPECT_EQ(stats.output_.bytes_written_, kMemorySize * 6);
+  EXPECT_GT(stats.intermediate_.bytes_written_, kMemorySize * 6);
+}
+
+/**
+ * Asserts that sorted chunks are kept compressed in memory, so input which is larger than memory is never spilled
+ */
+TEST_F(ExternalSorterTests, compressedRuns) {
+  generateInputFile(kMemorySize * 3);
+
+  es::SorterOptions options{};
+  options.compressed_runs_ = true;
+  options.verify_ = true;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  const auto& stats = sorter_->stats();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_GT(stats.compressed_runs_count_, 1);
+  EXPECT_LT(stats.compressed_runs_size_, kMemorySize);
+  EXPECT_EQ(stats.runs_count_, stats.resident_runs_count_);
+  EXPECT_EQ(stats.intermediate_.bytes_written_, 0);
+  EXPECT_EQ(stats.output_.bytes_written_, kMemorySize * 3);
+}
+
+/**
+ * Asserts that merged numbers are written correctly by a ring of buffers to preallocated files with write-behind
+ */
+TEST_F(ExternalSorterTests, outputFileWriter) {
+  generateInputFile(kMemorySize * 3);
+
+  es::SorterOptions options{};
+  options.output_buffers_count_ = 8;
+  options.preallocate_files_ = true;
+  options.write_behind_size_ = 256 * 1024;
+  options.verify_ = true;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_EQ(std::filesystem::file_size(kDefaultOutputDirectory + "output"), kMemorySize * 3);
+}
+
+/**
+ * Asserts that it is possible to sort a 'big' file with many duplicates by partitioning it to buckets
+ */
+TEST_F(ExternalSorterTests, distributionStrategy) {
+  generateInputFile(kMemorySize * 3);
+
+  es::SorterOptions options{};
+  options.sort_strategy_ = es::SortStrategy::kDistribution;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  const auto& stats = sorter_->stats();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_GT(stats.runs_count_, 2);
+  EXPECT_EQ(stats.merge_passes_count_, 0);
+  EXPECT_EQ(stats.output_.bytes_written_, kMemorySize * 3);
+  EXPECT_TRUE(std::filesystem::is_empty(kDefaultOutputDirectory + "intermediate"));
+}
+
+/**
+ * Asserts that a delta is sorted and merged with an existing sorted file in the incremental mode
+ */
+TEST_F(ExternalSorterTests, incrementalMode) {
+  const std::string base_path = "test/base";
+
+  generateInputFile(kMemorySize * 2);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>());
+  sorter_->sort();
+  sorter_.reset();
+
+  std::filesystem::rename(kDefaultOutputDirectory + "output", base_path);
+
+  generateInputFile(kMemorySize / 2);
+
+  es::SorterOptions options{};
+  options.base_file_path_ = base_path;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+  sorter_->sort();
+
+  const auto& stats = sorter_->stats();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_EQ(stats.output_.bytes_written_, kMemorySize * 2 + kMemorySize / 2);
+  EXPECT_EQ(stats.input_.bytes_read_, kMemorySize * 2 + kMemorySize / 2);
+  // The input fits in memory, so only the base file is streamed.
+  EXPECT_EQ(stats.intermediate_.bytes_written_, 0);
+
+  options.output_file_name_ = "../../" + base_path;
+
+  EXPECT_THROW(es::ExternalSorter<es::number_t>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                std::make_shared<es::ThreadPool>(), options),
+               std::runtime_error);
+}
+
+/**
+ * Asserts that the sparse index of the output file resolves ranges of numbers to the same numbers as a full scan
+ */
+TEST_F(ExternalSorterTests, sparseIndex) {
+  generateInputFile(kMemorySize * 2);
+
+  es::SorterOptions options{};
+  options.sparse_index_block_size_ = 64 * 1024;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  const auto output_path = kDefaultOutputDirectory + "output";
+  const es::SparseIndex<es::number_t> index{es::CreateSparseIndexFilePath(output_path)};
+
+  EXPECT_EQ(index.numbersCount(), kMemorySize * 2 / sizeof(es::number_t));
+  EXPECT_EQ(index.blocks().size(), kMemorySize * 2 / options.sparse_index_block_size_);
+
+  std::vector<es::number_t> numbers(index.numbersCount());
+  auto stream{es::OpenInputBinaryFileStream(output_path)};
+  stream.read(reinterpret_cast<char*>(numbers.data()), kMemorySize * 2);
+
+  for (const auto& [min, max] : {std::pair{kMin, kMin}, std::pair{1000U, 1200U}, std::pair{kMax, kMax + 10}}) {
+    const auto begin = std::lower_bound(numbers.begin(), numbers.end(), min);
+    const auto end = std::upper_bound(numbers.begin(), numbers.end(), max);
+
+    EXPECT_EQ(index.read(output_path, min, max), std::vector<es::number_t>(begin, end));
+  }
+
+  EXPECT_TRUE(index.read(output_path, kMax + 1, kMax + 10).empty());
+}
+
+/**
+ * Asserts that the output summary computed from merged buffers matches the summary of the output file with both
+ * strategies
+ */
+TEST_F(ExternalSorterTests, outputSummary) {
+  generateInputFile(kMemorySize * 2);
+
+  es::SorterOptions options{};
+  options.output_summary_ = true;
+  options.summary_quantiles_ = {0.99, 0, 0.5, 1};
+  options.summary_histogram_bounds_ = {1000, 25000, kMax + 1};
+
+  const auto output_path = kDefaultOutputDirectory + "output";
+
+  for (const auto strategy : {es::SortStrategy::kMerge, es::SortStrategy::kDistribution}) {
+    options.sort_strategy_ = strategy;
+
+    sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(
+        kMemorySize, kDefaultInputPath, kDefaultOutputDirectory, std::make_shared<es::ThreadPool>(), options);
+    sorter_->sort();
+
+    std::vector<es::number_t> numbers(kMemorySize * 2 / sizeof(es::number_t));
+    auto stream{es::OpenInputBinaryFileStream(output_path)};
+    stream.read(reinterpret_cast<char*>(numbers.data()), kMemorySize * 2);
+
+    const auto& summary = sorter_->outputSummary();
+
+    EXPECT_EQ(summary.numbers_count_, numbers.size());
+    EXPECT_EQ(summary.min_, numbers.front());
+    EXPECT_EQ(summary.max_, numbers.back());
+    EXPECT_EQ(summary.distinct_count_,
+              static_cast<std::uint64_t>(std::distance(numbers.begin(), std::unique(numbers.begin(), numbers.end()))));
+
+    // std::unique() has moved numbers
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char*>(numbers.data()), kMemorySize * 2);
+
+    ASSERT_EQ(summary.quantiles_.size(), 4U);
+
+    for (const auto& [quantile, rank] : {std::pair{0.0, std::size_t{0}}, std::pair{0.5, numbers.size() / 2 - 1},
+                                         std::pair{0.99, (numbers.size() * 99 + 99) / 100 - 1},
+                                         std::pair{1.0, numbers.size() - 1}}) {
+      const auto it = std::find_if(summary.quantiles_.begin(), summary.quantiles_.end(),
+                                   [quantile = quantile](const auto& item) { return item.quantile_ == quantile; });
+
+      ASSERT_NE(it, summary.quantiles_.end());
+      EXPECT_EQ(it->rank_, rank);
+      EXPECT_EQ(it->value_, numbers[rank]);
+    }
+
+    std::vector<std::uint64_t> histogram_counts;
+    auto bucket_begin = numbers.begin();
+
+    for (const auto bound : options.summary_histogram_bounds_) {
+      const auto bucket_end = std::lower_bound(bucket_begin, numbers.end(), bound);
+
+      histogram_counts.push_back(static_cast<std::uint64_t>(std::distance(bucket_begin, bucket_end)));
+      bucket_begin = bucket_end;
+    }
+
+    histogram_counts.push_back(static_cast<std::uint64_t>(std::distance(bucket_begin, numbers.end())));
+
+    EXPECT_EQ(summary.histogram_counts_, histogram_counts);
+    EXPECT_EQ(histogram_counts.back(), 0U);
+
+    std::ifstream summary_stream{es::CreateOutputSummaryFilePath(output_path)};
+    std::string summary_json;
+    std::getline(summary_stream, summary_json);
+
+    EXPECT_EQ(summary_json, es::ToJson(summary));
+
+    sorter_.reset();
+  }
+}
+
+/**
+ * Asserts that several input files (one of them is already sorted) are sorted to a single output file by parallel
+ * readers with both strategies
+ */
+TEST_F(ExternalSorterTests, multipleInputFiles) {
+  const std::string sorted_input_path = "test/sorted_input";
+  const std::vector<std::string> input_paths = {"test/input_0", "test/input_1", "test/input_2"};
+
+  generateInputFile(kMemorySize);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>());
+  sorter_->sort();
+  sorter_.reset();
+
+  std::filesystem::rename(kDefaultOutputDirectory + "output", sorted_input_path);
+
+  for (const auto& input_path : input_paths) {
+    generateInputFile(kMemorySize);
+    std::filesystem::rename(kDefaultInputPath, input_path);
+  }
+
+  es::SorterOptions options{};
+  options.input_readers_count_ = 2;
+
+  for (const auto strategy : {es::SortStrategy::kMerge, es::SortStrategy::kDistribution}) {
+    options.sort_strategy_ = strategy;
+
+    std::vector<es::InputFile> input_files;
+
+    for (const auto& input_path : input_paths) {
+      input_files.push_back(es::InputFile{input_path});
+    }
+
+    if (strategy == es::SortStrategy::kMerge) {
+      input_files.push_back(es::InputFile{sorted_input_path, true});
+    }
+
+    sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, input_files, kDefaultOutputDirectory,
+                                                                 std::make_shared<es::ThreadPool>(), options);
+    sorter_->sort();
+
+    const auto& stats = sorter_->stats();
+    const auto input_size = kMemorySize * input_files.size();
+
+    EXPECT_TRUE(checkOutputFile());
+    EXPECT_EQ(stats.input_.bytes_read_, input_size);
+    EXPECT_EQ(stats.output_.bytes_written_, input_size);
+  }
+
+  options.output_file_name_ = "../../" + sorted_input_path;
+
+  EXPECT_THROW(es::ExternalSorter<es::number_t>(kMemorySize, {es::InputFile{sorted_input_path, true}},
+                                                kDefaultOutputDirectory, std::make_shared<es::ThreadPool>(), options),
+               std::runtime_error);
+}
+
+/**
+ * Asserts that the verification mode accepts correct sorting with all strategies and detects an unsorted output
+ */
+TEST_F(ExternalSorterTests, verification) {
+  const std::string unsorted_path = "test/unsorted";
+
+  generateInputFile(kMemorySize);
+  std::filesystem::copy_file(kDefaultInputPath, unsorted_path, std::filesystem::copy_options::overwrite_existing);
+  generateInputFile(kMemorySize * 3);
+
+  es::SorterOptions options{};
+  options.verify_ = true;
+
+  for (const auto strategy : {es::SortStrategy::kMerge, es::SortStrategy::kDistribution}) {
+    options.sort_strategy_ = strategy;
+
+    sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(
+        kMemorySize, kDefaultInputPath, kDefaultOutputDirectory, std::make_shared<es::ThreadPool>(), options);
+
+    EXPECT_NO_THROW(sorter_->sort());
+    EXPECT_TRUE(checkOutputFile());
+  }
+
+  // An unsorted file which is merged as a sorted one breaks the order of the output.
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(
+      kMemorySize, std::vector<es::InputFile>{{kDefaultInputPath}, {unsorted_path, true}}, kDefaultOutputDirectory,
+      std::make_shared<es::ThreadPool>(), options);
+
+  EXPECT_THROW(sorter_->sort(), std::runtime_error);
+}
+
+/**
+ * Asserts that it is possible to sort a 'big' file with NUMA-local chunk buffers in a pinned thread pool
+ */
+TEST_F(ExternalSorterTests, numaLocalBuffers) {
+  generateInputFile(kMemorySize * 3);
+
+  es::ThreadPoolOptions pool_options{};
+  pool_options.threads_count_ = 2;
+  pool_options.pinning_ = es::ThreadPinning::kScatter;
+
+  es::SorterOptions options{};
+  options.numa_local_buffers_ = true;
+
+  auto thread_pool = std::make_shared<es::ThreadPool>(pool_options);
+
+  EXPECT_EQ(thread_pool->threadsCount(), 2);
+  EXPECT_EQ(thread_pool->threadsCpus().size(), 2);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               thread_pool, options);
+
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_EQ(sorter_->stats().input_.bytes_read_, kMemorySize * 3);
+}
+
+/**
+ * Asserts that it is possible to sort several input files of uneven sizes which are read by chunk tasks
+ */
+TEST_F(ExternalSorterTests, parallelInputReads) {
+  const std::vector<std::string> input_paths = {"test/input_0", "test/input_1"};
+  const std::vector<std::size_t> input_sizes = {kMemorySize + 12, kMemorySize * 2};
+
+  for (std::size_t i = 0; i < input_paths.size(); ++i) {
+    generateInputFile(input_sizes[i]);
+    std::filesystem::rename(kDefaultInputPath, input_paths[i]);
+  }
+
+  es::SorterOptions options{};
+  options.parallel_input_reads_ = true;
+  options.verify_ = true;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(
+      kMemorySize, std::vector<es::InputFile>{{input_paths[0]}, {input_paths[1]}}, kDefaultOutputDirectory,
+      std::make_shared<es::ThreadPool>(), options);
+
+  EXPECT_NO_THROW(sorter_->sort());
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_EQ(sorter_->stats().input_.bytes_read_, input_sizes[0] + input_sizes[1]);
+}
+
+/**
+ * Asserts that the argsort mode writes a stable permutation of input files and sorted keys, and that it requires packed
+ * numbers
+ */
+TEST_F(ExternalSorterTests, argsort) {
+  const std::vector<std::string> input_paths = {"test/input_0", "test/input_1"};
+  const std::vector<std::size_t> input_sizes = {kMemorySize / 2 + 12, kMemorySize};
+
+  std::vector<es::number_t> keys;
+
+  for (std::size_t i = 0; i < input_paths.size(); ++i) {
+    generateInputFile(input_sizes[i]);
+    std::filesystem::rename(kDefaultInputPath, input_paths[i]);
+
+    auto stream{es::OpenInputBinaryFileStream(input_paths[i])};
+    const auto begin = keys.size();
+
+    keys.resize(begin + input_sizes[i] / sizeof(es::number_t));
+    stream.read(reinterpret_cast<char*>(keys.data() + begin), input_sizes[i]);
+  }
+
+  es::SorterOptions options{};
+  options.argsort_ = true;
+  options.argsort_values_ = true;
+  options.sort_engine_ = es::SortEngine::kRadixSort;
+  options.verify_ = true;
+
+  const std::vector<es::InputFile> input_files{{input_paths[0]}, {input_paths[1]}};
+
+  EXPECT_THROW(es::ExternalSorter<es::number_t>(kMemorySize, input_files, kDefaultOutputDirectory,
+                                                std::make_shared<es::ThreadPool>(), options),
+               std::exception);
+
+  es::ExternalSorter<es::argsort_number_t> sorter{kMemorySize, input_files, kDefaultOutputDirectory,
+                                                  std::make_shared<es::ThreadPool>(), options};
+
+  ASSERT_NO_THROW(sorter.sort());
+  EXPECT_EQ(sorter.stats().input_.bytes_read_, input_sizes[0] + input_sizes[1]);
+  EXPECT_GT(sorter.stats().runs_count_, 1);
+
+  const auto output_path = kDefaultOutputDirectory + "output";
+
+  std::vector<std::uint64_t> indices(keys.size());
+  std::vector<es::number_t> values(keys.size());
+
+  ASSERT_EQ(std::filesystem::file_size(output_path), indices.size() * sizeof(std::uint64_t));
+  ASSERT_EQ(std::filesystem::file_size(es::CreateArgsortValuesFilePath(output_path)),
+            keys.size() * sizeof(es::number_t));
+
+  es::OpenInputBinaryFileStream(output_path).read(reinterpret_cast<char*>(indices.data()),
+                                                  indices.size() * sizeof(std::uint64_t));
+  es::OpenInputBinaryFileStream(es::CreateArgsortValuesFilePath(output_path))
+      .read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(es::number_t));
+
+  std::vector<std::uint64_t> expected_indices(keys.size());
+  std::iota(expected_indices.begin(), expected_indices.end(), 0);
+  std::stable_sort(expected_indices.begin(), expected_indices.end(),
+                   [&keys](auto left, auto right) { return keys[left] < keys[right]; });
+
+  EXPECT_EQ(indices, expected_indices);
+
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(values[i], keys[expected_indices[i]]);
+  }
+}
+
+/**
+ * Asserts that progress is reported and that a cancelled sorting removes intermediate files and leaves the thread pool
+ * reusable
+ */
+TEST_F(ExternalSorterTests, progressAndCancellation) {
+  const std::size_t input_size = kMemorySize * 3;
+
+  generateInputFile(input_size);
+
+  auto thread_pool = std::make_shared<es::ThreadPool>();
+  auto cancellation_token = std::make_shared<es::CancellationToken>();
+
+  es::SorterOptions options{};
+  options.cancellation_token_ = cancellation_token;
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               thread_pool, options);
+
+  EXPECT_EQ(sorter_->progress().phase_, es::SortPhase::kNotStarted);
+
+  // Sorting is cancelled as soon as it has read some input.
+  std::thread canceller([this, &cancellation_token]() {
+    while (sorter_->progress().bytes_processed_ == 0) {
+      std::this_thread::yield();
+    }
+
+    EXPECT_EQ(sorter_->progress().bytes_total_, 2 * input_size);
+
+    cancellation_token->cancel();
+  });
+
+  EXPECT_THROW(sorter_->sort(), es::SortCancelledException);
+
+  canceller.join();
+
+  EXPECT_EQ(sorter_->progress().phase_, es::SortPhase::kFinished);
+  EXPECT_FALSE(std::filesystem::exists(kDefaultOutputDirectory + "intermediate"));
+
+  EXPECT_NO_THROW(thread_pool->checkException());
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               thread_pool);
+
+  sorter_->sort();
+
+  EXPECT_TRUE(checkOutputFile());
+
+  const auto progress = sorter_->progress();
+
+  EXPECT_EQ(progress.phase_, es::SortPhase::kFinished);
+  EXPECT_EQ(progress.bytes_processed_, 2 * input_size);
+  EXPECT_EQ(progress.bytes_total_, 2 * input_size);
+  EXPECT_EQ(progress.remaining_time_ns_, 0);
+}
+
+/**
+ * Asserts that the merge shrinks buffers of files while the cgroup is under memory pressure and still merges correctly
+ */
+TEST_F(ExternalSorterTests, memoryPressure) {
+  const std::string cgroup_path = "test/cgroup";
+  const std::size_t memory_limit = 1024 * 1024 * 1024;
+
+  std::filesystem::create_directories(cgroup_path);
+  std::ofstream{cgroup_path + "/memory.current"} << memory_limit << '\n';
+  std::ofstream{cgroup_path + "/memory.stat"} << "anon " << memory_limit << "\ninactive_file 0\n";
+
+  generateInputFile(kMemorySize * 4);
+
+  es::SorterOptions options{};
+  options.verify_ = true;
+  options.memory_monitor_ = std::make_shared<es::MemoryPressureMonitor>(cgroup_path, memory_limit, 0.9, 0);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>(), options);
+
+  sorter_->sort();
+
+  const auto& stats = sorter_->stats();
+
+  EXPECT_TRUE(checkOutputFile());
+  EXPECT_GT(stats.runs_count_, 1);
+  EXPECT_GT(stats.memory_pressure_shrinks_count_, 0);
+  EXPECT_EQ(stats.output_.bytes_written_, kMemorySize * 4);
+  EXPECT_EQ(sorter_->memoryBudget().available() + sorter_->memoryBudget().reserved(), kMemorySize);
+}
+
+/**
+ * Asserts that concurrent jobs of a sort service share the output directory without collisions and that a failed job
+ * does not affect others
+ */
+TEST_F(ExternalSorterTests, sortService) {
+  const std::size_t jobs_count = 4;
+
+  generateInputFile(kMemorySize * 2);
+
+  std::vector<std::future<es::SortStats>> results;
+
+  {
+    es::SortServiceOptions service_options{};
+    service_options.memory_size_ = 2 * kMemorySize;
+    service_options.max_active_jobs_count_ = 2;
+    service_options.min_job_memory_size_ = 4 * 1024 * 1024;
+
+    es::SortService<es::number_t> service{std::make_shared<es::ThreadPool>(), service_options};
+    std::vector<es::SortJob> jobs;
+
+    for (std::size_t i = 0; i < jobs_count; ++i) {
+      es::SortJob job{{es::InputFile{kDefaultInputPath}}, kDefaultOutputDirectory, {}};
+      job.options_.output_file_name_ = i == 0 ? "output" : "output_" + std::to_string(i);
+      job.options_.verify_ = true;
+
+      jobs.push_back(std::move(job));
+    }
+
+    results = service.submit(std::move(jobs));
+    results.push_back(service.submit(es::SortJob{{es::InputFile{"test/missing"}}, kDefaultOutputDirectory, {}}));
+
+    // Jobs of the burst share memory, so both slots sort at once.
+    while (service.activeJobsCount() != 0 || service.queuedJobsCount() != 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+
+    EXPECT_EQ(service.peakActiveJobsCount(), 2);
+    EXPECT_LE(service.memoryBudget().peakReserved(), service_options.memory_size_);
+  }
+
+  for (std::size_t i = 0; i < jobs_count; ++i) {
+    const auto stats = results[i].get();
+
+    EXPECT_EQ(stats.output_.bytes_written_, kMemorySize * 2);
+    EXPECT_GT(stats.runs_count_, 1);
+  }
+
+  EXPECT_THROW(results.back().get(), std::runtime_error);
+  EXPECT_TRUE(checkOutputFile());
+
+  const auto read_file = [](const std::string& file_path) {
+    std::ifstream stream{file_path, std::ios::binary};
+
+    return std::string{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}};
+  };
+
+  const auto output = read_file(kDefaultOutputDirectory + "output");
+
+  for (std::size_t i = 1; i < jobs_count; ++i) {
+    EXPECT_EQ(read_file(kDefaultOutputDirectory + "output_" + std::to_string(i)), output);
+  }
+
+  for (const auto& entry : std::filesystem::directory_iterator{kDefaultOutputDirectory}) {
+    EXPECT_EQ(entry.path().filename().string().rfind("intermediate", 0), std::string::npos) << entry.path();
+  }
+}
+
+#ifdef ES_ENABLE_TRACING
+/**
+ * Asserts that sorting records phases, tasks and I/O when tracing is compiled in
+ */
+TEST_F(ExternalSorterTests, tracing) {
+  generateInputFile(kMemorySize * 3);
+
+  sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, kDefaultInputPath, kDefaultOutputDirectory,
+                                                               std::make_shared<es::ThreadPool>());
+
+  auto& tracer = es::Tracer::instance();
+
+  tracer.start();
+  sorter_->sort();
+  tracer.stop();
+
+  std::ostringstream stream;
+  tracer.writeChromeTrace(stream);
+
+  const auto trace = stream.str();
+
+  for (const auto* name :
+       {"run generation", "merge", "task", "read input file", "read intermediate file", "write file"}) {
+    EXPECT_NE(trace.find(std::string{"\"name\":\""} + name + '"'), std::string::npos) << name;
+  }
+
+  tracer.clear();
+}
+
+/**
+ * Asserts that buffers of reader threads of sorts are freed when their events are cleared, so repeated sorts do not
+ * add threads to traces
+ */
+TEST_F(ExternalSorterTests, tracingReaderThreads) {
+  const std::vector<std::string> input_paths = {"test/input_0", "test/input_1"};
+
+  for (const auto& input_path : input_paths) {
+    generateInputFile(kMemorySize * 2);
+    std::filesystem::rename(kDefaultInputPath, input_path);
+  }
+
+  es::SorterOptions options{};
+  options.input_readers_count_ = 2;
+
+  auto& tracer = es::Tracer::instance();
+  const auto thread_pool = std::make_shared<es::ThreadPool>();
+  std::vector<std::size_t> threads_counts;
+
+  for (std::size_t i = 0; i < 3; ++i) {
+    std::vector<es::InputFile> input_files;
+
+    for (const auto& input_path : input_paths) {
+      input_files.push_back(es::InputFile{input_path});
+    }
+
+    sorter_ = std::make_unique<es::ExternalSorter<es::number_t>>(kMemorySize, std::move(input_files),
+                                                                 kDefaultOutputDirectory, thread_pool, options);
+
+    tracer.start();
+    sorter_->sort();
+    tracer.stop();
+
+    std::ostringstream stream;
+    tracer.writeChromeTrace(stream);
+
+    threads_counts.push_back(CountTraceThreads(stream.str()));
+
+    EXPECT_TRUE(checkOutputFile());
+  }
+
+  tracer.clear();
+
+  EXPECT_EQ(threads_counts.front(), threads_counts.back());
+}
+#endif
+
+/**
+ * Asserts that a reservation exceeding the memory budget is rejected and released memory returns to the budget
+ */
+TEST(MemoryBudgetTests, reserve) {
+  es::MemoryBudget memory_budget{1024};
+
+  {
+    auto reservation = memory_budget.reserve(1000);
+
+    EXPECT_EQ(memory_budget.available(), 24);
+    EXPECT_THROW(memory_budget.reserve(25), std::runtime_error);
+  }
+
+  EXPECT_EQ(memory_budget.reserved(), 0);
+  EXPECT_EQ(memory_budget.peakReserved(), 1000);
+}
+
+/**
+ * Asserts that data written at reserved offsets out of order is placed by offsets, and preallocated space beyond the
+ * written data is released
+ */
+TEST(OutputFileTests, positionalWrites) {
+  const std::string file_path = "test/output_file";
+  const std::string first_part = "first ";
+  const std::string second_part = "second";
+
+  std::filesystem::create_directories("test");
+
+  {
+    es::OutputFile file{file_path, es::OutputFileOptions{1024 * 1024, 0}};
+
+    const auto first_offset = file.reserve(first_part.size());
+    const auto second_offset = file.reserve(second_part.size());
+
+    file.write(second_part.data(), second_part.size(), second_offset);
+    file.write(first_part.data(), first_part.size(), first_offset);
+    file.finish();
+  }
+
+  std::ifstream stream{file_path, std::ios::binary};
+  const std::string content{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}};
+
+  EXPECT_EQ(content, first_part + second_part);
+  EXPECT_EQ(std::filesystem::file_size(file_path), first_part.size() + second_part.size());
+
+  std::filesystem::remove(file_path);
+}
+
+/**
+ * Asserts that a run file is read back with its index, that blocks can be skipped and that a corrupted block is
+ * detected
+ */
+TEST(RunFileTests, blocksAndCorruption) {
+  const std::string file_path = "test/run_file";
+  const std::size_t block_size = 1024;
+  const std::size_t numbers_count = 10000;  // the last block is incomplete
+
+  std::filesystem::create_directories("test");
+
+  std::vector<es::number_t> numbers(numbers_count);
+
+  for (std::size_t i = 0; i < numbers_count; ++i) {
+    numbers[i] = static_cast<es::number_t>(i / 3);
+  }
+
+  {
+    es::OutputFile file{file_path};
+    es::RunFileWriter<es::number_t> writer{file, block_size};
+
+    // numbers are added in parts which do not match blocks
+    for (std::size_t begin = 0; begin < numbers_count; begin += 1000) {
+      file.append(reinterpret_cast<const char*>(numbers.data() + begin), 1000 * sizeof(es::number_t));
+      writer.add(numbers.data() + begin, 1000);
+    }
+
+    writer.finish();
+    file.finish();
+  }
+
+  {
+    es::RunFileReader<es::number_t> reader{file_path};
+
+    const auto block_numbers_count = block_size / sizeof(es::number_t);
+
+    EXPECT_EQ(reader.numbersCount(), numbers_count);
+    ASSERT_EQ(reader.blocks().size(), (numbers_count + block_numbers_count - 1) / block_numbers_count);
+    EXPECT_EQ(reader.blocks().back().max_, numbers.back());
+
+    std::vector<es::number_t> read_numbers(numbers_count + 1);
+
+    EXPECT_EQ(reader.read(read_numbers.data(), 100), 100);
+    EXPECT_EQ(reader.read(read_numbers.data() + 100, read_numbers.size()), numbers_count - 100);
+    EXPECT_EQ(reader.read(read_numbers.data(), read_numbers.size()), 0);
+
+    read_numbers.pop_back();
+    EXPECT_EQ(read_numbers, numbers);
+
+    // skips blocks which contain only smaller numbers
+    const auto block_index = reader.findBlock(2000);
+    reader.seekBlock(block_index);
+
+    es::number_t number{};
+    EXPECT_EQ(reader.read(&number, 1), 1);
+    EXPECT_LE(number, 2000);
+    EXPECT_EQ(number, numbers[block_index * block_numbers_count]);
+    EXPECT_EQ(reader.findBlock(es::number_t{numbers_count}), reader.blocks().size());
+  }
+
+  {
+    // flips a bit in the middle of the third block
+    std::fstream stream{file_path, std::ios::binary | std::ios::in | std::ios::out};
+    stream.seekp(static_cast<std::streamoff>(std::filesystem::file_size(file_path) / 4));
+    stream.put('\x7f');
+  }
+
+  es::RunFileReader<es::number_t> reader{file_path};
+  std::vector<es::number_t> read_numbers(numbers_count);
+
+  EXPECT_THROW(reader.read(read_numbers.data(), read_numbers.size()), std::exception);
+
+  {
+    std::ofstream stream{file_path, std::ios::binary};
+    stream << "not a run file";
+  }
+
+  EXPECT_THROW(es::RunFileReader<es::number_t>{file_path}, std::exception);
+
+  std::filesystem::remove(file_path);
+}
+
+/**
+ * Asserts that compressed runs are decoded to the same numbers and that a full store evicts the largest runs
+ */
+TEST(CompressedRunTests, decodingAndEviction) {
+  const std::size_t numbers_count = 1000;  // the last block is incomplete
+
+  // duplicates and deltas wider than 32 bits
+  std::vector<es::argsort_number_t> numbers(numbers_count);
+
+  for (std::size_t i = 0; i < numbers_count; ++i) {
+    numbers[i] = (i / 2) * 0x123456789ULL;
+  }
+
+  numbers.back() = std::numeric_limits<es::argsort_number_t>::max();
+
+  es::CompressedRun<es::argsort_number_t> run{numbers.data(), numbers.size()};
+
+  EXPECT_EQ(run.numbersCount(), numbers_count);
+  EXPECT_EQ(run.size(), es::CompressedRun<es::argsort_number_t>::calcSize(numbers.data(), numbers.size()));
+  EXPECT_LT(run.size(), numbers_count * sizeof(es::argsort_number_t));
+
+  es::CompressedRunReader<es::argsort_number_t> reader{std::move(run)};
+  std::vector<es::argsort_number_t> read_numbers(numbers_count + 1);
+
+  EXPECT_EQ(reader.read(read_numbers.data(), 100), 100);
+  EXPECT_EQ(reader.read(read_numbers.data() + 100, read_numbers.size() - 100), numbers_count - 100);
+  EXPECT_EQ(reader.read(read_numbers.data(), read_numbers.size()), 0);
+
+  read_numbers.pop_back();
+  EXPECT_EQ(read_numbers, numbers);
+
+  // a small run of equal numbers and a large run of random ones
+  const std::vector<es::number_t> small_numbers(numbers_count, 7);
+  std::vector<es::number_t> large_numbers(numbers_count);
+
+  std::mt19937 gen{42};
+  std::generate(large_numbers.begin(), large_numbers.end(), gen);
+  std::sort(large_numbers.begin(), large_numbers.end());
+
+  es::CompressedRun<es::number_t> small_run{small_numbers.data(), small_numbers.size()};
+  es::CompressedRun<es::number_t> large_run{large_numbers.data(), large_numbers.size()};
+
+  const auto small_size = small_run.size();
+  const auto large_size = large_run.size();
+  const std::size_t spill_buffer_size = 256 * 1024;
+
+  es::MemoryBudget memory_budget{spill_buffer_size + small_size + large_size};
+  es::CompressedRunStore<es::number_t> store{memory_budget.reserve(memory_budget.total())};
+  std::optional<es::CompressedRun<es::number_t>> evicted_run;
+
+  ASSERT_TRUE(store.reserve(large_size, evicted_run));
+  store.add(std::move(large_run));
+  ASSERT_TRUE(store.reserve(small_size, evicted_run));
+  store.add(std::move(small_run));
+
+  // the larger run is evicted for a new small one
+  EXPECT_FALSE(store.reserve(small_size, evicted_run));
+  ASSERT_TRUE(evicted_run.has_value());
+  EXPECT_EQ(evicted_run->size(), large_size);
+
+  std::vector<es::number_t> spilled_numbers;
+
+  store.spill(std::move(*evicted_run), [&spilled_numbers](const es::number_t* numbers, std::size_t count) {
+    spilled_numbers.insert(spilled_numbers.end(), numbers, numbers + count);
+  });
+
+  EXPECT_EQ(spilled_numbers, large_numbers);
+  EXPECT_TRUE(store.reserve(small_size, evicted_run));
+  store.add(es::CompressedRun<es::number_t>{small_numbers.data(), small_numbers.size()});
+
+  // a run larger than all stored ones is spilled itself
+  EXPECT_FALSE(store.reserve(large_size, evicted_run));
+  EXPECT_FALSE(evicted_run.has_value());
+  EXPECT_EQ(store.evictedRunsCount(), 1);
+
+  EXPECT_EQ(store.takeRuns().size(), 2);
+  EXPECT_EQ(memory_budget.reserved(), 0);
+}
+
+/**
+ * Asserts that threads take tasks of task groups in turn and that exceptions and pending tasks are tracked per group
+ */
+/**
+ * Asserts that counting sorts numbers with few distinct values, fails for more values and that counts of several tables
+ * are reduced
+ */
+TEST(CountingSortTests, tablesAndOverflow) {
+  std::vector<std::uint32_t> numbers = {7, 3, 7, 7, 1, 3, 9, 7};
+  auto expected_numbers = numbers;
+  std::sort(expected_numbers.begin(), expected_numbers.end());
+
+  ASSERT_TRUE(es::CountingSort(numbers.data(), numbers.data() + numbers.size(), 4));
+  EXPECT_EQ(numbers, expected_numbers);
+
+  // a fifth distinct value overflows the table, numbers are not changed then
+  std::vector<std::uint32_t> many_values = {5, 4, 3, 2, 1};
+
+  EXPECT_FALSE(es::CountingSort(many_values.data(), many_values.data() + many_values.size(), 4));
+  EXPECT_EQ(many_values, (std::vector<std::uint32_t>{5, 4, 3, 2, 1}));
+
+  // 16-bit numbers are counted by a dense table, which never overflows
+  std::vector<std::uint16_t> narrow_numbers(70000);
+  std::iota(narrow_numbers.begin(), narrow_numbers.end(), std::uint16_t{0});
+
+  es::CountingTable<std::uint16_t> dense_table{1};
+  ASSERT_TRUE(dense_table.add(narrow_numbers.data(), narrow_numbers.size()));
+
+  std::vector<es::CountedValue<std::uint16_t>> narrow_values;
+  dense_table.appendValues(narrow_values);
+  es::ReduceCountedValues(narrow_values);
+
+  ASSERT_EQ(narrow_values.size(), 65536);
+  EXPECT_EQ(narrow_values[1].count_, 2);
+  EXPECT_EQ(narrow_values[4464].count_, 1);
+
+  // tables of several threads are reduced to total counts
+  es::CountingTable<std::uint64_t> table{16};
+  const std::vector<std::uint64_t> other_numbers = {1, 65535, 1};
+  ASSERT_TRUE(table.add(other_numbers.data(), other_numbers.size()));
+
+  std::vector<es::CountedValue<std::uint64_t>> values;
+  table.appendValues(values);
+  table.appendValues(values);
+  es::ReduceCountedValues(values);
+
+  ASSERT_EQ(values.size(), 2);
+  EXPECT_EQ(values[0].value_, 1);
+  EXPECT_EQ(values[0].count_, 4);
+  EXPECT_EQ(values[1].value_, 65535);
+  EXPECT_EQ(values[1].count_, 2);
+}
+
+TEST(ThreadPoolTests, taskGroups) {
+  auto thread_pool = std::make_shared<es::ThreadPool>(1);
+  const auto first_group = thread_pool->createTaskGroup();
+  const auto second_group = thread_pool->createTaskGroup();
+
+  std::atomic_bool is_released = false;
+  std::mutex order_mutex;
+  std::string order;
+
+  // The only thread is busy, so tasks of both groups are queued before any of them is started.
+  thread_pool->add([&is_released]() {
+    while (!is_released.load()) {
+      std::this_thread::yield();
+    }
+  });
+
+  const auto addTasks = [&](es::task_group_t group, char name) {
+    const es::ThreadPool::TaskGroupScope task_group_scope{group};
+
+    for (int i = 0; i < 3; ++i) {
+      thread_pool->add([&, name]() {
+        std::scoped_lock<std::mutex> lock(order_mutex);
+
+        order.push_back(name);
+      });
+    }
+  };
+
+  addTasks(first_group, 'a');
+  addTasks(second_group, 'b');
+
+  is_released.store(true);
+
+  {
+    const es::ThreadPool::TaskGroupScope task_group_scope{first_group};
+
+    thread_pool->add([]() { throw std::runtime_error("failure"); });
+
+    while (thread_pool->hasPendingTasks()) {
+      std::this_thread::yield();
+    }
+
+    EXPECT_THROW(thread_pool->checkException(), std::runtime_error);
+  }
+
+  {
+    const es::ThreadPool::TaskGroupScope task_group_scope{second_group};
+
+    while (thread_pool->hasPendingTasks()) {
+      std::this_thread::yield();
+    }
+
+    EXPECT_NO_THROW(thread_pool->checkException());
+  }
+
+  EXPECT_EQ(order, "ababab");
+  EXPECT_NO_THROW(thread_pool->checkException());
+  EXPECT_EQ(es::ThreadPool::currentTaskGroup(), es::ThreadPool::kDefaultTaskGroup);
+
+  thread_pool->removeTaskGroup(first_group);
+  thread_pool->removeTaskGroup(second_group);
+}
+
+/**
+ * Asserts that a waiter is woken by a task which sets the flag and by a failed task of its group which does not
+ */
+TEST(ThreadPoolTests, waitForTask) {
+  auto thread_pool = std::make_shared<es::ThreadPool>(2);
+  std::atomic_bool is_done = false;
+
+  thread_pool->add([&is_done]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    is_done.store(true, std::memory_order_release);
+  });
+
+  thread_pool->waitForTask(is_done);
+
+  EXPECT_TRUE(is_done.load());
+  EXPECT_GT(thread_pool->stats().wait_time_ns_, 0);
+
+  const auto group = thread_pool->createTaskGroup();
+
+  {
+    const es::ThreadPool::TaskGroupScope task_group_scope{group};
+    const std::atomic_bool is_never_done = false;
+
+    thread_pool->add([]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+      throw std::runtime_error("failure");
+    });
+
+    EXPECT_THROW(thread_pool->waitForTask(is_never_done), std::runtime_error);
+  }
+
+  thread_pool->removeTaskGroup(group);
+}
+
+/**
+ * Asserts that items pass all stages in order of stages, are recycled, respect parallelism of stages and that a failed
+ * stage is reported to the producer
+ */
+TEST(PipelineTests, stages) {
+  struct Item {
+    std::vector<int> stages_;  ///< Indices of passed stages
+  };
+
+  const std::size_t items_count = 3;
+  const std::size_t pushes_count = 20;
+
+  auto thread_pool = std::make_shared<es::ThreadPool>(4);
+  std::atomic_size_t active_count = 0;
+  std::atomic_size_t peak_active_count = 0;
+  std::atomic_size_t completed_count = 0;
+
+  {
+    es::Pipeline<Item> pipeline{thread_pool};
+
+    pipeline
+        .addStage("first", 4, [](Item& item) { item.stages_.push_back(0); })
+        .addStage("serial", 1,
+                  [&](Item& item) {
+                    const auto count = ++active_count;
+
+                    peak_active_count.store(std::max(peak_active_count.load(), count));
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    --active_count;
+
+                    item.stages_.push_back(1);
+                  },
+                  1)
+        .addStage("last", 2, [&](Item& item) {
+          EXPECT_EQ(item.stages_, (std::vector<int>{0, 1}));
+
+          item.stages_.clear();
+          ++completed_count;
+        });
+
+    for (std::size_t i = 0; i < items_count; ++i) {
+      pipeline.addItem(Item{});
+    }
+
+    for (std::size_t i = 0; i < pushes_count; ++i) {
+      auto item = pipeline.acquire();
+
+      EXPECT_TRUE(item.stages_.empty());
+
+      pipeline.push(std::move(item));
+    }
+
+    pipeline.wait();
+
+    const auto stats = pipeline.stats();
+
+    ASSERT_EQ(stats.size(), 3);
+    EXPECT_EQ(stats[1].name_, "serial");
+    EXPECT_EQ(stats[1].parallelism_, 1);
+    EXPECT_EQ(stats[1].items_count_, pushes_count);
+    EXPECT_LE(stats[1].peak_queue_depth_, 1);
+  }
+
+  EXPECT_EQ(completed_count, pushes_count);
+  EXPECT_EQ(peak_active_count, 1);
+
+  es::Pipeline<Item> pipeline{thread_pool};
+
+  pipeline.addStage("failing", 1, [](Item&) { throw std::runtime_error{"failure"}; });
+  pipeline.addItem(Item{});
+  pipeline.push(pipeline.acquire());
+
+  EXPECT_THROW(pipeline.wait(), std::runtime_error);
+  EXPECT_THROW(pipeline.acquire(), std::runtime_error);
+  EXPECT_NO_THROW(thread_pool->checkException());
+}
+
+/**
+ * Asserts that CPU lists are parsed and threads are placed on NUMA nodes according to the pinning policy
+ */
+TEST(CpuTopologyTests, pinningCpus) {
+  EXPECT_EQ(es::ParseCpuList("0-3,8,10-11\n"), (std::vector<unsigned int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_THROW(es::ParseCpuList("3-1"), std::runtime_error);
+  EXPECT_THROW(es::ParseCpuList("0,a"), std::runtime_error);
+
+  const es::CpuTopology topology{{{0, 1, 2}, {3, 4, 5}}};
+
+  EXPECT_EQ(es::CreatePinningCpus(topology, es::ThreadPinning::kCompact, 4), (std::vector<unsigned int>{0, 1, 2, 3}));
+  EXPECT_EQ(es::CreatePinningCpus(topology, es::ThreadPinning::kScatter, 4), (std::vector<unsigned int>{0, 3, 1, 4}));
+  EXPECT_TRUE(es::CreatePinningCpus(topology, es::ThreadPinning::kNone, 4).empty());
+
+  EXPECT_FALSE(es::DetectCpuTopology().nodes_cpus_.empty());
+}
+
+/**
+ * Asserts that the strictest limits of a cgroup and its ancestors are taken and inactive file pages are not counted as
+ * used memory
+ */
+TEST(ResourceLimitsTests, cgroupLimits) {
+  const std::string root_path = "test/cgroup_root";
+  const std::size_t megabyte = 1024 * 1024;
+
+  std::filesystem::create_directories(root_path + "/job/task");
+  std::ofstream{root_path + "/job/memory.max"} << 1024 * megabyte << '\n';
+  std::ofstream{root_path + "/job/memory.current"} << 100 * megabyte << '\n';
+  std::ofstream{root_path + "/job/memory.stat"} << "anon 1\ninactive_file " << 20 * megabyte << '\n';
+  std::ofstream{root_path + "/job/cpu.max"} << "max 100000\n";
+  std::ofstream{root_path + "/job/task/memory.max"} << "max\n";
+  std::ofstream{root_path + "/job/task/cpu.max"} << "150000 100000\n";
+
+  const auto limits = es::ReadCgroupLimits(root_path, "/job/task", 8, 4096 * megabyte);
+
+  EXPECT_EQ(limits.memory_limit_, 1024 * megabyte);
+  EXPECT_EQ(limits.memory_usage_, 80 * megabyte);
+  EXPECT_EQ(limits.cpus_count_, 2);
+  EXPECT_EQ(std::filesystem::path{limits.memory_cgroup_path_}, std::filesystem::path{root_path + "/job"});
+  EXPECT_EQ(es::CalcAutoMemorySize(limits), 944 * megabyte / 4 * 3);
+
+  // There are no limits in the root, so available memory of the system is reported.
+  const auto root_limits = es::ReadCgroupLimits(root_path, "/", 8, 4096 * megabyte);
+
+  EXPECT_EQ(root_limits.memory_limit_, 4096 * megabyte);
+  EXPECT_EQ(root_limits.memory_usage_, 0);
+  EXPECT_EQ(root_limits.cpus_count_, 8);
+  EXPECT_TRUE(root_limits.memory_cgroup_path_.empty());
+
+  es::MemoryPressureMonitor monitor{root_path + "/job", 100 * megabyte, 0.9, 0};
+
+  EXPECT_FALSE(monitor.check());
+
+  std::ofstream{root_path + "/job/memory.current"} << 120 * megabyte << '\n';
+
+  EXPECT_TRUE(monitor.check());
+  EXPECT_GE(es::DetectResourceLimits().cpus_count_, 1);
+
+  std::filesystem::remove_all(root_path);
+}
+
+/**
+ * Asserts that recorded events are written in trace-event format
+ */
+TEST(TracerTests, chromeTrace) {
+  auto& tracer = es::Tracer::instance();
+
+  tracer.start();
+
+  {
+    const es::TraceScope scope{"test", "traced scope"};
+  }
+
+  tracer.stop();
+
+  {
+    const es::TraceScope scope{"test", "not traced scope"};
+  }
+
+  std::ostringstream stream;
+  tracer.writeChromeTrace(stream);
+
+  const auto trace = stream.str();
+
+  EXPECT_EQ(trace.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0), 0);
+  EXPECT_NE(trace.find("\"name\":\"traced scope\",\"cat\":\"test\",\"ph\":\"X\""), std::string::npos);
+  EXPECT_EQ(trace.find("not traced scope"), std::string::npos);
+
+  tracer.clear();
+}
+
+/**
+ * Asserts that events of exited threads are kept until they are cleared, then buffers of the threads are freed
+ */
+TEST(TracerTests, exitedThreads) {
+  auto& tracer = es::Tracer::instance();
+
+  const auto write_trace = [&tracer]() {
+    std::ostringstream stream;
+    tracer.writeChromeTrace(stream);
+
+    return stream.str();
+  };
+
+  tracer.start();
+
+  {
+    const es::TraceScope scope{"test", "main scope"};
+  }
+
+  for (std::size_t i = 0; i < 3; ++i) {
+    std::thread{[]() { const es::TraceScope scope{"test", "thread scope"}; }}.join();
+
+    const auto trace = write_trace();
+
+    EXPECT_NE(trace.find("\"name\":\"thread scope\""), std::string::npos);
+    EXPECT_EQ(CountTraceThreads(trace), 2);
+
+    tracer.clear();
+
+    EXPECT_EQ(CountTraceThreads(write_trace()), 1);
+  }
+
+  tracer.stop();
+  tracer.clear();
+}
+
 }  // namespace
\ No newline at end of file